@@ -4,6 +4,9 @@
 // Try with DMA1_Channel6, triggered by TIM3_CH1
 
 #include "pios_dma.h"
+#include "pios_trace.h"
+#include "pios_irq.h"
+#include "pios_swtimer.h"
 
 extern const uint32_t SystemFrequency;
 
@@ -28,10 +31,30 @@ struct stm32_gpio io = {
     }
 };
 
+static const struct pios_swtimer_cfg swtimer_cfg = {
+    .timer = TIM4,
+    .tim_channel = TIM_Channel_1,
+    .irq = {
+        .init = {
+            .NVIC_IRQChannel = TIM4_IRQn,
+            .NVIC_IRQChannelPreemptionPriority = PIOS_IRQ_PRIO_MID,
+            .NVIC_IRQChannelSubPriority = 0,
+            .NVIC_IRQChannelCmd = ENABLE,
+        },
+    },
+};
+
+static struct pios_swtimer led_timer;
+
+void TIM4_IRQHandler(void)
+{
+    PIOS_SWTimer_IRQ_Handler();
+}
+
 void Setup_RCC()
 {
     RCC_APB2PeriphClockCmd(RCC_APB2Periph_GPIOA | RCC_APB2Periph_GPIOC | RCC_APB2Periph_TIM1 | RCC_APB2Periph_AFIO, ENABLE);
-    RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM3, ENABLE);
+    RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM3 | RCC_APB1Periph_TIM4, ENABLE);
     RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE);
 }
 
@@ -63,6 +86,18 @@ void Setup_TIMER(TIM_TypeDef *timer, uint8_t tim_channel, uint32_t baud)
     TIM_Cmd(timer, ENABLE);
 }
 
+/* 100 ms on, 50 ms off */
+static void led_blink(struct pios_swtimer *timer, uint32_t context)
+{
+    if(GPIO_ReadOutputDataBit(led.gpio, led.init.GPIO_Pin) == Bit_RESET) {
+        GPIO_WriteBit(led.gpio, led.init.GPIO_Pin, Bit_SET);
+        PIOS_SWTimer_Start(timer, 100000, 0, led_blink, context);
+    } else {
+        GPIO_WriteBit(led.gpio, led.init.GPIO_Pin, Bit_RESET);
+        PIOS_SWTimer_Start(timer, 50000, 0, led_blink, context);
+    }
+}
+
 static void dma_transfer_complete(uint32_t dma_handle, uint32_t context)
 {
     TIM_DMACmd(TIM3, TIM_DMA_CC1, DISABLE); // Stop generating requests
@@ -91,6 +126,8 @@ void Setup_DMA(uint32_t *dma_handle, DMA_Channel_TypeDef *dma_channel, void *buf
             .DMA_PeripheralBaseAddr = (uint32_t)&io.gpio->BSRR,
         },
         .stream = dma_channel,
+        .timer = TIM3,
+        .tim_dma_source = TIM_DMA_CC1,
         .callbacks = {
             .complete = dma_transfer_complete,
             .setup = dma_transfer_setup,
@@ -109,15 +146,26 @@ void assert_failed(uint8_t *file, uint32_t line)
 
 int main()
 {
+    /* all priority bits preempt, before any NVIC_Init() */
+    NVIC_PriorityGroupConfig(NVIC_PriorityGroup_4);
+
     PIOS_DELAY_Init();
+#ifdef PIOS_INCLUDE_TRACE
+    PIOS_Trace_Init();
+#endif
+#ifdef PIOS_INCLUDE_IRQ_PROFILE
+    PIOS_IRQ_Profile_Init();
+#endif
 
     Setup_RCC();
     Setup_GPIO();
     
     uint32_t dma_handle1, dma_handle2;
     
-    Setup_DMA(&dma_handle1, DMA1_Channel6, &bsrr_buffer1[0], sizeof(bsrr_buffer1) / sizeof(bsrr_buffer1[0]));
-    Setup_DMA(&dma_handle2, DMA1_Channel6, &bsrr_buffer2[0], sizeof(bsrr_buffer2) / sizeof(bsrr_buffer2[0]));
+    DMA_Channel_TypeDef *dma_channel = PIOS_DMA_Alloc_TIM(TIM3, TIM_DMA_CC1);
+    
+    Setup_DMA(&dma_handle1, dma_channel, &bsrr_buffer1[0], sizeof(bsrr_buffer1) / sizeof(bsrr_buffer1[0]));
+    Setup_DMA(&dma_handle2, dma_channel, &bsrr_buffer2[0], sizeof(bsrr_buffer2) / sizeof(bsrr_buffer2[0]));
     
     Setup_TIMER(TIM3, TIM_Channel_1, 57600);
     
@@ -138,19 +186,12 @@ int main()
         }
     }
     
-    int countdown = 0;
+    PIOS_SWTimer_Init(&swtimer_cfg);
+    PIOS_SWTimer_Start(&led_timer, 0, 0, led_blink, 0);
+
+    /* everything else runs from interrupts */
     while(1) {
-        GPIO_WriteBit(led.gpio, led.init.GPIO_Pin, Bit_SET);
-        PIOS_DELAY_WaitmS(100);
-        GPIO_WriteBit(led.gpio, led.init.GPIO_Pin, Bit_RESET);
-        PIOS_DELAY_WaitmS(50);
-        if(countdown == 0) {
-//            PIOS_DMA_Queue(dma_handle1);
-//            PIOS_DMA_Queue(dma_handle2);
-            countdown = 20;
-        } else {
-            --countdown;
-        }
+        __WFI();
     }
     
     return 0;
@@ -37,12 +37,57 @@
 /* these should be defined by CMSIS, but they aren't */
 #define DWT_CTRL   (*(volatile uint32_t *)0xe0001000)
 #define CYCCNTENA  (1 << 0)
-#define DWT_CYCCNT (*(volatile uint32_t *)0xe0001004)
 
 
 /* cycles per microsecond */
 static uint32_t us_ticks;
 
+/* floor((2^32 - 1) / us_ticks), for dividing by multiplying */
+static uint32_t us_recip;
+
+/* 2^32 = us_per_wrap * us_ticks + us_wrap_rem */
+static uint32_t us_per_wrap;
+static uint32_t us_wrap_rem;
+
+/* bits 62..31 of the cycle count when last read */
+static uint32_t raw_epoch;
+
+/*
+ * cycles / us_ticks: the reciprocal undershoots by less than one, so a
+ * single correction makes it exact
+ */
+static inline uint32_t PIOS_DELAY_CyclesTouS(uint32_t cycles, uint32_t *rem)
+{
+    uint32_t us = ((uint64_t)cycles * us_recip) >> 32;
+    uint32_t r  = cycles - us * us_ticks;
+
+    if (r >= us_ticks) {
+        ++us;
+        r -= us_ticks;
+    }
+
+    if (rem) {
+        *rem = r;
+    }
+
+    return us;
+}
+
+/* the divisors of the conversions for ticks cycles per microsecond */
+static void PIOS_DELAY_SetTicks(uint32_t ticks)
+{
+    us_ticks = ticks;
+    PIOS_DEBUG_Assert(us_ticks > 1);
+
+    us_recip    = 0xffffffff / us_ticks;
+    us_per_wrap = us_recip;
+    us_wrap_rem = 0xffffffff % us_ticks + 1;
+    if (us_wrap_rem == us_ticks) {
+        ++us_per_wrap;
+        us_wrap_rem = 0;
+    }
+}
+
 /**
  * Initialises the Timer used by PIOS_DELAY functions.
  *
@@ -55,8 +100,7 @@ int32_t PIOS_DELAY_Init(void)
 
     /* compute the number of system clocks per microsecond */
     RCC_GetClocksFreq(&clocks);
-    us_ticks = clocks.SYSCLK_Frequency / 1000000;
-    PIOS_DEBUG_Assert(us_ticks > 1);
+    PIOS_DELAY_SetTicks(clocks.SYSCLK_Frequency / 1000000);
 
     /* turn on access to the DWT registers */
     CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
@@ -131,11 +175,11 @@ int32_t PIOS_DELAY_WaitmS(uint32_t mS)
 
 /**
  * @brief Query the Delay timer for the current uS
- * @return A microsecond value
+ * @return A microsecond value, wraps at 32 bits like the arithmetic on it
  */
 uint32_t PIOS_DELAY_GetuS(void)
 {
-    return DWT_CYCCNT / us_ticks;
+    return PIOS_DELAY_GetuS64();
 }
 
 /**
@@ -163,9 +207,104 @@ uint32_t PIOS_DELAY_GetRaw()
  */
 uint32_t PIOS_DELAY_DiffuS(uint32_t raw)
 {
-    uint32_t diff = DWT_CYCCNT - raw;
+    return PIOS_DELAY_CyclesTouS(DWT_CYCCNT - raw, 0);
+}
 
-    return diff / us_ticks;
+/**
+ * @brief Compare two raw times and convert to us
+ * @param[in] raw the earlier time
+ * @param[in] later
+ * @return A microsecond value
+ */
+uint32_t PIOS_DELAY_DiffuS2(uint32_t raw, uint32_t later)
+{
+    return PIOS_DELAY_CyclesTouS(later - raw, 0);
+}
+
+/**
+ * @brief The cycle counter extended to 64 bits
+ * @return Cycles since PIOS_DELAY_Init()
+ */
+uint64_t PIOS_DELAY_GetRaw64(void)
+{
+    uint32_t epoch;
+    uint32_t count;
+
+    /* an interrupt in between fails the store, so the epoch never goes back */
+    do {
+        epoch = __LDREXW(&raw_epoch);
+        count = DWT_CYCCNT;
+
+        /* the count moved on to its next half */
+        if ((count >> 31) != (epoch & 1)) {
+            ++epoch;
+        }
+    } while (__STREXW(epoch, &raw_epoch));
+
+    return ((uint64_t)(epoch >> 1) << 32) | count;
+}
+
+/**
+ * @brief Extend a raw time taken earlier to 64 bits
+ * @param[in] raw PIOS_DELAY_GetRaw() from at most 2^31 cycles ago
+ * @return The PIOS_DELAY_GetRaw64() value it was taken at
+ */
+uint64_t PIOS_DELAY_ExtendRaw(uint32_t raw)
+{
+    uint64_t now = PIOS_DELAY_GetRaw64();
+
+    return now - (uint32_t)((uint32_t)now - raw);
+}
+
+/*
+ * raw / us_ticks without a 64 bit division: each 2^32 cycles is
+ * us_per_wrap us and us_wrap_rem cycles, folding the wraps into those
+ * leaves a high word smaller by 2^32 / us_wrap_rem, so at most three rounds
+ */
+static uint64_t PIOS_DELAY_Raw64TouS(uint64_t raw, uint32_t *rem)
+{
+    uint64_t us = 0;
+    uint32_t r;
+
+    while (raw >> 32) {
+        uint32_t wraps = raw >> 32;
+
+        us += (uint64_t)wraps * us_per_wrap + PIOS_DELAY_CyclesTouS(raw, &r);
+        raw = (uint64_t)wraps * us_wrap_rem + r;
+    }
+
+    return us + PIOS_DELAY_CyclesTouS(raw, rem);
+}
+
+/**
+ * @brief Convert a 64 bit raw time to us, exact at any uptime
+ * @return A microsecond value
+ */
+uint64_t PIOS_DELAY_RawTouS64(uint64_t raw)
+{
+    return PIOS_DELAY_Raw64TouS(raw, 0);
+}
+
+/**
+ * @brief Convert a 64 bit raw time to ns, exact at any uptime
+ * @return A nanosecond value
+ */
+uint64_t PIOS_DELAY_RawTonS64(uint64_t raw)
+{
+    uint32_t rem;
+    uint64_t us = PIOS_DELAY_Raw64TouS(raw, &rem);
+
+    /* rem < us_ticks, so rem * 1000 fits up to 4 GHz */
+    return us * 1000 + PIOS_DELAY_CyclesTouS(rem * 1000, 0);
+}
+
+/**
+ * @brief Query the Delay timer for the current uS, 64 bits
+ * @return Microseconds since PIOS_DELAY_Init()
+ */
+uint64_t PIOS_DELAY_GetuS64(void)
+{
+    return PIOS_DELAY_RawTouS64(PIOS_DELAY_GetRaw64());
 }
 
 #endif /* PIOS_INCLUDE_DELAY */
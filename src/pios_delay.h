@@ -32,6 +32,9 @@
 #ifndef PIOS_DELAY_H
 #define PIOS_DELAY_H
 
+/* DWT cycle counter, running once PIOS_DELAY_Init() turned it on */
+#define DWT_CYCCNT (*(volatile uint32_t *)0xe0001004)
+
 /* Public Functions */
 extern int32_t PIOS_DELAY_Init(void);
 extern int32_t PIOS_DELAY_WaituS(uint32_t uS);
@@ -42,6 +45,24 @@ extern uint32_t PIOS_DELAY_GetRaw();
 extern uint32_t PIOS_DELAY_DiffuS(uint32_t raw);
 extern uint32_t PIOS_DELAY_DiffuS2(uint32_t raw, uint32_t later);
 
+/*
+ * 64 bit cycle count, monotonic for as long as something reads it at least
+ * once per 2^31 cycles (PIOS_DELAY_EXTEND_PERIOD_US), the software timer
+ * service does. Any context, lock-free.
+ */
+#define PIOS_DELAY_EXTEND_PERIOD_US 5000000
+extern uint64_t PIOS_DELAY_GetRaw64(void);
+
+/*
+ * Interrupt timestamps: take PIOS_DELAY_GetRaw() (one load) in the handler,
+ * extend it to 64 bits later, up to 2^31 cycles on.
+ */
+extern uint64_t PIOS_DELAY_ExtendRaw(uint32_t raw);
+
+extern uint64_t PIOS_DELAY_RawTouS64(uint64_t raw);
+extern uint64_t PIOS_DELAY_RawTonS64(uint64_t raw);
+extern uint64_t PIOS_DELAY_GetuS64(void);
+
 #endif /* PIOS_DELAY_H */
 
 /**
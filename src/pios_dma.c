@@ -29,7 +29,10 @@
  */
 
 #include "pios_dma.h"
+#include "pios_instrumentation.h"
+#include "pios_trace.h"
 #include <stdbool.h>
+#include <stdint.h>
 
 /* F1 (F3?) implementation */
 
@@ -44,24 +47,59 @@ struct pios_dma_request {
     struct pios_dma_callbacks callbacks;
     uint32_t callback_context;
 
+    uint8_t priority;
+    uint16_t done;          /* items transferred before being preempted */
+
+    const struct pios_dma_segment *chain;
+    uint8_t chain_len;
+    uint8_t segment;        /* chain segment running */
+
     struct pios_dma_queue *queue;
     struct pios_dma_request *next;
 };
 
+/*
+ * Producers (PIOS_DMA_Queue() from any context) only ever push onto the
+ * pending stack with compare and swap, so a request can be queued from
+ * threads and from any interrupt without masking interrupts. The low bit
+ * of pending is the channel busy flag, whoever sets it owns starting the
+ * channel. The channel side (irq handler, PIOS_DMA_Stop()) is the only
+ * consumer: whenever it picks the next request it takes the whole stack
+ * at once, sorts it into ready by priority, FIFO among equals, and clears
+ * busy when nothing is left.
+ */
+#define PENDING_BUSY ((uintptr_t)1)
+
 struct pios_dma_queue {
-    struct pios_dma_request *head;
-    struct pios_dma_request **tail_next;
+    struct pios_dma_request *volatile head; /* running on the channel */
+    struct pios_dma_request *ready;         /* next by priority, channel side only */
+    volatile uintptr_t pending;             /* queued since, newest first | PENDING_BUSY */
     
     pios_dma_stream_t *stream;
 
     DMA_TypeDef *dma;
     uint8_t dma_isr_shift;
+    IRQn_Type irq;
+    uint8_t irq_prio;       /* preemption priority the channel irq got */
+
+    uint8_t requests;       /* made with PIOS_DMA_Init(), the allocator's load */
 };
 
 #define CHANNEL_NR_DMA2_MASK 0x80
 
+/* channel registers are evenly spaced after the DMA flag registers */
+#define DMA_CHANNEL_STRIDE  ((uint32_t)DMA1_Channel2 - (uint32_t)DMA1_Channel1)
+
+#if defined(STM32F3)
+# define DMA_QUEUES (7 + 5)
+#else
+# define DMA_QUEUES 7
+#endif
+
 #if !defined(PIOS_INCLUDE_FREERTOS)
-#define PIOS_DMA_REQUEST_MAX 5
+# ifndef PIOS_DMA_REQUEST_MAX
+#  define PIOS_DMA_REQUEST_MAX 5
+# endif
 static uint8_t dma_request_count;
 static struct pios_dma_request dma_request_buffer[PIOS_DMA_REQUEST_MAX];
 #endif /* PIOS_INCLUDE_FREERTOS */
@@ -69,26 +107,302 @@ static struct pios_dma_request dma_request_buffer[PIOS_DMA_REQUEST_MAX];
 
 static struct pios_dma_queue dma_queue[7+5]; /* 140 bytes on F1, maybe allocate when needed? */
 
+#if defined(STM32F1)
+/*
+ * Timer DMA request lines, fixed in hardware (RM0008, DMA1 request
+ * mapping). TIM5-8 on DMA2 of high density parts are not in here.
+ */
+struct pios_dma_tim_line {
+    TIM_TypeDef *timer;
+    uint16_t sources;       /* TIM_DMA_xxx served by the channel */
+};
+
+#define DMA_TIM_LINES_PER_CHANNEL 3
+
+static const struct pios_dma_tim_line dma_tim_lines[7][DMA_TIM_LINES_PER_CHANNEL] = {
+    [0] = { { TIM2, TIM_DMA_CC3 }, { TIM4, TIM_DMA_CC1 } },
+    [1] = { { TIM1, TIM_DMA_CC1 }, { TIM2, TIM_DMA_Update }, { TIM3, TIM_DMA_CC3 } },
+    [2] = { { TIM1, TIM_DMA_CC2 }, { TIM3, TIM_DMA_CC4 | TIM_DMA_Update } },
+    [3] = { { TIM1, TIM_DMA_CC4 | TIM_DMA_Trigger | TIM_DMA_COM }, { TIM4, TIM_DMA_CC2 } },
+    [4] = { { TIM1, TIM_DMA_Update }, { TIM2, TIM_DMA_CC1 }, { TIM4, TIM_DMA_CC3 } },
+    [5] = { { TIM1, TIM_DMA_CC3 }, { TIM3, TIM_DMA_CC1 | TIM_DMA_Trigger } },
+    [6] = { { TIM2, TIM_DMA_CC2 | TIM_DMA_CC4 }, { TIM4, TIM_DMA_Update } },
+};
+
+/* the sources of timer that queue_nr serves */
+static uint16_t PIOS_DMA_TIM_Sources(uint8_t queue_nr, TIM_TypeDef *timer)
+{
+    if(queue_nr >= 7) {
+        return 0;
+    }
+
+    for(uint8_t i = 0; i < DMA_TIM_LINES_PER_CHANNEL; ++i) {
+        if(dma_tim_lines[queue_nr][i].timer == timer) {
+            return dma_tim_lines[queue_nr][i].sources;
+        }
+    }
+
+    return 0;
+}
+#else
+static uint16_t PIOS_DMA_TIM_Sources(__attribute__((unused)) uint8_t queue_nr, __attribute__((unused)) TIM_TypeDef *timer)
+{
+    return 0; /* no table yet */
+}
+#endif /* STM32F1 */
+
+/* queue number of a channel, DMA_QUEUES if it is none */
+static uint8_t PIOS_DMA_Queue_Nr(pios_dma_stream_t *stream)
+{
+    uint32_t offset = (uint32_t)stream - (uint32_t)DMA1_Channel1;
+
+    if(offset < 7 * DMA_CHANNEL_STRIDE && !(offset % DMA_CHANNEL_STRIDE)) {
+        return offset / DMA_CHANNEL_STRIDE;
+    }
+
+#if defined(STM32F3)
+    offset = (uint32_t)stream - (uint32_t)DMA2_Channel1;
+
+    if(offset < 5 * DMA_CHANNEL_STRIDE && !(offset % DMA_CHANNEL_STRIDE)) {
+        return 7 + offset / DMA_CHANNEL_STRIDE;
+    }
+#endif
+
+    return DMA_QUEUES;
+}
+
+static pios_dma_stream_t *PIOS_DMA_Stream(uint8_t queue_nr)
+{
+    if(queue_nr < 7) {
+        return (pios_dma_stream_t *)((uint32_t)DMA1_Channel1 + queue_nr * DMA_CHANNEL_STRIDE);
+    }
+
+#if defined(STM32F3)
+    return (pios_dma_stream_t *)((uint32_t)DMA2_Channel1 + (queue_nr - 7) * DMA_CHANNEL_STRIDE);
+#else
+    return 0;
+#endif
+}
+
+/*
+ * LDREX/STREX compare and swap. Any exception entry clears the exclusive
+ * monitor, so a store after being preempted fails and we look again.
+ */
+static inline bool PIOS_DMA_CompareAndSwap(volatile uintptr_t *ptr, uintptr_t expected, uintptr_t desired)
+{
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+    uintptr_t value;
+    uint32_t failed;
+
+    do {
+        __asm volatile ("ldrex %0, [%1]" : "=r" (value) : "r" (ptr) : "memory");
+
+        if(value != expected) {
+            __asm volatile ("clrex" ::: "memory");
+            return false;
+        }
+
+        __asm volatile ("strex %0, %2, [%1]" : "=&r" (failed) : "r" (ptr), "r" (desired) : "memory");
+    } while(failed);
+
+    return true;
+#else
+    return __atomic_compare_exchange_n(ptr, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+/*
+ * Channel irq off around channel side work outside the handler, returns
+ * whether it was on. Restoring that instead of enabling keeps it off for
+ * a caller that had it off, and for a section this one preempted.
+ */
+static inline bool PIOS_DMA_IRQ_Off(struct pios_dma_queue *queue)
+{
+    bool on = NVIC->ISER[queue->irq >> 5] & (1 << (queue->irq & 31));
+
+    NVIC_DisableIRQ(queue->irq);
+
+    return on;
+}
+
+static inline void PIOS_DMA_IRQ_Restore(struct pios_dma_queue *queue, bool on)
+{
+    if(on) {
+        NVIC_EnableIRQ(queue->irq);
+    }
+}
+
+/* Channel side: into ready behind higher priorities, and behind or ahead of equal ones */
+static void PIOS_DMA_Insert(struct pios_dma_queue *queue, struct pios_dma_request *dma_req, bool ahead)
+{
+    struct pios_dma_request **pos = &queue->ready;
+
+    while(*pos && ((*pos)->priority > dma_req->priority || (!ahead && (*pos)->priority == dma_req->priority))) {
+        pos = &(*pos)->next;
+    }
+
+    dma_req->next = *pos;
+    *pos = dma_req;
+}
+
+/*
+ * Channel side: move everything queued since into ready. With release,
+ * mark the channel idle if that leaves nothing to run.
+ */
+static void PIOS_DMA_Collect(struct pios_dma_queue *queue, bool release)
+{
+    uintptr_t pending;
+    uintptr_t keep;
+
+    do {
+        pending = queue->pending;
+        keep = (release && pending == PENDING_BUSY && !queue->ready) ? 0 : PENDING_BUSY;
+    } while(!PIOS_DMA_CompareAndSwap(&queue->pending, pending, keep));
+
+    /* newest first, reverse to keep FIFO order among equal priorities */
+    struct pios_dma_request *stack = (struct pios_dma_request *)(pending & ~PENDING_BUSY);
+    struct pios_dma_request *fifo = 0;
+
+    while(stack) {
+        struct pios_dma_request *req = stack;
+
+        stack = req->next;
+        req->next = fifo;
+        fifo = req;
+    }
+
+    while(fifo) {
+        struct pios_dma_request *req = fifo;
+
+        fifo = req->next;
+        PIOS_DMA_Insert(queue, req, false);
+    }
+}
+
+/*
+ * Channel side: the request to run after head, or 0 with the channel
+ * marked idle. Head must already be cleared, a producer that finds the
+ * channel idle sets it.
+ */
+static struct pios_dma_request *PIOS_DMA_Next(struct pios_dma_queue *queue)
+{
+    PIOS_DMA_Collect(queue, true);
+
+    struct pios_dma_request *next = queue->ready;
+
+    if(next) {
+        queue->ready = next->next;
+    }
+
+    return next;
+}
+
+static inline uint32_t PIOS_DMA_Segment_CCR(uint32_t ccr, const struct pios_dma_segment *seg)
+{
+    return (seg->flags & PIOS_DMA_SEGMENT_HOLD_MEMORY) ? ccr & ~DMA_CCR1_MINC : ccr;
+}
+
 static void PIOS_DMA_Begin(struct pios_dma_request *dma_req)
 {
+    PIOS_INSTRUMENTATION_SCOPE(PIOS_INSTRUMENTATION_DMA_BEGIN);
+
     DMA_Channel_TypeDef *hw = dma_req->queue->stream;
     
     hw->CCR &= ~(DMA_CCR1_EN);
     while(hw->CCR & DMA_CCR1_EN) { }
 
-    hw->CMAR = dma_req->regs.CMAR;
-    hw->CPAR = dma_req->regs.CPAR;
-    hw->CNDTR = dma_req->regs.CNDTR;
+    uint32_t ccr = dma_req->regs.CCR;
+    uint32_t cmar = dma_req->regs.CMAR;
+    uint32_t cpar = dma_req->regs.CPAR;
+    uint16_t cndtr = dma_req->regs.CNDTR;
+
+    if(dma_req->chain) {
+        const struct pios_dma_segment *seg = &dma_req->chain[dma_req->segment];
+
+        ccr = PIOS_DMA_Segment_CCR(ccr, seg);
+        cmar = (uint32_t)seg->memory;
+        cpar = seg->peripheral ? (uint32_t)seg->peripheral : cpar;
+        cndtr = seg->count;
+    }
+
+    /* a preempted request picks up where it left */
+    uint16_t done = dma_req->done;
+
+    hw->CMAR = cmar + ((ccr & DMA_CCR1_MINC) ? done << ((ccr & DMA_CCR1_MSIZE) >> 10) : 0);
+    hw->CPAR = cpar + ((ccr & DMA_CCR1_PINC) ? done << ((ccr & DMA_CCR1_PSIZE) >> 8) : 0);
+    hw->CNDTR = cndtr - done;
 
     if(dma_req->callbacks.setup) {
         dma_req->callbacks.setup((uint32_t)dma_req, dma_req->callback_context);
     }
 
-    hw->CCR = dma_req->regs.CCR | DMA_CCR1_EN;
+    hw->CCR = ccr | DMA_CCR1_EN;
+
+    PIOS_TRACE(PIOS_TRACE_DMA_BEGIN, dma_req->queue - dma_queue);
+}
+
+/*
+ * Chain fast path from the complete irq: the channel is done with the
+ * last segment and the request source is still set up, so just point
+ * it at the next segment. No setup, no waiting for EN to drop.
+ */
+static void PIOS_DMA_Segment_Next(DMA_Channel_TypeDef *hw, struct pios_dma_request *dma_req)
+{
+    const struct pios_dma_segment *seg = &dma_req->chain[++dma_req->segment];
+
+    hw->CCR = 0;
+    hw->CMAR = (uint32_t)seg->memory;
+    hw->CPAR = seg->peripheral ? (uint32_t)seg->peripheral : dma_req->regs.CPAR;
+    hw->CNDTR = seg->count;
+    hw->CCR = PIOS_DMA_Segment_CCR(dma_req->regs.CCR, seg) | DMA_CCR1_EN;
+}
+
+/*
+ * Channel side: let the most urgent queued request take the channel from
+ * a lower priority one in mid transfer. Only requests with a suspend
+ * callback give way, they resume where they left first among their
+ * priority, setup is called again then.
+ */
+static void PIOS_DMA_Preempt(struct pios_dma_queue *queue)
+{
+    struct pios_dma_request *running = queue->head;
+
+    PIOS_DMA_Collect(queue, false);
+
+    struct pios_dma_request *urgent = queue->ready;
+
+    if(!urgent || urgent->priority <= running->priority || !running->callbacks.suspend || (running->regs.CCR & DMA_CCR1_CIRC)) {
+        return;
+    }
+
+    DMA_Channel_TypeDef *hw = queue->stream;
+
+    hw->CCR &= ~(DMA_CCR1_EN);
+
+    uint16_t left = hw->CNDTR;
+
+    if(!left) {
+        /* finished meanwhile, its complete flag has the irq pending again */
+        return;
+    }
+
+    running->callbacks.suspend((uint32_t)running, running->callback_context);
+
+    uint16_t count = running->chain ? running->chain[running->segment].count : running->regs.CNDTR;
+
+    running->done = count - left;
+
+    queue->ready = urgent->next;
+    PIOS_DMA_Insert(queue, running, true);
+
+    queue->head = urgent;
+    PIOS_DMA_Begin(urgent);
 }
 
 static void PIOS_DMA_Generic_IRQHandler(struct pios_dma_queue *queue)
 {
+    PIOS_INSTRUMENTATION_SCOPE(PIOS_INSTRUMENTATION_DMA_IRQ + (queue - dma_queue));
+
     // dequeue whatever was there
     struct pios_dma_request *dma_req = queue->head;
     
@@ -99,17 +413,34 @@ static void PIOS_DMA_Generic_IRQHandler(struct pios_dma_queue *queue)
 
     if(dma_req) {
     
-        /* dequeue on complete & error */
-        bool begin_next = false;
+        if(!(dma_isr & (DMA_ISR_TCIF1 | DMA_ISR_HTIF1 | DMA_ISR_TEIF1))) {
+            /* no transfer event, PIOS_DMA_Queue() pended us for an urgent request */
+            PIOS_DMA_Preempt(queue);
+            return;
+        }
+
+        if((dma_isr & DMA_ISR_TCIF1) && !(dma_isr & DMA_ISR_TEIF1) && dma_req->chain && dma_req->segment + 1 < dma_req->chain_len) {
+            PIOS_DMA_Segment_Next(queue->stream, dma_req);
+            return;
+        }
+
+        /* dequeue on complete & error, circular requests stay until PIOS_DMA_Stop() */
+        bool retire = (dma_isr & DMA_ISR_TEIF1) || ((dma_isr & DMA_ISR_TCIF1) && !(dma_req->regs.CCR & DMA_CCR1_CIRC));
         
-        if(dma_isr & (DMA_ISR_TCIF1|DMA_ISR_TEIF1))
-        {
-            queue->head = dma_req->next;
-            if(!queue->head) {
-                queue->tail_next = &queue->head;
-            } else {
-                begin_next = true;
-            }
+        if(retire) {
+            queue->head = 0;
+            dma_req->done = 0;
+            dma_req->segment = 0;
+        }
+
+        if(dma_isr & DMA_ISR_TCIF1) {
+            PIOS_TRACE(PIOS_TRACE_DMA_COMPLETE, queue - dma_queue);
+        }
+        if(dma_isr & DMA_ISR_TEIF1) {
+            PIOS_TRACE(PIOS_TRACE_DMA_ERROR, queue - dma_queue);
+        }
+        if(dma_isr & DMA_ISR_HTIF1) {
+            PIOS_TRACE(PIOS_TRACE_DMA_HALFTRANSFER, queue - dma_queue);
         }
         
         if((dma_isr & DMA_ISR_TCIF1) && dma_req->callbacks.complete) {
@@ -122,10 +453,63 @@ static void PIOS_DMA_Generic_IRQHandler(struct pios_dma_queue *queue)
             dma_req->callbacks.halftransfer((uint32_t)dma_req, dma_req->callback_context);
         }
         
-        if(begin_next) {
-            PIOS_DMA_Begin(queue->head);
+        /* pick the next one only now, callbacks may have queued something urgent */
+        if(retire) {
+            struct pios_dma_request *next = PIOS_DMA_Next(queue);
+
+            if(next) {
+                queue->head = next;
+                PIOS_DMA_Begin(next);
+            }
+        }
+    }
+}
+
+/* channel irq at the caller's priority */
+static void PIOS_DMA_Queue_IRQ(struct pios_dma_queue *queue, const NVIC_InitTypeDef *irq)
+{
+    NVIC_InitTypeDef irqInit = *irq;
+    
+    irqInit.NVIC_IRQChannel = queue->irq;
+    irqInit.NVIC_IRQChannelCmd = ENABLE;
+    
+    NVIC_Init(&irqInit);
+
+    queue->irq_prio = irq->NVIC_IRQChannelPreemptionPriority;
+}
+
+/* first user of a channel sets up its queue and irq */
+static struct pios_dma_queue *PIOS_DMA_Queue_Setup(uint8_t queue_nr, const NVIC_InitTypeDef *irq)
+{
+    struct pios_dma_queue *queue = &dma_queue[queue_nr];
+    
+    if(!queue->stream) {
+        /* channel irqs are numbered in order too */
+#if defined(STM32F3)
+        IRQn_Type irq_channel = (IRQn_Type)((queue_nr < 7) ? DMA1_Channel1_IRQn + queue_nr : DMA2_Channel1_IRQn + queue_nr - 7);
+#else
+        IRQn_Type irq_channel = (IRQn_Type)(DMA1_Channel1_IRQn + queue_nr);
+#endif
+
+        queue->stream = PIOS_DMA_Stream(queue_nr);
+        queue->head = 0;
+        queue->ready = 0;
+        queue->pending = 0;
+        queue->irq = irq_channel;
+        
+        if(queue_nr < 7) {
+            queue->dma_isr_shift = queue_nr * 4;
+            queue->dma = DMA1;
+        } else {
+            queue->dma_isr_shift = (queue_nr - 7) * 4;
+            queue->dma = DMA2;
         }
+
+        // also enable nvic
+        PIOS_DMA_Queue_IRQ(queue, irq);
     }
+
+    return queue;
 }
 
 int32_t PIOS_DMA_Init(uint32_t *dma, const struct pios_dma_config *config)
@@ -133,6 +517,17 @@ int32_t PIOS_DMA_Init(uint32_t *dma, const struct pios_dma_config *config)
     PIOS_DEBUG_Assert(dma);
     PIOS_DEBUG_Assert(config);
 
+    uint8_t queue_nr = PIOS_DMA_Queue_Nr(config->stream);
+
+    if(queue_nr >= DMA_QUEUES) {
+        return -1;
+    }
+
+    /* the timer source must be wired to this channel */
+    if(config->timer && (PIOS_DMA_TIM_Sources(queue_nr, config->timer) & config->tim_dma_source) != config->tim_dma_source) {
+        return -1;
+    }
+
 #if !defined(PIOS_INCLUDE_FREERTOS)
     PIOS_DEBUG_Assert(dma_request_count < PIOS_DMA_REQUEST_MAX);
     struct pios_dma_request *dma_req = &dma_request_buffer[dma_request_count++];
@@ -143,108 +538,32 @@ int32_t PIOS_DMA_Init(uint32_t *dma, const struct pios_dma_config *config)
     DMA_Init(&dma_req->regs, &config->init);
     
     dma_req->callbacks = config->callbacks;
+    dma_req->priority = config->priority;
+    dma_req->done = 0;
+    dma_req->chain = 0;
+    dma_req->chain_len = 0;
+    dma_req->segment = 0;
     
     if(dma_req->callbacks.complete) {
         DMA_ITConfig(&dma_req->regs, DMA_IT_TC, ENABLE);
     }
-    if(dma_req->callbacks.halftransfer) {
+    if(dma_req->callbacks.halftransfer && (config->init.DMA_Mode == DMA_Mode_Circular)) {
         DMA_ITConfig(&dma_req->regs, DMA_IT_HT, ENABLE);
     }
     if(dma_req->callbacks.error) {
         DMA_ITConfig(&dma_req->regs, DMA_IT_TE, ENABLE);
     }
     
-    // need to figure out:
-    // - dma irq flags
-    // - dma instance (1 or 2)
-    // - dma queue number
-    
-    uint8_t queue_nr = 0;
-    uint8_t irq_channel = 0;
-    
-    switch((uint32_t)config->stream) {
-        case (uint32_t)DMA1_Channel1:
-            queue_nr = 0;
-            irq_channel = DMA1_Channel1_IRQn;
-            break;
-        case (uint32_t)DMA1_Channel2:
-            queue_nr = 1;
-            irq_channel = DMA1_Channel2_IRQn;
-            break;
-        case (uint32_t)DMA1_Channel3:
-            queue_nr = 2;
-            irq_channel = DMA1_Channel3_IRQn;
-            break;
-        case (uint32_t)DMA1_Channel4:
-            queue_nr = 3;
-            irq_channel = DMA1_Channel4_IRQn;
-            break;
-        case (uint32_t)DMA1_Channel5:
-            queue_nr = 4;
-            irq_channel = DMA1_Channel5_IRQn;
-            break;
-        case (uint32_t)DMA1_Channel6:
-            queue_nr = 5;
-            irq_channel = DMA1_Channel6_IRQn;
-            break;
-        case (uint32_t)DMA1_Channel7:
-            queue_nr = 6;
-            irq_channel = DMA1_Channel7_IRQn;
-            break;
-#if defined(STM32F3)
-        case (uint32_t)DMA2_Channel1:
-            queue_nr = 7;
-            irq_channel = DMA2_Channel1_IRQn;
-            break;
-        case (uint32_t)DMA2_Channel2:
-            queue_nr = 8;
-            irq_channel = DMA2_Channel2_IRQn;
-            break;
-        case (uint32_t)DMA2_Channel3:
-            queue_nr = 9;
-            irq_channel = DMA2_Channel3_IRQn;
-            break;
-        case (uint32_t)DMA2_Channel4:
-            queue_nr = 10;
-            irq_channel = DMA2_Channel4_IRQn;
-            break;
-        case (uint32_t)DMA2_Channel5:
-            queue_nr = 11;
-            irq_channel = DMA2_Channel5_IRQn;
-            break;
-#endif /* STM32F3 */
-    }
-    
-    struct pios_dma_queue *queue = &dma_queue[queue_nr];
-    
-    // irq disable?
-    
-    if(!queue->stream) {
-        queue->stream = config->stream;
-        queue->head = 0;
-        queue->tail_next = &queue->head;
-        
-        if(queue_nr < 7) {
-            queue->dma_isr_shift = queue_nr * 4;
-            queue->dma = DMA1;
-        } else {
-            queue->dma_isr_shift = (queue_nr - 7) * 4;
-            queue->dma = DMA2;
-        }
+    struct pios_dma_queue *queue = PIOS_DMA_Queue_Setup(queue_nr, &config->irq);
+    uint8_t irq_prio = config->irq.NVIC_IRQChannelPreemptionPriority;
 
-        // also enable nvic
-        
-        NVIC_InitTypeDef irqInit = config->irq;
-        
-        irqInit.NVIC_IRQChannel = irq_channel;
-        irqInit.NVIC_IRQChannelCmd = ENABLE;
-        
-        NVIC_Init(&irqInit);
+    /* copies leave their low priority behind, the first request sets its own, later ones only raise it */
+    if(irq_prio != queue->irq_prio && (!queue->requests || irq_prio < queue->irq_prio)) {
+        PIOS_DMA_Queue_IRQ(queue, &config->irq);
     }
     
     dma_req->queue = queue;
-
-    // irq enable
+    ++queue->requests;
 
     dma_req->magic = PIOS_DMA_REQUEST_MAGIC;
     *dma = (uint32_t) dma_req;
@@ -252,6 +571,25 @@ int32_t PIOS_DMA_Init(uint32_t *dma, const struct pios_dma_config *config)
     return 0;
 }
 
+pios_dma_stream_t *PIOS_DMA_Alloc_TIM(TIM_TypeDef *timer, uint16_t tim_dma_sources)
+{
+    pios_dma_stream_t *best = 0;
+    uint8_t best_requests = 0xff;
+
+    for(uint8_t queue_nr = 0; queue_nr < DMA_QUEUES; ++queue_nr) {
+        if(!(PIOS_DMA_TIM_Sources(queue_nr, timer) & tim_dma_sources)) {
+            continue;
+        }
+
+        if(dma_queue[queue_nr].requests < best_requests) {
+            best = PIOS_DMA_Stream(queue_nr);
+            best_requests = dma_queue[queue_nr].requests;
+        }
+    }
+
+    return best;
+}
+
 void PIOS_DMA_SetMemoryBaseAddr(uint32_t dma, void *memptr, uint16_t size)
 {
     struct pios_dma_request *dma_req = (struct pios_dma_request *)dma; // validate?
@@ -267,28 +605,288 @@ void PIOS_DMA_SetPeripheralBaseAddr(uint32_t dma, __IO void *periph)
     dma_req->regs.CPAR = (uint32_t)periph;
 }
 
+void PIOS_DMA_SetCircular(uint32_t dma, bool circular)
+{
+    struct pios_dma_request *dma_req = (struct pios_dma_request *)dma; // validate?
 
-void PIOS_DMA_Queue(uint32_t dma, uint32_t callback_context)
+    /* half transfer interrupt is only useful for refilling a circular buffer */
+    uint32_t mask = DMA_CCR1_CIRC;
+    
+    if(dma_req->callbacks.halftransfer) {
+        mask |= DMA_CCR1_HTIE;
+    }
+    
+    if(circular) {
+        dma_req->regs.CCR |= mask;
+    } else {
+        dma_req->regs.CCR &= ~mask;
+    }
+}
+
+void PIOS_DMA_SetChain(uint32_t dma, const struct pios_dma_segment *segments, uint8_t count)
+{
+    struct pios_dma_request *dma_req = (struct pios_dma_request *)dma; // validate?
+
+    PIOS_DEBUG_Assert(!count || !(dma_req->regs.CCR & DMA_CCR1_CIRC));
+
+    dma_req->chain = count ? segments : 0;
+    dma_req->chain_len = count;
+    dma_req->segment = 0;
+
+    /* segments are switched from the complete irq */
+    if(count || dma_req->callbacks.complete) {
+        dma_req->regs.CCR |= DMA_CCR1_TCIE;
+    } else {
+        dma_req->regs.CCR &= ~DMA_CCR1_TCIE;
+    }
+}
+
+void PIOS_DMA_Stop(uint32_t dma)
+{
+    struct pios_dma_request *dma_req = (struct pios_dma_request *)dma; // validate?
+    struct pios_dma_queue *queue = dma_req->queue;
+
+    /* we are the channel side now, keep the irq handler out */
+    bool irq_on = PIOS_DMA_IRQ_Off(queue);
+
+    if(queue->head != dma_req) {
+        /* not running */
+        PIOS_DMA_IRQ_Restore(queue, irq_on);
+        return;
+    }
+
+    queue->stream->CCR &= ~(DMA_CCR1_EN);
+
+    // drop flags raised before the channel stopped
+    queue->dma->IFCR = DMA_ISR_GIF1 << queue->dma_isr_shift;
+
+    queue->head = 0;
+    dma_req->done = 0;
+    dma_req->segment = 0;
+
+    struct pios_dma_request *next = PIOS_DMA_Next(queue);
+
+    if(next) {
+        queue->head = next;
+        PIOS_DMA_Begin(next);
+    }
+
+    PIOS_DMA_IRQ_Restore(queue, irq_on);
+}
+
+uint16_t PIOS_DMA_GetRemaining(uint32_t dma)
 {
     struct pios_dma_request *dma_req = (struct pios_dma_request *)dma; // validate?
 
-    // irq disable
+    if(dma_req->queue->head != dma_req) {
+        /* not started yet, or preempted */
+        uint16_t count = dma_req->chain ? dma_req->chain[dma_req->segment].count : dma_req->regs.CNDTR;
+
+        return count - dma_req->done;
+    }
+
+    return dma_req->queue->stream->CNDTR;
+}
+
+void PIOS_DMA_Queue(uint32_t dma, uint32_t callback_context)
+{
+    struct pios_dma_request *dma_req = (struct pios_dma_request *)dma; // validate?
+    struct pios_dma_queue *queue = dma_req->queue;
+    uintptr_t pending;
+    uintptr_t queued;
 
     dma_req->callback_context = callback_context;
-    
-    *(dma_req->queue->tail_next) = dma_req;
-    dma_req->next = 0;
-    dma_req->queue->tail_next = &dma_req->next;
 
-    // irq enable
+    PIOS_TRACE(PIOS_TRACE_DMA_QUEUE, queue - dma_queue);
+
+    do {
+        pending = queue->pending;
+
+        if(pending & PENDING_BUSY) {
+            dma_req->next = (struct pios_dma_request *)(pending & ~PENDING_BUSY);
+            queued = (uintptr_t)dma_req | PENDING_BUSY;
+        } else {
+            /* idle channel, claim it */
+            queued = PENDING_BUSY;
+        }
+    } while(!PIOS_DMA_CompareAndSwap(&queue->pending, pending, queued));
+
+    if(!(pending & PENDING_BUSY)) {
+        /* a preempt hint must not find head before Begin enabled it */
+        bool irq_on = PIOS_DMA_IRQ_Off(queue);
 
-    if(dma_req->queue->head == dma_req) {
+        queue->head = dma_req;
         PIOS_DMA_Begin(dma_req);
+
+        PIOS_DMA_IRQ_Restore(queue, irq_on);
+        return;
+    }
+
+    /* just a hint, the irq handler looks again */
+    struct pios_dma_request *running = queue->head;
+
+    if(running && running->callbacks.suspend && dma_req->priority > running->priority) {
+        NVIC_SetPendingIRQ(queue->irq);
     }
 }
 
 /* IRQ handlers */
 
+/*
+ * Memory to memory copies borrow channels no peripheral request was
+ * initialized on, so they never wait behind a circular transfer. While
+ * copies are in flight new ones go to the same channel, that keeps them
+ * in submission order.
+ */
+#ifndef PIOS_DMA_MEMCPY_MAX
+# define PIOS_DMA_MEMCPY_MAX 4
+#endif
+
+struct pios_dma_memcpy {
+    struct pios_dma_request req;
+    pios_dma_memcpy_callback_t done;
+    uint32_t context;
+};
+
+static struct pios_dma_memcpy dma_memcpy[PIOS_DMA_MEMCPY_MAX];
+static volatile uintptr_t dma_memcpy_used;  /* bit per slot */
+static volatile uintptr_t dma_memcpy_state; /* copies in flight | channel << 8 */
+
+static const NVIC_InitTypeDef dma_memcpy_irq = {
+    .NVIC_IRQChannelPreemptionPriority = PIOS_IRQ_PRIO_LOW,
+};
+
+static void PIOS_DMA_Memcpy_Finish(uint32_t dma, uint32_t slot, bool ok)
+{
+    struct pios_dma_memcpy *copy = (struct pios_dma_memcpy *)dma;
+    pios_dma_memcpy_callback_t done = copy->done;
+    uint32_t context = copy->context;
+    uintptr_t old;
+
+    do {
+        old = dma_memcpy_state;
+    } while(!PIOS_DMA_CompareAndSwap(&dma_memcpy_state, old, old - 1));
+
+    do {
+        old = dma_memcpy_used;
+    } while(!PIOS_DMA_CompareAndSwap(&dma_memcpy_used, old, old & ~((uintptr_t)1 << slot)));
+
+    if(done) {
+        done(context, ok);
+    }
+}
+
+static void PIOS_DMA_Memcpy_Complete(uint32_t dma, uint32_t slot)
+{
+    PIOS_DMA_Memcpy_Finish(dma, slot, true);
+}
+
+static void PIOS_DMA_Memcpy_Error(uint32_t dma, uint32_t slot)
+{
+    PIOS_DMA_Memcpy_Finish(dma, slot, false);
+}
+
+/* an unused DMA1 channel for the first copy in flight, DMA_QUEUES if there is none */
+static uint8_t PIOS_DMA_Memcpy_Channel(void)
+{
+    for(uint8_t queue_nr = 7; queue_nr--;) {
+        struct pios_dma_queue *queue = &dma_queue[queue_nr];
+
+        if(!queue->requests && !queue->pending) {
+            return queue_nr;
+        }
+    }
+
+    return DMA_QUEUES;
+}
+
+int32_t PIOS_DMA_Memcpy(void *dst, const void *src, uint16_t count, uint8_t width, uint32_t flags, pios_dma_memcpy_callback_t done, uint32_t context)
+{
+    uint8_t size_shift = width >> 1; /* 1, 2, 4 bytes */
+
+    if((width != 1 && width != 2 && width != 4) || (((uint32_t)dst | (uint32_t)src) & (width - 1)) || !count) {
+        return -1;
+    }
+
+    /* take a slot */
+    uintptr_t used;
+    uint8_t slot;
+
+    do {
+        used = dma_memcpy_used;
+
+        for(slot = 0; slot < PIOS_DMA_MEMCPY_MAX && (used & ((uintptr_t)1 << slot)); ++slot) { }
+
+        if(slot == PIOS_DMA_MEMCPY_MAX) {
+            return -1;
+        }
+    } while(!PIOS_DMA_CompareAndSwap(&dma_memcpy_used, used, used | ((uintptr_t)1 << slot)));
+
+    /* join the copies in flight or pick a channel */
+    uintptr_t state;
+    uintptr_t next;
+
+    do {
+        state = dma_memcpy_state;
+
+        if(state & 0xff) {
+            next = state + 1;
+        } else {
+            uint8_t queue_nr = PIOS_DMA_Memcpy_Channel();
+
+            if(queue_nr == DMA_QUEUES) {
+                do {
+                    used = dma_memcpy_used;
+                } while(!PIOS_DMA_CompareAndSwap(&dma_memcpy_used, used, used & ~((uintptr_t)1 << slot)));
+
+                return -1;
+            }
+
+            next = 1 | (queue_nr << 8);
+        }
+    } while(!PIOS_DMA_CompareAndSwap(&dma_memcpy_state, state, next));
+
+    struct pios_dma_memcpy *copy = &dma_memcpy[slot];
+    struct pios_dma_request *dma_req = &copy->req;
+
+    /* the source is the "peripheral" side of a memory to memory transfer */
+    DMA_InitTypeDef init = {
+        .DMA_PeripheralBaseAddr = (uint32_t)src,
+        .DMA_MemoryBaseAddr = (uint32_t)dst,
+        .DMA_DIR = DMA_DIR_PeripheralSRC,
+        .DMA_BufferSize = count,
+        .DMA_PeripheralInc = (flags & PIOS_DMA_MEMCPY_FILL) ? DMA_PeripheralInc_Disable : DMA_PeripheralInc_Enable,
+        .DMA_MemoryInc = DMA_MemoryInc_Enable,
+        .DMA_PeripheralDataSize = size_shift << 8,
+        .DMA_MemoryDataSize = size_shift << 10,
+        .DMA_Mode = DMA_Mode_Normal,
+        .DMA_Priority = DMA_Priority_Low,
+        .DMA_M2M = DMA_M2M_Enable,
+    };
+
+    DMA_Init(&dma_req->regs, &init);
+    DMA_ITConfig(&dma_req->regs, DMA_IT_TC | DMA_IT_TE, ENABLE);
+
+    dma_req->callbacks = (struct pios_dma_callbacks) {
+        .complete = PIOS_DMA_Memcpy_Complete,
+        .error = PIOS_DMA_Memcpy_Error,
+    };
+    dma_req->priority = 0;
+    dma_req->done = 0;
+    dma_req->chain = 0;
+    dma_req->chain_len = 0;
+    dma_req->segment = 0;
+    dma_req->queue = PIOS_DMA_Queue_Setup(next >> 8, &dma_memcpy_irq);
+    dma_req->magic = PIOS_DMA_REQUEST_MAGIC;
+
+    copy->done = done;
+    copy->context = context;
+
+    PIOS_DMA_Queue((uint32_t)dma_req, slot);
+
+    return 0;
+}
+
 void DMA1_Channel1_IRQHandler(void)
 {
     PIOS_DMA_Generic_IRQHandler(&dma_queue[0]);
@@ -40,6 +40,8 @@ struct pios_dma_callbacks {
     pios_dma_callback_t complete;
     pios_dma_callback_t halftransfer;
     pios_dma_callback_t error;
+    /* optional, lets a higher priority request preempt this one: stop the request source, setup is called again on resume */
+    pios_dma_callback_t suspend;
 };
 
 
@@ -55,14 +57,72 @@ struct pios_dma_config {
     pios_dma_stream_t *stream;
     struct pios_dma_callbacks callbacks;
     
+    /* channel irq priority, the most urgent of the channel's requests wins */
     NVIC_InitTypeDef irq;
+
+    /* queue order on the channel, higher first, FIFO among equals */
+    uint8_t priority;
+
+    /* optional timer DMA request (TIM_DMA_xxx) driving the transfer, checked against the channel */
+    TIM_TypeDef *timer;
+    uint16_t tim_dma_source;
 };
 
+/* one part of a chained transfer, peripheral 0 keeps the request's peripheral address */
+struct pios_dma_segment {
+    void *memory;
+    __IO void *peripheral;
+    uint16_t count;
+    uint16_t flags;
+};
+
+/* memory address stays put, e.g. to repeat one pad word */
+#define PIOS_DMA_SEGMENT_HOLD_MEMORY (1 << 0)
+
+/* fails if the stream is no channel or config->timer's request is not wired to it */
 int32_t PIOS_DMA_Init(uint32_t *dma_handle, const struct pios_dma_config *config);
 
+/*
+ * Channel serving any of the timer's DMA requests (TIM_DMA_xxx), the one
+ * with the fewest requests initialized so far, 0 if none is wired to them.
+ * Call PIOS_DMA_Init() for it before allocating the next one.
+ */
+pios_dma_stream_t *PIOS_DMA_Alloc_TIM(TIM_TypeDef *timer, uint16_t tim_dma_sources);
+
 void PIOS_DMA_SetMemoryBaseAddr(uint32_t dma_handle, void *memptr, uint16_t size);
 void PIOS_DMA_SetPeripheralBaseAddr(uint32_t dma_handle, __IO void *periph);
 
+/* circular requests are not dequeued on transfer complete, they run until PIOS_DMA_Stop() */
+void PIOS_DMA_SetCircular(uint32_t dma_handle, bool circular);
+
+/*
+ * Run the segments back to back as one request, complete is called once
+ * at the end of the chain. The segments are used in place, keep them
+ * until then. Not for circular requests, 0 segments go back to the plain
+ * memory base address.
+ */
+void PIOS_DMA_SetChain(uint32_t dma_handle, const struct pios_dma_segment *segments, uint8_t count);
+
+/* masks the channel irq while it runs, so not from an interrupt that can preempt the channel irq */
+void PIOS_DMA_Stop(uint32_t dma_handle);
+
+/* transfers left in the current pass or segment, tells how far a circular request got */
+uint16_t PIOS_DMA_GetRemaining(uint32_t dma_handle);
+
+/* lock-free, safe from threads and any interrupt without masking interrupts */
 void PIOS_DMA_Queue(uint32_t dma_handle, uint32_t callback_context);
 
+typedef void (* pios_dma_memcpy_callback_t)(uint32_t context, bool ok);
+
+/* src points at one item that is repeated, memset with any width */
+#define PIOS_DMA_MEMCPY_FILL (1 << 0)
+
+/*
+ * Copy count items of width 1, 2 or 4 bytes in the background on a DMA1
+ * channel no peripheral uses, done is called from its irq. Copies queued
+ * while others are in flight complete in submission order. Fails if
+ * nothing is free, copy on the CPU then. The DMA1 clock must be on.
+ */
+int32_t PIOS_DMA_Memcpy(void *dst, const void *src, uint16_t count, uint8_t width, uint32_t flags, pios_dma_memcpy_callback_t done, uint32_t context);
+
 #endif /* PIOS_DMA_H */
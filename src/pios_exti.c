@@ -31,12 +31,19 @@
 
 #include "pios.h"
 #include "pios_exti.h"
+#include "pios_instrumentation.h"
+#include "pios_trace.h"
 #ifdef PIOS_INCLUDE_EXTI
 
 /* Map EXTI line to full config */
 #define EXTI_MAX_LINES 16
 
-static pios_exti_vector_t pios_exti_vector[EXTI_MAX_LINES];
+struct pios_exti_line {
+    pios_exti_vector_t vector;
+    uint32_t context;
+};
+
+static struct pios_exti_line pios_exti_line[EXTI_MAX_LINES];
 
 static uint8_t PIOS_EXTI_line_to_IRQn(uint32_t line)
 {
@@ -145,13 +152,14 @@ int32_t PIOS_EXTI_Init(const struct pios_exti_cfg *cfg)
     /* Connect this config to the requested vector */
     uint8_t line_index = PIOS_EXTI_line_to_index(cfg->line);
 
-    if (pios_exti_vector[line_index]) {
+    if (pios_exti_line[line_index].vector) {
         /* Someone else already has this mapped */
         return -1;
     }
 
     /* Bind the vector to the exti line */
-    pios_exti_vector[line_index] = cfg->vector;
+    pios_exti_line[line_index].context = cfg->context;
+    pios_exti_line[line_index].vector  = cfg->vector;
 
     /* Initialize the GPIO pin */
     GPIO_Init(cfg->pin.gpio, &cfg->pin.init);
@@ -177,12 +185,12 @@ int32_t PIOS_EXTI_DeInit(const struct pios_exti_cfg *cfg)
 {
     uint8_t line_index = PIOS_EXTI_line_to_index(cfg->line);
 
-    if (pios_exti_vector[line_index] == cfg->vector) {
+    if (pios_exti_line[line_index].vector == cfg->vector && pios_exti_line[line_index].context == cfg->context) {
         EXTI_InitTypeDef disable = cfg->exti.init;
         disable.EXTI_LineCmd = DISABLE;
 
         EXTI_Init(&disable);
-        pios_exti_vector[line_index] = 0;
+        pios_exti_line[line_index].vector = 0;
 
         return 0;
     }
@@ -190,35 +198,59 @@ int32_t PIOS_EXTI_DeInit(const struct pios_exti_cfg *cfg)
     return -1;
 }
 
-static bool PIOS_EXTI_generic_irq_handler(uint8_t line_index)
+/*
+ * One read of the pending register for all lines of a handler, one write
+ * to clear them before their vectors run (so an edge arriving meanwhile
+ * stays pending), then the set bits lowest first. EXTI_GetITStatus()
+ * checks IMR as well, masked lines keep their pending bit for later.
+ * The handlers read timestamp before anything else, so it trails the
+ * edge by the exception entry only.
+ */
+static bool PIOS_EXTI_generic_irq_handler(uint32_t lines, uint32_t timestamp)
 {
-    return pios_exti_vector[line_index] ? pios_exti_vector[line_index]() : false;
+    uint32_t pending = EXTI->PR & EXTI->IMR & lines;
+    bool woken = false;
+
+    EXTI->PR = pending;
+
+    while (pending) {
+        uint8_t line_index = __builtin_ctz(pending);
+        const struct pios_exti_line *line = &pios_exti_line[line_index];
+
+        pending &= pending - 1;
+
+        PIOS_TRACE(PIOS_TRACE_EXTI, line_index);
+
+        if (line->vector && line->vector(line->context, timestamp)) {
+            woken = true;
+        }
+    }
+
+    return woken;
 }
 
 #ifdef PIOS_INCLUDE_FREERTOS
-#define PIOS_EXTI_HANDLE_LINE(line, woken)                      \
-    if (EXTI_GetITStatus(EXTI_Line##line) != RESET) {       \
-        EXTI_ClearITPendingBit(EXTI_Line##line);        \
-        woken = PIOS_EXTI_generic_irq_handler(line) ? pdTRUE : woken; \
-    }
+#define PIOS_EXTI_HANDLE_LINES(lines, timestamp, woken) \
+    woken = PIOS_EXTI_generic_irq_handler(lines, timestamp) ? pdTRUE : woken;
 #else
-#define PIOS_EXTI_HANDLE_LINE(line, woken)                      \
-    if (EXTI_GetITStatus(EXTI_Line##line) != RESET) {       \
-        EXTI_ClearITPendingBit(EXTI_Line##line);        \
-        PIOS_EXTI_generic_irq_handler(line);            \
-    }
+#define PIOS_EXTI_HANDLE_LINES(lines, timestamp, woken) \
+    PIOS_EXTI_generic_irq_handler(lines, timestamp);
 #endif
 
 /* Bind Interrupt Handlers */
 
 static void PIOS_EXTI_0_irq_handler(void)
 {
+    uint32_t timestamp = DWT_CYCCNT;
+
+    PIOS_INSTRUMENTATION_SCOPE(PIOS_INSTRUMENTATION_EXTI0_IRQ);
+
 #ifdef PIOS_INCLUDE_FREERTOS
     portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
 #else
     __attribute__((unused)) bool xHigherPriorityTaskWoken; // dummy variable
 #endif
-    PIOS_EXTI_HANDLE_LINE(0, xHigherPriorityTaskWoken);
+    PIOS_EXTI_HANDLE_LINES(EXTI_Line0, timestamp, xHigherPriorityTaskWoken);
 #ifdef PIOS_INCLUDE_FREERTOS
     portEND_SWITCHING_ISR(xHigherPriorityTaskWoken);
 #endif
@@ -227,12 +259,16 @@ void EXTI0_IRQHandler(void) __attribute__((alias("PIOS_EXTI_0_irq_handler")));
 
 static void PIOS_EXTI_1_irq_handler(void)
 {
+    uint32_t timestamp = DWT_CYCCNT;
+
+    PIOS_INSTRUMENTATION_SCOPE(PIOS_INSTRUMENTATION_EXTI1_IRQ);
+
 #ifdef PIOS_INCLUDE_FREERTOS
     portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
 #else
     __attribute__((unused)) bool xHigherPriorityTaskWoken; // dummy variable
 #endif
-    PIOS_EXTI_HANDLE_LINE(1, xHigherPriorityTaskWoken);
+    PIOS_EXTI_HANDLE_LINES(EXTI_Line1, timestamp, xHigherPriorityTaskWoken);
 #ifdef PIOS_INCLUDE_FREERTOS
     portEND_SWITCHING_ISR(xHigherPriorityTaskWoken);
 #endif
@@ -241,12 +277,16 @@ void EXTI1_IRQHandler(void) __attribute__((alias("PIOS_EXTI_1_irq_handler")));
 
 static void PIOS_EXTI_2_irq_handler(void)
 {
+    uint32_t timestamp = DWT_CYCCNT;
+
+    PIOS_INSTRUMENTATION_SCOPE(PIOS_INSTRUMENTATION_EXTI2_IRQ);
+
 #ifdef PIOS_INCLUDE_FREERTOS
     portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
 #else
     __attribute__((unused)) bool xHigherPriorityTaskWoken; // dummy variable
 #endif
-    PIOS_EXTI_HANDLE_LINE(2, xHigherPriorityTaskWoken);
+    PIOS_EXTI_HANDLE_LINES(EXTI_Line2, timestamp, xHigherPriorityTaskWoken);
 #ifdef PIOS_INCLUDE_FREERTOS
     portEND_SWITCHING_ISR(xHigherPriorityTaskWoken);
 #endif
@@ -255,12 +295,16 @@ void EXTI2_IRQHandler(void) __attribute__((alias("PIOS_EXTI_2_irq_handler")));
 
 static void PIOS_EXTI_3_irq_handler(void)
 {
+    uint32_t timestamp = DWT_CYCCNT;
+
+    PIOS_INSTRUMENTATION_SCOPE(PIOS_INSTRUMENTATION_EXTI3_IRQ);
+
 #ifdef PIOS_INCLUDE_FREERTOS
     portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
 #else
     __attribute__((unused)) bool xHigherPriorityTaskWoken; // dummy variable
 #endif
-    PIOS_EXTI_HANDLE_LINE(3, xHigherPriorityTaskWoken);
+    PIOS_EXTI_HANDLE_LINES(EXTI_Line3, timestamp, xHigherPriorityTaskWoken);
 #ifdef PIOS_INCLUDE_FREERTOS
     portEND_SWITCHING_ISR(xHigherPriorityTaskWoken);
 #endif
@@ -269,12 +313,16 @@ void EXTI3_IRQHandler(void) __attribute__((alias("PIOS_EXTI_3_irq_handler")));
 
 static void PIOS_EXTI_4_irq_handler(void)
 {
+    uint32_t timestamp = DWT_CYCCNT;
+
+    PIOS_INSTRUMENTATION_SCOPE(PIOS_INSTRUMENTATION_EXTI4_IRQ);
+
 #ifdef PIOS_INCLUDE_FREERTOS
     portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
 #else
     __attribute__((unused)) bool xHigherPriorityTaskWoken; // dummy variable
 #endif
-    PIOS_EXTI_HANDLE_LINE(4, xHigherPriorityTaskWoken);
+    PIOS_EXTI_HANDLE_LINES(EXTI_Line4, timestamp, xHigherPriorityTaskWoken);
 #ifdef PIOS_INCLUDE_FREERTOS
     portEND_SWITCHING_ISR(xHigherPriorityTaskWoken);
 #endif
@@ -283,16 +331,16 @@ void EXTI4_IRQHandler(void) __attribute__((alias("PIOS_EXTI_4_irq_handler")));
 
 static void PIOS_EXTI_9_5_irq_handler(void)
 {
+    uint32_t timestamp = DWT_CYCCNT;
+
+    PIOS_INSTRUMENTATION_SCOPE(PIOS_INSTRUMENTATION_EXTI9_5_IRQ);
+
 #ifdef PIOS_INCLUDE_FREERTOS
     portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
 #else
     __attribute__((unused)) bool xHigherPriorityTaskWoken; // dummy variable
 #endif
-    PIOS_EXTI_HANDLE_LINE(5, xHigherPriorityTaskWoken);
-    PIOS_EXTI_HANDLE_LINE(6, xHigherPriorityTaskWoken);
-    PIOS_EXTI_HANDLE_LINE(7, xHigherPriorityTaskWoken);
-    PIOS_EXTI_HANDLE_LINE(8, xHigherPriorityTaskWoken);
-    PIOS_EXTI_HANDLE_LINE(9, xHigherPriorityTaskWoken);
+    PIOS_EXTI_HANDLE_LINES(EXTI_Line5 | EXTI_Line6 | EXTI_Line7 | EXTI_Line8 | EXTI_Line9, timestamp, xHigherPriorityTaskWoken);
 #ifdef PIOS_INCLUDE_FREERTOS
     portEND_SWITCHING_ISR(xHigherPriorityTaskWoken);
 #endif
@@ -301,17 +349,16 @@ void EXTI9_5_IRQHandler(void) __attribute__((alias("PIOS_EXTI_9_5_irq_handler"))
 
 static void PIOS_EXTI_15_10_irq_handler(void)
 {
+    uint32_t timestamp = DWT_CYCCNT;
+
+    PIOS_INSTRUMENTATION_SCOPE(PIOS_INSTRUMENTATION_EXTI15_10_IRQ);
+
 #ifdef PIOS_INCLUDE_FREERTOS
     portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
 #else
     __attribute__((unused)) bool xHigherPriorityTaskWoken; // dummy variable
 #endif
-    PIOS_EXTI_HANDLE_LINE(10, xHigherPriorityTaskWoken);
-    PIOS_EXTI_HANDLE_LINE(11, xHigherPriorityTaskWoken);
-    PIOS_EXTI_HANDLE_LINE(12, xHigherPriorityTaskWoken);
-    PIOS_EXTI_HANDLE_LINE(13, xHigherPriorityTaskWoken);
-    PIOS_EXTI_HANDLE_LINE(14, xHigherPriorityTaskWoken);
-    PIOS_EXTI_HANDLE_LINE(15, xHigherPriorityTaskWoken);
+    PIOS_EXTI_HANDLE_LINES(EXTI_Line10 | EXTI_Line11 | EXTI_Line12 | EXTI_Line13 | EXTI_Line14 | EXTI_Line15, timestamp, xHigherPriorityTaskWoken);
 #ifdef PIOS_INCLUDE_FREERTOS
     portEND_SWITCHING_ISR(xHigherPriorityTaskWoken);
 #endif
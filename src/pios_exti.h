@@ -35,10 +35,16 @@
 
 #include <pios_stm32.h>
 
-typedef bool (*pios_exti_vector_t)(void);
+/*
+ * Called from the EXTI interrupt with the context it was registered with
+ * and the DWT cycle count read on entry to the handler, return true when
+ * a higher priority task was woken.
+ */
+typedef bool (*pios_exti_vector_t)(uint32_t context, uint32_t timestamp);
 
 struct pios_exti_cfg {
     pios_exti_vector_t vector;
+    uint32_t context;
     uint32_t line; /* use EXTI_LineN macros */
     struct stm32_gpio  pin;
     struct stm32_irq   irq;
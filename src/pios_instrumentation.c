@@ -0,0 +1,79 @@
+/**
+ ******************************************************************************
+ * @addtogroup PIOS PIOS Core hardware abstraction layer
+ * @{
+ * @addtogroup PIOS_INSTRUMENTATION Interrupt cost counters
+ * @brief Cycle counts of interrupt handlers and driver callbacks
+ * @{
+ *
+ * @file       pios_instrumentation.c
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      Interrupt cost counters
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "pios.h"
+#include "pios_irq.h"
+#include "pios_instrumentation.h"
+
+#include <string.h>
+
+#ifdef PIOS_INCLUDE_INSTRUMENTATION
+
+struct pios_instrumentation_site_data pios_instrumentation_data[PIOS_INSTRUMENTATION_SITES] = {
+    [0 ... PIOS_INSTRUMENTATION_SITES - 1] = { .min = UINT32_MAX },
+};
+
+void PIOS_Instrumentation_Get(enum pios_instrumentation_site site, struct pios_instrumentation_stats *stats)
+{
+    PIOS_DEBUG_Assert(site < PIOS_INSTRUMENTATION_SITES);
+
+    struct pios_instrumentation_site_data data;
+
+    /* one consistent snapshot, the handlers keep counting */
+    PIOS_IRQ_Disable();
+    data = pios_instrumentation_data[site];
+    PIOS_IRQ_Enable();
+
+    stats->count = data.count;
+    stats->min = data.count ? data.min : 0;
+    stats->max = data.max;
+    stats->mean = data.count ? data.total / data.count : 0;
+
+    memcpy(stats->histogram, data.histogram, sizeof(stats->histogram));
+}
+
+void PIOS_Instrumentation_Reset(enum pios_instrumentation_site site)
+{
+    PIOS_DEBUG_Assert(site < PIOS_INSTRUMENTATION_SITES);
+
+    struct pios_instrumentation_site_data *data = &pios_instrumentation_data[site];
+
+    PIOS_IRQ_Disable();
+    memset(data, 0, sizeof(*data));
+    data->min = UINT32_MAX;
+    PIOS_IRQ_Enable();
+}
+
+#endif /* PIOS_INCLUDE_INSTRUMENTATION */
+
+/**
+ * @}
+ * @}
+ */
@@ -0,0 +1,139 @@
+/**
+ ******************************************************************************
+ * @addtogroup PIOS PIOS Core hardware abstraction layer
+ * @{
+ * @addtogroup PIOS_INSTRUMENTATION Interrupt cost counters
+ * @brief Cycle counts of interrupt handlers and driver callbacks
+ * @{
+ *
+ * @file       pios_instrumentation.h
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      Interrupt cost counters header
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef PIOS_INSTRUMENTATION_H
+#define PIOS_INSTRUMENTATION_H
+
+#include <stdint.h>
+#include "pios_delay.h"
+
+enum pios_instrumentation_site {
+    PIOS_INSTRUMENTATION_DMA_IRQ,           /* + channel queue number, DMA1 channel 1 is 0 */
+    PIOS_INSTRUMENTATION_DMA_BEGIN = PIOS_INSTRUMENTATION_DMA_IRQ + 12,
+    PIOS_INSTRUMENTATION_EXTI0_IRQ,
+    PIOS_INSTRUMENTATION_EXTI1_IRQ,
+    PIOS_INSTRUMENTATION_EXTI2_IRQ,
+    PIOS_INSTRUMENTATION_EXTI3_IRQ,
+    PIOS_INSTRUMENTATION_EXTI4_IRQ,
+    PIOS_INSTRUMENTATION_EXTI9_5_IRQ,
+    PIOS_INSTRUMENTATION_EXTI15_10_IRQ,
+    PIOS_INSTRUMENTATION_SOFT_SERIAL_DMA_SETUP,
+    PIOS_INSTRUMENTATION_SOFT_SERIAL_DMA_COMPLETE,
+    PIOS_INSTRUMENTATION_SOFT_SERIAL_DMA_HALFTRANSFER,
+    PIOS_INSTRUMENTATION_SOFT_SERIAL_EDGE,
+    PIOS_INSTRUMENTATION_SOFT_SERIAL_GROUP_DMA_SETUP,
+    PIOS_INSTRUMENTATION_SOFT_SERIAL_GROUP_DMA_COMPLETE,
+    PIOS_INSTRUMENTATION_SOFT_SERIAL_GROUP_DMA_HALFTRANSFER,
+    PIOS_INSTRUMENTATION_SWTIMER_IRQ,
+    PIOS_INSTRUMENTATION_SITES,
+};
+
+/* bucket 0 counts runs under 2^SHIFT cycles, each next one twice as long, the last one everything above */
+#ifndef PIOS_INSTRUMENTATION_BUCKETS
+# define PIOS_INSTRUMENTATION_BUCKETS 8
+#endif
+#ifndef PIOS_INSTRUMENTATION_BUCKET_SHIFT
+# define PIOS_INSTRUMENTATION_BUCKET_SHIFT 6
+#endif
+
+struct pios_instrumentation_stats {
+    uint32_t count;
+    uint32_t min;           /* cycles */
+    uint32_t max;
+    uint32_t mean;
+    uint32_t histogram[PIOS_INSTRUMENTATION_BUCKETS];
+};
+
+#ifdef PIOS_INCLUDE_INSTRUMENTATION
+
+struct pios_instrumentation_site_data {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint32_t histogram[PIOS_INSTRUMENTATION_BUCKETS];
+};
+
+extern struct pios_instrumentation_site_data pios_instrumentation_data[PIOS_INSTRUMENTATION_SITES];
+
+struct pios_instrumentation_scope {
+    enum pios_instrumentation_site site;
+    uint32_t start;
+};
+
+/*
+ * Plain read-modify-write: a handler nested into another run of the same
+ * site may lose one update, times include anything that preempted it.
+ */
+static inline void PIOS_Instrumentation_Record(enum pios_instrumentation_site site, uint32_t cycles)
+{
+    struct pios_instrumentation_site_data *data = &pios_instrumentation_data[site];
+    uint32_t scaled = cycles >> PIOS_INSTRUMENTATION_BUCKET_SHIFT;
+    uint32_t bucket = scaled ? 32 - __builtin_clz(scaled) : 0;
+
+    if(bucket >= PIOS_INSTRUMENTATION_BUCKETS) {
+        bucket = PIOS_INSTRUMENTATION_BUCKETS - 1;
+    }
+
+    ++data->histogram[bucket];
+    ++data->count;
+    data->total += cycles;
+
+    if(cycles < data->min) {
+        data->min = cycles;
+    }
+    if(cycles > data->max) {
+        data->max = cycles;
+    }
+}
+
+static inline void PIOS_Instrumentation_Leave(struct pios_instrumentation_scope *scope)
+{
+    PIOS_Instrumentation_Record(scope->site, DWT_CYCCNT - scope->start);
+}
+
+/* times the rest of the enclosing block, whichever way it is left */
+#define PIOS_INSTRUMENTATION_SCOPE(site) \
+    struct pios_instrumentation_scope __pios_instrumentation_scope __attribute__((cleanup(PIOS_Instrumentation_Leave))) = { (site), DWT_CYCCNT }
+
+void PIOS_Instrumentation_Get(enum pios_instrumentation_site site, struct pios_instrumentation_stats *stats);
+void PIOS_Instrumentation_Reset(enum pios_instrumentation_site site);
+
+#else
+
+#define PIOS_INSTRUMENTATION_SCOPE(site)
+
+#endif /* PIOS_INCLUDE_INSTRUMENTATION */
+
+#endif /* PIOS_INSTRUMENTATION_H */
+
+/**
+ * @}
+ * @}
+ */
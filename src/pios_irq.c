@@ -33,6 +33,9 @@
  */
 
 #include "pios.h"
+#include "pios_irq.h"
+
+#include <string.h>
 
 #ifdef PIOS_INCLUDE_IRQ
 
@@ -45,6 +48,97 @@ static uint32_t nested_ctr;
 /* Stored priority level before IRQ has been disabled (important for co-existence with vPortEnterCritical) */
 static uint32_t prev_primask;
 
+/* The mask registers, through the CMSIS intrinsics on other targets than the core (the host tests) */
+#ifdef __arm__
+static inline uint32_t PIOS_IRQ_Get_PRIMASK(void)
+{
+    uint32_t primask;
+
+    __asm volatile ("   mrs %0, primask\n" : "=r" (primask));
+    return primask;
+}
+
+static inline void PIOS_IRQ_Set_PRIMASK(uint32_t primask)
+{
+    __asm volatile ("   msr primask, %0\n" ::"r" (primask) : "memory");
+}
+
+static inline void PIOS_IRQ_Disable_PRIMASK(void)
+{
+    __asm volatile ("   cpsid i\n" ::: "memory");
+}
+
+static inline uint32_t PIOS_IRQ_Get_BASEPRI(void)
+{
+    uint32_t basepri;
+
+    __asm volatile ("   mrs %0, basepri\n" : "=r" (basepri));
+    return basepri;
+}
+
+static inline void PIOS_IRQ_Set_BASEPRI(uint32_t basepri)
+{
+    __asm volatile ("   msr basepri, %0\n" ::"r" (basepri) : "memory");
+}
+
+/* basepri_max ignores values that would lower the current ceiling */
+static inline void PIOS_IRQ_Raise_BASEPRI(uint32_t basepri)
+{
+    __asm volatile ("   msr basepri_max, %0\n" ::"r" (basepri) : "memory");
+}
+#else
+#define PIOS_IRQ_Get_PRIMASK()     __get_PRIMASK()
+#define PIOS_IRQ_Set_PRIMASK(x)    __set_PRIMASK(x)
+#define PIOS_IRQ_Disable_PRIMASK() __disable_irq()
+#define PIOS_IRQ_Get_BASEPRI()     __get_BASEPRI()
+#define PIOS_IRQ_Set_BASEPRI(x)    __set_BASEPRI(x)
+
+static inline void PIOS_IRQ_Raise_BASEPRI(uint32_t basepri)
+{
+    uint32_t current = __get_BASEPRI();
+
+    if (!current || basepri < current) {
+        __set_BASEPRI(basepri);
+    }
+}
+#endif /* __arm__ */
+
+#ifdef PIOS_INCLUDE_IRQ_PROFILE
+
+struct pios_irq_profile pios_irq_profile = {
+    .magic = PIOS_IRQ_PROFILE_MAGIC,
+    .buckets = PIOS_IRQ_PROFILE_BUCKETS,
+    .bucket_shift = PIOS_IRQ_PROFILE_BUCKET_SHIFT,
+};
+
+/* Start of the outermost section and who began it */
+static uint32_t disabled_start;
+static uint32_t disabled_caller;
+static uint32_t masked_start;
+static uint32_t masked_caller;
+
+/* Called with the section still in force, so nothing else updates it meanwhile */
+static void PIOS_IRQ_Profile_Record(struct pios_irq_profile_sections *sections, uint32_t start, uint32_t caller)
+{
+    uint32_t cycles = DWT_CYCCNT - start;
+    uint32_t scaled = cycles >> PIOS_IRQ_PROFILE_BUCKET_SHIFT;
+    uint32_t bucket = scaled ? 32 - __builtin_clz(scaled) : 0;
+
+    if (bucket >= PIOS_IRQ_PROFILE_BUCKETS) {
+        bucket = PIOS_IRQ_PROFILE_BUCKETS - 1;
+    }
+
+    ++sections->histogram[bucket];
+    ++sections->count;
+
+    if (cycles > sections->max) {
+        sections->max = cycles;
+        sections->max_caller = caller;
+    }
+}
+
+#endif /* PIOS_INCLUDE_IRQ_PROFILE */
+
 /**
  * Disables all interrupts (nested)
  * \return < 0 On errors
@@ -53,12 +147,18 @@ int32_t PIOS_IRQ_Disable(void)
 {
     /* Get current priority if nested level == 0 */
     if (!nested_ctr) {
-        __asm volatile ("   mrs %0, primask\n" : "=r" (prev_primask)
-                        );
+        prev_primask = PIOS_IRQ_Get_PRIMASK();
     }
 
     /* Disable interrupts */
-    __asm volatile ("     mov r0, #1     \n" "     msr primask, r0\n" ::: "r0");
+    PIOS_IRQ_Disable_PRIMASK();
+
+#ifdef PIOS_INCLUDE_IRQ_PROFILE
+    if (!nested_ctr) {
+        disabled_start  = DWT_CYCCNT;
+        disabled_caller = (uint32_t)__builtin_return_address(0);
+    }
+#endif
 
     ++nested_ctr;
 
@@ -84,14 +184,107 @@ int32_t PIOS_IRQ_Enable(void)
 
     /* Set back previous priority once nested level reached 0 again */
     if (nested_ctr == 0) {
-        __asm volatile ("   msr primask, %0\n" ::"r" (prev_primask)
-                        );
+#ifdef PIOS_INCLUDE_IRQ_PROFILE
+        PIOS_IRQ_Profile_Record(&pios_irq_profile.disabled, disabled_start, disabled_caller);
+#endif
+        PIOS_IRQ_Set_PRIMASK(prev_primask);
     }
 
     /* No error */
     return 0;
 }
 
+/**
+ * Masks the interrupts at priority prio and below (numerically >= prio),
+ * leaving the more urgent ones running. Only ever raises the ceiling, so
+ * nested sections with a lower ceiling (and vPortEnterCritical) keep theirs.
+ * \param[in] prio PIOS_IRQ_PRIO_* level, must not be 0 (use PIOS_IRQ_Disable)
+ * \return the previous mask, to be handed to PIOS_IRQ_Unmask()
+ */
+uint32_t PIOS_IRQ_Mask(uint8_t prio)
+{
+    PIOS_DEBUG_Assert(prio > 0 && prio < (1 << __NVIC_PRIO_BITS));
+
+    /* with subpriority bits NVIC_Init() scrambles the levels, nothing gets masked */
+    PIOS_DEBUG_Assert((SCB->AIRCR & SCB_AIRCR_PRIGROUP_Msk) == NVIC_PriorityGroup_4);
+
+    uint32_t prev_basepri = PIOS_IRQ_Get_BASEPRI();
+
+    PIOS_IRQ_Raise_BASEPRI((uint32_t)prio << (8 - __NVIC_PRIO_BITS));
+
+#ifdef PIOS_INCLUDE_IRQ_PROFILE
+    /* Exception entry leaves basepri alone, so only one outermost section exists at a time */
+    if (!prev_basepri) {
+        masked_start  = DWT_CYCCNT;
+        masked_caller = (uint32_t)__builtin_return_address(0);
+    }
+#endif
+
+    return prev_basepri;
+}
+
+/**
+ * Ends a section started by PIOS_IRQ_Mask(), sections nest by unmasking in
+ * the reverse order
+ * \param[in] prev_basepri the value PIOS_IRQ_Mask() returned
+ */
+void PIOS_IRQ_Unmask(uint32_t prev_basepri)
+{
+#ifdef PIOS_INCLUDE_IRQ_PROFILE
+    if (!prev_basepri) {
+        PIOS_IRQ_Profile_Record(&pios_irq_profile.masked, masked_start, masked_caller);
+    }
+#endif
+
+    PIOS_IRQ_Set_BASEPRI(prev_basepri);
+}
+
+#ifdef PIOS_INCLUDE_IRQ_PROFILE
+
+/**
+ * Records the clock for tools/pios_irq_profile.py
+ */
+void PIOS_IRQ_Profile_Init(void)
+{
+    RCC_ClocksTypeDef clocks;
+
+    RCC_GetClocksFreq(&clocks);
+    pios_irq_profile.clock = clocks.SYSCLK_Frequency;
+}
+
+/**
+ * Copies one consistent snapshot of the section statistics
+ * \param[out] profile
+ */
+void PIOS_IRQ_Profile_Get(struct pios_irq_profile *profile)
+{
+    /* Not through PIOS_IRQ_Disable(), the copy would show up as a section */
+    uint32_t primask = PIOS_IRQ_Get_PRIMASK();
+
+    PIOS_IRQ_Disable_PRIMASK();
+
+    *profile = pios_irq_profile;
+
+    PIOS_IRQ_Set_PRIMASK(primask);
+}
+
+/**
+ * Clears the section statistics, a section open right now still counts when it ends
+ */
+void PIOS_IRQ_Profile_Reset(void)
+{
+    uint32_t primask = PIOS_IRQ_Get_PRIMASK();
+
+    PIOS_IRQ_Disable_PRIMASK();
+
+    memset(&pios_irq_profile.disabled, 0, sizeof(pios_irq_profile.disabled));
+    memset(&pios_irq_profile.masked, 0, sizeof(pios_irq_profile.masked));
+
+    PIOS_IRQ_Set_PRIMASK(primask);
+}
+
+#endif /* PIOS_INCLUDE_IRQ_PROFILE */
+
 #endif /* PIOS_INCLUDE_IRQ */
 
 /**
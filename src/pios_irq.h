@@ -31,8 +31,50 @@
 #ifndef PIOS_IRQ_H
 #define PIOS_IRQ_H
 
+#include <stdint.h>
+
 /* Public Functions */
 extern int32_t PIOS_IRQ_Disable(void);
 extern int32_t PIOS_IRQ_Enable(void);
+/* needs NVIC_PriorityGroup_4, set before the first NVIC_Init() */
+extern uint32_t PIOS_IRQ_Mask(uint8_t prio);
+extern void PIOS_IRQ_Unmask(uint32_t prev_basepri);
+
+/* bucket 0 counts sections under 2^SHIFT cycles, each next one twice as long, the last one everything above */
+#ifndef PIOS_IRQ_PROFILE_BUCKETS
+# define PIOS_IRQ_PROFILE_BUCKETS 8
+#endif
+#ifndef PIOS_IRQ_PROFILE_BUCKET_SHIFT
+# define PIOS_IRQ_PROFILE_BUCKET_SHIFT 6
+#endif
+
+#define PIOS_IRQ_PROFILE_MAGIC 0x51524950 /* "PIRQ" in a little endian dump */
+
+/* outermost sections only, in DWT cycles */
+struct pios_irq_profile_sections {
+    uint32_t count;
+    uint32_t max;
+    uint32_t max_caller;    /* return address into the code that began the longest one */
+    uint32_t histogram[PIOS_IRQ_PROFILE_BUCKETS];
+};
+
+/* laid out for tools/pios_irq_profile.py, which finds it in a RAM dump by its magic */
+struct pios_irq_profile {
+    uint32_t magic;
+    uint32_t clock;         /* cycles per second, 0 before PIOS_IRQ_Profile_Init() */
+    uint32_t buckets;
+    uint32_t bucket_shift;
+    struct pios_irq_profile_sections disabled;  /* PIOS_IRQ_Disable() */
+    struct pios_irq_profile_sections masked;    /* PIOS_IRQ_Mask(), whatever the ceiling */
+};
+
+#ifdef PIOS_INCLUDE_IRQ_PROFILE
+extern struct pios_irq_profile pios_irq_profile;
+
+/* after PIOS_DELAY_Init(), which starts the cycle counter */
+extern void PIOS_IRQ_Profile_Init(void);
+extern void PIOS_IRQ_Profile_Get(struct pios_irq_profile *profile);
+extern void PIOS_IRQ_Profile_Reset(void);
+#endif
 
 #endif /* PIOS_IRQ_H */
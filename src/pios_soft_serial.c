@@ -30,7 +30,10 @@
 
 #include "pios_soft_serial.h"
 #include "pios_soft_serial_ll.h"
+#include "pios_soft_serial_slice.h"
 #include "pios_irq.h"
+#include "pios_instrumentation.h"
+#include "pios_trace.h"
 #include "pios_tim.h"
 #include "pios_usart.h"
 
@@ -59,18 +62,93 @@ struct pios_com_driver pios_soft_serial_driver = {
 /* pios_dma callbacks */
 static void PIOS_Soft_Serial_DMA_Setup(uint32_t dma_handle, uint32_t context);
 static void PIOS_Soft_Serial_DMA_Complete(uint32_t dma_handle, uint32_t context);
+static void PIOS_Soft_Serial_DMA_HalfTransfer(uint32_t dma_handle, uint32_t context);
 static void PIOS_Soft_Serial_DMA_Error(uint32_t dma_handle, uint32_t context);
 
 /* edge detect callback */
-static void PIOS_Soft_Serial_Edge_Detected(uint32_t dev, uint32_t context);
+static void PIOS_Soft_Serial_Edge_Detected(uint32_t dev, uint32_t context, uint32_t timestamp);
+
+/* group dma callbacks */
+static void PIOS_Soft_Serial_Group_DMA_Setup(uint32_t dma_handle, uint32_t context);
+static void PIOS_Soft_Serial_Group_DMA_Complete(uint32_t dma_handle, uint32_t context);
+static void PIOS_Soft_Serial_Group_DMA_HalfTransfer(uint32_t dma_handle, uint32_t context);
+static void PIOS_Soft_Serial_Group_DMA_Error(uint32_t dma_handle, uint32_t context);
 
 typedef enum {
     PIOS_SOFT_SERIAL_MAGIC = 0x50F75E81
 } pios_soft_serial_magic_t;
 
-#define DMA_BUFFER_SIZE (1 + 9 + 2)
+typedef enum {
+    PIOS_SOFT_SERIAL_GROUP_MAGIC = 0x50F76A0B
+} pios_soft_serial_group_magic_t;
+
+#define DMA_FRAME_SIZE (1 + 9 + 2)
+
+/* number of characters encoded back to back into one DMA transfer */
+#ifndef PIOS_SOFT_SERIAL_TX_BATCH
+# define PIOS_SOFT_SERIAL_TX_BATCH 4
+#endif
+
+#define DMA_BUFFER_SIZE (DMA_FRAME_SIZE * PIOS_SOFT_SERIAL_TX_BATCH)
 #define DMA_NUM_BUFFERS 2
 
+/*
+ * TX buffers hold one BSRR word per bit, or with PIOS_SOFT_SERIAL_TX_BITBAND
+ * one byte per bit for the bit-band alias of the tx pin's ODR bit, which
+ * takes a quarter of the RAM. Toggle TX needs word buffers, so it is not
+ * available then. Groups always merge BSRR words in their own buffers.
+ */
+#ifdef PIOS_SOFT_SERIAL_TX_BITBAND
+typedef uint8_t pios_soft_serial_tx_word_t;
+#else
+typedef uint32_t pios_soft_serial_tx_word_t;
+#endif
+
+/* RX samples IDR into the (then idle) TX buffers, one halfword per sample */
+#define RX_RING_SIZE (sizeof(((struct pios_soft_serial_device *)0)->dma_buffer) / sizeof(uint16_t))
+#define RX_DELIVER_MAX 8
+
+/*
+ * Cycles from the start bit edge to the EXTI handler's timestamp: input
+ * synchronisation plus exception entry.
+ */
+#ifndef PIOS_SOFT_SERIAL_EDGE_ENTRY_CYCLES
+# define PIOS_SOFT_SERIAL_EDGE_ENTRY_CYCLES 16
+#endif
+
+/*
+ * Timestamp ticks from toggle TX dma setup to the first start bit, must
+ * cover the rest of dma setup.
+ */
+#ifndef PIOS_SOFT_SERIAL_TOGGLE_LEAD
+# define PIOS_SOFT_SERIAL_TOGGLE_LEAD 128
+#endif
+
+/* capture input filter (IC1F, the TI1 edges come through it), 3 = 8 timer clocks */
+#ifndef PIOS_SOFT_SERIAL_CAPTURE_FILTER
+# define PIOS_SOFT_SERIAL_CAPTURE_FILTER 3
+#endif
+
+/* frame bits following the 8 data bits: optional 9th bit (data or parity) + up to 2 stop bits */
+#define TX_TAIL_SIZE (1 + 2)
+
+/* longest frame, start bit included */
+#define FRAME_BITS_MAX (1 + 8 + TX_TAIL_SIZE)
+
+/*
+ * Fractional baud ARR periods per table pass, a power of two. Bit and
+ * sample times are exact to 1/STEPS timer ticks on average.
+ */
+#ifndef PIOS_SOFT_SERIAL_FRAC_STEPS
+# define PIOS_SOFT_SERIAL_FRAC_STEPS 16
+#endif
+
+typedef enum {
+    TIM_MODE_CLOCK,         /* compare at counter wrap clocks the dma */
+    TIM_MODE_CAPTURE,       /* both edges of TI1 captured on a free running counter */
+    TIM_MODE_TOGGLE,        /* output toggles on compare, dma loads the next compare */
+} pios_soft_serial_tim_mode_t;
+
 typedef enum {
     STATE_IDLE,
     STATE_RX_WAIT,
@@ -83,6 +161,58 @@ struct pios_soft_serial_gpio {
     uint32_t dma;
 };
 
+/*
+ * Precomputed BSRR words for the current TX pin and frame format.
+ * Rebuilt by PIOS_Soft_Serial_Build_Tx_Table() whenever any of them changes,
+ * so encoding a byte is just a few table copies.
+ */
+struct pios_soft_serial_tx_table {
+    uint32_t start;                         /* start bit */
+    uint32_t nibble[16][4];                 /* 4 data bits, LSB first */
+    uint32_t tail[2][TX_TAIL_SIZE];         /* indexed by data parity (1 = odd number of ones) */
+    uint32_t idle;                          /* line idle (mark) */
+    uint8_t tail_level[2];                  /* tail line levels, bit n = tail[][n] is mark */
+    pios_soft_serial_tx_word_t mark;        /* idle line in the tx buffer encoding */
+    uint8_t tail_len;
+};
+
+/* one member per GPIO pin */
+#define PIOS_SOFT_SERIAL_GROUP_MAX_MEMBERS 16
+
+struct pios_soft_serial_device;
+
+struct pios_soft_serial_group {
+    pios_soft_serial_group_magic_t magic;
+
+    const struct pios_soft_serial_config *cfg;
+
+    GPIO_TypeDef *gpio;
+    uint32_t dma;
+    uint16_t tim_dma_source;
+
+    struct pios_soft_serial_device *member[PIOS_SOFT_SERIAL_GROUP_MAX_MEMBERS];
+    uint8_t member_count;
+
+    uint16_t tx_pending;    /* members with tx pending, one bit per member */
+    bool tx_active;
+
+    uint8_t tx_active_buffer;
+    bool tx_next;           /* other buffer holds an encoded batch */
+    uint16_t tx_next_len;
+
+    uint32_t rx_dma;
+    bool rx_armed;
+    uint16_t rx_arr;
+    uint16_t rx_psc;
+    struct pios_soft_serial_slice rx_slice;
+    struct pios_soft_serial_device *rx_member[16]; /* by rx pin number */
+
+    uint32_t dma_buffer[DMA_NUM_BUFFERS][DMA_BUFFER_SIZE];
+};
+
+/* group RX samples the whole port into the (then idle) TX buffers */
+#define GROUP_RX_RING_SIZE (sizeof(((struct pios_soft_serial_group *)0)->dma_buffer) / sizeof(uint16_t))
+
 struct pios_soft_serial_device {
     pios_soft_serial_magic_t magic;
     
@@ -103,23 +233,102 @@ struct pios_soft_serial_device {
 
     uint8_t dma_buffer_free;
 
-    uint32_t dma_buffer[DMA_NUM_BUFFERS][DMA_BUFFER_SIZE];
+    /* rx uses them as one halfword ring */
+    pios_soft_serial_tx_word_t dma_buffer[DMA_NUM_BUFFERS][DMA_BUFFER_SIZE] __attribute__((aligned(4)));
+
+    pios_soft_serial_tx_word_t *tx_active;    /* buffer currently owned by tx dma */
+    pios_soft_serial_tx_word_t *tx_next;      /* encoded batch waiting for tx dma */
+    uint16_t tx_next_len;
+
+    bool tx_toggle;         /* tx by output compare toggling at each level change */
+    uint16_t tx_toggle_end[DMA_NUM_BUFFERS]; /* batch end timestamp, by buffer */
+    uint16_t tx_toggle_lead; /* timestamp ticks the last batch still needs on the wire */
+
+    bool tx_stream;         /* use circular streaming when starting tx */
+    bool tx_streaming;      /* circular tx is running */
+    bool tx_stream_idle;    /* last refilled half holds only idle line */
+    uint16_t tx_stream_half; /* words per half of the circular buffer */
+
+    struct pios_soft_serial_tx_table tx_table;
+
+    uint32_t baud;
+    uint16_t tx_arr;
+    uint16_t rx_arr;
+    uint16_t clk_psc;           /* prescaler for both arr */
+
+    bool frac_baud;             /* per period ARR from arr_steps */
+    uint32_t tx_frac;           /* timer ticks per PIOS_SOFT_SERIAL_FRAC_STEPS bits */
+    uint32_t rx_frac;           /* timer ticks per PIOS_SOFT_SERIAL_FRAC_STEPS samples */
+    uint32_t arr_dma;           /* update request loading ARR, 0 until first used */
+    uint16_t arr_steps[PIOS_SOFT_SERIAL_FRAC_STEPS];
+    uint32_t arr_steps_total;   /* ticks arr_steps spreads */
+
+    uint32_t sysclk;
+    uint32_t bit_cycles;        /* DWT cycles per bit */
+    uint32_t tick_per_cycle;    /* timer ticks per DWT cycle, 16.16 */
+    uint32_t edge_latency_max;  /* DWT cycles from edge to rx dma armed */
+    bool rx_edge_skip;          /* edge serviced after the start bit center */
+
+    pios_soft_serial_tim_mode_t tim_mode;
+    uint16_t ts_psc;        /* timestamp prescaler, a frame must fit in 16 bits */
+    uint16_t ts_bit;        /* timestamp ticks per bit */
+
+    bool rx_capture;        /* rx from edge timestamps */
+    uint16_t rx_frame_start; /* timestamp of the start bit edge */
+    uint16_t rx_last_edge;
+    bool rx_level;          /* line level since the last edge */
+
+    bool rx_enabled;        /* COM layer wants data */
+    uint8_t rx_oversample;  /* 1 is edge aligned, one sample per bit */
+    uint16_t rx_pos;        /* next sample to look at */
+    uint16_t rx_avail;      /* samples ready from rx_pos on */
+    uint16_t rx_skip;       /* samples from rx_pos to next bit center */
+    uint8_t rx_bit;         /* frame bit at next bit center, 0 = start bit */
+    uint16_t rx_shift;
+    bool rx_break;          /* stop bit was a space, wait for mark before the next start bit */
+    struct pios_soft_serial_rx_errors rx_errors;
     
-    uint16_t tim_dma_source;
+    uint16_t tim_dma_source;    /* with TIM_DMA_Update for fractional baud */
+    pios_dma_stream_t *dma_stream;
     
     pios_soft_serial_state_t state;
     
     uint32_t edge_detect;
+
+    struct pios_soft_serial_group *group;
+    uint8_t group_member;
     
     struct pios_soft_serial_gpio rx;
     struct pios_soft_serial_gpio tx;
 };
 
 /* private functions */
-static uint32_t *PIOS_Soft_Serial_GetDMABuffer(struct pios_soft_serial_device *dev);
-static void PIOS_Soft_Serial_FreeDMABuffer(struct pios_soft_serial_device *dev, uint32_t *buffer);
+static pios_soft_serial_tx_word_t *PIOS_Soft_Serial_GetDMABuffer(struct pios_soft_serial_device *dev);
+static void PIOS_Soft_Serial_FreeDMABuffer(struct pios_soft_serial_device *dev, pios_soft_serial_tx_word_t *buffer);
+static void PIOS_Soft_Serial_Build_Tx_Table(struct pios_soft_serial_device *dev);
 static uint16_t PIOS_Soft_Serial_Encode(struct pios_soft_serial_device *dev, uint8_t data, uint32_t *buffer);
+static uint16_t PIOS_Soft_Serial_Tx_Fill(struct pios_soft_serial_device *dev, pios_soft_serial_tx_word_t *buffer, uint16_t *headroom);
+static void PIOS_Soft_Serial_Tx_Prefetch(struct pios_soft_serial_device *dev);
+static void PIOS_Soft_Serial_Tx_Queue(struct pios_soft_serial_device *dev, pios_soft_serial_tx_word_t *buffer, uint16_t len);
+static __IO void *PIOS_Soft_Serial_Tx_Target(struct pios_soft_serial_device *dev);
 static void PIOS_Soft_Serial_Tx_Start_Internal(struct pios_soft_serial_device *dev);
+static bool PIOS_Soft_Serial_Tx_Stream_Start(struct pios_soft_serial_device *dev);
+static void PIOS_Soft_Serial_Tx_Stream_Refill(struct pios_soft_serial_device *dev, uint8_t half);
+static void PIOS_Soft_Serial_Tx_Stream_Stop(struct pios_soft_serial_device *dev);
+static void PIOS_Soft_Serial_Tx_Done(struct pios_soft_serial_device *dev);
+static void PIOS_Soft_Serial_Rx_Arm(struct pios_soft_serial_device *dev);
+static void PIOS_Soft_Serial_Rx_Disarm(struct pios_soft_serial_device *dev);
+static void PIOS_Soft_Serial_Rx_Decode(struct pios_soft_serial_device *dev, uint16_t samples);
+static void PIOS_Soft_Serial_Rx_Edge_Frame(struct pios_soft_serial_device *dev);
+static void PIOS_Soft_Serial_Rx_Capture_Update(struct pios_soft_serial_device *dev);
+static __IO uint16_t *PIOS_Soft_Serial_Tim_CCR(struct pios_soft_serial_device *dev);
+static void PIOS_Soft_Serial_Tim_Mode(struct pios_soft_serial_device *dev, pios_soft_serial_tim_mode_t mode);
+static void PIOS_Soft_Serial_Line_Setup(struct pios_soft_serial_device *dev, struct pios_soft_serial_gpio *gs);
+static bool PIOS_Soft_Serial_Group_Bind_Port(struct pios_soft_serial_group *group, GPIO_TypeDef *gpio);
+static void PIOS_Soft_Serial_Group_Tx_Start(struct pios_soft_serial_group *group, struct pios_soft_serial_device *dev);
+static void PIOS_Soft_Serial_Group_Rx_Start(struct pios_soft_serial_group *group, struct pios_soft_serial_device *dev);
+static void PIOS_Soft_Serial_Group_Rx_Arm(struct pios_soft_serial_group *group);
+static void PIOS_Soft_Serial_Group_Rx_Disarm(struct pios_soft_serial_group *group);
 
 
 #if !defined(PIOS_INCLUDE_FREERTOS)
@@ -128,6 +337,11 @@ static void PIOS_Soft_Serial_Tx_Start_Internal(struct pios_soft_serial_device *d
 # endif
 static uint8_t soft_serial_count;
 static struct pios_soft_serial_device soft_serial_device[PIOS_SOFT_SERIAL_MAX_DEV];
+# ifndef PIOS_SOFT_SERIAL_MAX_GROUP
+#  define PIOS_SOFT_SERIAL_MAX_GROUP 1
+# endif
+static uint8_t soft_serial_group_count;
+static struct pios_soft_serial_group soft_serial_group[PIOS_SOFT_SERIAL_MAX_GROUP];
 #endif /* PIOS_INCLUDE_FREERTOS */
 
 
@@ -141,13 +355,98 @@ struct pios_soft_serial_device *__d = (struct pios_soft_serial_device *)__id; \
 bool valid = PIOS_Soft_Serial_Validate(__d); \
 PIOS_DEBUG_Assert(valid)
 
+static bool PIOS_Soft_Serial_Group_Validate(struct pios_soft_serial_group *group)
+{
+    return group && (group->magic == PIOS_SOFT_SERIAL_GROUP_MAGIC);
+}
+
+#define PIOS_SOFT_SERIAL_GROUP_VALIDATE_AND_ASSERT(__g, __id) \
+struct pios_soft_serial_group *__g = (struct pios_soft_serial_group *)__id; \
+bool valid = PIOS_Soft_Serial_Group_Validate(__g); \
+PIOS_DEBUG_Assert(valid)
+
+
+
+/* the configured channel, or the least busy one wired to the timer channel's request */
+static pios_dma_stream_t *PIOS_Soft_Serial_DMA_Stream(const struct pios_soft_serial_config *config)
+{
+    if(config->dma_stream) {
+        return config->dma_stream;
+    }
+
+    return PIOS_DMA_Alloc_TIM(config->timer, PIOS_TIM_CHANNEL_DIER_CCxDE(config->tim_channel));
+}
+
+static inline void PIOS_Soft_Serial_Set_State(struct pios_soft_serial_device *dev, pios_soft_serial_state_t state)
+{
+    dev->state = state;
 
+    PIOS_TRACE(PIOS_TRACE_SOFT_SERIAL_STATE + state, (uint32_t)dev);
+}
 
 int32_t PIOS_Soft_Serial_Init(uint32_t *id, const struct pios_soft_serial_config *config)
 {
     PIOS_DEBUG_Assert(config);
     PIOS_DEBUG_Assert(id);
 
+    pios_dma_stream_t *dma_stream = PIOS_Soft_Serial_DMA_Stream(config);
+
+    if(!dma_stream) {
+        return -1;
+    }
+
+    struct pios_dma_config dma_config = {
+        .init = {
+            .DMA_M2M = DMA_M2M_Disable,
+            .DMA_Priority = DMA_Priority_Medium,
+            .DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word,
+            .DMA_MemoryDataSize = DMA_MemoryDataSize_Word,
+            .DMA_MemoryInc = DMA_MemoryInc_Enable,
+            .DMA_PeripheralInc = DMA_PeripheralInc_Disable,
+            .DMA_DIR = DMA_DIR_PeripheralDST,
+//            .DMA_BufferSize = ndt,
+//            .DMA_MemoryBaseAddr = (uint32_t)buffer,
+//            .DMA_PeripheralBaseAddr = (uint32_t)&io.gpio->BSRR,
+        },
+        .stream = dma_stream,
+        .timer = config->timer,
+        .tim_dma_source = PIOS_TIM_CHANNEL_DIER_CCxDE(config->tim_channel),
+        .irq = { // NVIC irq priority only
+            .NVIC_IRQChannelPreemptionPriority = PIOS_SOFT_SERIAL_DMA_IRQ_PRIO,
+        },
+        .callbacks = {
+            .setup = PIOS_Soft_Serial_DMA_Setup,
+            .complete = PIOS_Soft_Serial_DMA_Complete,
+            .halftransfer = PIOS_Soft_Serial_DMA_HalfTransfer,
+            .error = PIOS_Soft_Serial_DMA_Error,
+        }
+    };
+
+#ifdef PIOS_SOFT_SERIAL_TX_BITBAND
+    /* one byte per bit into a bit-band alias word */
+    dma_config.init.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+#endif
+
+    /* before taking a device or touching the timer, a rejected config leaves neither behind */
+    uint32_t tx_dma;
+    uint32_t rx_dma;
+
+    if(PIOS_DMA_Init(&tx_dma, &dma_config)) {
+        /* tim_channel's request is not wired to the configured channel */
+        return -1;
+    }
+    
+    /* RX samples the 16 bit IDR */
+    dma_config.init.DMA_DIR = DMA_DIR_PeripheralSRC;
+    dma_config.init.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord;
+    dma_config.init.DMA_MemoryDataSize = DMA_MemoryDataSize_HalfWord;
+    /* a start bit waits for no more than the TX batch in flight */
+    dma_config.priority = 1;
+    
+    if(PIOS_DMA_Init(&rx_dma, &dma_config)) {
+        return -1;
+    }
+
 #ifdef PIOS_INCLUDE_FREERTOS
     struct pios_soft_serial_device *dev = (struct pios_soft_serial_device *)pios_malloc(sizeof(*dev));
 #else
@@ -160,13 +459,25 @@ int32_t PIOS_Soft_Serial_Init(uint32_t *id, const struct pios_soft_serial_config
     dev->magic = PIOS_SOFT_SERIAL_MAGIC;
     dev->cfg = config;
 
-    dev->state = STATE_IDLE;
+    PIOS_Soft_Serial_Set_State(dev, STATE_IDLE);
 
     dev->word_len = PIOS_COM_Word_length_8b;
     dev->parity = PIOS_COM_Parity_No;
     dev->stop_bits = PIOS_COM_StopBits_1;
     dev->inverted = PIOS_USART_Inverted_None;
     dev->dma_buffer_free = 0xff;
+    dev->rx_oversample = 4;
+
+    dev->tx.dma = tx_dma;
+    dev->rx.dma = rx_dma;
+    dev->tim_dma_source = PIOS_TIM_CHANNEL_DIER_CCxDE(dev->cfg->tim_channel);
+    dev->dma_stream = dma_stream;
+
+    RCC_ClocksTypeDef clocks;
+    RCC_GetClocksFreq(&clocks);
+    dev->sysclk = clocks.SYSCLK_Frequency;
+
+    PIOS_Soft_Serial_Build_Tx_Table(dev);
     
     /* initialize timer base */
     TIM_TimeBaseInitTypeDef timeBaseInit = {
@@ -181,38 +492,6 @@ int32_t PIOS_Soft_Serial_Init(uint32_t *id, const struct pios_soft_serial_config
     TIM_Cmd(dev->cfg->timer, ENABLE);
 
     PIOS_Soft_Serial_Set_Baud((uint32_t) dev, 9600);
-
-    struct pios_dma_config dma_config = {
-        .init = {
-            .DMA_M2M = DMA_M2M_Disable,
-            .DMA_Priority = DMA_Priority_Medium,
-            .DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word,
-            .DMA_MemoryDataSize = DMA_MemoryDataSize_Word,
-            .DMA_MemoryInc = DMA_MemoryInc_Enable,
-            .DMA_PeripheralInc = DMA_PeripheralInc_Disable,
-            .DMA_DIR = DMA_DIR_PeripheralDST,
-//            .DMA_BufferSize = ndt,
-//            .DMA_MemoryBaseAddr = (uint32_t)buffer,
-//            .DMA_PeripheralBaseAddr = (uint32_t)&io.gpio->BSRR,
-        },
-        .stream = dev->cfg->dma_stream,
-//        .irq = { // NVIC irq priority only
-//            .
-//        }
-        .callbacks = {
-            .setup = PIOS_Soft_Serial_DMA_Setup,
-            .complete = PIOS_Soft_Serial_DMA_Complete,
-            .error = PIOS_Soft_Serial_DMA_Error,
-        }
-    };
-
-    PIOS_DMA_Init(&dev->tx.dma, &dma_config);
-    
-    dma_config.init.DMA_DIR = DMA_DIR_PeripheralSRC;
-    
-    PIOS_DMA_Init(&dev->rx.dma, &dma_config);
-    
-    dev->tim_dma_source = PIOS_TIM_CHANNEL_DIER_CCxDE(dev->cfg->tim_channel);
     
     PIOS_Soft_Serial_LL_EdgeDetect_Init(&dev->edge_detect, PIOS_Soft_Serial_Edge_Detected, (uint32_t) dev);
 
@@ -229,7 +508,140 @@ static void PIOS_Soft_Serial_Set_Baud(uint32_t id, uint32_t baud)
         return;
     }
 
-    TIM_SetAutoreload(dev->cfg->timer, (PIOS_TIM_Ck_Int(dev->cfg->timer) / baud) - 1);
+    struct pios_tim_period period;
+
+    /* one prescaler for bits and the faster samples, the bit time sets it */
+    if(PIOS_TIM_Period(dev->cfg->timer, baud, &period)) {
+        return;
+    }
+
+    uint32_t ck_int = PIOS_TIM_Ck_Int(dev->cfg->timer);
+    uint32_t div = period.psc + 1;
+    uint32_t rx_rate = baud * dev->rx_oversample;
+
+    dev->baud = baud;
+    dev->clk_psc = period.psc;
+
+    /* exact bit and sample times in 1/STEPS ticks, fits for timer clocks below 268 MHz */
+    dev->tx_frac = (ck_int * PIOS_SOFT_SERIAL_FRAC_STEPS + baud * div / 2) / (baud * div);
+    dev->rx_frac = (ck_int * PIOS_SOFT_SERIAL_FRAC_STEPS + rx_rate * div / 2) / (rx_rate * div);
+
+    /* nearest whole tick periods when not fractional */
+    dev->tx_arr = period.arr;
+    dev->rx_arr = (dev->rx_frac + PIOS_SOFT_SERIAL_FRAC_STEPS / 2) / PIOS_SOFT_SERIAL_FRAC_STEPS - 1;
+
+    dev->bit_cycles = dev->sysclk / baud;
+    dev->tick_per_cycle = ((uint64_t)ck_int << 16) / dev->sysclk / div;
+
+    /* 12 bits of timestamp ticks must stay below the 16 bit wrap */
+    dev->ts_psc = ((ck_int / baud) * 12) >> 16;
+    dev->ts_bit = (ck_int / (dev->ts_psc + 1)) / baud;
+
+    /* the free running modes keep their counter setup */
+    if(dev->tim_mode == TIM_MODE_CLOCK) {
+        PIOS_TIM_SetPeriod(dev->cfg->timer, &period);
+    }
+}
+
+/*
+ * The timer update request's channel, held by a circular transfer into
+ * ARR from the first use on. The update request only runs while tx or rx
+ * clocks the timer, so the channel idles in between.
+ */
+static bool PIOS_Soft_Serial_Frac_Init(struct pios_soft_serial_device *dev)
+{
+    if(dev->arr_dma) {
+        return true;
+    }
+
+    pios_dma_stream_t *stream = dev->cfg->arr_dma_stream;
+
+    if(!stream) {
+        stream = PIOS_DMA_Alloc_TIM(dev->cfg->timer, TIM_DMA_Update);
+    }
+
+    /* behind the data requests on one channel it would never run */
+    if(!stream || stream == dev->dma_stream) {
+        return false;
+    }
+
+    struct pios_dma_config dma_config = {
+        .init = {
+            .DMA_M2M = DMA_M2M_Disable,
+            .DMA_Priority = DMA_Priority_High,
+            .DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord,
+            .DMA_MemoryDataSize = DMA_MemoryDataSize_HalfWord,
+            .DMA_MemoryInc = DMA_MemoryInc_Enable,
+            .DMA_PeripheralInc = DMA_PeripheralInc_Disable,
+            .DMA_DIR = DMA_DIR_PeripheralDST,
+        },
+        .stream = stream,
+        .timer = dev->cfg->timer,
+        .tim_dma_source = TIM_DMA_Update,
+        .irq = { // NVIC irq priority only
+            .NVIC_IRQChannelPreemptionPriority = PIOS_SOFT_SERIAL_DMA_IRQ_PRIO,
+        },
+    };
+
+    if(PIOS_DMA_Init(&dev->arr_dma, &dma_config)) {
+        return false;
+    }
+
+    PIOS_DMA_SetMemoryBaseAddr(dev->arr_dma, dev->arr_steps, PIOS_SOFT_SERIAL_FRAC_STEPS);
+    PIOS_DMA_SetPeripheralBaseAddr(dev->arr_dma, &dev->cfg->timer->ARR);
+    PIOS_DMA_SetCircular(dev->arr_dma, true);
+    PIOS_DMA_Queue(dev->arr_dma, (uint32_t)dev);
+
+    return true;
+}
+
+/*
+ * Spread total ticks over the table, each run of n periods then sums to
+ * within one tick of n * total / STEPS wherever the dma happens to be.
+ */
+static void PIOS_Soft_Serial_Frac_Fill(struct pios_soft_serial_device *dev, uint32_t total)
+{
+    uint32_t prev = 0;
+
+    for(uint8_t i = 0; i < PIOS_SOFT_SERIAL_FRAC_STEPS; ++i) {
+        uint32_t next = total * (i + 1) / PIOS_SOFT_SERIAL_FRAC_STEPS;
+
+        dev->arr_steps[i] = next - prev - 1;
+        prev = next;
+    }
+
+    dev->arr_steps_total = total;
+}
+
+/*
+ * Periods of total / steps ticks of div / ck_int s, spread as by
+ * PIOS_Soft_Serial_Frac_Fill(), against the exact 1 / rate s: average
+ * error, and worst drift over runs of up to span periods from any table
+ * position.
+ */
+static void PIOS_Soft_Serial_Period_Error(uint32_t ck_int, uint32_t div, uint32_t rate, uint32_t total, uint32_t steps, uint16_t span, int32_t *ppm, uint32_t *drift_ns)
+{
+    uint64_t tick_rate = (uint64_t)rate * div;
+
+    *ppm = ((int64_t)(total * tick_rate) - (int64_t)steps * ck_int) * 1000000 / ((int64_t)steps * ck_int);
+
+    uint64_t worst = 0;
+
+    for(uint32_t from = 0; from < steps; ++from) {
+        uint32_t start = total * from / steps;
+
+        for(uint16_t n = 1; n <= span; ++n) {
+            /* ticks * div * rate - n * ck_int, the drift in 1 / (rate * ck_int) s */
+            int64_t drift = (int64_t)((total * (from + n) / steps - start) * tick_rate) - (int64_t)n * ck_int;
+            uint64_t magnitude = (drift < 0) ? -drift : drift;
+
+            if(magnitude > worst) {
+                worst = magnitude;
+            }
+        }
+    }
+
+    *drift_ns = worst * 1000000000 / ((uint64_t)rate * ck_int);
 }
 
 static void PIOS_Soft_Serial_Set_Config(uint32_t id, enum PIOS_COM_Word_Length word_len, enum PIOS_COM_Parity parity, enum PIOS_COM_StopBits stop_bits, uint32_t baud_rate)
@@ -247,6 +659,8 @@ static void PIOS_Soft_Serial_Set_Config(uint32_t id, enum PIOS_COM_Word_Length w
     if(stop_bits != PIOS_COM_StopBits_Unchanged) {
         dev->stop_bits = stop_bits;
     }
+
+    PIOS_Soft_Serial_Build_Tx_Table(dev);
     
     PIOS_Soft_Serial_Set_Baud(id, baud_rate);
 }
@@ -255,13 +669,13 @@ static void PIOS_Soft_Serial_Tx_Start(uint32_t id, uint16_t tx_bytes_avail)
 {
     PIOS_SOFT_SERIAL_VALIDATE_AND_ASSERT(dev, id);
 
-    PIOS_IRQ_Disable();
+    uint32_t prev_mask = PIOS_IRQ_Mask(PIOS_SOFT_SERIAL_DMA_IRQ_PRIO);
     
     bool pending = dev->tx_pending;
     
     dev->tx_pending = true;
     
-    PIOS_IRQ_Enable();
+    PIOS_IRQ_Unmask(prev_mask);
     
     if(!pending) {
         PIOS_Soft_Serial_Tx_Start_Internal(dev);
@@ -271,6 +685,22 @@ static void PIOS_Soft_Serial_Tx_Start(uint32_t id, uint16_t tx_bytes_avail)
 static void PIOS_Soft_Serial_Rx_Start(uint32_t id, uint16_t rx_bytes_avail)
 {
     PIOS_SOFT_SERIAL_VALIDATE_AND_ASSERT(dev, id);
+
+    if(dev->group) {
+        PIOS_Soft_Serial_Group_Rx_Start(dev->group, dev);
+        return;
+    }
+
+    uint32_t prev_mask = PIOS_IRQ_Mask(PIOS_SOFT_SERIAL_DMA_IRQ_PRIO);
+
+    dev->rx_enabled = true;
+
+    /* half duplex, tx completion re-arms rx */
+    if(!dev->tx_pending) {
+        PIOS_Soft_Serial_Rx_Arm(dev);
+    }
+
+    PIOS_IRQ_Unmask(prev_mask);
 }
 
 static void PIOS_Soft_Serial_Bind_Rx_Cb(uint32_t id, pios_com_callback rx_in_cb, uint32_t context)
@@ -309,6 +739,11 @@ static int32_t  PIOS_Soft_Serial_Ioctl(uint32_t id, uint32_t ctl, void *param)
         case PIOS_IOCTL_SOFT_SERIAL_SET_RXGPIO:
             {
                 const struct stm32_gpio *pin = (const struct stm32_gpio *) param;
+
+                if(dev->group && !PIOS_Soft_Serial_Group_Bind_Port(dev->group, pin->gpio)) {
+                    /* group members must share one GPIO port */
+                    break;
+                }
                 
                 PIOS_Soft_Serial_LL_GPIO_Init(&dev->rx.ll, pin);
                 
@@ -323,145 +758,1724 @@ static int32_t  PIOS_Soft_Serial_Ioctl(uint32_t id, uint32_t ctl, void *param)
         case PIOS_IOCTL_SOFT_SERIAL_SET_TXGPIO:
             {
                 const struct stm32_gpio *pin = (const struct stm32_gpio *) param;
+
+                if(dev->group && !PIOS_Soft_Serial_Group_Bind_Port(dev->group, pin->gpio)) {
+                    /* group members must share one GPIO port */
+                    break;
+                }
                 
                 PIOS_Soft_Serial_LL_GPIO_Init(&dev->tx.ll, pin);
                 
-                PIOS_DMA_SetPeripheralBaseAddr(dev->tx.dma, &pin->gpio->BSRR);
+                PIOS_DMA_SetPeripheralBaseAddr(dev->tx.dma, PIOS_Soft_Serial_Tx_Target(dev));
+
+                PIOS_Soft_Serial_Build_Tx_Table(dev);
                 
                 ret = 0;
             }
             break;
         
-        case PIOS_IOCTL_USART_SET_INVERTED:
+        case PIOS_IOCTL_SOFT_SERIAL_SET_TXSTREAM:
             {
-                dev->inverted = *(enum PIOS_USART_Inverted *)param;
-
-                reconf_edge_detect = true;
+                /* takes effect on next transmission start */
+                dev->tx_stream = *(bool *)param;
                 
                 ret = 0;
             }
             break;
-    }
-
-    if(reconf_edge_detect) {
-        PIOS_Soft_Serial_LL_EdgeDetect_Configure(dev->edge_detect,
-                                                 &dev->rx.ll.pin,
-                                                 (dev->inverted & PIOS_USART_Inverted_Rx) ?
-                                                 PIOS_SOFT_SERIAL_LL_EDGEDETECT_RISING : PIOS_SOFT_SERIAL_LL_EDGEDETECT_FALLING);
-    }
+        
+        case PIOS_IOCTL_SOFT_SERIAL_SET_RXOVERSAMPLE:
+            {
+                uint8_t oversample = *(uint8_t *)param;
 
-    return ret;
-}
+                if(oversample != 1 && oversample != 3 && oversample != 4 && oversample != 8) {
+                    break;
+                }
 
+                /* the group decoder has no edge alignment, it needs samples between the bit centers */
+                if(oversample == 1 && dev->group) {
+                    break;
+                }
 
-static uint32_t *PIOS_Soft_Serial_GetDMABuffer(struct pios_soft_serial_device *dev)
-{
-    if(dev->dma_buffer_free == 0) {
-        return 0;
-    }
+                /* a waiting receiver samples in the old mode, start it again in the new one */
+                uint32_t prev_mask = PIOS_IRQ_Mask(PIOS_SOFT_SERIAL_DMA_IRQ_PRIO);
+                bool rearm = !dev->group && (dev->state == STATE_RX_WAIT || dev->state == STATE_RX_DATA);
 
-    uint32_t buffer_nr = __builtin_ctz(dev->dma_buffer_free);
-    
-    if(buffer_nr >= DMA_NUM_BUFFERS) {
-        return 0;
-    }
-    
-    /* mark this buffer as used */
-    dev->dma_buffer_free &= ~(1 << buffer_nr);
-    
-    return dev->dma_buffer[buffer_nr];
-}
+                if(rearm) {
+                    PIOS_Soft_Serial_Rx_Disarm(dev);
+                }
 
-static void PIOS_Soft_Serial_FreeDMABuffer(struct pios_soft_serial_device *dev, uint32_t *buffer)
-{
-    uint32_t buffer_nr = (buffer - dev->dma_buffer[0]) / DMA_BUFFER_SIZE;
-    
-    PIOS_DEBUG_Assert(buffer_nr < DMA_NUM_BUFFERS);
+                dev->rx_oversample = oversample;
 
-    dev->dma_buffer_free |= (1 << buffer_nr);
-}
+                PIOS_Soft_Serial_Set_Baud(id, dev->baud);
 
-static uint16_t PIOS_Soft_Serial_Encode(struct pios_soft_serial_device *dev, uint8_t data, uint32_t *buffer)
-{
-    
-    return 10;
-}
+                if(rearm) {
+                    PIOS_Soft_Serial_Rx_Arm(dev);
+                }
 
-static void PIOS_Soft_Serial_Tx_Start_Internal(struct pios_soft_serial_device *dev)
-{
-    /* 1. get dma buffer */
-    /* 2. tx_callback */
-    /* 3. encode */
-    /* 4. queue_dma */
-    
-    if(!dev->tx_out_cb) {
-        return;
-    }
-    
-    uint32_t *buffer = PIOS_Soft_Serial_GetDMABuffer(dev);
-    if(!buffer) {
-        return;
-    }
+                PIOS_IRQ_Unmask(prev_mask);
 
-    bool task_woken = false;
-    uint8_t b;
+                ret = 0;
+            }
+            break;
 
-    if(dev->tx_out_cb(dev->tx_out_context, &b, 1, 0, &task_woken) != 1) {
-        PIOS_Soft_Serial_FreeDMABuffer(dev, buffer);
-        dev->tx_pending = false;
+        case PIOS_IOCTL_SOFT_SERIAL_GET_RXERRORS:
+            {
+                *(struct pios_soft_serial_rx_errors *)param = dev->rx_errors;
+
+                ret = 0;
+            }
+            break;
+
+        case PIOS_IOCTL_SOFT_SERIAL_SET_RXCAPTURE:
+            {
+                if(dev->group) {
+                    break;
+                }
+
+                /* takes effect when rx is armed next */
+                dev->rx_capture = *(bool *)param;
+
+                ret = 0;
+            }
+            break;
+
+        case PIOS_IOCTL_SOFT_SERIAL_SET_TXTOGGLE:
+            {
+#ifdef PIOS_SOFT_SERIAL_TX_BITBAND
+                /* compare values don't fit byte buffers */
+#else
+                if(dev->group || dev->tx_pending) {
+                    break;
+                }
+
+                dev->tx_toggle = *(bool *)param;
+
+                ret = 0;
+#endif
+            }
+            break;
+
+        case PIOS_IOCTL_SOFT_SERIAL_SET_FRACBAUD:
+            {
+                bool enable = *(bool *)param;
+
+                if(dev->group || (enable && !PIOS_Soft_Serial_Frac_Init(dev))) {
+                    break;
+                }
+
+                uint32_t prev_mask = PIOS_IRQ_Mask(PIOS_SOFT_SERIAL_DMA_IRQ_PRIO);
+
+                dev->frac_baud = enable;
+
+                if(enable) {
+                    /* from the next dma setup on */
+                    dev->tim_dma_source |= TIM_DMA_Update;
+                } else {
+                    dev->tim_dma_source &= ~TIM_DMA_Update;
+                    TIM_DMACmd(dev->cfg->timer, TIM_DMA_Update, DISABLE);
+                }
+
+                PIOS_IRQ_Unmask(prev_mask);
+
+                ret = 0;
+            }
+            break;
+
+        case PIOS_IOCTL_SOFT_SERIAL_GET_BAUDERROR:
+            {
+                struct pios_soft_serial_baud_error *error = (struct pios_soft_serial_baud_error *)param;
+                uint32_t ck_int = PIOS_TIM_Ck_Int(dev->cfg->timer);
+                uint32_t steps = dev->frac_baud ? PIOS_SOFT_SERIAL_FRAC_STEPS : 1;
+
+                PIOS_Soft_Serial_Period_Error(ck_int, dev->clk_psc + 1u, dev->baud,
+                                              dev->frac_baud ? dev->tx_frac : dev->tx_arr + 1u, steps,
+                                              FRAME_BITS_MAX, &error->tx_ppm, &error->tx_drift_ns);
+                PIOS_Soft_Serial_Period_Error(ck_int, dev->clk_psc + 1u, dev->baud * dev->rx_oversample,
+                                              dev->frac_baud ? dev->rx_frac : dev->rx_arr + 1u, steps,
+                                              FRAME_BITS_MAX * dev->rx_oversample, &error->rx_ppm, &error->rx_drift_ns);
+
+                ret = 0;
+            }
+            break;
+
+        case PIOS_IOCTL_SOFT_SERIAL_GET_RXEDGELATENCY:
+            {
+                *(uint32_t *)param = dev->edge_latency_max;
+
+                ret = 0;
+            }
+            break;
+        
+        case PIOS_IOCTL_USART_SET_INVERTED:
+            {
+                dev->inverted = *(enum PIOS_USART_Inverted *)param;
+
+                PIOS_Soft_Serial_Build_Tx_Table(dev);
+
+                reconf_edge_detect = true;
+                
+                ret = 0;
+            }
+            break;
     }
-    
-    uint16_t enc_size = PIOS_Soft_Serial_Encode(dev, b, buffer);
-    
-    PIOS_DMA_SetMemoryBaseAddr(dev->tx.dma, buffer, enc_size);
-    PIOS_DMA_Queue(dev->tx.dma, (uint32_t) dev);
+
+    if(reconf_edge_detect) {
+        PIOS_Soft_Serial_LL_EdgeDetect_Configure(dev->edge_detect,
+                                                 &dev->rx.ll.pin,
+                                                 (dev->inverted & PIOS_USART_Inverted_Rx) ?
+                                                 PIOS_SOFT_SERIAL_LL_EDGEDETECT_RISING : PIOS_SOFT_SERIAL_LL_EDGEDETECT_FALLING);
+
+        /* that leaves the line masked, an edge aligned receiver waiting for its start bit needs it */
+        if(dev->state == STATE_RX_WAIT && dev->rx_oversample == 1 && !dev->rx_capture) {
+            PIOS_Soft_Serial_LL_EdgeDetect_Cmd(dev->edge_detect, ENABLE);
+        }
+    }
+
+    return ret;
 }
 
-static void PIOS_Soft_Serial_DMA_Setup(uint32_t dma_handle, uint32_t context)
+
+static pios_soft_serial_tx_word_t *PIOS_Soft_Serial_GetDMABuffer(struct pios_soft_serial_device *dev)
 {
-    PIOS_SOFT_SERIAL_VALIDATE_AND_ASSERT(dev, context);
+    if(dev->dma_buffer_free == 0) {
+        return 0;
+    }
+
+    uint32_t buffer_nr = __builtin_ctz(dev->dma_buffer_free);
     
-    /* Disable start bit detection */
-    PIOS_Soft_Serial_LL_EdgeDetect_Cmd(dev->edge_detect, DISABLE);
+    if(buffer_nr >= DMA_NUM_BUFFERS) {
+        return 0;
+    }
     
-    /* Reconfigure GPIO */
-    struct pios_soft_serial_gpio *gs = 0;
+    /* mark this buffer as used */
+    dev->dma_buffer_free &= ~(1 << buffer_nr);
     
-    if(dma_handle == dev->rx.dma) {
-        gs = &dev->rx;
-    } else if(dma_handle == dev->tx.dma) {
-        gs = &dev->tx;
+    return dev->dma_buffer[buffer_nr];
+}
+
+static void PIOS_Soft_Serial_FreeDMABuffer(struct pios_soft_serial_device *dev, pios_soft_serial_tx_word_t *buffer)
+{
+    uint32_t buffer_nr = (buffer - dev->dma_buffer[0]) / DMA_BUFFER_SIZE;
+    
+    PIOS_DEBUG_Assert(buffer_nr < DMA_NUM_BUFFERS);
+
+    dev->dma_buffer_free |= (1 << buffer_nr);
+}
+
+static void PIOS_Soft_Serial_Build_Tx_Table(struct pios_soft_serial_device *dev)
+{
+    struct pios_soft_serial_tx_table *t = &dev->tx_table;
+    uint32_t pin = dev->tx.ll.pin.init.GPIO_Pin;
+
+    /* BSRR words for line level 0 (space) and 1 (mark) */
+    uint32_t level[2] = { pin << 16, pin };
+
+    if(dev->inverted & PIOS_USART_Inverted_Tx) {
+        level[0] = pin;
+        level[1] = pin << 16;
+    }
+
+    t->start = level[0];
+    t->idle = level[1];
+
+#ifdef PIOS_SOFT_SERIAL_TX_BITBAND
+    t->mark = !(dev->inverted & PIOS_USART_Inverted_Tx);
+#else
+    t->mark = t->idle;
+#endif
+
+    for(uint32_t n = 0; n < 16; ++n) {
+        for(uint32_t bit = 0; bit < 4; ++bit) {
+            t->nibble[n][bit] = level[(n >> bit) & 1];
+        }
+    }
+
+    /*
+     * 9th bit carries parity if enabled, otherwise for 9 bit words it is
+     * the 9th data bit, which the byte oriented COM layer can't supply,
+     * so it is sent as mark.
+     */
+    uint8_t len = 0;
+
+    switch(dev->parity) {
+        case PIOS_COM_Parity_Even:
+            t->tail[0][len] = level[0];
+            t->tail[1][len] = level[1];
+            ++len;
+            break;
+        case PIOS_COM_Parity_Odd:
+            t->tail[0][len] = level[1];
+            t->tail[1][len] = level[0];
+            ++len;
+            break;
+        default:
+            if(dev->word_len == PIOS_COM_Word_length_9b) {
+                t->tail[0][len] = level[1];
+                t->tail[1][len] = level[1];
+                ++len;
+            }
+            break;
+    }
+
+    /* fractional stop bits are rounded up, we can only do whole bit times */
+    uint8_t stop_bits = (dev->stop_bits == PIOS_COM_StopBits_1_5 || dev->stop_bits == PIOS_COM_StopBits_2) ? 2 : 1;
+
+    while(stop_bits--) {
+        t->tail[0][len] = level[1];
+        t->tail[1][len] = level[1];
+        ++len;
+    }
+
+    t->tail_len = len;
+
+    /* same tail as line levels for the toggle encoder */
+    for(uint8_t p = 0; p < 2; ++p) {
+        t->tail_level[p] = 0;
+
+        for(uint8_t i = 0; i < len; ++i) {
+            t->tail_level[p] |= (t->tail[p][i] == level[1]) << i;
+        }
+    }
+}
+
+static uint16_t PIOS_Soft_Serial_Encode(struct pios_soft_serial_device *dev, uint8_t data, uint32_t *buffer)
+{
+    const struct pios_soft_serial_tx_table *t = &dev->tx_table;
+
+    /* 0x6996 is the parity of every nibble value, folded into one 16 bit constant */
+    uint32_t parity = (0x6996 >> ((data ^ (data >> 4)) & 0xf)) & 1;
+
+    buffer[0] = t->start;
+    memcpy(&buffer[1], t->nibble[data & 0xf], sizeof(t->nibble[0]));
+    memcpy(&buffer[5], t->nibble[data >> 4], sizeof(t->nibble[0]));
+    memcpy(&buffer[9], t->tail[parity], t->tail_len * sizeof(uint32_t));
+
+    return 9 + t->tail_len;
+}
+
+#ifdef PIOS_SOFT_SERIAL_TX_BITBAND
+/* 4 data bits LSB first, one ODR byte each, little endian */
+static const uint32_t bitband_nibble[16] = {
+    0x00000000, 0x00000001, 0x00000100, 0x00000101,
+    0x00010000, 0x00010001, 0x00010100, 0x00010101,
+    0x01000000, 0x01000001, 0x01000100, 0x01000101,
+    0x01010000, 0x01010001, 0x01010100, 0x01010101,
+};
+
+/* One byte per bit for the bit-band alias of the tx pin's ODR bit */
+static uint16_t PIOS_Soft_Serial_Encode_Bitband(struct pios_soft_serial_device *dev, uint8_t data, uint8_t *buffer)
+{
+    const struct pios_soft_serial_tx_table *t = &dev->tx_table;
+
+    uint32_t parity = (0x6996 >> ((data ^ (data >> 4)) & 0xf)) & 1;
+
+    /* ODR is the line level, unless mark is ODR 0 */
+    uint8_t invert = !t->mark;
+    uint32_t lo = bitband_nibble[data & 0xf] ^ (invert * 0x01010101);
+    uint32_t hi = bitband_nibble[data >> 4] ^ (invert * 0x01010101);
+
+    buffer[0] = invert;
+    memcpy(&buffer[1], &lo, sizeof(lo));
+    memcpy(&buffer[5], &hi, sizeof(hi));
+
+    for(uint8_t i = 0; i < t->tail_len; ++i) {
+        buffer[9 + i] = ((t->tail_level[parity] >> i) & 1) ^ invert;
+    }
+
+    return 9 + t->tail_len;
+}
+#else /* PIOS_SOFT_SERIAL_TX_BITBAND */
+
+/*
+ * Toggle encoding: one compare value per level change instead of one
+ * BSRR word per bit, so runs of equal bits cost nothing and 0x00 or 0xff
+ * take two dma beats. The frame is built as a line level word from the
+ * same tail as the BSRR table, start bit at bit 0 after idle mark, and
+ * every bit that differs from the one before it becomes a compare at
+ * start plus its bit time.
+ */
+static uint16_t PIOS_Soft_Serial_Encode_Toggle(struct pios_soft_serial_device *dev, uint8_t data, uint16_t start, uint32_t *buffer)
+{
+    const struct pios_soft_serial_tx_table *t = &dev->tx_table;
+
+    uint32_t parity = (0x6996 >> ((data ^ (data >> 4)) & 0xf)) & 1;
+    uint32_t bits = 9 + t->tail_len;
+    uint32_t levels = ((uint32_t)data << 1) | ((uint32_t)t->tail_level[parity] << 9);
+    uint32_t changes = (levels ^ ((levels << 1) | 1)) & ((1 << bits) - 1);
+    uint16_t len = 0;
+
+    while(changes) {
+        buffer[len++] = (uint16_t)(start + __builtin_ctz(changes) * dev->ts_bit);
+        changes &= changes - 1;
+    }
+
+    return len;
+}
+#endif /* PIOS_SOFT_SERIAL_TX_BITBAND */
+
+/* Pull up to one batch of bytes from the COM layer and encode them back to back */
+static uint16_t PIOS_Soft_Serial_Tx_Fill(struct pios_soft_serial_device *dev, pios_soft_serial_tx_word_t *buffer, uint16_t *headroom)
+{
+    uint8_t bytes[PIOS_SOFT_SERIAL_TX_BATCH];
+    bool task_woken = false;
+
+    *headroom = 0;
+
+    uint16_t count = dev->tx_out_cb(dev->tx_out_context, bytes, sizeof(bytes), headroom, &task_woken);
+
+    PIOS_TRACE(PIOS_TRACE_COM_TX, count);
+
+    uint16_t len = 0;
+
+#ifndef PIOS_SOFT_SERIAL_TX_BITBAND
+    if(dev->tx_toggle) {
+        uint16_t frame = (9 + dev->tx_table.tail_len) * dev->ts_bit;
+
+        if(!count) {
+            return 0;
+        }
+
+        for(uint16_t i = 0; i < count; ++i) {
+            len += PIOS_Soft_Serial_Encode_Toggle(dev, bytes[i], i * frame, &buffer[len]);
+        }
+
+        /*
+         * The dma request of the last transition loads one more compare,
+         * a whole wrap after it so it never fires: dma complete holds the
+         * line first.
+         */
+        buffer[len] = (uint16_t)(buffer[len - 1] - 1);
+        ++len;
+
+        dev->tx_toggle_end[(buffer - dev->dma_buffer[0]) / DMA_BUFFER_SIZE] = count * frame;
+
+        return len;
+    }
+#endif /* PIOS_SOFT_SERIAL_TX_BITBAND */
+
+    for(uint16_t i = 0; i < count; ++i) {
+#ifdef PIOS_SOFT_SERIAL_TX_BITBAND
+        len += PIOS_Soft_Serial_Encode_Bitband(dev, bytes[i], &buffer[len]);
+#else
+        len += PIOS_Soft_Serial_Encode(dev, bytes[i], &buffer[len]);
+#endif
+    }
+
+    return len;
+}
+
+/* Encode the next batch while the current one is on the wire */
+static void PIOS_Soft_Serial_Tx_Prefetch(struct pios_soft_serial_device *dev)
+{
+    if(dev->tx_next) {
+        return;
+    }
+
+    pios_soft_serial_tx_word_t *buffer = PIOS_Soft_Serial_GetDMABuffer(dev);
+    if(!buffer) {
+        return;
+    }
+
+    uint16_t headroom;
+    uint16_t len = PIOS_Soft_Serial_Tx_Fill(dev, buffer, &headroom);
+
+    if(!len) {
+        PIOS_Soft_Serial_FreeDMABuffer(dev, buffer);
+        return;
+    }
+
+    dev->tx_next_len = len;
+    dev->tx_next = buffer;
+}
+
+static void PIOS_Soft_Serial_Tx_Queue(struct pios_soft_serial_device *dev, pios_soft_serial_tx_word_t *buffer, uint16_t len)
+{
+    dev->tx_active = buffer;
+
+    if(dev->tx_toggle) {
+        /* dma setup loads the first compare, dma the rest */
+        PIOS_DMA_SetPeripheralBaseAddr(dev->tx.dma, PIOS_Soft_Serial_Tim_CCR(dev));
+        PIOS_DMA_SetMemoryBaseAddr(dev->tx.dma, &buffer[1], len - 1);
     } else {
-        PIOS_DEBUG_Assert(0); //
+        PIOS_DMA_SetPeripheralBaseAddr(dev->tx.dma, PIOS_Soft_Serial_Tx_Target(dev));
+        PIOS_DMA_SetMemoryBaseAddr(dev->tx.dma, buffer, len);
     }
-    
-    PIOS_Soft_Serial_LL_GPIO_Init(&gs->ll, 0);
 
-    /* Start generating DMA requests */
-    /* Should we adjust appropriate CCR now? */
+    PIOS_DMA_Queue(dev->tx.dma, (uint32_t) dev);
+}
 
-    TIM_DMACmd(dev->cfg->timer, dev->tim_dma_source, ENABLE);
+/* Where tx dma writes the encoded bits: BSRR, or the ODR bit-band alias word of the tx pin */
+static __IO void *PIOS_Soft_Serial_Tx_Target(struct pios_soft_serial_device *dev)
+{
+#ifdef PIOS_SOFT_SERIAL_TX_BITBAND
+    uint32_t odr = (uint32_t)&dev->tx.ll.pin.gpio->ODR;
+    uint32_t bit = __builtin_ctz(dev->tx.ll.pin.init.GPIO_Pin);
+
+    return (__IO void *)(PERIPH_BB_BASE + (odr - PERIPH_BASE) * 32 + bit * 4);
+#else
+    return &dev->tx.ll.pin.gpio->BSRR;
+#endif
 }
 
-static void PIOS_Soft_Serial_DMA_Complete(uint32_t dma_handle, uint32_t context)
+static void PIOS_Soft_Serial_Tx_Start_Internal(struct pios_soft_serial_device *dev)
 {
-    PIOS_SOFT_SERIAL_VALIDATE_AND_ASSERT(dev, context);
+    /* 1. get dma buffer */
+    /* 2. tx_callback, as many bytes as fit in one batch */
+    /* 3. encode */
+    /* 4. prefetch next batch if COM fifo has more, so DMA complete can chain it right away */
+    /* 5. queue_dma */
+    
+    if(!dev->tx_out_cb) {
+        PIOS_Soft_Serial_Tx_Done(dev);
+        return;
+    }
 
-    TIM_DMACmd(dev->cfg->timer, dev->tim_dma_source, DISABLE); // Stop generating requests
+    if(dev->group) {
+        PIOS_Soft_Serial_Group_Tx_Start(dev->group, dev);
+        return;
+    }
+
+    /* half duplex, rx sampling gives up the channel and the buffers */
+    PIOS_Soft_Serial_Rx_Disarm(dev);
+
+    if(dev->tx_stream && !dev->tx_toggle) {
+        if(!PIOS_Soft_Serial_Tx_Stream_Start(dev)) {
+            PIOS_Soft_Serial_Tx_Done(dev);
+        }
+        return;
+    }
     
-    // Should go to next state
-    //
+    pios_soft_serial_tx_word_t *buffer = PIOS_Soft_Serial_GetDMABuffer(dev);
+    if(!buffer) {
+        return;
+    }
+
+    uint16_t headroom;
+    uint16_t len = PIOS_Soft_Serial_Tx_Fill(dev, buffer, &headroom);
+
+    if(!len) {
+        PIOS_Soft_Serial_FreeDMABuffer(dev, buffer);
+        PIOS_Soft_Serial_Tx_Done(dev);
+        return;
+    }
+
+    PIOS_Soft_Serial_Set_State(dev, STATE_TX_DATA);
+
+    if(headroom) {
+        PIOS_Soft_Serial_Tx_Prefetch(dev);
+    }
+
+    PIOS_Soft_Serial_Tx_Queue(dev, buffer, len);
 }
 
-static void PIOS_Soft_Serial_DMA_Error(uint32_t dma_handle, uint32_t context)
+/*
+ * Streaming tx runs the channel in circular mode over both DMA buffers,
+ * which are contiguous in memory. Each half holds exactly one batch of
+ * frames, so a full COM fifo goes out with no gap between characters.
+ * Half transfer / transfer complete refill whichever half just finished,
+ * padding with idle line when the fifo runs short.
+ */
+static uint16_t PIOS_Soft_Serial_Tx_Stream_Fill(struct pios_soft_serial_device *dev, pios_soft_serial_tx_word_t *half)
 {
-    PIOS_SOFT_SERIAL_VALIDATE_AND_ASSERT(dev, context);
-    
-    TIM_DMACmd(dev->cfg->timer, dev->tim_dma_source, DISABLE); // Stop generating requests
+    uint16_t headroom;
+    uint16_t len = PIOS_Soft_Serial_Tx_Fill(dev, half, &headroom);
+
+    for(uint16_t i = len; i < dev->tx_stream_half; ++i) {
+        half[i] = dev->tx_table.mark;
+    }
+
+    return len;
 }
 
-static void PIOS_Soft_Serial_Edge_Detected(__attribute__((unused)) uint32_t edge_detect_dev, uint32_t context)
+static bool PIOS_Soft_Serial_Tx_Stream_Start(struct pios_soft_serial_device *dev)
 {
-    PIOS_SOFT_SERIAL_VALIDATE_AND_ASSERT(dev, context);
+    if(dev->dma_buffer_free != 0xff) {
+        /* batch mode still owns a buffer */
+        return false;
+    }
+
+    pios_soft_serial_tx_word_t *buffer = dev->dma_buffer[0];
+
+    dev->tx_stream_half = (9 + dev->tx_table.tail_len) * PIOS_SOFT_SERIAL_TX_BATCH;
+
+    if(!PIOS_Soft_Serial_Tx_Stream_Fill(dev, buffer)) {
+        return false;
+    }
+
+    /* both buffers belong to the stream until it stops */
+    PIOS_Soft_Serial_GetDMABuffer(dev);
+    PIOS_Soft_Serial_GetDMABuffer(dev);
+
+    dev->tx_stream_idle = !PIOS_Soft_Serial_Tx_Stream_Fill(dev, &buffer[dev->tx_stream_half]);
+    dev->tx_streaming = true;
+    PIOS_Soft_Serial_Set_State(dev, STATE_TX_DATA);
+
+    PIOS_DMA_SetCircular(dev->tx.dma, true);
+    PIOS_DMA_SetMemoryBaseAddr(dev->tx.dma, buffer, 2 * dev->tx_stream_half);
+    PIOS_DMA_Queue(dev->tx.dma, (uint32_t) dev);
+
+    return true;
+}
+
+static void PIOS_Soft_Serial_Tx_Stream_Refill(struct pios_soft_serial_device *dev, uint8_t half)
+{
+    if(dev->tx_stream_idle) {
+        /* other half carried the last frame and line is idle now */
+        PIOS_Soft_Serial_Tx_Stream_Stop(dev);
+
+        /* pick up anything queued after the last refill */
+        PIOS_Soft_Serial_Tx_Start_Internal(dev);
+        return;
+    }
+
+    pios_soft_serial_tx_word_t *buffer = &dev->dma_buffer[0][half * dev->tx_stream_half];
+
+    dev->tx_stream_idle = !PIOS_Soft_Serial_Tx_Stream_Fill(dev, buffer);
+}
+
+static void PIOS_Soft_Serial_Tx_Stream_Stop(struct pios_soft_serial_device *dev)
+{
+    TIM_DMACmd(dev->cfg->timer, dev->tim_dma_source, DISABLE); // Stop generating requests
+
+    PIOS_DMA_Stop(dev->tx.dma);
+    PIOS_DMA_SetCircular(dev->tx.dma, false);
+
+    PIOS_Soft_Serial_FreeDMABuffer(dev, dev->dma_buffer[0]);
+    PIOS_Soft_Serial_FreeDMABuffer(dev, dev->dma_buffer[1]);
+
+    dev->tx_streaming = false;
+}
+
+/* Last tx batch is out, hand the line back to rx if anyone listens */
+static void PIOS_Soft_Serial_Tx_Done(struct pios_soft_serial_device *dev)
+{
+    dev->tx_pending = false;
+    PIOS_Soft_Serial_Set_State(dev, STATE_IDLE);
+
+    if(dev->rx_enabled) {
+        PIOS_Soft_Serial_Rx_Arm(dev);
+    }
+}
+
+/*
+ * RX samples IDR at rx_oversample times the baud rate with circular DMA,
+ * half transfer and transfer complete hand each filled half to the decoder.
+ */
+static void PIOS_Soft_Serial_Rx_Arm(struct pios_soft_serial_device *dev)
+{
+    if(!dev->rx.ll.pin.gpio || dev->state != STATE_IDLE) {
+        return;
+    }
+
+    if(dev->dma_buffer_free != 0xff) {
+        /* tx still owns a buffer */
+        return;
+    }
+
+    PIOS_Soft_Serial_GetDMABuffer(dev);
+    PIOS_Soft_Serial_GetDMABuffer(dev);
+
+    dev->rx_pos = 0;
+    dev->rx_avail = 0;
+    dev->rx_break = false;
+
+    PIOS_Soft_Serial_Line_Setup(dev, &dev->rx);
+
+    PIOS_Soft_Serial_Set_State(dev, STATE_RX_WAIT);
+
+    if(dev->rx_oversample == 1 && !dev->rx_capture) {
+        /* the start bit edge arms rx dma for one frame */
+        PIOS_DMA_SetCircular(dev->rx.dma, false);
+        PIOS_Soft_Serial_LL_EdgeDetect_Cmd(dev->edge_detect, ENABLE);
+        return;
+    }
+
+    if(dev->rx_capture) {
+        /* capture register of the dma request channel */
+        PIOS_DMA_SetPeripheralBaseAddr(dev->rx.dma, PIOS_Soft_Serial_Tim_CCR(dev));
+        dev->rx_level = 1;
+    } else {
+        PIOS_DMA_SetPeripheralBaseAddr(dev->rx.dma, &dev->rx.ll.pin.gpio->IDR);
+    }
+
+    PIOS_DMA_SetCircular(dev->rx.dma, true);
+    PIOS_DMA_SetMemoryBaseAddr(dev->rx.dma, dev->dma_buffer, RX_RING_SIZE);
+    PIOS_DMA_Queue(dev->rx.dma, (uint32_t) dev);
+}
+
+static void PIOS_Soft_Serial_Rx_Disarm(struct pios_soft_serial_device *dev)
+{
+    /* the edge handler must not arm rx dma behind our back */
+    uint32_t prev_mask = PIOS_IRQ_Mask(PIOS_IRQ_PRIO_HIGHEST);
+
+    if(dev->state != STATE_RX_WAIT && dev->state != STATE_RX_DATA) {
+        PIOS_IRQ_Unmask(prev_mask);
+        return;
+    }
+
+    PIOS_Soft_Serial_LL_EdgeDetect_Cmd(dev->edge_detect, DISABLE);
+
+    TIM_DMACmd(dev->cfg->timer, dev->tim_dma_source, DISABLE); // Stop generating requests
+
+    PIOS_DMA_Stop(dev->rx.dma);
+    PIOS_DMA_SetCircular(dev->rx.dma, false);
+
+    PIOS_Soft_Serial_FreeDMABuffer(dev, dev->dma_buffer[0]);
+    PIOS_Soft_Serial_FreeDMABuffer(dev, dev->dma_buffer[1]);
+
+    PIOS_Soft_Serial_Set_State(dev, STATE_IDLE);
+
+    PIOS_IRQ_Unmask(prev_mask);
+}
+
+static inline uint32_t PIOS_Soft_Serial_Rx_Sample(struct pios_soft_serial_device *dev, const uint16_t *ring, uint16_t pos)
+{
+    uint32_t level = (ring[pos] & dev->rx.ll.pin.init.GPIO_Pin) != 0;
+
+    return (dev->inverted & PIOS_USART_Inverted_Rx) ? !level : level;
+}
+
+static void PIOS_Soft_Serial_Rx_Deliver(struct pios_soft_serial_device *dev, uint8_t *bytes, uint8_t count)
+{
+    if(!count || !dev->rx_in_cb) {
+        return;
+    }
+
+    uint16_t headroom = 0;
+    bool task_woken = false;
+
+    uint16_t accepted = dev->rx_in_cb(dev->rx_in_context, bytes, count, &headroom, &task_woken);
+
+    PIOS_TRACE(PIOS_TRACE_COM_RX, accepted);
+
+    dev->rx_errors.overrun += count - accepted;
+}
+
+static uint8_t PIOS_Soft_Serial_Rx_Data_Bits(struct pios_soft_serial_device *dev)
+{
+    return (dev->parity == PIOS_COM_Parity_Even || dev->parity == PIOS_COM_Parity_Odd || dev->word_len == PIOS_COM_Word_length_9b) ? 9 : 8;
+}
+
+/* Stop bit and parity of a received frame, counts the errors */
+static bool PIOS_Soft_Serial_Rx_Check(struct pios_soft_serial_device *dev, uint16_t shift, uint32_t stop)
+{
+    uint32_t parity = ((0x6996 >> ((shift ^ (shift >> 4)) & 0xf)) & 1) ^ ((shift >> 8) & 1);
+
+    if(!stop) {
+        ++dev->rx_errors.framing;
+        return false;
+    }
+
+    if((dev->parity == PIOS_COM_Parity_Even && parity) || (dev->parity == PIOS_COM_Parity_Odd && !parity)) {
+        ++dev->rx_errors.parity;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Walk the new samples: hunt for the start bit edge, then jump from bit
+ * center to bit center and majority vote the samples either side of it.
+ * Decoder state survives between halves, so frames may straddle them.
+ */
+static void PIOS_Soft_Serial_Rx_Decode(struct pios_soft_serial_device *dev, uint16_t samples)
+{
+    const uint16_t *ring = (const uint16_t *)dev->dma_buffer;
+    uint8_t data_bits = PIOS_Soft_Serial_Rx_Data_Bits(dev);
+
+    uint8_t bytes[RX_DELIVER_MAX];
+    uint8_t count = 0;
+
+    dev->rx_avail += samples;
+
+    while(dev->rx_avail) {
+        if(dev->state == STATE_RX_WAIT) {
+            uint32_t mark = PIOS_Soft_Serial_Rx_Sample(dev, ring, dev->rx_pos);
+
+            /* the rest of a space stop bit is not a start bit */
+            if(mark || dev->rx_break) {
+                dev->rx_break &= !mark;
+
+                if(++dev->rx_pos == RX_RING_SIZE) {
+                    dev->rx_pos = 0;
+                }
+                --dev->rx_avail;
+                continue;
+            }
+
+            /* first space sample, start bit center is half a bit further */
+            PIOS_Soft_Serial_Set_State(dev, STATE_RX_DATA);
+            dev->rx_bit = 0;
+            dev->rx_shift = 0;
+            dev->rx_skip = dev->rx_oversample / 2;
+        }
+
+        /* need the sample after the center for voting */
+        if(dev->rx_avail <= dev->rx_skip + 1) {
+            break;
+        }
+
+        dev->rx_pos += dev->rx_skip;
+        if(dev->rx_pos >= RX_RING_SIZE) {
+            dev->rx_pos -= RX_RING_SIZE;
+        }
+        dev->rx_avail -= dev->rx_skip;
+        dev->rx_skip = dev->rx_oversample;
+
+        uint16_t prev = dev->rx_pos ? dev->rx_pos - 1 : RX_RING_SIZE - 1;
+        uint16_t next = (dev->rx_pos + 1 < RX_RING_SIZE) ? dev->rx_pos + 1 : 0;
+
+        uint32_t bit = (PIOS_Soft_Serial_Rx_Sample(dev, ring, prev) +
+                        PIOS_Soft_Serial_Rx_Sample(dev, ring, dev->rx_pos) +
+                        PIOS_Soft_Serial_Rx_Sample(dev, ring, next)) >= 2;
+
+        if(dev->rx_bit == 0) {
+            if(bit) {
+                /* glitch, not a start bit */
+                PIOS_Soft_Serial_Set_State(dev, STATE_RX_WAIT);
+                continue;
+            }
+        } else if(dev->rx_bit <= data_bits) {
+            dev->rx_shift |= bit << (dev->rx_bit - 1);
+        } else {
+            /* first stop bit, hunt for the next start bit from here */
+            PIOS_Soft_Serial_Set_State(dev, STATE_RX_WAIT);
+            dev->rx_break = !bit;
+
+            if(PIOS_Soft_Serial_Rx_Check(dev, dev->rx_shift, bit)) {
+                bytes[count++] = dev->rx_shift;
+
+                if(count == sizeof(bytes)) {
+                    PIOS_Soft_Serial_Rx_Deliver(dev, bytes, count);
+                    count = 0;
+                }
+            }
+            continue;
+        }
+
+        ++dev->rx_bit;
+    }
+
+    PIOS_Soft_Serial_Rx_Deliver(dev, bytes, count);
+}
+
+/*
+ * Capture RX keeps the frame as one bit per frame bit in rx_shift, start
+ * bit at bit 0. rx_bit is the first frame bit not known yet; everything
+ * up to an edge has the level from before it.
+ */
+static void PIOS_Soft_Serial_Rx_Capture_Fill(struct pios_soft_serial_device *dev, uint8_t to)
+{
+    if(dev->rx_level && to > dev->rx_bit) {
+        dev->rx_shift |= ((1 << to) - 1) & ~((1 << dev->rx_bit) - 1);
+    }
+
+    dev->rx_bit = to;
+}
+
+static void PIOS_Soft_Serial_Rx_Capture_Finish(struct pios_soft_serial_device *dev)
+{
+    uint8_t data_bits = PIOS_Soft_Serial_Rx_Data_Bits(dev);
+
+    PIOS_Soft_Serial_Rx_Capture_Fill(dev, data_bits + 2);
+
+    uint16_t shift = (dev->rx_shift >> 1) & ((1 << data_bits) - 1);
+
+    if(PIOS_Soft_Serial_Rx_Check(dev, shift, (dev->rx_shift >> (data_bits + 1)) & 1)) {
+        uint8_t byte = shift;
+
+        PIOS_Soft_Serial_Rx_Deliver(dev, &byte, 1);
+    }
+
+    PIOS_Soft_Serial_Set_State(dev, STATE_RX_WAIT);
+}
+
+static void PIOS_Soft_Serial_Rx_Capture_Edge(struct pios_soft_serial_device *dev, uint16_t stamp)
+{
+    dev->rx_last_edge = stamp;
+
+    if(dev->state == STATE_RX_DATA) {
+        uint16_t bit = dev->ts_bit;
+        uint16_t nr = ((uint16_t)(stamp - dev->rx_frame_start) + bit / 2) / bit;
+
+        if(nr == 0) {
+            /* back to mark within half a bit, that was a glitch */
+            PIOS_Soft_Serial_Set_State(dev, STATE_RX_WAIT);
+            dev->rx_level = 1;
+            return;
+        }
+
+        if(nr < PIOS_Soft_Serial_Rx_Data_Bits(dev) + 2) {
+            PIOS_Soft_Serial_Rx_Capture_Fill(dev, nr);
+            dev->rx_level = !dev->rx_level;
+            return;
+        }
+
+        /* edge after the stop bit, may well be the next start bit */
+        PIOS_Soft_Serial_Rx_Capture_Finish(dev);
+    }
+
+    dev->rx_level = !dev->rx_level;
+
+    if(!dev->rx_level) {
+        PIOS_Soft_Serial_Set_State(dev, STATE_RX_DATA);
+        dev->rx_frame_start = stamp;
+        dev->rx_shift = 0;
+        dev->rx_bit = 1;
+    }
+}
+
+/*
+ * Consume the timestamps dma has written so far, then finish a frame
+ * whose stop bit center has passed without further edges.
+ */
+static void PIOS_Soft_Serial_Rx_Capture_Update(struct pios_soft_serial_device *dev)
+{
+    /* pin, then time, then edges: nothing unseen is older than now */
+    uint32_t level = ((dev->rx.ll.pin.gpio->IDR & dev->rx.ll.pin.init.GPIO_Pin) != 0) ^ ((dev->inverted & PIOS_USART_Inverted_Rx) != 0);
+    uint16_t now = TIM_GetCounter(dev->cfg->timer);
+    uint16_t head = RX_RING_SIZE - PIOS_DMA_GetRemaining(dev->rx.dma);
+
+    const uint16_t *ring = (const uint16_t *)dev->dma_buffer;
+    bool edges = false;
+
+    if(head == RX_RING_SIZE) {
+        head = 0;
+    }
+
+    while(dev->rx_pos != head) {
+        PIOS_Soft_Serial_Rx_Capture_Edge(dev, ring[dev->rx_pos]);
+        edges = true;
+
+        if(++dev->rx_pos == RX_RING_SIZE) {
+            dev->rx_pos = 0;
+        }
+    }
+
+    uint16_t bit = dev->ts_bit;
+    uint16_t frame = (PIOS_Soft_Serial_Rx_Data_Bits(dev) + 2) * bit;
+
+    if(dev->state == STATE_RX_DATA) {
+        if((uint16_t)(now - dev->rx_frame_start) >= frame - bit / 2) {
+            PIOS_Soft_Serial_Rx_Capture_Finish(dev);
+        }
+    } else if(!edges && (uint16_t)(now - dev->rx_last_edge) >= frame) {
+        /* quiet line, a filtered out edge must not flip every frame after it */
+        dev->rx_level = level;
+    }
+}
+
+/* Compare / capture register of the dma request channel */
+static __IO uint16_t *PIOS_Soft_Serial_Tim_CCR(struct pios_soft_serial_device *dev)
+{
+    return &dev->cfg->timer->CCR1 + (dev->cfg->tim_channel >> 2) * 2;
+}
+
+/* Output compare mode of the channel, OC1M bits */
+static void PIOS_Soft_Serial_Tim_OCM(struct pios_soft_serial_device *dev, uint16_t ocm)
+{
+    uint8_t nr = dev->cfg->tim_channel >> 2;
+    __IO uint16_t *ccmr = (nr < 2) ? &dev->cfg->timer->CCMR1 : &dev->cfg->timer->CCMR2;
+    uint8_t shift = (nr & 1) * 8;
+
+    *ccmr = (*ccmr & ~(TIM_CCMR1_OC1M << shift)) | (ocm << shift);
+}
+
+/*
+ * BSRR TX and sampling RX only use the channel compare as dma clock,
+ * capture RX turns the channel into a both edges capture of TI1 and
+ * toggle TX drives the channel output, both on a free running counter.
+ * Toggle mode is entered holding the line at mark.
+ */
+static void PIOS_Soft_Serial_Tim_Mode(struct pios_soft_serial_device *dev, pios_soft_serial_tim_mode_t mode)
+{
+    if(dev->tim_mode == mode) {
+        return;
+    }
+
+    TIM_TypeDef *timer = dev->cfg->timer;
+    uint8_t nr = dev->cfg->tim_channel >> 2;
+    __IO uint16_t *ccmr = (nr < 2) ? &timer->CCMR1 : &timer->CCMR2;
+    uint8_t shift = (nr & 1) * 8;
+
+    if(dev->tim_mode == TIM_MODE_TOGGLE) {
+        /* pin back to gpio output at mark before the channel lets go */
+        dev->tx.ll.pin.gpio->BSRR = dev->tx_table.idle;
+        PIOS_Soft_Serial_LL_GPIO_Init(&dev->tx.ll, 0);
+    }
+
+    if(dev->tim_mode == TIM_MODE_CAPTURE) {
+        timer->CCMR1 &= ~TIM_CCMR1_IC1F;
+    }
+
+    timer->CCER &= ~((TIM_CCER_CC1E | TIM_CCER_CC1P) << (nr * 4));
+    *ccmr &= ~(0xff << shift);
+    timer->SMCR &= ~TIM_SMCR_TS;
+
+    switch(mode) {
+        case TIM_MODE_CAPTURE:
+            /* TRC = TI1F_ED, filtered by IC1F whichever channel captures it */
+            timer->SMCR |= TIM_SMCR_TS_2;
+            *ccmr |= TIM_CCMR1_CC1S << shift;
+            timer->CCMR1 |= PIOS_SOFT_SERIAL_CAPTURE_FILTER << 4;
+            timer->CCER |= TIM_CCER_CC1E << (nr * 4);
+            break;
+
+        case TIM_MODE_TOGGLE:
+            {
+                /* OCxREF forced active is mark, CCxP inverts the output */
+                PIOS_Soft_Serial_Tim_OCM(dev, TIM_CCMR1_OC1M_2 | TIM_CCMR1_OC1M_0);
+
+                if(dev->inverted & PIOS_USART_Inverted_Tx) {
+                    timer->CCER |= TIM_CCER_CC1P << (nr * 4);
+                }
+
+                timer->CCER |= TIM_CCER_CC1E << (nr * 4);
+
+                if(timer == TIM1) {
+                    /* advanced timer outputs need the main output enable */
+                    timer->BDTR |= TIM_BDTR_MOE;
+                }
+
+                struct pios_soft_serial_ll_gpio oc = dev->tx.ll;
+
+                oc.pin.init.GPIO_Mode = GPIO_Mode_AF_PP;
+                PIOS_Soft_Serial_LL_GPIO_Init(&oc, 0);
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    if(mode == TIM_MODE_CLOCK) {
+        /* compare at counter wrap */
+        *PIOS_Soft_Serial_Tim_CCR(dev) = 0;
+
+        TIM_PrescalerConfig(timer, dev->clk_psc, TIM_PSCReloadMode_Immediate);
+    } else {
+        /* no fractional baud preload left over */
+        TIM_ARRPreloadConfig(timer, DISABLE);
+        TIM_SetAutoreload(timer, 0xffff);
+        TIM_PrescalerConfig(timer, dev->ts_psc, TIM_PSCReloadMode_Immediate);
+    }
+
+    dev->tim_mode = mode;
+}
+
+/*
+ * Pin and timer for the direction taking the line, rx once per arming
+ * so the start bit edge of each frame finds them ready.
+ */
+static void PIOS_Soft_Serial_Line_Setup(struct pios_soft_serial_device *dev, struct pios_soft_serial_gpio *gs)
+{
+    PIOS_Soft_Serial_LL_GPIO_Init(&gs->ll, 0);
+
+    PIOS_Soft_Serial_Tim_Mode(dev, (gs == &dev->rx && dev->rx_capture) ? TIM_MODE_CAPTURE : TIM_MODE_CLOCK);
+
+    if(dev->tim_mode == TIM_MODE_CLOCK) {
+        /* rx samples faster than tx shifts bits out */
+        uint16_t arr = (gs == &dev->rx) ? dev->rx_arr : dev->tx_arr;
+        uint32_t frac = (gs == &dev->rx) ? dev->rx_frac : dev->tx_frac;
+
+        /* the table already runs at this rate, writing ARR would replace the period it loaded */
+        if(dev->frac_baud && (dev->cfg->timer->CR1 & TIM_CR1_ARPE) && dev->arr_steps_total == frac) {
+            return;
+        }
+
+        TIM_ARRPreloadConfig(dev->cfg->timer, DISABLE);
+        TIM_SetAutoreload(dev->cfg->timer, arr);
+
+        /* past a shorter period the counter would run up to the 16 bit wrap first */
+        if(TIM_GetCounter(dev->cfg->timer) > arr) {
+            TIM_SetCounter(dev->cfg->timer, 0);
+        }
+
+        if(dev->frac_baud) {
+            /* each update dma write sets the period after the next update */
+            PIOS_Soft_Serial_Frac_Fill(dev, frac);
+            TIM_ARRPreloadConfig(dev->cfg->timer, ENABLE);
+        }
+    }
+}
+
+void PIOS_Soft_Serial_Rx_Poll(uint32_t id)
+{
+    PIOS_SOFT_SERIAL_VALIDATE_AND_ASSERT(dev, id);
+
+    uint32_t prev_mask = PIOS_IRQ_Mask(PIOS_SOFT_SERIAL_DMA_IRQ_PRIO);
+
+    if(dev->rx_capture && (dev->state == STATE_RX_WAIT || dev->state == STATE_RX_DATA)) {
+        PIOS_Soft_Serial_Rx_Capture_Update(dev);
+    }
+
+    PIOS_IRQ_Unmask(prev_mask);
+}
+
+/* One frame sampled at its bit centers, wait for the next start bit */
+static void PIOS_Soft_Serial_Rx_Edge_Frame(struct pios_soft_serial_device *dev)
+{
+    const uint16_t *samples = (const uint16_t *)dev->dma_buffer;
+    uint8_t data_bits = PIOS_Soft_Serial_Rx_Data_Bits(dev);
+    uint8_t n = 0;
+
+    /* mark at the start bit center, that was a glitch */
+    if(dev->rx_edge_skip || !PIOS_Soft_Serial_Rx_Sample(dev, samples, n++)) {
+        uint16_t shift = 0;
+
+        for(uint8_t i = 0; i < data_bits; ++i) {
+            shift |= PIOS_Soft_Serial_Rx_Sample(dev, samples, n++) << i;
+        }
+
+        if(PIOS_Soft_Serial_Rx_Check(dev, shift, PIOS_Soft_Serial_Rx_Sample(dev, samples, n))) {
+            uint8_t byte = shift;
+
+            PIOS_Soft_Serial_Rx_Deliver(dev, &byte, 1);
+        }
+    }
+
+    PIOS_Soft_Serial_Set_State(dev, STATE_RX_WAIT);
+
+    PIOS_Soft_Serial_LL_EdgeDetect_Cmd(dev->edge_detect, ENABLE);
+}
+
+/*
+ * Toggle TX batch start: batch time 0 is lead ticks from now, which also
+ * lets the previous batch finish its stop bits. The first compare goes
+ * straight into the channel, its match makes the dma load the next.
+ * Compare values are words in the tx buffers, the timer takes word
+ * writes to its 16 bit registers.
+ */
+static void PIOS_Soft_Serial_Tx_Toggle_Begin(struct pios_soft_serial_device *dev)
+{
+    uint16_t lead = dev->tx_toggle_lead;
+
+    if(lead < PIOS_SOFT_SERIAL_TOGGLE_LEAD) {
+        lead = PIOS_SOFT_SERIAL_TOGGLE_LEAD;
+    }
+
+    dev->tx_toggle_lead = 0;
+
+    PIOS_Soft_Serial_Tim_Mode(dev, TIM_MODE_TOGGLE);
+
+    TIM_SetCounter(dev->cfg->timer, (uint16_t)-lead);
+
+    *PIOS_Soft_Serial_Tim_CCR(dev) = dev->tx_active[0];
+
+    PIOS_Soft_Serial_Tim_OCM(dev, TIM_CCMR1_OC1M_1 | TIM_CCMR1_OC1M_0);
+}
+
+/* Last toggle of the batch is out, hold mark until the next batch takes over */
+static void PIOS_Soft_Serial_Tx_Toggle_End(struct pios_soft_serial_device *dev)
+{
+    PIOS_Soft_Serial_Tim_OCM(dev, TIM_CCMR1_OC1M_2 | TIM_CCMR1_OC1M_0);
+
+    uint16_t end = dev->tx_toggle_end[(dev->tx_active - dev->dma_buffer[0]) / DMA_BUFFER_SIZE];
+
+    dev->tx_toggle_lead = end - TIM_GetCounter(dev->cfg->timer);
+}
+
+static void PIOS_Soft_Serial_DMA_Setup(uint32_t dma_handle, uint32_t context)
+{
+    PIOS_INSTRUMENTATION_SCOPE(PIOS_INSTRUMENTATION_SOFT_SERIAL_DMA_SETUP);
+
+    PIOS_SOFT_SERIAL_VALIDATE_AND_ASSERT(dev, context);
+    
+    /* Disable start bit detection */
+    PIOS_Soft_Serial_LL_EdgeDetect_Cmd(dev->edge_detect, DISABLE);
+    
+    PIOS_DEBUG_Assert(dma_handle == dev->rx.dma || dma_handle == dev->tx.dma);
+
+    /* Rx_Arm() set up pin and timer for rx, edge aligned frames only need their dma clock */
+    if(dma_handle == dev->tx.dma) {
+        if(dev->tx_toggle) {
+            PIOS_Soft_Serial_Tx_Toggle_Begin(dev);
+        } else {
+            PIOS_Soft_Serial_Line_Setup(dev, &dev->tx);
+        }
+    }
+
+    uint16_t tim_dma_source = dev->tim_dma_source;
+
+    if(dev->tim_mode != TIM_MODE_CLOCK) {
+        /* free running, ARR stays put */
+        tim_dma_source &= ~TIM_DMA_Update;
+    }
+
+    /* Start generating DMA requests */
+    /* Should we adjust appropriate CCR now? */
+
+    TIM_DMACmd(dev->cfg->timer, tim_dma_source, ENABLE);
+}
+
+static void PIOS_Soft_Serial_DMA_Complete(uint32_t dma_handle, uint32_t context)
+{
+    PIOS_INSTRUMENTATION_SCOPE(PIOS_INSTRUMENTATION_SOFT_SERIAL_DMA_COMPLETE);
+
+    PIOS_SOFT_SERIAL_VALIDATE_AND_ASSERT(dev, context);
+
+    if(dma_handle == dev->tx.dma && dev->tx_streaming) {
+        PIOS_Soft_Serial_Tx_Stream_Refill(dev, 1);
+        return;
+    }
+
+    if(dma_handle == dev->rx.dma && dev->rx_capture) {
+        PIOS_Soft_Serial_Rx_Capture_Update(dev);
+        return;
+    }
+
+    if(dma_handle == dev->rx.dma && dev->rx_oversample != 1) {
+        PIOS_Soft_Serial_Rx_Decode(dev, RX_RING_SIZE / 2);
+        return;
+    }
+
+    TIM_DMACmd(dev->cfg->timer, dev->tim_dma_source, DISABLE); // Stop generating requests
+
+    if(dma_handle == dev->rx.dma) {
+        PIOS_Soft_Serial_Rx_Edge_Frame(dev);
+        return;
+    }
+
+    if(dma_handle != dev->tx.dma) {
+        return;
+    }
+
+    if(dev->tx_toggle) {
+        PIOS_Soft_Serial_Tx_Toggle_End(dev);
+    }
+
+    PIOS_Soft_Serial_FreeDMABuffer(dev, dev->tx_active);
+    dev->tx_active = 0;
+
+    if(dev->tx_next) {
+        pios_soft_serial_tx_word_t *buffer = dev->tx_next;
+
+        dev->tx_next = 0;
+
+        PIOS_Soft_Serial_Tx_Queue(dev, buffer, dev->tx_next_len);
+        PIOS_Soft_Serial_Tx_Prefetch(dev);
+    } else {
+        PIOS_Soft_Serial_Tx_Start_Internal(dev);
+    }
+}
+
+static void PIOS_Soft_Serial_DMA_HalfTransfer(uint32_t dma_handle, uint32_t context)
+{
+    PIOS_INSTRUMENTATION_SCOPE(PIOS_INSTRUMENTATION_SOFT_SERIAL_DMA_HALFTRANSFER);
+
+    PIOS_SOFT_SERIAL_VALIDATE_AND_ASSERT(dev, context);
+
+    if(dma_handle == dev->tx.dma && dev->tx_streaming) {
+        PIOS_Soft_Serial_Tx_Stream_Refill(dev, 0);
+    } else if(dma_handle == dev->rx.dma && dev->rx_capture) {
+        PIOS_Soft_Serial_Rx_Capture_Update(dev);
+    } else if(dma_handle == dev->rx.dma && dev->rx_oversample != 1) {
+        PIOS_Soft_Serial_Rx_Decode(dev, RX_RING_SIZE / 2);
+    }
+}
+
+static void PIOS_Soft_Serial_DMA_Error(uint32_t dma_handle, uint32_t context)
+{
+    PIOS_SOFT_SERIAL_VALIDATE_AND_ASSERT(dev, context);
+
+    TIM_DMACmd(dev->cfg->timer, dev->tim_dma_source, DISABLE); // Stop generating requests
+
+    if(dma_handle == dev->tx.dma && dev->tx_streaming) {
+        /* channel is already disabled and dequeued, just release the stream */
+        PIOS_DMA_SetCircular(dev->tx.dma, false);
+
+        PIOS_Soft_Serial_FreeDMABuffer(dev, dev->dma_buffer[0]);
+        PIOS_Soft_Serial_FreeDMABuffer(dev, dev->dma_buffer[1]);
+
+        dev->tx_streaming = false;
+        PIOS_Soft_Serial_Tx_Done(dev);
+    } else if(dma_handle == dev->rx.dma) {
+        /* channel is already dequeued, rx_start will arm again */
+        PIOS_DMA_SetCircular(dev->rx.dma, false);
+
+        PIOS_Soft_Serial_FreeDMABuffer(dev, dev->dma_buffer[0]);
+        PIOS_Soft_Serial_FreeDMABuffer(dev, dev->dma_buffer[1]);
+
+        PIOS_Soft_Serial_Set_State(dev, STATE_IDLE);
+        dev->rx_enabled = false;
+    } else if(dma_handle == dev->tx.dma) {
+        /* drop whatever was in flight, next tx_start will begin from scratch */
+        PIOS_Soft_Serial_FreeDMABuffer(dev, dev->tx_active);
+        dev->tx_active = 0;
+
+        if(dev->tx_next) {
+            PIOS_Soft_Serial_FreeDMABuffer(dev, dev->tx_next);
+            dev->tx_next = 0;
+        }
+
+        PIOS_Soft_Serial_Tx_Done(dev);
+    }
+}
+
+/*
+ * Start bit edge in edge aligned mode: re-phase the timer so its next
+ * compare, which clocks the rx dma, lands on the start bit center, then
+ * let dma take one sample per bit for the rest of the frame. The counter
+ * wraps to the compare at 0, so preloading it with half a bit plus the
+ * time already gone since the edge does the alignment. If the start bit
+ * center has already passed, aim at the first data bit instead.
+ */
+static void PIOS_Soft_Serial_Edge_Detected(uint32_t edge_detect_dev, uint32_t context, uint32_t entry)
+{
+    PIOS_INSTRUMENTATION_SCOPE(PIOS_INSTRUMENTATION_SOFT_SERIAL_EDGE);
+
+    PIOS_SOFT_SERIAL_VALIDATE_AND_ASSERT(dev, context);
+
+    /* the rest of the frame is sampled by dma */
+    PIOS_Soft_Serial_LL_EdgeDetect_Cmd(edge_detect_dev, DISABLE);
+
+    if(dev->state != STATE_RX_WAIT || dev->rx_oversample != 1 || dev->rx_capture) {
+        return;
+    }
+
+    uint32_t cycles = PIOS_DELAY_GetRaw() - entry + PIOS_SOFT_SERIAL_EDGE_ENTRY_CYCLES;
+
+    if(cycles >= dev->bit_cycles) {
+        /* missed the whole start bit, can't tell where the frame is */
+        ++dev->rx_errors.late;
+        PIOS_Soft_Serial_LL_EdgeDetect_Cmd(edge_detect_dev, ENABLE);
+        return;
+    }
+
+    uint16_t bit = dev->rx_arr + 1;
+    uint16_t since_edge = ((uint64_t)cycles * dev->tick_per_cycle) >> 16;
+    uint8_t data_bits = PIOS_Soft_Serial_Rx_Data_Bits(dev);
+
+    dev->rx_edge_skip = (since_edge >= bit / 2);
+    PIOS_Soft_Serial_Set_State(dev, STATE_RX_DATA);
+
+    TIM_SetCounter(dev->cfg->timer, since_edge + bit - bit / 2 - (dev->rx_edge_skip ? bit : 0));
+
+    /* start bit (unless skipped), data bits and the first stop bit */
+    PIOS_DMA_SetMemoryBaseAddr(dev->rx.dma, dev->dma_buffer, 1 + data_bits + 1 - dev->rx_edge_skip);
+    PIOS_DMA_Queue(dev->rx.dma, (uint32_t) dev);
+
+    cycles = PIOS_DELAY_GetRaw() - entry + PIOS_SOFT_SERIAL_EDGE_ENTRY_CYCLES;
+
+    if(cycles > dev->edge_latency_max) {
+        dev->edge_latency_max = cycles;
+    }
+}
+
+int32_t PIOS_Soft_Serial_Group_Init(uint32_t *id, const struct pios_soft_serial_config *config)
+{
+    PIOS_DEBUG_Assert(config);
+    PIOS_DEBUG_Assert(id);
+
+    pios_dma_stream_t *dma_stream = PIOS_Soft_Serial_DMA_Stream(config);
+
+    if(!dma_stream) {
+        return -1;
+    }
+
+    struct pios_dma_config dma_config = {
+        .init = {
+            .DMA_M2M = DMA_M2M_Disable,
+            .DMA_Priority = DMA_Priority_Medium,
+            .DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word,
+            .DMA_MemoryDataSize = DMA_MemoryDataSize_Word,
+            .DMA_MemoryInc = DMA_MemoryInc_Enable,
+            .DMA_PeripheralInc = DMA_PeripheralInc_Disable,
+            .DMA_DIR = DMA_DIR_PeripheralDST,
+        },
+        .stream = dma_stream,
+        .timer = config->timer,
+        .tim_dma_source = PIOS_TIM_CHANNEL_DIER_CCxDE(config->tim_channel),
+        .irq = {
+            .NVIC_IRQChannelPreemptionPriority = PIOS_SOFT_SERIAL_DMA_IRQ_PRIO,
+        },
+        .callbacks = {
+            .setup = PIOS_Soft_Serial_Group_DMA_Setup,
+            .complete = PIOS_Soft_Serial_Group_DMA_Complete,
+            .halftransfer = PIOS_Soft_Serial_Group_DMA_HalfTransfer,
+            .error = PIOS_Soft_Serial_Group_DMA_Error,
+        }
+    };
+
+    /* as for devices, nothing is taken or started for a rejected config */
+    uint32_t tx_dma;
+    uint32_t rx_dma;
+
+    if(PIOS_DMA_Init(&tx_dma, &dma_config)) {
+        return -1;
+    }
+
+    /* RX samples the 16 bit IDR, one sample covers every member */
+    dma_config.init.DMA_DIR = DMA_DIR_PeripheralSRC;
+    dma_config.init.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord;
+    dma_config.init.DMA_MemoryDataSize = DMA_MemoryDataSize_HalfWord;
+    dma_config.priority = 1;
+
+    if(PIOS_DMA_Init(&rx_dma, &dma_config)) {
+        return -1;
+    }
+
+#ifdef PIOS_INCLUDE_FREERTOS
+    struct pios_soft_serial_group *group = (struct pios_soft_serial_group *)pios_malloc(sizeof(*group));
+#else
+    PIOS_DEBUG_Assert(soft_serial_group_count < PIOS_SOFT_SERIAL_MAX_GROUP);
+    struct pios_soft_serial_group *group = &soft_serial_group[soft_serial_group_count++];
+#endif
+
+    memset(group, 0, sizeof(*group));
+
+    group->magic = PIOS_SOFT_SERIAL_GROUP_MAGIC;
+    group->cfg = config;
+    group->dma = tx_dma;
+    group->rx_dma = rx_dma;
+
+    /* members set the baud rate through their own set_baud, they all share this timer */
+    TIM_TimeBaseInitTypeDef timeBaseInit = {
+        .TIM_Prescaler = 0,
+        .TIM_CounterMode = TIM_CounterMode_Up,
+        .TIM_Period = (PIOS_TIM_Ck_Int(config->timer) / 9600) - 1,
+        .TIM_ClockDivision = TIM_CKD_DIV1,
+    };
+
+    TIM_TimeBaseInit(config->timer, &timeBaseInit);
+
+    TIM_Cmd(config->timer, ENABLE);
+
+    PIOS_Soft_Serial_Slice_Init(&group->rx_slice, 4);
+
+    group->tim_dma_source = PIOS_TIM_CHANNEL_DIER_CCxDE(config->tim_channel);
+
+    *id = (uint32_t) group;
+
+    return 0;
+}
+
+int32_t PIOS_Soft_Serial_Group_Add(uint32_t group_id, uint32_t id)
+{
+    PIOS_SOFT_SERIAL_GROUP_VALIDATE_AND_ASSERT(group, group_id);
+    struct pios_soft_serial_device *dev = (struct pios_soft_serial_device *)id;
+
+    PIOS_DEBUG_Assert(PIOS_Soft_Serial_Validate(dev));
+
+    if(group->member_count >= PIOS_SOFT_SERIAL_GROUP_MAX_MEMBERS) {
+        return -1;
+    }
+
+    if(dev->tx.ll.pin.gpio && !PIOS_Soft_Serial_Group_Bind_Port(group, dev->tx.ll.pin.gpio)) {
+        return -1;
+    }
+
+    if(dev->rx.ll.pin.gpio && !PIOS_Soft_Serial_Group_Bind_Port(group, dev->rx.ll.pin.gpio)) {
+        return -1;
+    }
+
+    dev->group_member = group->member_count;
+    group->member[group->member_count++] = dev;
+
+    dev->group = group;
+
+    return 0;
+}
+
+static bool PIOS_Soft_Serial_Group_Bind_Port(struct pios_soft_serial_group *group, GPIO_TypeDef *gpio)
+{
+    if(!group->gpio) {
+        group->gpio = gpio;
+        PIOS_DMA_SetPeripheralBaseAddr(group->dma, &gpio->BSRR);
+        PIOS_DMA_SetPeripheralBaseAddr(group->rx_dma, &gpio->IDR);
+    }
+
+    return group->gpio == gpio;
+}
+
+/*
+ * Each member encodes its batch with its own tables, every BSRR word only
+ * touches that member's pin, so merging is a plain OR. Positions past
+ * the end of a member's frames stay zero and leave its pin alone.
+ */
+static uint16_t PIOS_Soft_Serial_Group_Fill(struct pios_soft_serial_group *group, uint32_t *buffer)
+{
+    uint16_t group_len = 0;
+    uint16_t pending = group->tx_pending;
+
+    memset(buffer, 0, sizeof(group->dma_buffer[0]));
+
+    while(pending) {
+        uint8_t nr = __builtin_ctz(pending);
+        pending &= pending - 1;
+
+        struct pios_soft_serial_device *dev = group->member[nr];
+
+        uint8_t bytes[PIOS_SOFT_SERIAL_TX_BATCH];
+        uint16_t headroom = 0;
+        bool task_woken = false;
+
+        uint16_t count = dev->tx_out_cb ? dev->tx_out_cb(dev->tx_out_context, bytes, sizeof(bytes), &headroom, &task_woken) : 0;
+
+        PIOS_TRACE(PIOS_TRACE_COM_TX, count);
+
+        if(!count) {
+            group->tx_pending &= ~(1 << nr);
+            dev->tx_pending = false;
+            continue;
+        }
+
+        uint16_t len = 0;
+
+        for(uint16_t i = 0; i < count; ++i) {
+            uint32_t frame[DMA_FRAME_SIZE];
+            uint16_t frame_len = PIOS_Soft_Serial_Encode(dev, bytes[i], frame);
+
+            for(uint16_t bit = 0; bit < frame_len; ++bit) {
+                buffer[len + bit] |= frame[bit];
+            }
+
+            len += frame_len;
+        }
+
+        if(len > group_len) {
+            group_len = len;
+        }
+    }
+
+    return group_len;
+}
+
+static void PIOS_Soft_Serial_Group_Prefetch(struct pios_soft_serial_group *group)
+{
+    if(group->tx_next) {
+        return;
+    }
+
+    group->tx_next_len = PIOS_Soft_Serial_Group_Fill(group, group->dma_buffer[group->tx_active_buffer ^ 1]);
+    group->tx_next = (group->tx_next_len != 0);
+}
+
+static void PIOS_Soft_Serial_Group_Queue(struct pios_soft_serial_group *group, uint16_t len)
+{
+    PIOS_DMA_SetMemoryBaseAddr(group->dma, group->dma_buffer[group->tx_active_buffer], len);
+    PIOS_DMA_Queue(group->dma, (uint32_t) group);
+}
+
+/* Encode into the idle buffer and prefetch the next batch before queueing, so DMA complete can't race us */
+static void PIOS_Soft_Serial_Group_Tx_Start_Internal(struct pios_soft_serial_group *group)
+{
+    uint8_t nr = group->tx_active_buffer ^ 1;
+    uint16_t len = PIOS_Soft_Serial_Group_Fill(group, group->dma_buffer[nr]);
+
+    if(!len) {
+        group->tx_active = false;
+
+        if(group->rx_slice.lines) {
+            PIOS_Soft_Serial_Group_Rx_Arm(group);
+        }
+        return;
+    }
+
+    group->tx_active_buffer = nr;
+
+    if(group->tx_pending) {
+        PIOS_Soft_Serial_Group_Prefetch(group);
+    }
+
+    PIOS_Soft_Serial_Group_Queue(group, len);
+}
+
+static void PIOS_Soft_Serial_Group_Tx_Start(struct pios_soft_serial_group *group, struct pios_soft_serial_device *dev)
+{
+    uint32_t prev_mask = PIOS_IRQ_Mask(PIOS_SOFT_SERIAL_DMA_IRQ_PRIO);
+
+    group->tx_pending |= (1 << dev->group_member);
+
+    bool active = group->tx_active;
+
+    group->tx_active = true;
+
+    PIOS_IRQ_Unmask(prev_mask);
+
+    if(!active) {
+        /* half duplex, rx sampling gives up the channel and the buffers */
+        PIOS_Soft_Serial_Group_Rx_Disarm(group);
+        PIOS_Soft_Serial_Group_Tx_Start_Internal(group);
+    }
+}
+
+/*
+ * All members receive through one circular DMA sampling the whole port,
+ * the bit-sliced decoder runs every member's line on each sample. The
+ * members share the timer, so the sampling rate follows the member that
+ * started receiving last. A member set to one sample per bit before it
+ * joined does not receive, it would leave the decoder voting across bits.
+ */
+static void PIOS_Soft_Serial_Group_Rx_Start(struct pios_soft_serial_group *group, struct pios_soft_serial_device *dev)
+{
+    uint16_t line = dev->rx.ll.pin.init.GPIO_Pin;
+
+    if(!line || dev->rx_oversample == 1) {
+        return;
+    }
+
+    uint32_t prev_mask = PIOS_IRQ_Mask(PIOS_SOFT_SERIAL_DMA_IRQ_PRIO);
+
+    dev->rx_enabled = true;
+
+    group->rx_member[__builtin_ctz(line)] = dev;
+    group->rx_arr = dev->rx_arr;
+    group->rx_psc = dev->clk_psc;
+    group->rx_slice.oversample = dev->rx_oversample;
+
+    PIOS_Soft_Serial_Slice_Configure(&group->rx_slice, line, dev->inverted & PIOS_USART_Inverted_Rx, dev->word_len, dev->parity);
+
+    if(!group->tx_active && !group->rx_armed) {
+        PIOS_Soft_Serial_Group_Rx_Arm(group);
+    }
+
+    PIOS_IRQ_Unmask(prev_mask);
+}
+
+static void PIOS_Soft_Serial_Group_Rx_Arm(struct pios_soft_serial_group *group)
+{
+    if(group->rx_armed) {
+        return;
+    }
+
+    PIOS_Soft_Serial_Slice_Reset(&group->rx_slice);
+
+    group->rx_armed = true;
+
+    PIOS_DMA_SetCircular(group->rx_dma, true);
+    PIOS_DMA_SetMemoryBaseAddr(group->rx_dma, group->dma_buffer, GROUP_RX_RING_SIZE);
+    PIOS_DMA_Queue(group->rx_dma, (uint32_t) group);
+}
+
+static void PIOS_Soft_Serial_Group_Rx_Disarm(struct pios_soft_serial_group *group)
+{
+    if(!group->rx_armed) {
+        return;
+    }
+
+    TIM_DMACmd(group->cfg->timer, group->tim_dma_source, DISABLE); // Stop generating requests
+
+    PIOS_DMA_Stop(group->rx_dma);
+    PIOS_DMA_SetCircular(group->rx_dma, false);
+
+    group->rx_armed = false;
+}
+
+static void PIOS_Soft_Serial_Group_Rx_Frames(uint32_t context, uint16_t done, uint16_t framing, uint16_t parity, const uint8_t *bytes)
+{
+    struct pios_soft_serial_group *group = (struct pios_soft_serial_group *)context;
+
+    while(done) {
+        uint8_t line = __builtin_ctz(done);
+        uint16_t bit = 1 << line;
+
+        done &= done - 1;
+
+        struct pios_soft_serial_device *dev = group->rx_member[line];
+
+        if(framing & bit) {
+            ++dev->rx_errors.framing;
+        } else if(parity & bit) {
+            ++dev->rx_errors.parity;
+        } else {
+            PIOS_Soft_Serial_Rx_Deliver(dev, (uint8_t *)&bytes[line], 1);
+        }
+    }
+}
+
+static void PIOS_Soft_Serial_Group_DMA_Setup(uint32_t dma_handle, uint32_t context)
+{
+    PIOS_INSTRUMENTATION_SCOPE(PIOS_INSTRUMENTATION_SOFT_SERIAL_GROUP_DMA_SETUP);
+
+    PIOS_SOFT_SERIAL_GROUP_VALIDATE_AND_ASSERT(group, context);
+
+    if(dma_handle == group->rx_dma) {
+        struct pios_tim_period period = { .psc = group->rx_psc, .arr = group->rx_arr };
+
+        PIOS_TIM_SetPeriod(group->cfg->timer, &period);
+        TIM_DMACmd(group->cfg->timer, group->tim_dma_source, ENABLE);
+        return;
+    }
+
+    uint16_t pending = group->tx_pending;
+
+    if(pending) {
+        /* back from rx sampling rate */
+        struct pios_soft_serial_device *first = group->member[__builtin_ctz(pending)];
+        struct pios_tim_period period = { .psc = first->clk_psc, .arr = first->tx_arr };
+
+        PIOS_TIM_SetPeriod(group->cfg->timer, &period);
+    }
+
+    while(pending) {
+        struct pios_soft_serial_device *dev = group->member[__builtin_ctz(pending)];
+        pending &= pending - 1;
+
+        PIOS_Soft_Serial_LL_EdgeDetect_Cmd(dev->edge_detect, DISABLE);
+        PIOS_Soft_Serial_LL_GPIO_Init(&dev->tx.ll, 0);
+    }
+
+    TIM_DMACmd(group->cfg->timer, group->tim_dma_source, ENABLE);
+}
+
+static void PIOS_Soft_Serial_Group_DMA_Complete(uint32_t dma_handle, uint32_t context)
+{
+    PIOS_INSTRUMENTATION_SCOPE(PIOS_INSTRUMENTATION_SOFT_SERIAL_GROUP_DMA_COMPLETE);
+
+    PIOS_SOFT_SERIAL_GROUP_VALIDATE_AND_ASSERT(group, context);
+
+    if(dma_handle == group->rx_dma) {
+        PIOS_Soft_Serial_Slice_Decode(&group->rx_slice, (const uint16_t *)group->dma_buffer, GROUP_RX_RING_SIZE, GROUP_RX_RING_SIZE / 2, PIOS_Soft_Serial_Group_Rx_Frames, (uint32_t) group);
+        return;
+    }
+
+    TIM_DMACmd(group->cfg->timer, group->tim_dma_source, DISABLE); // Stop generating requests
+
+    if(group->tx_next) {
+        group->tx_next = false;
+        group->tx_active_buffer ^= 1;
+
+        PIOS_Soft_Serial_Group_Queue(group, group->tx_next_len);
+        PIOS_Soft_Serial_Group_Prefetch(group);
+    } else {
+        PIOS_Soft_Serial_Group_Tx_Start_Internal(group);
+    }
+}
+
+static void PIOS_Soft_Serial_Group_DMA_HalfTransfer(uint32_t dma_handle, uint32_t context)
+{
+    PIOS_INSTRUMENTATION_SCOPE(PIOS_INSTRUMENTATION_SOFT_SERIAL_GROUP_DMA_HALFTRANSFER);
+
+    PIOS_SOFT_SERIAL_GROUP_VALIDATE_AND_ASSERT(group, context);
+
+    if(dma_handle == group->rx_dma) {
+        PIOS_Soft_Serial_Slice_Decode(&group->rx_slice, (const uint16_t *)group->dma_buffer, GROUP_RX_RING_SIZE, GROUP_RX_RING_SIZE / 2, PIOS_Soft_Serial_Group_Rx_Frames, (uint32_t) group);
+    }
+}
+
+static void PIOS_Soft_Serial_Group_DMA_Error(uint32_t dma_handle, uint32_t context)
+{
+    PIOS_SOFT_SERIAL_GROUP_VALIDATE_AND_ASSERT(group, context);
+
+    TIM_DMACmd(group->cfg->timer, group->tim_dma_source, DISABLE); // Stop generating requests
+
+    if(dma_handle == group->rx_dma) {
+        /* channel is already dequeued, members' rx_start will arm again */
+        PIOS_DMA_SetCircular(group->rx_dma, false);
+
+        group->rx_armed = false;
+        group->rx_slice.lines = 0;
+        return;
+    }
+
+    /* drop everything, members restart on their next tx_start */
+    for(uint8_t i = 0; i < group->member_count; ++i) {
+        group->member[i]->tx_pending = false;
+    }
 
+    group->tx_pending = 0;
+    group->tx_next = false;
+    group->tx_active = false;
 }
@@ -37,14 +37,85 @@
 extern struct pios_com_driver pios_soft_serial_driver; /* half duplex driver */
 
 struct pios_soft_serial_config {
-    pios_dma_stream_t *dma_stream;
+    pios_dma_stream_t *dma_stream;  /* 0 to pick one wired to the tim_channel request */
     TIM_TypeDef *timer;
     uint8_t tim_channel;
+    pios_dma_stream_t *arr_dma_stream; /* fractional baud, 0 to pick the one wired to the timer update request */
 };
 
 int32_t PIOS_Soft_Serial_Init(uint32_t *dev, const struct pios_soft_serial_config *config);
 
+/*
+ * Capture RX (PIOS_IOCTL_SOFT_SERIAL_SET_RXCAPTURE) finishes a frame at
+ * its next edge, or once its time is up. Call this at least once per
+ * 65536 timer ticks while receiving, e.g. from a periodic PIOS_SWTimer, so the last
+ * frame of a burst is delivered. Harmless in other modes.
+ */
+void PIOS_Soft_Serial_Rx_Poll(uint32_t dev);
+
+/*
+ * TX port group: soft serial devices with TX pins on the same GPIO port
+ * share one timer and one DMA channel, their frames are merged into
+ * a single BSRR word stream. Members run at the group timer baud rate.
+ */
+int32_t PIOS_Soft_Serial_Group_Init(uint32_t *group, const struct pios_soft_serial_config *config);
+int32_t PIOS_Soft_Serial_Group_Add(uint32_t group, uint32_t dev);
+
 #define PIOS_IOCTL_SOFT_SERIAL_SET_RXGPIO     COM_IOCTL(COM_IOCTL_TYPE_SOFT_SERIAL, 4, struct stm32_gpio)
 #define PIOS_IOCTL_SOFT_SERIAL_SET_TXGPIO     COM_IOCTL(COM_IOCTL_TYPE_SOFT_SERIAL, 5, struct stm32_gpio)
 
+/* continuous circular DMA transmit, no gaps between batches */
+#define PIOS_IOCTL_SOFT_SERIAL_SET_TXSTREAM   COM_IOCTL(COM_IOCTL_TYPE_SOFT_SERIAL, 6, bool)
+
+/* RX samples per bit, 3, 4 or 8, or 1 to sample bit centers aligned to the start bit edge (not in groups) */
+#define PIOS_IOCTL_SOFT_SERIAL_SET_RXOVERSAMPLE COM_IOCTL(COM_IOCTL_TYPE_SOFT_SERIAL, 7, uint8_t)
+
+struct pios_soft_serial_rx_errors {
+    uint32_t framing;
+    uint32_t parity;
+    uint32_t overrun;   /* decoded bytes rejected by the COM layer */
+    uint32_t late;      /* start bit edges serviced too late to align to */
+};
+
+#define PIOS_IOCTL_SOFT_SERIAL_GET_RXERRORS   COM_IOCTL(COM_IOCTL_TYPE_SOFT_SERIAL, 8, struct pios_soft_serial_rx_errors)
+
+/* worst DWT cycles from a start bit edge to rx dma armed, edge aligned mode */
+#define PIOS_IOCTL_SOFT_SERIAL_GET_RXEDGELATENCY COM_IOCTL(COM_IOCTL_TYPE_SOFT_SERIAL, 9, uint32_t)
+
+/*
+ * RX from edge timestamps: tim_channel captures both edges of the
+ * timer's channel 1 input (TI1F_ED), so the rx pin must be that input.
+ * Not available for group members.
+ */
+#define PIOS_IOCTL_SOFT_SERIAL_SET_RXCAPTURE  COM_IOCTL(COM_IOCTL_TYPE_SOFT_SERIAL, 10, bool)
+
+/*
+ * TX by toggling the tim_channel output at each level change, one dma
+ * beat per transition instead of one per bit. The tx pin must be that
+ * channel's output pin, it is switched to alternate function push-pull
+ * while transmitting. No streaming, not available for group members,
+ * only while no tx is pending.
+ */
+#define PIOS_IOCTL_SOFT_SERIAL_SET_TXTOGGLE   COM_IOCTL(COM_IOCTL_TYPE_SOFT_SERIAL, 11, bool)
+
+/*
+ * Fractional baud: the timer update request has dma load every next bit
+ * (or sample) period into ARR from a table of whole tick periods that
+ * averages the exact bit time. Holds the update request's dma channel,
+ * which must not be the tim_channel one, from the first use on. Takes
+ * effect when tx or rx starts next, only in the BSRR tx and sampling rx
+ * modes. Not available for group members.
+ */
+#define PIOS_IOCTL_SOFT_SERIAL_SET_FRACBAUD   COM_IOCTL(COM_IOCTL_TYPE_SOFT_SERIAL, 12, bool)
+
+/* the bit and sample clocks achieved at the current baud rate */
+struct pios_soft_serial_baud_error {
+    int32_t tx_ppm;         /* bit time error, positive is slow */
+    uint32_t tx_drift_ns;   /* worst bit edge offset within a frame */
+    int32_t rx_ppm;         /* sample period error */
+    uint32_t rx_drift_ns;   /* worst sample offset within a frame */
+};
+
+#define PIOS_IOCTL_SOFT_SERIAL_GET_BAUDERROR  COM_IOCTL(COM_IOCTL_TYPE_SOFT_SERIAL, 13, struct pios_soft_serial_baud_error)
+
 #endif /* PIOS_SOFT_SERIAL_H */
@@ -38,6 +38,8 @@
 
 struct pios_soft_serial_ll_edgedetect_device {
     uint32_t exti_line;
+    pios_soft_serial_ll_edgedetect_cb callback;
+    uint32_t context;
 };
 
 #if !defined(PIOS_INCLUDE_FREERTOS)
@@ -61,12 +63,33 @@ int32_t PIOS_Soft_Serial_LL_EdgeDetect_Init(uint32_t *id, pios_soft_serial_ll_ed
     memset(dev, 0, sizeof(*dev));
 
     dev->exti_line = EXTI_LINENONE;
+    dev->callback = callback;
+    dev->context = context;
+
+    *id = (uint32_t) dev;
 
     return 0;
 }
 
-static bool PIOS_Soft_Serial_LL_EdgeDetect_Vector()
+/*
+ * IMR is shared by every line and the edge handler of one port preempts
+ * the dma callbacks of another, a bit-band store changes only our bit.
+ */
+static inline void PIOS_Soft_Serial_LL_EdgeDetect_Mask(uint32_t exti_line, bool unmask)
+{
+    uint32_t bit = __builtin_ctz(exti_line);
+
+    *(__IO uint32_t *)(PERIPH_BB_BASE + ((uint32_t)&EXTI->IMR - PERIPH_BASE) * 32 + bit * 4) = unmask;
+}
+
+static bool PIOS_Soft_Serial_LL_EdgeDetect_Vector(uint32_t context, uint32_t timestamp)
 {
+    struct pios_soft_serial_ll_edgedetect_device *dev = (struct pios_soft_serial_ll_edgedetect_device *)context;
+
+    if(dev->callback) {
+        dev->callback((uint32_t) dev, dev->context, timestamp);
+    }
+
     return false;
 }
 
@@ -79,6 +102,7 @@ void PIOS_Soft_Serial_LL_EdgeDetect_Configure(uint32_t id,
     if(dev->exti_line != EXTI_LINENONE) {
         struct pios_exti_cfg cfg = {
             .vector = PIOS_Soft_Serial_LL_EdgeDetect_Vector,
+            .context = (uint32_t) dev,
             .line = dev->exti_line,
             .exti = {
                 .init = {
@@ -96,6 +120,7 @@ void PIOS_Soft_Serial_LL_EdgeDetect_Configure(uint32_t id,
     if(dev->exti_line != EXTI_LINENONE) {
         struct pios_exti_cfg cfg = {
             .vector = PIOS_Soft_Serial_LL_EdgeDetect_Vector,
+            .context = (uint32_t) dev,
             .line = dev->exti_line,
             .pin = *pin,
             .exti = {
@@ -114,14 +139,29 @@ void PIOS_Soft_Serial_LL_EdgeDetect_Configure(uint32_t id,
                 }
             }
         };
-        
+
         PIOS_EXTI_Init(&cfg);
+
+        /* stays masked until the receiver waits for a start bit */
+        PIOS_Soft_Serial_LL_EdgeDetect_Mask(dev->exti_line, false);
     }
 }
 
-void PIOS_Soft_Serial_LL_EdgeDetect_Cmd(uint32_t dev, FunctionalState NewState)
+void PIOS_Soft_Serial_LL_EdgeDetect_Cmd(uint32_t id, FunctionalState NewState)
 {
+    struct pios_soft_serial_ll_edgedetect_device *dev = (struct pios_soft_serial_ll_edgedetect_device *)id;
+
+    if(dev->exti_line == EXTI_LINENONE) {
+        return;
+    }
 
+    if(NewState != DISABLE) {
+        /* forget edges from before, e.g. our own transmission */
+        EXTI->PR = dev->exti_line;
+        PIOS_Soft_Serial_LL_EdgeDetect_Mask(dev->exti_line, true);
+    } else {
+        PIOS_Soft_Serial_LL_EdgeDetect_Mask(dev->exti_line, false);
+    }
 }
 
 void PIOS_Soft_Serial_LL_GPIO_Init(struct pios_soft_serial_ll_gpio *llg, const struct stm32_gpio *pin)
@@ -132,9 +172,14 @@ void PIOS_Soft_Serial_LL_GPIO_Init(struct pios_soft_serial_ll_gpio *llg, const s
 
     PIOS_DEBUG_Assert(llg->pin.gpio);
     
-    PIOS_IRQ_Disable();
+    /*
+     * CRL/CRH read-modify-write, the dma callbacks reconfigure pins on the
+     * same port, and so does the edge handler when its rx dma queue finds
+     * the channel idle and runs the setup callback right away.
+     */
+    uint32_t prev_mask = PIOS_IRQ_Mask(PIOS_IRQ_PRIO_HIGHEST);
     {
       GPIO_Init(llg->pin.gpio, &llg->pin.init);
     }
-    PIOS_IRQ_Enable();
+    PIOS_IRQ_Unmask(prev_mask);
 }
@@ -32,7 +32,16 @@
 
 #include "pios.h"
 
-typedef void (*pios_soft_serial_ll_edgedetect_cb)(uint32_t dev, uint32_t context);
+/*
+ * DMA channel irq level. Sections that only race the dma callbacks mask up
+ * to it, so they never hold off the start bit edge at PIOS_IRQ_PRIO_HIGHEST.
+ */
+#ifndef PIOS_SOFT_SERIAL_DMA_IRQ_PRIO
+# define PIOS_SOFT_SERIAL_DMA_IRQ_PRIO PIOS_IRQ_PRIO_HIGH
+#endif
+
+/* timestamp: DWT cycles read on entry to the EXTI handler */
+typedef void (*pios_soft_serial_ll_edgedetect_cb)(uint32_t dev, uint32_t context, uint32_t timestamp);
 
 int32_t PIOS_Soft_Serial_LL_EdgeDetect_Init(uint32_t *dev, pios_soft_serial_ll_edgedetect_cb callback, uint32_t context);
 
@@ -0,0 +1,243 @@
+/**
+ ******************************************************************************
+ * @addtogroup PIOS PIOS Core hardware abstraction layer
+ * @{
+ * @addtogroup PIOS_SOFT_SERIAL Bit-sliced receiver
+ * @brief PiOS Soft Serial parallel decoder for all lines of a GPIO port
+ * @{
+ *
+ * @file       pios_soft_serial_slice.c
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      Soft Serial bit-sliced receiver
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "pios_soft_serial_slice.h"
+
+#include <string.h>
+
+#define FRAME_TOP PIOS_SOFT_SERIAL_SLICE_FRAME_MAX
+
+void PIOS_Soft_Serial_Slice_Init(struct pios_soft_serial_slice *slice, uint8_t oversample)
+{
+    memset(slice, 0, sizeof(*slice));
+
+    slice->oversample = oversample;
+}
+
+void PIOS_Soft_Serial_Slice_Configure(struct pios_soft_serial_slice *slice, uint16_t lines, bool inverted, enum PIOS_COM_Word_Length word_len, enum PIOS_COM_Parity parity)
+{
+    /* lines already decoding keep their frame in progress */
+    slice->hunt |= lines & ~slice->lines;
+    slice->lines |= lines;
+
+    slice->inverted &= ~lines;
+    slice->long_frame &= ~lines;
+    slice->parity_even &= ~lines;
+    slice->parity_odd &= ~lines;
+
+    if(inverted) {
+        slice->inverted |= lines;
+    }
+
+    if(parity == PIOS_COM_Parity_Even) {
+        slice->parity_even |= lines;
+    } else if(parity == PIOS_COM_Parity_Odd) {
+        slice->parity_odd |= lines;
+    }
+
+    if(parity == PIOS_COM_Parity_Even || parity == PIOS_COM_Parity_Odd || word_len == PIOS_COM_Word_length_9b) {
+        slice->long_frame |= lines;
+    }
+}
+
+/* Drop partial frames, every line hunts for a start bit from the next sample on */
+void PIOS_Soft_Serial_Slice_Reset(struct pios_soft_serial_slice *slice)
+{
+    slice->hunt = slice->lines;
+    slice->first = 0;
+    slice->wait_mark = 0;
+
+    memset(slice->count, 0, sizeof(slice->count));
+    memset(slice->frame, 0, sizeof(slice->frame));
+
+    slice->pos = 0;
+    slice->avail = 0;
+}
+
+/* Load value into the counters of lines in mask */
+static inline void PIOS_Soft_Serial_Slice_Load(struct pios_soft_serial_slice *slice, uint16_t mask, uint8_t value)
+{
+    for(uint8_t i = 0; i < 4; ++i) {
+        slice->count[i] = (slice->count[i] & ~mask) | ((value & (1 << i)) ? mask : 0);
+    }
+}
+
+/* Count down all lines in mask at once, returns the lines reaching zero */
+static inline uint16_t PIOS_Soft_Serial_Slice_Tick(struct pios_soft_serial_slice *slice, uint16_t mask)
+{
+    uint16_t borrow = mask;
+    uint16_t nonzero = 0;
+
+    for(uint8_t i = 0; i < 4; ++i) {
+        uint16_t bit = slice->count[i];
+
+        slice->count[i] = bit ^ borrow;
+        borrow &= ~bit;
+        nonzero |= slice->count[i];
+    }
+
+    return mask & ~nonzero;
+}
+
+static inline void PIOS_Soft_Serial_Slice_Clear(struct pios_soft_serial_slice *slice, uint16_t mask)
+{
+    for(uint8_t i = 0; i <= FRAME_TOP; ++i) {
+        slice->frame[i] &= ~mask;
+    }
+}
+
+/*
+ * 16x16 bit matrix transpose by swapping ever smaller off-diagonal blocks,
+ * afterwards bit j of m[n] is what bit n of m[j] was.
+ */
+static void PIOS_Soft_Serial_Slice_Transpose(uint16_t *m)
+{
+    uint16_t mask = 0x00ff;
+
+    for(uint8_t j = 8; j; j >>= 1, mask ^= mask << j) {
+        for(uint8_t k = 0; k < 16; k = (k + j + 1) & ~j) {
+            uint16_t t = ((m[k] >> j) ^ m[k + j]) & mask;
+
+            m[k + j] ^= t;
+            m[k] ^= t << j;
+        }
+    }
+}
+
+/*
+ * Frames of the lines in done have their end marker in frame[0]. Short
+ * frames sit one plane higher than long ones, line them up, check them
+ * all at once and transpose the 8 data planes into one byte per line.
+ */
+static void PIOS_Soft_Serial_Slice_Finish(struct pios_soft_serial_slice *slice, uint16_t done, pios_soft_serial_slice_cb callback, uint32_t context)
+{
+    uint16_t data[16];
+    uint16_t parity = 0;
+
+    for(uint8_t j = 0; j < 8; ++j) {
+        data[j] = (slice->frame[2 + j] & slice->long_frame) | (slice->frame[3 + j] & ~slice->long_frame);
+        parity ^= data[j];
+    }
+
+    parity ^= slice->frame[10] & slice->long_frame;
+
+    uint16_t framing = done & ~slice->frame[FRAME_TOP];
+    uint16_t parity_err = done & ~framing & ((slice->parity_even & parity) | (slice->parity_odd & ~parity));
+
+    memset(&data[8], 0, 8 * sizeof(data[0]));
+
+    PIOS_Soft_Serial_Slice_Transpose(data);
+
+    uint8_t bytes[16];
+
+    for(uint8_t n = 0; n < 16; ++n) {
+        bytes[n] = data[n];
+    }
+
+    PIOS_Soft_Serial_Slice_Clear(slice, done);
+
+    callback(context, done, framing, parity_err, bytes);
+}
+
+/*
+ * Walk the new samples one port-wide word at a time. Lines in hunt start
+ * a countdown to their start bit center on the first space sample, the
+ * others count down to their next bit center. At a center the 2-of-3
+ * vote of the samples around it is shifted into the frame planes of just
+ * those lines; the end marker loaded with the start bit tells when a line
+ * has its stop bit.
+ */
+void PIOS_Soft_Serial_Slice_Decode(struct pios_soft_serial_slice *slice, const uint16_t *ring, uint16_t ring_size, uint16_t samples, pios_soft_serial_slice_cb callback, uint32_t context)
+{
+    slice->avail += samples;
+
+    /* the vote needs the sample after the center */
+    while(slice->avail > 1) {
+        uint16_t prev = slice->pos ? slice->pos - 1 : ring_size - 1;
+        uint16_t next = (slice->pos + 1 < ring_size) ? slice->pos + 1 : 0;
+
+        uint16_t a = ring[prev] ^ slice->inverted;
+        uint16_t b = ring[slice->pos] ^ slice->inverted;
+        uint16_t c = ring[next] ^ slice->inverted;
+
+        uint16_t center = PIOS_Soft_Serial_Slice_Tick(slice, slice->lines & ~slice->hunt);
+
+        if(center) {
+            uint16_t vote = (a & b) | (c & (a | b));
+
+            for(uint8_t i = 0; i < FRAME_TOP; ++i) {
+                slice->frame[i] = (slice->frame[i] & ~center) | (slice->frame[i + 1] & center);
+            }
+
+            slice->frame[FRAME_TOP] = (slice->frame[FRAME_TOP] & ~center) | (vote & center);
+
+            PIOS_Soft_Serial_Slice_Load(slice, center, slice->oversample);
+
+            /* mark at the start bit center, that was a glitch */
+            uint16_t glitch = center & slice->first & vote;
+
+            slice->first &= ~center;
+
+            if(glitch) {
+                PIOS_Soft_Serial_Slice_Clear(slice, glitch);
+                slice->hunt |= glitch;
+            }
+
+            uint16_t done = center & slice->frame[0];
+
+            if(done) {
+                PIOS_Soft_Serial_Slice_Finish(slice, done, callback, context);
+                slice->hunt |= done;
+                slice->wait_mark |= done & ~vote;
+            }
+        }
+
+        /* the rest of a space stop bit is not a start bit */
+        slice->wait_mark &= ~b;
+
+        uint16_t start = slice->hunt & ~b & ~slice->wait_mark;
+
+        if(start) {
+            slice->hunt &= ~start;
+            slice->first |= start;
+
+            PIOS_Soft_Serial_Slice_Load(slice, start, slice->oversample / 2);
+
+            /* end marker reaches frame[0] with the stop bit center */
+            slice->frame[FRAME_TOP] |= start & slice->long_frame;
+            slice->frame[FRAME_TOP - 1] |= start & ~slice->long_frame;
+        }
+
+        if(++slice->pos == ring_size) {
+            slice->pos = 0;
+        }
+        --slice->avail;
+    }
+}
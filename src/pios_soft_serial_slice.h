@@ -0,0 +1,76 @@
+/**
+ ******************************************************************************
+ * @addtogroup PIOS PIOS Core hardware abstraction layer
+ * @{
+ * @addtogroup PIOS_SOFT_SERIAL Bit-sliced receiver
+ * @brief PiOS Soft Serial parallel decoder for all lines of a GPIO port
+ * @{
+ *
+ * @file       pios_soft_serial_slice.h
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      Soft Serial bit-sliced receiver header
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef PIOS_SOFT_SERIAL_SLICE_H
+#define PIOS_SOFT_SERIAL_SLICE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "pios_com.h"
+
+/* start + 8 data + parity or 9th bit + stop */
+#define PIOS_SOFT_SERIAL_SLICE_FRAME_MAX 11
+
+/*
+ * One 16 bit IDR sample holds one sample of every line on the port, so
+ * all decoder state is kept the same way: bit n of every word below
+ * belongs to line n.
+ */
+struct pios_soft_serial_slice {
+    uint16_t lines;         /* lines being decoded */
+    uint16_t inverted;      /* lines idling low */
+    uint16_t long_frame;    /* lines with parity or 9 bit words */
+    uint16_t parity_even;
+    uint16_t parity_odd;
+
+    uint16_t hunt;          /* lines waiting for a start bit */
+    uint16_t first;         /* lines heading for their start bit center */
+    uint16_t wait_mark;     /* lines whose stop bit was a space, no start bit before mark */
+    uint16_t count[4];      /* countdown to next bit center, one plane per counter bit */
+    uint16_t frame[PIOS_SOFT_SERIAL_SLICE_FRAME_MAX + 1]; /* bit centers received so far, plus end marker */
+
+    uint8_t oversample;     /* samples per bit */
+
+    uint16_t pos;           /* next sample to look at */
+    uint16_t avail;         /* samples ready from pos on */
+};
+
+/*
+ * Called whenever frames end: bytes[n] holds the byte received on line n
+ * for every line in done that is in neither framing nor parity.
+ */
+typedef void (*pios_soft_serial_slice_cb)(uint32_t context, uint16_t done, uint16_t framing, uint16_t parity, const uint8_t *bytes);
+
+void PIOS_Soft_Serial_Slice_Init(struct pios_soft_serial_slice *slice, uint8_t oversample);
+void PIOS_Soft_Serial_Slice_Configure(struct pios_soft_serial_slice *slice, uint16_t lines, bool inverted, enum PIOS_COM_Word_Length word_len, enum PIOS_COM_Parity parity);
+void PIOS_Soft_Serial_Slice_Reset(struct pios_soft_serial_slice *slice);
+void PIOS_Soft_Serial_Slice_Decode(struct pios_soft_serial_slice *slice, const uint16_t *ring, uint16_t ring_size, uint16_t samples, pios_soft_serial_slice_cb callback, uint32_t context);
+
+#endif /* PIOS_SOFT_SERIAL_SLICE_H */
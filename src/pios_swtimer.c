@@ -0,0 +1,363 @@
+/**
+ ******************************************************************************
+ * @addtogroup PIOS PIOS Core hardware abstraction layer
+ * @{
+ * @addtogroup PIOS_SWTIMER Software timers
+ * @brief One-shot and periodic callbacks sharing one hardware timer
+ * @{
+ *
+ * @file       pios_swtimer.c
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      Software timer service
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "pios.h"
+#include "pios_swtimer.h"
+#include "pios_irq.h"
+#include "pios_tim.h"
+#include "pios_instrumentation.h"
+
+#ifdef PIOS_INCLUDE_SWTIMER
+
+/*
+ * Hierarchical wheel over a 32 bit microsecond time. Level l holds the
+ * timers whose expiry agrees with the wheel time above its bits
+ * 5 * l .. 5 * l + 4, in the slot those bits select. Level 0 slots are
+ * due at exactly that microsecond, a higher slot is cascaded to the levels
+ * below once the wheel time reaches its start, so the lowest occupied
+ * level always holds the next thing to do. The hardware compare is set
+ * to that instead of ticking through the empty microseconds.
+ */
+#define SWTIMER_LEVEL_BITS 5
+#define SWTIMER_SLOTS      (1 << SWTIMER_LEVEL_BITS)
+#define SWTIMER_LEVELS     ((32 + SWTIMER_LEVEL_BITS - 1) / SWTIMER_LEVEL_BITS)
+
+/* longest compare sleep, the 16 bit counter is extended at least this often */
+#define SWTIMER_MAX_SLEEP  0x8000
+
+static const struct pios_swtimer_cfg *swtimer_cfg;
+static __IO uint16_t *swtimer_ccr;
+static uint16_t swtimer_ccif;
+static uint8_t swtimer_prio;
+
+static uint32_t swtimer_time;   /* service time at counter value swtimer_cnt */
+static uint16_t swtimer_cnt;
+static uint32_t swtimer_now;    /* everything due up to here has run */
+
+static uint32_t swtimer_occupied[SWTIMER_LEVELS];
+static struct pios_swtimer *swtimer_wheel[SWTIMER_LEVELS * SWTIMER_SLOTS];
+
+#ifdef PIOS_INCLUDE_DELAY
+/* reads the cycle counter often enough for PIOS_DELAY_GetRaw64() to extend it */
+static struct pios_swtimer swtimer_delay_extend;
+
+static void PIOS_SWTimer_Delay_Extend(__attribute__((unused)) struct pios_swtimer *timer, __attribute__((unused)) uint32_t context)
+{
+    PIOS_DELAY_GetRaw64();
+}
+#endif
+
+/* callers mask the service irq */
+static uint32_t PIOS_SWTimer_Time(void)
+{
+    uint16_t cnt = swtimer_cfg->timer->CNT;
+
+    swtimer_time += (uint16_t)(cnt - swtimer_cnt);
+    swtimer_cnt = cnt;
+
+    return swtimer_time;
+}
+
+static void PIOS_SWTimer_Insert(struct pios_swtimer *timer)
+{
+    if((int32_t)(timer->expires - swtimer_now) < 0) {
+        timer->expires = swtimer_now;
+    }
+
+    uint32_t diff = timer->expires ^ swtimer_now;
+    uint8_t level = diff ? (31 - __builtin_clz(diff)) / SWTIMER_LEVEL_BITS : 0;
+    uint8_t index = (timer->expires >> (level * SWTIMER_LEVEL_BITS)) & (SWTIMER_SLOTS - 1);
+
+    timer->slot = level * SWTIMER_SLOTS + index;
+
+    struct pios_swtimer **head = &swtimer_wheel[timer->slot];
+
+    timer->next = *head;
+    if(timer->next) {
+        timer->next->prev = &timer->next;
+    }
+    timer->prev = head;
+    *head = timer;
+
+    swtimer_occupied[level] |= 1u << index;
+}
+
+static void PIOS_SWTimer_Remove(struct pios_swtimer *timer)
+{
+    *timer->prev = timer->next;
+    if(timer->next) {
+        timer->next->prev = timer->prev;
+    }
+    timer->prev = 0;
+
+    if(!swtimer_wheel[timer->slot]) {
+        swtimer_occupied[timer->slot / SWTIMER_SLOTS] &= ~(1u << (timer->slot % SWTIMER_SLOTS));
+    }
+}
+
+/* us from swtimer_now to the next slot to run or cascade, UINT32_MAX when idle */
+static uint32_t PIOS_SWTimer_Next(void)
+{
+    for(uint8_t level = 0; level < SWTIMER_LEVELS; ++level) {
+        uint32_t occupied = swtimer_occupied[level];
+
+        if(!occupied) {
+            continue;
+        }
+
+        uint8_t shift = level * SWTIMER_LEVEL_BITS;
+        uint8_t current = (swtimer_now >> shift) & (SWTIMER_SLOTS - 1);
+        uint32_t ahead = occupied & (~0u << current);
+
+        /* only the top level wraps, the subtraction wraps with it */
+        uint8_t index = __builtin_ctz(ahead ? ahead : occupied);
+
+        return ((uint32_t)(index - current) << shift) - (swtimer_now & ((1u << shift) - 1));
+    }
+
+    return UINT32_MAX;
+}
+
+/* brings the wheel up to time, running what is due in order */
+static void PIOS_SWTimer_Run(uint32_t time)
+{
+    uint32_t next;
+
+    while((next = PIOS_SWTimer_Next()) <= time - swtimer_now) {
+        struct pios_swtimer *timer;
+
+        swtimer_now += next;
+
+        /* top down, so a timer cascades all the way in one go */
+        for(uint8_t level = SWTIMER_LEVELS - 1; level > 0; --level) {
+            uint8_t shift = level * SWTIMER_LEVEL_BITS;
+
+            if(swtimer_now & ((1u << shift) - 1)) {
+                continue;
+            }
+
+            uint16_t slot = level * SWTIMER_SLOTS + ((swtimer_now >> shift) & (SWTIMER_SLOTS - 1));
+
+            while((timer = swtimer_wheel[slot])) {
+                PIOS_SWTimer_Remove(timer);
+                PIOS_SWTimer_Insert(timer);
+            }
+        }
+
+        uint16_t slot = swtimer_now & (SWTIMER_SLOTS - 1);
+
+        while((timer = swtimer_wheel[slot])) {
+            PIOS_SWTimer_Remove(timer);
+
+            if(timer->period) {
+                /* periods missed while the irq was held off are skipped, not run in a burst */
+                do {
+                    timer->expires += timer->period;
+                } while((int32_t)(timer->expires - time) <= 0);
+
+                PIOS_SWTimer_Insert(timer);
+            }
+
+            timer->callback(timer, timer->context);
+        }
+    }
+
+    swtimer_now = time;
+}
+
+/* sets the compare to the next deadline, or the longest sleep */
+static void PIOS_SWTimer_Reschedule(void)
+{
+    uint32_t time = PIOS_SWTimer_Time();
+    uint32_t next = PIOS_SWTimer_Next();
+    uint16_t sleep = SWTIMER_MAX_SLEEP;
+
+    if(next != UINT32_MAX) {
+        int32_t until = swtimer_now + next - time;
+
+        if(until < SWTIMER_MAX_SLEEP) {
+            sleep = (until > 0) ? until : 0;
+        }
+    }
+
+    *swtimer_ccr = swtimer_cnt + sleep;
+
+    /* the count may be at or past the compare already, then it never matches */
+    if((uint16_t)(swtimer_cfg->timer->CNT - swtimer_cnt) >= sleep) {
+        swtimer_cfg->timer->EGR = swtimer_ccif;
+    }
+}
+
+/**
+ * Starts the service on a timer of its own, counting microseconds
+ * \param[in] cfg
+ * \return -1 if the timer clock is not a whole number of MHz
+ */
+int32_t PIOS_SWTimer_Init(const struct pios_swtimer_cfg *cfg)
+{
+    PIOS_DEBUG_Assert(cfg);
+    PIOS_DEBUG_Assert(cfg->irq.init.NVIC_IRQChannelPreemptionPriority > 0);
+
+    uint32_t timer_clock = PIOS_TIM_Ck_Int(cfg->timer);
+
+    if(!timer_clock || timer_clock % 1000000) {
+        return -1;
+    }
+
+    TIM_TimeBaseInitTypeDef timerInitCfg = {
+        .TIM_Prescaler         = timer_clock / 1000000 - 1,
+        .TIM_ClockDivision     = TIM_CKD_DIV1,
+        .TIM_CounterMode       = TIM_CounterMode_Up,
+        .TIM_Period            = 0xffff,
+        .TIM_RepetitionCounter = 0x0000,
+    };
+
+    swtimer_cfg = cfg;
+    swtimer_ccr = &cfg->timer->CCR1 + (cfg->tim_channel >> 2) * 2;
+    swtimer_ccif = TIM_IT_CC1 << (cfg->tim_channel >> 2);
+    swtimer_prio = cfg->irq.init.NVIC_IRQChannelPreemptionPriority;
+
+    TIM_Cmd(cfg->timer, DISABLE);
+    TIM_TimeBaseInit(cfg->timer, &timerInitCfg);
+
+    swtimer_cnt = cfg->timer->CNT;
+
+    cfg->timer->SR = (uint16_t)~swtimer_ccif;
+    cfg->timer->DIER |= swtimer_ccif;
+
+    NVIC_InitTypeDef irq = cfg->irq.init;
+    irq.NVIC_IRQChannelCmd = ENABLE;
+    NVIC_Init(&irq);
+
+    uint32_t prev_mask = PIOS_IRQ_Mask(swtimer_prio);
+
+    PIOS_SWTimer_Reschedule();
+
+    PIOS_IRQ_Unmask(prev_mask);
+
+    TIM_Cmd(cfg->timer, ENABLE);
+
+#ifdef PIOS_INCLUDE_DELAY
+    PIOS_SWTimer_Start(&swtimer_delay_extend, PIOS_DELAY_EXTEND_PERIOD_US, PIOS_DELAY_EXTEND_PERIOD_US, PIOS_SWTimer_Delay_Extend, 0);
+#endif
+
+    return 0;
+}
+
+/**
+ * Arms a timer, restarting it if it is pending
+ * \param[in] timer
+ * \param[in] delay_us until the first call, up to PIOS_SWTIMER_MAX_DELAY
+ * \param[in] period_us between the following calls, 0 for one call only
+ * \param[in] callback
+ * \param[in] context passed to callback
+ */
+void PIOS_SWTimer_Start(struct pios_swtimer *timer, uint32_t delay_us, uint32_t period_us,
+                        pios_swtimer_callback callback, uint32_t context)
+{
+    PIOS_DEBUG_Assert(swtimer_cfg);
+    PIOS_DEBUG_Assert(callback);
+    PIOS_DEBUG_Assert(delay_us <= PIOS_SWTIMER_MAX_DELAY && period_us <= PIOS_SWTIMER_MAX_DELAY);
+
+    uint32_t prev_mask = PIOS_IRQ_Mask(swtimer_prio);
+
+    if(timer->prev) {
+        PIOS_SWTimer_Remove(timer);
+    }
+
+    timer->callback = callback;
+    timer->context = context;
+    timer->period = period_us;
+    timer->expires = PIOS_SWTimer_Time() + delay_us;
+
+    PIOS_SWTimer_Insert(timer);
+    PIOS_SWTimer_Reschedule();
+
+    PIOS_IRQ_Unmask(prev_mask);
+}
+
+/**
+ * Stops a timer, its callback does not run after this returns
+ * \param[in] timer
+ * \return true if it was pending
+ */
+bool PIOS_SWTimer_Cancel(struct pios_swtimer *timer)
+{
+    uint32_t prev_mask = PIOS_IRQ_Mask(swtimer_prio);
+
+    bool pending = timer->prev != 0;
+
+    if(pending) {
+        PIOS_SWTimer_Remove(timer);
+    }
+
+    PIOS_IRQ_Unmask(prev_mask);
+
+    /* the compare stays, an early wake up finds nothing to do */
+    return pending;
+}
+
+/**
+ * The service time timers are started against
+ * \return microseconds, wraps at 32 bits
+ */
+uint32_t PIOS_SWTimer_GetuS(void)
+{
+    uint32_t prev_mask = PIOS_IRQ_Mask(swtimer_prio);
+
+    uint32_t time = PIOS_SWTimer_Time();
+
+    PIOS_IRQ_Unmask(prev_mask);
+
+    return time;
+}
+
+void PIOS_SWTimer_IRQ_Handler(void)
+{
+    PIOS_INSTRUMENTATION_SCOPE(PIOS_INSTRUMENTATION_SWTIMER_IRQ);
+
+    TIM_TypeDef *timer = swtimer_cfg->timer;
+
+    if(!(timer->SR & swtimer_ccif)) {
+        return;
+    }
+
+    timer->SR = (uint16_t)~swtimer_ccif;
+
+    PIOS_SWTimer_Run(PIOS_SWTimer_Time());
+    PIOS_SWTimer_Reschedule();
+}
+
+#endif /* PIOS_INCLUDE_SWTIMER */
+
+/**
+ * @}
+ * @}
+ */
@@ -0,0 +1,84 @@
+/**
+ ******************************************************************************
+ * @addtogroup PIOS PIOS Core hardware abstraction layer
+ * @{
+ * @addtogroup PIOS_SWTIMER Software timers
+ * @brief One-shot and periodic callbacks sharing one hardware timer
+ * @{
+ *
+ * @file       pios_swtimer.h
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      Software timer service header
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef PIOS_SWTIMER_H
+#define PIOS_SWTIMER_H
+
+#include "pios.h"
+
+/* longest delay or period, in us */
+#define PIOS_SWTIMER_MAX_DELAY (1u << 29)
+
+struct pios_swtimer;
+
+/* runs from the service interrupt, may start or cancel any timer including its own */
+typedef void (*pios_swtimer_callback)(struct pios_swtimer *timer, uint32_t context);
+
+/* owned by the caller, zeroed (static storage) before its first start */
+struct pios_swtimer {
+    struct pios_swtimer *next;
+    struct pios_swtimer **prev;     /* the link pointing at this timer, 0 when not pending */
+    uint32_t expires;               /* service time, us */
+    uint32_t period;                /* us, 0 for one-shot */
+    uint16_t slot;
+    pios_swtimer_callback callback;
+    uint32_t context;
+};
+
+struct pios_swtimer_cfg {
+    TIM_TypeDef *timer;             /* for the service alone, counts us */
+    uint16_t tim_channel;           /* compare channel waking the service */
+    struct stm32_irq irq;           /* priority above 0, the timers mask up to it */
+};
+
+extern int32_t PIOS_SWTimer_Init(const struct pios_swtimer_cfg *cfg);
+
+/*
+ * From the service interrupt or anything it preempts. Starting a pending
+ * timer restarts it.
+ */
+extern void PIOS_SWTimer_Start(struct pios_swtimer *timer, uint32_t delay_us, uint32_t period_us,
+                               pios_swtimer_callback callback, uint32_t context);
+extern bool PIOS_SWTimer_Cancel(struct pios_swtimer *timer);
+extern uint32_t PIOS_SWTimer_GetuS(void);
+
+static inline bool PIOS_SWTimer_Pending(const struct pios_swtimer *timer)
+{
+    return timer->prev != 0;
+}
+
+/* to be called from the configured timer's IRQ handler */
+extern void PIOS_SWTimer_IRQ_Handler(void);
+
+#endif /* PIOS_SWTIMER_H */
+
+/**
+ * @}
+ * @}
+ */
@@ -2,31 +2,88 @@
 
 #define PERIPH_BASE_MASK 0xffff0000
 
-uint32_t PIOS_TIM_Ck_Int(__attribute__((unused)) TIM_TypeDef *timer)
+/*
+ * Timer clocks decoded from the clock tree. Everything they depend on is
+ * in RCC->CFGR (and the PLL registers below), so the cache is keyed by
+ * those: any RCC change makes the next lookup decode again. Lookups
+ * racing each other decode the same values.
+ */
+static struct {
+    uint32_t cfgr;
+#if defined(STM32F10X_CL) || defined(STM32F3)
+    uint32_t cfgr2;
+#elif defined(STM32F4)
+    uint32_t pllcfgr;
+#endif
+    uint32_t apb1;      /* 0 until decoded */
+    uint32_t apb2;
+} tim_clock;
+
+static bool PIOS_TIM_Clock_Valid(uint32_t cfgr)
+{
+    return tim_clock.apb1 && tim_clock.cfgr == cfgr
+#if defined(STM32F10X_CL) || defined(STM32F3)
+           && tim_clock.cfgr2 == RCC->CFGR2
+#elif defined(STM32F4)
+           && tim_clock.pllcfgr == RCC->PLLCFGR
+#endif
+    ;
+}
+
+static void PIOS_TIM_Clock_Update(uint32_t cfgr)
 {
     RCC_ClocksTypeDef clocks;
 
     RCC_GetClocksFreq(&clocks);
 
-    uint32_t timer_clock = 0;
-    uint32_t apb_hclk_div = 0;
+    /* timers run at twice a divided APB clock */
+    tim_clock.apb1 = clocks.PCLK1_Frequency * ((cfgr & RCC_CFGR_PPRE1_2) ? 2 : 1);
+    tim_clock.apb2 = clocks.PCLK2_Frequency * ((cfgr & RCC_CFGR_PPRE2_2) ? 2 : 1);
+
+#if defined(STM32F10X_CL) || defined(STM32F3)
+    tim_clock.cfgr2 = RCC->CFGR2;
+#elif defined(STM32F4)
+    tim_clock.pllcfgr = RCC->PLLCFGR;
+#endif
+    tim_clock.cfgr = cfgr;
+}
+
+uint32_t PIOS_TIM_Ck_Int(TIM_TypeDef *timer)
+{
+    uint32_t cfgr = RCC->CFGR;
+
+    if(!PIOS_TIM_Clock_Valid(cfgr)) {
+        PIOS_TIM_Clock_Update(cfgr);
+    }
 
     switch((uint32_t)timer & PERIPH_BASE_MASK)
     {
         case APB1PERIPH_BASE:
-            timer_clock = clocks.PCLK1_Frequency;
-            apb_hclk_div = RCC->CFGR & RCC_CFGR_PPRE1_2;
-            break;
+            return tim_clock.apb1;
         case APB2PERIPH_BASE:
-            timer_clock = clocks.PCLK2_Frequency;
-            apb_hclk_div = RCC->CFGR & RCC_CFGR_PPRE2_2;
-            break;
+            return tim_clock.apb2;
     }
 
-    if(apb_hclk_div) {
-        timer_clock *= 2;
+    return 0;
+}
+
+int32_t PIOS_TIM_Period(TIM_TypeDef *timer, uint32_t rate, struct pios_tim_period *period)
+{
+    uint32_t ck_int = PIOS_TIM_Ck_Int(timer);
+
+    /* ARR 0 stops the counter */
+    if(!rate || rate > ck_int / 2) {
+        return -1;
     }
 
-    return timer_clock;
-}
+    uint32_t ticks = (ck_int + rate / 2) / rate;
+
+    /* the finest prescaler that lets the period fit ARR, never past 16 bits below 2^32 ticks */
+    uint32_t div = ((ticks - 1) >> 16) + 1;
+    uint32_t tick_rate = rate * div;
 
+    period->psc = div - 1;
+    period->arr = (ck_int + tick_rate / 2) / tick_rate - 1;
+
+    return 0;
+}
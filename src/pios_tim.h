@@ -3,8 +3,38 @@
 
 #include "pios.h"
 
+/* cached, decoded again after clock tree changes */
 uint32_t PIOS_TIM_Ck_Int(TIM_TypeDef *timer);
 
+/* register values for a counter wrapping rate times per second */
+struct pios_tim_period {
+    uint16_t psc;
+    uint16_t arr;
+};
+
+/*
+ * The finest prescaler ARR fits with and the nearest ARR for it, off by
+ * half a tick at most, under 16 ppm once a prescaler is needed. Fails
+ * for rates above half the timer clock.
+ */
+int32_t PIOS_TIM_Period(TIM_TypeDef *timer, uint32_t rate, struct pios_tim_period *period);
+
+/*
+ * ARR right away (or at the next update with ARR preload), PSC too through an update event only if it changed.
+ * A counter already past a shorter ARR restarts instead of running up to the 16 bit wrap.
+ */
+static inline void PIOS_TIM_SetPeriod(TIM_TypeDef *timer, const struct pios_tim_period *period)
+{
+    timer->ARR = period->arr;
+
+    if(timer->PSC != period->psc) {
+        timer->PSC = period->psc;
+        timer->EGR = TIM_EGR_UG;
+    } else if(timer->CNT > period->arr) {
+        timer->CNT = 0;
+    }
+}
+
 #define PIOS_TIM_CHANNEL_DIER_CCxDE(tim_chan) (TIM_DIER_CC1DE << (tim_chan >> 2))
 #define PIOS_TIM_CHANNEL_DIER_CCxIE(tim_chan) (TIM_DIER_CC1IE << (tim_chan >> 2))
 
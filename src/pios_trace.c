@@ -0,0 +1,58 @@
+/**
+ ******************************************************************************
+ * @addtogroup PIOS PIOS Core hardware abstraction layer
+ * @{
+ * @addtogroup PIOS_TRACE Event trace
+ * @brief Timestamped driver events in a RAM ring
+ * @{
+ *
+ * @file       pios_trace.c
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      Event trace
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "pios.h"
+#include "pios_trace.h"
+
+#ifdef PIOS_INCLUDE_TRACE
+
+#if PIOS_TRACE_EVENTS & (PIOS_TRACE_EVENTS - 1)
+# error PIOS_TRACE_EVENTS must be a power of two
+#endif
+
+struct pios_trace_ring pios_trace_ring = {
+    .magic = PIOS_TRACE_MAGIC,
+    .size = PIOS_TRACE_EVENTS,
+};
+
+void PIOS_Trace_Init(void)
+{
+    RCC_ClocksTypeDef clocks;
+
+    RCC_GetClocksFreq(&clocks);
+    pios_trace_ring.clock = clocks.SYSCLK_Frequency;
+}
+
+#endif /* PIOS_INCLUDE_TRACE */
+
+/**
+ * @}
+ * @}
+ */
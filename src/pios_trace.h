@@ -0,0 +1,113 @@
+/**
+ ******************************************************************************
+ * @addtogroup PIOS PIOS Core hardware abstraction layer
+ * @{
+ * @addtogroup PIOS_TRACE Event trace
+ * @brief Timestamped driver events in a RAM ring
+ * @{
+ *
+ * @file       pios_trace.h
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      Event trace header
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef PIOS_TRACE_H
+#define PIOS_TRACE_H
+
+#include <stdint.h>
+#include "pios_delay.h"
+
+/* keep tools/pios_trace_decode.py in step */
+enum pios_trace_event_id {
+    PIOS_TRACE_DMA_QUEUE,                   /* arg: channel queue number, DMA1 channel 1 is 0 */
+    PIOS_TRACE_DMA_BEGIN,
+    PIOS_TRACE_DMA_COMPLETE,
+    PIOS_TRACE_DMA_HALFTRANSFER,
+    PIOS_TRACE_DMA_ERROR,
+    PIOS_TRACE_EXTI,                        /* arg: line */
+    PIOS_TRACE_SOFT_SERIAL_STATE,           /* + new state, arg: low half of the device address */
+    PIOS_TRACE_COM_RX = PIOS_TRACE_SOFT_SERIAL_STATE + 4, /* arg: bytes taken by the COM layer */
+    PIOS_TRACE_COM_TX,                      /* arg: bytes handed out by the COM layer */
+};
+
+/* power of two, 8 bytes each */
+#ifndef PIOS_TRACE_EVENTS
+# define PIOS_TRACE_EVENTS 512
+#endif
+
+#define PIOS_TRACE_MAGIC 0x43525450 /* "PTRC" in a little endian dump */
+
+struct pios_trace_event {
+    uint32_t time;          /* DWT cycles */
+    uint16_t event;
+    uint16_t arg;
+};
+
+/* laid out for the decoder, which finds it in a RAM dump by its magic */
+struct pios_trace_ring {
+    uint32_t magic;
+    uint32_t clock;         /* cycles per second, 0 before PIOS_Trace_Init() */
+    uint32_t size;          /* events */
+    volatile uint32_t head; /* events recorded so far, the next one goes to head % size */
+    struct pios_trace_event events[PIOS_TRACE_EVENTS];
+};
+
+#ifdef PIOS_INCLUDE_TRACE
+
+extern struct pios_trace_ring pios_trace_ring;
+
+/*
+ * Lock-free from any context: the slot is claimed with LDREX/STREX and
+ * the timestamp read inside the same exclusive pair, so an interrupt in
+ * between makes the claim retry and slots stay in time order.
+ */
+static inline void PIOS_Trace_Record(uint16_t event, uint16_t arg)
+{
+    uint32_t slot;
+    uint32_t time;
+
+    do {
+        slot = __LDREXW(&pios_trace_ring.head);
+        time = DWT_CYCCNT;
+    } while(__STREXW(slot + 1, &pios_trace_ring.head));
+
+    struct pios_trace_event *entry = &pios_trace_ring.events[slot & (PIOS_TRACE_EVENTS - 1)];
+
+    entry->time = time;
+    entry->event = event;
+    entry->arg = arg;
+}
+
+#define PIOS_TRACE(event, arg) PIOS_Trace_Record((event), (arg))
+
+/* after PIOS_DELAY_Init(), records the clock for the decoder */
+void PIOS_Trace_Init(void);
+
+#else
+
+#define PIOS_TRACE(event, arg)
+
+#endif /* PIOS_INCLUDE_TRACE */
+
+#endif /* PIOS_TRACE_H */
+
+/**
+ * @}
+ * @}
+ */
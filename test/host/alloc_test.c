@@ -0,0 +1,163 @@
+/**
+ ******************************************************************************
+ * @file       alloc_test.c
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      Timer DMA request lines: channel choice and rejected configs
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/* for the device and group counts, and the channel of a request line */
+#include "pios_soft_serial.c"
+#include "pios_dma.c"
+
+#include "test.h"
+
+/*
+ * TIM4 CH1 requests on channel 1 only, a config naming channel 2 is
+ * refused. That must leave no device or group taken and the timer off.
+ */
+static void check_soft_serial(void)
+{
+    static const struct pios_soft_serial_config wrong = {
+        .dma_stream = DMA1_Channel2,
+        .timer = TIM4,
+        .tim_channel = TIM_Channel_1,
+    };
+    static const struct pios_soft_serial_config right = {
+        .timer = TIM4,
+        .tim_channel = TIM_Channel_1,
+    };
+    uint32_t id;
+
+    for (uint8_t n = 0; n < PIOS_SOFT_SERIAL_MAX_DEV; ++n) {
+        TEST_EQ(PIOS_Soft_Serial_Init(&id, &wrong), -1);
+        TEST_EQ(PIOS_Soft_Serial_Group_Init(&id, &wrong), -1);
+    }
+
+    TEST_EQ(soft_serial_count, 0);
+    TEST_EQ(soft_serial_group_count, 0);
+    TEST_EQ(TIM4->CR1 & TIM_CR1_CEN, 0);
+
+    TEST_EQ(PIOS_Soft_Serial_Init(&id, &right), 0);
+
+    TEST_EQ(soft_serial_count, 1);
+    TEST_EQ(((struct pios_soft_serial_device *)id)->dma_stream, DMA1_Channel1);
+    TEST_TRUE(TIM4->CR1 & TIM_CR1_CEN);
+}
+
+/* RM0008 table 78, DMA1 requests of TIM1..4, channels 1..7 and 0 for none */
+static const struct {
+    TIM_TypeDef *timer;
+    uint8_t channel[7];     /* CC1, CC2, CC3, CC4, Update, Trigger, COM */
+} rm0008[] = {
+    { TIM1, { 2, 3, 6, 4, 5, 4, 4 } },
+    { TIM2, { 5, 7, 1, 7, 2, 0, 0 } },
+    { TIM3, { 6, 0, 2, 3, 3, 6, 0 } },
+    { TIM4, { 1, 4, 5, 0, 7, 0, 0 } },
+};
+
+static const uint16_t sources[7] = {
+    TIM_DMA_CC1, TIM_DMA_CC2, TIM_DMA_CC3, TIM_DMA_CC4, TIM_DMA_Update, TIM_DMA_Trigger, TIM_DMA_COM,
+};
+
+static DMA_Channel_TypeDef *const channels[8] = {
+    0, DMA1_Channel1, DMA1_Channel2, DMA1_Channel3, DMA1_Channel4, DMA1_Channel5, DMA1_Channel6, DMA1_Channel7,
+};
+
+static int32_t request_init(DMA_Channel_TypeDef *stream, TIM_TypeDef *timer, uint16_t source)
+{
+    uint32_t handle;
+    struct pios_dma_config config = {
+        .stream = stream,
+        .irq = {
+            .NVIC_IRQChannelPreemptionPriority = PIOS_IRQ_PRIO_MID,
+        },
+        .timer = timer,
+        .tim_dma_source = source,
+    };
+
+    return PIOS_DMA_Init(&handle, &config);
+}
+
+/* Every request line of the table on its channel and refused on the others */
+static void check_lines(void)
+{
+    uint32_t wrong_alloc = 0;
+    uint32_t wrong_init = 0;
+
+    for (uint8_t t = 0; t < sizeof(rm0008) / sizeof(rm0008[0]); ++t) {
+        for (uint8_t s = 0; s < 7; ++s) {
+            DMA_Channel_TypeDef *expect = channels[rm0008[t].channel[s]];
+
+            wrong_alloc += PIOS_DMA_Alloc_TIM(rm0008[t].timer, sources[s]) != expect;
+
+            /* only the wired channel takes it, nothing is initialized on the others */
+            for (uint8_t ch = 1; ch <= 7; ++ch) {
+                if (channels[ch] != expect) {
+                    wrong_init += request_init(channels[ch], rm0008[t].timer, sources[s]) != -1;
+                }
+            }
+        }
+    }
+
+    TEST_EQ(wrong_alloc, 0);
+    TEST_EQ(wrong_init, 0);
+
+    /* sources sharing a channel go together, ones spread over channels do not */
+    TEST_EQ(request_init(DMA1_Channel7, TIM2, TIM_DMA_CC2 | TIM_DMA_CC4), 0);
+    TEST_EQ(request_init(DMA1_Channel3, TIM3, TIM_DMA_CC4 | TIM_DMA_Update), 0);
+    TEST_EQ(request_init(DMA1_Channel2, TIM1, TIM_DMA_CC1 | TIM_DMA_CC2), -1);
+
+    /* not a channel */
+    TEST_EQ(request_init((DMA_Channel_TypeDef *)DMA1, 0, 0), -1);
+}
+
+/*
+ * Any of several sources picks the channel with the fewest requests,
+ * the first of equals. Channel 1 has the device's two from above and
+ * channel 7 the TIM2 one.
+ */
+static void check_least_loaded(void)
+{
+    uint16_t any = TIM_DMA_CC1 | TIM_DMA_CC2 | TIM_DMA_CC3 | TIM_DMA_Update;
+    static DMA_Channel_TypeDef *const expect[] = {
+        DMA1_Channel4, DMA1_Channel5, DMA1_Channel4, DMA1_Channel5, DMA1_Channel7, DMA1_Channel1,
+    };
+
+    for (uint8_t n = 0; n < sizeof(expect) / sizeof(expect[0]); ++n) {
+        DMA_Channel_TypeDef *stream = PIOS_DMA_Alloc_TIM(TIM4, any);
+
+        TEST_EQ(stream, expect[n]);
+        TEST_EQ(request_init(stream, TIM4, PIOS_DMA_TIM_Sources(PIOS_DMA_Queue_Nr(stream), TIM4) & any), 0);
+    }
+
+    TEST_EQ(PIOS_DMA_Alloc_TIM(TIM4, TIM_DMA_CC4), 0);
+}
+
+int main(void)
+{
+    sim_init();
+    NVIC_PriorityGroupConfig(NVIC_PriorityGroup_4);
+
+    check_soft_serial();
+    check_lines();
+    check_least_loaded();
+
+    return test_result();
+}
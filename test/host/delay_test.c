@@ -0,0 +1,179 @@
+/**
+ ******************************************************************************
+ * @file       delay_test.c
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      PIOS_DELAY conversions against exact division, 64 bit raw time across wraps
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/* for the reciprocal and the divisors of other clocks */
+#include "pios_delay.c"
+
+#include "test.h"
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static uint64_t rng64(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+
+    return rng_state;
+}
+
+static uint32_t wrong_us;
+static uint32_t wrong_rem;
+static uint32_t wrong_ns;
+
+static void check_cycles(uint32_t cycles)
+{
+    uint32_t rem;
+    uint32_t us = PIOS_DELAY_CyclesTouS(cycles, &rem);
+
+    wrong_us  += us != cycles / us_ticks;
+    wrong_rem += rem != cycles % us_ticks;
+}
+
+static void check_raw(uint64_t raw)
+{
+    uint32_t rem;
+    uint64_t us = PIOS_DELAY_Raw64TouS(raw, &rem);
+
+    wrong_us  += us != raw / us_ticks;
+    wrong_rem += rem != raw % us_ticks;
+
+    /* both sides modulo 2^64 once the nanoseconds no longer fit */
+    wrong_ns  += PIOS_DELAY_RawTonS64(raw) != (uint64_t)((unsigned __int128)raw * 1000 / us_ticks);
+}
+
+/*
+ * Every clock up to 1024 MHz and some to the 4 GHz the nanoseconds allow.
+ * The reciprocal undershoots most near 2^32, so the quotients up there,
+ * and the ones around each wrap of a 64 bit time, go in besides random
+ * ones at every size.
+ */
+static void check_conversions(void)
+{
+    static const uint32_t fast[] = { 1031, 1500, 2047, 2048, 3000, 4093, 4294 };
+    uint32_t clocks = 0;
+
+    for (uint32_t n = 0; n < 1023 + sizeof(fast) / sizeof(fast[0]); ++n) {
+        PIOS_DELAY_SetTicks(n < 1023 ? n + 2 : fast[n - 1023]);
+        ++clocks;
+
+        uint32_t top = 0xffffffff / us_ticks;
+
+        for (uint32_t q = 0; q < 64; ++q) {
+            check_cycles((top - q) * us_ticks);
+            check_cycles((top - q) * us_ticks - 1);
+            check_cycles((top - q) * us_ticks + us_ticks - 1);
+            check_cycles(q * us_ticks + us_ticks - 1);
+        }
+
+        check_cycles(0);
+        check_cycles(0xffffffff);
+
+        for (uint32_t i = 0; i < 1000; ++i) {
+            check_cycles(rng64() >> (rng64() & 31));
+        }
+
+        for (uint8_t shift = 32; shift < 64; ++shift) {
+            uint64_t wrap = 1ull << shift;
+
+            check_raw(wrap);
+            check_raw(wrap - 1);
+            check_raw(wrap / us_ticks * us_ticks);
+            check_raw(wrap / us_ticks * us_ticks - 1);
+        }
+
+        for (uint32_t i = 0; i < 1000; ++i) {
+            check_raw(rng64() >> (rng64() & 63));
+        }
+
+        check_raw(0);
+        check_raw(~0ull);
+    }
+
+    TEST_EQ(wrong_us, 0);
+    TEST_EQ(wrong_rem, 0);
+    TEST_EQ(wrong_ns, 0);
+
+    printf("%u clocks, the conversions are exact\n", clocks);
+}
+
+/*
+ * The cycle counter is the low word of sim_time, read at least every 2^31
+ * cycles the 64 bit time follows it across its wraps. A raw time from up
+ * to 2^31 cycles ago extends to the 64 bit time it was taken at.
+ */
+static void check_raw64(void)
+{
+    uint32_t wrong_raw = 0;
+    uint32_t wrong_extend = 0;
+    uint32_t wrong_time = 0;
+    uint32_t wraps = 0;
+
+    PIOS_DELAY_Init();
+    TEST_EQ(us_ticks, SIM_SYSCLK / 1000000);
+
+    uint64_t offset = sim_time - PIOS_DELAY_GetRaw64();
+    uint32_t last = PIOS_DELAY_GetRaw();
+
+    TEST_EQ(offset, 0);
+
+    for (uint32_t i = 0; i < 200; ++i) {
+        /* mostly long steps, sometimes the longest allowed or a short one */
+        uint64_t step = (i % 5 == 0) ? 0x7fffffff : (i % 5 == 1) ? rng64() % 1000 : rng64() % 0x7fffffff;
+
+        sim_run(step);
+
+        uint32_t now = PIOS_DELAY_GetRaw();
+
+        wraps += now < last;
+        last = now;
+
+        uint64_t raw64 = PIOS_DELAY_GetRaw64();
+
+        wrong_raw += raw64 != sim_time;
+        wrong_time += PIOS_DELAY_GetuS64() != sim_time / us_ticks;
+
+        uint32_t ago = rng64() % 0x80000000;
+
+        wrong_extend += PIOS_DELAY_ExtendRaw((uint32_t)(sim_time - ago)) != sim_time - ago;
+    }
+
+    TEST_TRUE(wraps >= 40);
+    TEST_EQ(wrong_raw, 0);
+    TEST_EQ(wrong_time, 0);
+    TEST_EQ(wrong_extend, 0);
+
+    printf("%u counter wraps, %.1f s\n", wraps, (double)sim_time / SIM_SYSCLK);
+}
+
+int main(void)
+{
+    sim_init();
+    NVIC_PriorityGroupConfig(NVIC_PriorityGroup_4);
+
+    check_conversions();
+    check_raw64();
+
+    return test_result();
+}
@@ -0,0 +1,265 @@
+/**
+ ******************************************************************************
+ * @file       encode_test.c
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      Soft serial frame encoder against a bit by bit reference
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/* for the encoder itself */
+#include "pios_soft_serial.c"
+
+#include "test.h"
+#include "uart.h"
+
+#define BAUD 115200
+#define BENCH_BYTES 10000000
+
+static const struct {
+    const char *name;
+    struct uart_format format;
+} formats[] = {
+    { "8N1", { PIOS_COM_Word_length_8b, PIOS_COM_Parity_No, PIOS_COM_StopBits_1 } },
+    { "8E1", { PIOS_COM_Word_length_8b, PIOS_COM_Parity_Even, PIOS_COM_StopBits_1 } },
+    { "8O1", { PIOS_COM_Word_length_8b, PIOS_COM_Parity_Odd, PIOS_COM_StopBits_1 } },
+    { "8N2", { PIOS_COM_Word_length_8b, PIOS_COM_Parity_No, PIOS_COM_StopBits_2 } },
+    { "9N1", { PIOS_COM_Word_length_9b, PIOS_COM_Parity_No, PIOS_COM_StopBits_1 } },
+};
+
+static const struct pios_soft_serial_config config = {
+    .timer = TIM3,
+    .tim_channel = TIM_Channel_1,
+};
+
+static const struct stm32_gpio tx_pin = {
+    .gpio = GPIOB,
+    .init = {
+        .GPIO_Pin   = GPIO_Pin_10,
+        .GPIO_Speed = GPIO_Speed_50MHz,
+        .GPIO_Mode  = GPIO_Mode_Out_PP,
+    },
+};
+
+/* every byte value once, for the COM layer */
+static uint16_t tx_next;
+
+static uint16_t tx_out(uint32_t context, uint8_t *buf, uint16_t buf_len, uint16_t *headroom, bool *task_woken)
+{
+    uint16_t count = 0;
+
+    while (count < buf_len && tx_next < 256) {
+        buf[count++] = tx_next++;
+    }
+
+    *headroom = 256 - tx_next;
+
+    return count;
+}
+
+/* 9 bit words go out with the 9th bit as mark */
+static uint16_t ref_data(const struct uart_format *f, uint8_t data)
+{
+    return (f->word_len == PIOS_COM_Word_length_9b && f->parity == PIOS_COM_Parity_No) ? data | 0x100 : data;
+}
+
+/* BSRR words against the reference frame */
+static void check_encode(struct pios_soft_serial_device *dev, const struct uart_format *f)
+{
+    for (uint16_t data = 0; data < 256; ++data) {
+        uint32_t words[UART_FRAME_MAX];
+        uint8_t level[UART_FRAME_MAX];
+        uint16_t len  = PIOS_Soft_Serial_Encode(dev, data, words);
+        uint8_t bits  = uart_frame(f, ref_data(f, data), level);
+        uint8_t wrong = 0;
+
+        for (uint8_t i = 0; i < bits && i < len; ++i) {
+            wrong += words[i] != (level[i] ? tx_pin.init.GPIO_Pin : tx_pin.init.GPIO_Pin << 16);
+        }
+
+        TEST_EQ(len, bits);
+        TEST_EQ(wrong, 0);
+    }
+}
+
+/* The same frames on the simulated pin, through the dma path */
+static void check_wire(uint32_t id, const struct uart_format *f, struct uart_wave *wave)
+{
+    static uint8_t frames[256][UART_FRAME_MAX];
+    uint8_t bits = uart_frame(f, 0, frames[0]);
+    double bit_cycles = (double)SIM_SYSCLK / BAUD;
+    uint32_t misaligned;
+
+    uart_wave_reset(wave);
+    tx_next = 0;
+    pios_soft_serial_driver.tx_start(id, 256);
+    sim_run(256 * (bits + 2) * bit_cycles);
+
+    uint32_t found = uart_wave_frames(wave, f, bits, bit_cycles, frames, 0, 256, &misaligned);
+
+    TEST_EQ(found, 256);
+    TEST_EQ(misaligned, 0);
+
+    for (uint32_t i = 0; i < found; ++i) {
+        uint8_t level[UART_FRAME_MAX];
+
+        uart_frame(f, ref_data(f, i), level);
+        TEST_EQ(memcmp(frames[i], level, bits), 0);
+    }
+}
+
+/*
+ * Worst offset in cycles of an edge from the bit grid of its frame's
+ * start edge. A frame starts at the first edge into the start bit once
+ * the one before is out to its stop bit.
+ */
+static double frame_edge_error(const struct uart_wave *wave, uint8_t bits, double bit_cycles)
+{
+    double worst = 0;
+    uint64_t start = 0;
+    bool framed = false;
+
+    for (uint32_t e = 0; e < wave->count; ++e) {
+        if (!wave->level[e] && (!framed || wave->time[e] >= start + (bits - 0.5) * bit_cycles)) {
+            start  = wave->time[e];
+            framed = true;
+            continue;
+        }
+
+        if (!framed) {
+            continue;
+        }
+
+        double phase = (wave->time[e] - start) / bit_cycles;
+        double off   = (phase - (uint64_t)(phase + 0.5)) * bit_cycles;
+
+        if (off > worst || -off > worst) {
+            worst = off > 0 ? off : -off;
+        }
+    }
+
+    return worst;
+}
+
+/*
+ * 921600 baud at 72 MHz is 78.125 ticks a bit. Whole tick periods are
+ * 1/8 tick short per bit, past one tick by the stop bit. With the ARR
+ * dither table every edge of a frame stays within one tick of where it
+ * belongs, wherever in the table the frame starts and across the tx
+ * batches of a long transmission.
+ */
+static void check_frac(uint32_t id, struct uart_wave *wave)
+{
+    static const struct uart_format f = { PIOS_COM_Word_length_8b, PIOS_COM_Parity_No, PIOS_COM_StopBits_1 };
+    static uint8_t frames[256][UART_FRAME_MAX];
+    enum PIOS_USART_Inverted inv = PIOS_USART_Inverted_None;
+    uint32_t baud = 921600;
+    double bit_cycles = (double)SIM_SYSCLK / baud;
+    uint8_t bits = uart_frame(&f, 0, frames[0]);
+    double worst[2];
+
+    pios_soft_serial_driver.ioctl(id, PIOS_IOCTL_USART_SET_INVERTED, &inv);
+    pios_soft_serial_driver.set_config(id, f.word_len, f.parity, f.stop_bits, baud);
+    GPIO_WriteBit(GPIOB, tx_pin.init.GPIO_Pin, Bit_SET);
+
+    for (uint8_t frac = 0; frac < 2; ++frac) {
+        bool enable = frac;
+
+        TEST_EQ(pios_soft_serial_driver.ioctl(id, PIOS_IOCTL_SOFT_SERIAL_SET_FRACBAUD, &enable), 0);
+
+        uart_wave_reset(wave);
+        tx_next = 0;
+        pios_soft_serial_driver.tx_start(id, 256);
+        sim_run(256 * (bits + 2) * bit_cycles);
+
+        worst[frac] = frame_edge_error(wave, bits, bit_cycles);
+    }
+
+    /* the frames themselves, found on the same grid */
+    uint32_t misaligned;
+    uint32_t found = uart_wave_frames(wave, &f, bits, bit_cycles, frames, 0, 256, &misaligned);
+
+    TEST_EQ(found, 256);
+    TEST_EQ(misaligned, 0);
+
+    for (uint32_t i = 0; i < found; ++i) {
+        TEST_EQ(uart_decode(&f, frames[i]), i);
+    }
+
+    TEST_TRUE(worst[0] > 1.0);
+    TEST_TRUE(worst[1] < 1.0);
+
+    printf("921600 8N1: worst edge %.3f cycles off, %.3f with whole tick periods\n", worst[1], worst[0]);
+}
+
+static double bench_encode(struct pios_soft_serial_device *dev)
+{
+    static uint32_t words[UART_FRAME_MAX] __attribute__((aligned(64)));
+    volatile uint32_t sink = 0;
+    double start = test_now();
+
+    for (uint32_t i = 0; i < BENCH_BYTES; ++i) {
+        PIOS_Soft_Serial_Encode(dev, i, words);
+        sink += words[i & 7];
+    }
+
+    return (test_now() - start) * 1e9 / BENCH_BYTES;
+}
+
+int main(void)
+{
+    static struct uart_wave wave;
+    uint32_t id;
+
+    sim_init();
+    NVIC_PriorityGroupConfig(NVIC_PriorityGroup_4);
+
+    TEST_EQ(PIOS_Soft_Serial_Init(&id, &config), 0);
+    pios_soft_serial_driver.ioctl(id, PIOS_IOCTL_SOFT_SERIAL_SET_TXGPIO, (void *)&tx_pin);
+    pios_soft_serial_driver.bind_tx_cb(id, tx_out, 0);
+
+    struct pios_soft_serial_device *dev = (struct pios_soft_serial_device *)id;
+
+    for (uint8_t n = 0; n < sizeof(formats) / sizeof(formats[0]); ++n) {
+        for (uint8_t inverted = 0; inverted < 2; ++inverted) {
+            struct uart_format f = formats[n].format;
+            enum PIOS_USART_Inverted inv = inverted ? PIOS_USART_Inverted_Tx : PIOS_USART_Inverted_None;
+
+            f.inverted = inverted;
+            pios_soft_serial_driver.ioctl(id, PIOS_IOCTL_USART_SET_INVERTED, &inv);
+            pios_soft_serial_driver.set_config(id, f.word_len, f.parity, f.stop_bits, BAUD);
+
+            /* idle line for the new polarity before recording */
+            GPIO_WriteBit(GPIOB, tx_pin.init.GPIO_Pin, inverted ? Bit_RESET : Bit_SET);
+            if (!wave.gpio) {
+                uart_wave_attach(&wave, GPIOB, tx_pin.init.GPIO_Pin);
+            }
+
+            check_encode(dev, &f);
+            check_wire(id, &f, &wave);
+
+            printf("%s%s: %.2f ns/byte\n", formats[n].name, inverted ? " inverted" : "", bench_encode(dev));
+        }
+    }
+
+    check_frac(id, &wave);
+
+    uart_wave_detach_all();
+
+    return test_result();
+}
@@ -0,0 +1,165 @@
+/**
+ ******************************************************************************
+ * @file       group_test.c
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      Soft serial port group TX, every member's pin decoded on its own
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/* for the group and device internals */
+#include "pios_soft_serial.c"
+
+#include "test.h"
+#include "uart.h"
+
+#define BAUD    115200
+#define MEMBERS 3
+
+/* with the length, messages may hold zero bytes */
+#define MESSAGE(s) s, sizeof(s) - 1
+
+/* one timer and one dma channel for the group, the members use the same config */
+static const struct pios_soft_serial_config config = {
+    .timer = TIM3,
+    .tim_channel = TIM_Channel_1,
+};
+
+/* frame lengths 10, 12 and 11 bits, so batches of the members end apart */
+static const struct {
+    struct uart_format format;
+    const char *message;
+    uint16_t len;
+} members[MEMBERS] = {
+    { { PIOS_COM_Word_length_8b, PIOS_COM_Parity_No, PIOS_COM_StopBits_1 }, MESSAGE("Hello, port group member zero") },
+    { { PIOS_COM_Word_length_8b, PIOS_COM_Parity_Even, PIOS_COM_StopBits_2, true }, MESSAGE("World!") },
+    { { PIOS_COM_Word_length_8b, PIOS_COM_Parity_Odd, PIOS_COM_StopBits_1 }, MESSAGE("\x00\x55\xaa\xff\x01\x80 and text") },
+};
+
+static uint16_t tx_pos[MEMBERS];
+
+static uint16_t tx_out(uint32_t context, uint8_t *buf, uint16_t buf_len, uint16_t *headroom, bool *task_woken)
+{
+    uint16_t count = 0;
+
+    while (count < buf_len && tx_pos[context] < members[context].len) {
+        buf[count++] = members[context].message[tx_pos[context]++];
+    }
+
+    *headroom = members[context].len - tx_pos[context];
+
+    return count;
+}
+
+int main(void)
+{
+    static struct uart_wave wave[MEMBERS];
+    static uint8_t frames[64][UART_FRAME_MAX];
+    uint32_t group, id[MEMBERS];
+    struct stm32_gpio pin[MEMBERS];
+    double bit_cycles = (double)SIM_SYSCLK / BAUD;
+    uint32_t bits_max = 0;
+
+    sim_init();
+    NVIC_PriorityGroupConfig(NVIC_PriorityGroup_4);
+
+    TEST_EQ(PIOS_Soft_Serial_Group_Init(&group, &config), 0);
+
+    for (uint8_t i = 0; i < MEMBERS; ++i) {
+        const struct uart_format *f = &members[i].format;
+        enum PIOS_USART_Inverted inv = f->inverted ? PIOS_USART_Inverted_Tx : PIOS_USART_Inverted_None;
+        uint8_t level[UART_FRAME_MAX];
+
+        pin[i] = (struct stm32_gpio) {
+            .gpio = GPIOB,
+            .init = {
+                .GPIO_Pin   = GPIO_Pin_10 << i,
+                .GPIO_Speed = GPIO_Speed_50MHz,
+                .GPIO_Mode  = GPIO_Mode_Out_PP,
+            },
+        };
+
+        TEST_EQ(PIOS_Soft_Serial_Init(&id[i], &config), 0);
+        pios_soft_serial_driver.ioctl(id[i], PIOS_IOCTL_SOFT_SERIAL_SET_TXGPIO, &pin[i]);
+        TEST_EQ(PIOS_Soft_Serial_Group_Add(group, id[i]), 0);
+        pios_soft_serial_driver.bind_tx_cb(id[i], tx_out, i);
+        pios_soft_serial_driver.ioctl(id[i], PIOS_IOCTL_USART_SET_INVERTED, &inv);
+        pios_soft_serial_driver.set_config(id[i], f->word_len, f->parity, f->stop_bits, BAUD);
+
+        uint8_t bits = uart_frame(f, 0, level);
+
+        if (bits > bits_max) {
+            bits_max = bits;
+        }
+
+        GPIO_WriteBit(GPIOB, pin[i].init.GPIO_Pin, f->inverted ? Bit_RESET : Bit_SET);
+        uart_wave_attach(&wave[i], GPIOB, pin[i].init.GPIO_Pin);
+    }
+
+    /* a pin on another port can't join */
+    struct stm32_gpio other = pin[0];
+    uint32_t stray;
+
+    other.gpio = GPIOA;
+    TEST_EQ(PIOS_Soft_Serial_Init(&stray, &config), 0);
+    pios_soft_serial_driver.ioctl(stray, PIOS_IOCTL_SOFT_SERIAL_SET_TXGPIO, &other);
+    TEST_EQ(PIOS_Soft_Serial_Group_Add(group, stray), -1);
+
+    for (uint8_t i = 0; i < MEMBERS; ++i) {
+        pios_soft_serial_driver.tx_start(id[i], members[i].len);
+    }
+
+    uint32_t longest = 0;
+
+    for (uint8_t i = 0; i < MEMBERS; ++i) {
+        longest = members[i].len > longest ? members[i].len : longest;
+    }
+
+    /* batches run in lockstep at the longest frame, plus a gap per batch */
+    sim_run(longest * (bits_max + 2) * bit_cycles);
+
+    struct pios_soft_serial_group *g = (struct pios_soft_serial_group *)group;
+
+    TEST_TRUE(!g->tx_active);
+
+    for (uint8_t i = 0; i < MEMBERS; ++i) {
+        const struct uart_format *f = &members[i].format;
+        uint8_t level[UART_FRAME_MAX];
+        uint8_t bits = uart_frame(f, 0, level);
+        uint32_t misaligned;
+        uint32_t found = uart_wave_frames(&wave[i], f, bits, bit_cycles, frames, 0, 64, &misaligned);
+        uint32_t wrong = 0;
+
+        TEST_EQ(found, members[i].len);
+        TEST_EQ(misaligned, 0);
+
+        for (uint32_t n = 0; n < found && n < members[i].len; ++n) {
+            wrong += uart_decode(f, frames[n]) != (uint8_t)members[i].message[n];
+        }
+
+        TEST_EQ(wrong, 0);
+        printf("pin %u: %u frames, %u edges\n", 10 + i, found, wave[i].count);
+    }
+
+    /* one channel and one transfer complete per batch served all of them */
+    TEST_EQ(sim_irq_count[DMA1_Channel6_IRQn], (longest + PIOS_SOFT_SERIAL_TX_BATCH - 1) / PIOS_SOFT_SERIAL_TX_BATCH);
+
+    uart_wave_detach_all();
+
+    return test_result();
+}
@@ -0,0 +1,290 @@
+/**
+ ******************************************************************************
+ * @file       irq_test.c
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      Masked section profile of PIOS_IRQ, and its limit under driver load
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/* the library copy is built without the profile */
+#define PIOS_INCLUDE_IRQ_PROFILE
+#include "pios_irq.c"
+
+#include "pios_soft_serial.h"
+#include "pios_swtimer.h"
+
+#include "test.h"
+#include "uart.h"
+
+#define BAUD   115200
+#define FRAMES 256
+
+/*
+ * The regression limit for the longest section under the load below.
+ * Time only passes between simulator events, so a section that gets
+ * past the first bucket stayed masked across one: a DMA beat, a timer
+ * compare or a pin edge that the hardware would have had to wait for.
+ */
+#define SECTION_LIMIT_CYCLES (1 << PIOS_IRQ_PROFILE_BUCKET_SHIFT)
+
+static const struct pios_soft_serial_config config = {
+    .timer = TIM3,
+    .tim_channel = TIM_Channel_1,
+};
+
+static const struct stm32_gpio tx_pin = {
+    .gpio = GPIOB,
+    .init = {
+        .GPIO_Pin   = GPIO_Pin_10,
+        .GPIO_Speed = GPIO_Speed_50MHz,
+        .GPIO_Mode  = GPIO_Mode_Out_PP,
+    },
+};
+
+static const struct stm32_gpio rx_pin = {
+    .gpio = GPIOA,
+    .init = {
+        .GPIO_Pin  = GPIO_Pin_3,
+        .GPIO_Mode = GPIO_Mode_IN_FLOATING,
+    },
+};
+
+static uint16_t tx_next;
+static uint16_t received_count;
+
+static uint16_t tx_out(uint32_t context, uint8_t *buf, uint16_t buf_len, uint16_t *headroom, bool *task_woken)
+{
+    uint16_t count = 0;
+
+    while (count < buf_len && tx_next < FRAMES) {
+        buf[count++] = tx_next++;
+    }
+
+    *headroom = FRAMES - tx_next;
+
+    return count;
+}
+
+static uint16_t rx_in(uint32_t context, uint8_t *buf, uint16_t buf_len, uint16_t *headroom, bool *task_woken)
+{
+    received_count += buf_len;
+    *headroom = 2 * FRAMES;
+
+    return buf_len;
+}
+
+static const struct pios_swtimer_cfg swtimer_cfg = {
+    .timer = TIM4,
+    .tim_channel = TIM_Channel_1,
+    .irq = {
+        .init = {
+            .NVIC_IRQChannel = TIM4_IRQn,
+            .NVIC_IRQChannelPreemptionPriority = PIOS_IRQ_PRIO_MID,
+            .NVIC_IRQChannelSubPriority = 0,
+            .NVIC_IRQChannelCmd = ENABLE,
+        },
+    },
+};
+
+void TIM4_IRQHandler(void)
+{
+    PIOS_SWTimer_IRQ_Handler();
+}
+
+static struct pios_swtimer swtimer;
+static uint32_t swtimer_calls;
+
+static void swtimer_tick(struct pios_swtimer *timer, uint32_t context)
+{
+    ++swtimer_calls;
+}
+
+/* the outermost sections begin in these, at their own call sites */
+static void __attribute__((noinline)) disabled_section(uint32_t cycles)
+{
+    PIOS_IRQ_Disable();
+    sim_run(cycles / 2);
+
+    /* nested, only counts as part of the outer one */
+    PIOS_IRQ_Disable();
+    sim_run(cycles - cycles / 2);
+    PIOS_IRQ_Enable();
+
+    PIOS_IRQ_Enable();
+}
+
+static void __attribute__((noinline)) other_disabled_section(uint32_t cycles)
+{
+    PIOS_IRQ_Disable();
+    sim_run(cycles);
+    PIOS_IRQ_Enable();
+}
+
+static void __attribute__((noinline)) masked_section(uint32_t cycles)
+{
+    uint32_t outer = PIOS_IRQ_Mask(PIOS_IRQ_PRIO_MID);
+
+    sim_run(cycles / 2);
+
+    /* raises the ceiling, still the same section */
+    uint32_t inner = PIOS_IRQ_Mask(PIOS_IRQ_PRIO_HIGH);
+
+    sim_run(cycles - cycles / 2);
+
+    PIOS_IRQ_Unmask(inner);
+    PIOS_IRQ_Unmask(outer);
+}
+
+/* Exact cycles, buckets, nesting and the caller of the longest section */
+static void check_profile(void)
+{
+    struct pios_irq_profile profile;
+
+    PIOS_IRQ_Profile_Init();
+    PIOS_IRQ_Profile_Reset();
+
+    disabled_section(160);
+    PIOS_IRQ_Profile_Get(&profile);
+
+    uint32_t caller = profile.disabled.max_caller;
+
+    TEST_EQ(profile.magic, PIOS_IRQ_PROFILE_MAGIC);
+    TEST_EQ(profile.clock, SIM_SYSCLK);
+    TEST_EQ(profile.disabled.count, 1);
+    TEST_EQ(profile.disabled.max, 160);
+    TEST_TRUE(caller != 0);
+
+    /* 160 >> 6 is 2, bucket 2 holds 128..255 */
+    TEST_EQ(profile.disabled.histogram[2], 1);
+    TEST_EQ(profile.masked.count, 0);
+
+    /* a shorter one elsewhere counts, the longest stays */
+    other_disabled_section(20);
+    PIOS_IRQ_Profile_Get(&profile);
+
+    TEST_EQ(profile.disabled.count, 2);
+    TEST_EQ(profile.disabled.max, 160);
+    TEST_EQ(profile.disabled.max_caller, caller);
+    TEST_EQ(profile.disabled.histogram[0], 1);
+
+    /* a longer one moves the caller, the last bucket takes the rest */
+    other_disabled_section(100000);
+    PIOS_IRQ_Profile_Get(&profile);
+
+    TEST_EQ(profile.disabled.count, 3);
+    TEST_EQ(profile.disabled.max, 100000);
+    TEST_TRUE(profile.disabled.max_caller != caller);
+    TEST_EQ(profile.disabled.histogram[PIOS_IRQ_PROFILE_BUCKETS - 1], 1);
+
+    masked_section(300);
+    PIOS_IRQ_Profile_Get(&profile);
+
+    TEST_EQ(profile.masked.count, 1);
+    TEST_EQ(profile.masked.max, 300);
+    TEST_EQ(profile.masked.histogram[3], 1);
+    TEST_EQ(profile.disabled.count, 3);
+
+    /* unbalanced enable */
+    TEST_EQ(PIOS_IRQ_Enable(), -1);
+
+    PIOS_IRQ_Profile_Reset();
+    PIOS_IRQ_Profile_Get(&profile);
+
+    TEST_EQ(profile.magic, PIOS_IRQ_PROFILE_MAGIC);
+    TEST_EQ(profile.buckets, PIOS_IRQ_PROFILE_BUCKETS);
+    TEST_EQ(profile.disabled.count, 0);
+    TEST_EQ(profile.disabled.max, 0);
+    TEST_EQ(profile.masked.count, 0);
+    TEST_EQ(profile.masked.histogram[3], 0);
+}
+
+/* drives one frame of i on the rx pin */
+static void send(uint16_t i, double bit_cycles)
+{
+    static const struct uart_format f = { PIOS_COM_Word_length_8b, PIOS_COM_Parity_No, PIOS_COM_StopBits_1 };
+    uint8_t level[UART_FRAME_MAX];
+    uint8_t bits = uart_frame(&f, i, level);
+    uint64_t start = sim_time;
+
+    for (uint8_t b = 0; b < bits; ++b) {
+        sim_run_until(start + (uint64_t)(b * bit_cycles));
+        sim_gpio_drive(GPIOA, rx_pin.init.GPIO_Pin, level[b] ? rx_pin.init.GPIO_Pin : 0);
+    }
+
+    sim_run_until(start + (uint64_t)(bits * bit_cycles));
+}
+
+/*
+ * Soft serial sending and then receiving back to back frames with a
+ * software timer running, then the longest section of each kind against the limit.
+ */
+static void check_limit(void)
+{
+    struct pios_irq_profile profile;
+    double bit_cycles = (double)SIM_SYSCLK / BAUD;
+    uint32_t id;
+
+    TEST_EQ(PIOS_Soft_Serial_Init(&id, &config), 0);
+    pios_soft_serial_driver.ioctl(id, PIOS_IOCTL_SOFT_SERIAL_SET_TXGPIO, (void *)&tx_pin);
+    pios_soft_serial_driver.ioctl(id, PIOS_IOCTL_SOFT_SERIAL_SET_RXGPIO, (void *)&rx_pin);
+    pios_soft_serial_driver.bind_tx_cb(id, tx_out, 0);
+    pios_soft_serial_driver.bind_rx_cb(id, rx_in, 0);
+    pios_soft_serial_driver.set_config(id, PIOS_COM_Word_length_8b, PIOS_COM_Parity_No, PIOS_COM_StopBits_1, BAUD);
+
+    sim_gpio_drive(GPIOA, rx_pin.init.GPIO_Pin, rx_pin.init.GPIO_Pin);
+    pios_soft_serial_driver.rx_start(id, 2 * FRAMES);
+
+    TEST_EQ(PIOS_SWTimer_Init(&swtimer_cfg), 0);
+    PIOS_SWTimer_Start(&swtimer, 50, 50, swtimer_tick, 0);
+
+    PIOS_IRQ_Profile_Reset();
+
+    /* half duplex, rx comes back once the last frame is out */
+    pios_soft_serial_driver.tx_start(id, FRAMES);
+    sim_run(FRAMES * 12 * bit_cycles);
+
+    for (uint16_t i = 0; i < FRAMES; ++i) {
+        send(i, bit_cycles);
+    }
+
+    sim_run(100 * bit_cycles);
+
+    PIOS_IRQ_Profile_Get(&profile);
+
+    TEST_EQ(tx_next, FRAMES);
+    TEST_EQ(received_count, FRAMES);
+    TEST_TRUE(swtimer_calls > 0);
+    TEST_TRUE(profile.masked.count > 0);
+    TEST_TRUE(profile.disabled.max <= SECTION_LIMIT_CYCLES);
+    TEST_TRUE(profile.masked.max <= SECTION_LIMIT_CYCLES);
+
+    printf("%u disabled, %u masked sections, longest %u and %u cycles (limit %u)\n",
+           profile.disabled.count, profile.masked.count, profile.disabled.max, profile.masked.max, SECTION_LIMIT_CYCLES);
+}
+
+int main(void)
+{
+    sim_init();
+    NVIC_PriorityGroupConfig(NVIC_PriorityGroup_4);
+
+    check_profile();
+    check_limit();
+
+    return test_result();
+}
@@ -0,0 +1,293 @@
+/**
+ ******************************************************************************
+ * @file       memcpy_test.c
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      PIOS_DMA_Memcpy() copies, fills and their order on the queue
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "pios.h"
+#include "pios_dma.h"
+#include "pios_irq.h"
+
+#include "test.h"
+
+#include <stdlib.h>
+
+#define BYTES   4096
+#define GUARD   16
+#define CHAIN   40
+
+static uint8_t src[BYTES] __attribute__((aligned(4)));
+static uint8_t dst[BYTES + GUARD] __attribute__((aligned(4)));
+
+static uint32_t order[64];
+static uint8_t done_count;
+static uint8_t failed;
+
+static void done(uint32_t context, bool ok)
+{
+    order[done_count++] = context;
+    failed += !ok;
+}
+
+/* the next copy of the chain from the completion of the last */
+static void chain(uint32_t context, bool ok)
+{
+    done(context, ok);
+
+    if (context < CHAIN) {
+        TEST_EQ(PIOS_DMA_Memcpy(&dst[context + 1], &src[context + 1], 1, 1, 0, chain, context + 1), 0);
+    }
+}
+
+static void reset(void)
+{
+    memset(dst, 0xee, sizeof(dst));
+    done_count = failed = 0;
+}
+
+static bool guard_intact(uint32_t from)
+{
+    for (uint32_t i = from; i < sizeof(dst); ++i) {
+        if (dst[i] != 0xee) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Every width, odd counts, nothing written past the end */
+static void check_copy(void)
+{
+    static const uint8_t widths[] = { 1, 2, 4 };
+
+    for (uint8_t w = 0; w < sizeof(widths); ++w) {
+        uint8_t width = widths[w];
+        uint16_t count = (BYTES - 12) / width + 1;
+
+        reset();
+
+        TEST_EQ(PIOS_DMA_Memcpy(dst, src, count, width, 0, done, width), 0);
+        sim_sync();
+
+        TEST_EQ(done_count, 1);
+        TEST_EQ(order[0], width);
+        TEST_EQ(failed, 0);
+        TEST_EQ(memcmp(dst, src, count * width), 0);
+        TEST_TRUE(guard_intact(count * width));
+    }
+}
+
+/* One item repeated, the memset case */
+static void check_fill(void)
+{
+    static const uint32_t pattern = 0xa5c3e1f0;
+    static const uint8_t widths[] = { 1, 2, 4 };
+
+    for (uint8_t w = 0; w < sizeof(widths); ++w) {
+        uint8_t width = widths[w];
+        uint16_t count = 1000 / width;
+
+        reset();
+
+        TEST_EQ(PIOS_DMA_Memcpy(dst, &pattern, count, width, PIOS_DMA_MEMCPY_FILL, done, 0), 0);
+        sim_sync();
+
+        uint32_t wrong = 0;
+
+        for (uint16_t i = 0; i < count; ++i) {
+            wrong += memcmp(&dst[i * width], &pattern, width) != 0;
+        }
+
+        TEST_EQ(done_count, 1);
+        TEST_EQ(wrong, 0);
+        TEST_TRUE(guard_intact(count * width));
+    }
+}
+
+/*
+ * With the copy irq held off, copies pile up on the queue. They must
+ * land in submission order: later copies over the same bytes win, and
+ * the callbacks come in the same order. The pool is full after
+ * PIOS_DMA_MEMCPY_MAX.
+ */
+static void check_order(void)
+{
+    static uint8_t layer[4][256];
+
+    reset();
+
+    for (uint8_t n = 0; n < 4; ++n) {
+        memset(layer[n], n + 1, sizeof(layer[n]));
+    }
+
+    uint32_t prev = PIOS_IRQ_Mask(PIOS_IRQ_PRIO_LOW);
+
+    for (uint8_t n = 0; n < 4; ++n) {
+        /* each one shorter, the tail of the earlier ones stays */
+        TEST_EQ(PIOS_DMA_Memcpy(dst, layer[n], 256 - n * 64, 1, 0, done, n), 0);
+    }
+
+    TEST_EQ(PIOS_DMA_Memcpy(dst, src, 4, 1, 0, done, 99), -1);
+    TEST_EQ(done_count, 0);
+
+    PIOS_IRQ_Unmask(prev);
+    sim_sync();
+
+    TEST_EQ(done_count, 4);
+
+    for (uint8_t n = 0; n < 4; ++n) {
+        TEST_EQ(order[n], n);
+        TEST_EQ(dst[n * 64], 4 - n);
+        TEST_EQ(dst[n * 64 + 63], 4 - n);
+    }
+
+    TEST_TRUE(guard_intact(256));
+
+    /* queued from the completion callback, one after the other */
+    reset();
+
+    TEST_EQ(PIOS_DMA_Memcpy(&dst[0], &src[0], 1, 1, 0, chain, 0), 0);
+    sim_sync();
+
+    TEST_EQ(done_count, CHAIN + 1);
+
+    for (uint8_t n = 0; n <= CHAIN; ++n) {
+        TEST_EQ(order[n], n);
+    }
+
+    TEST_EQ(memcmp(dst, src, CHAIN + 1), 0);
+}
+
+static void check_refused(void)
+{
+    reset();
+
+    TEST_EQ(PIOS_DMA_Memcpy(dst, src, 0, 1, 0, done, 0), -1);
+    TEST_EQ(PIOS_DMA_Memcpy(dst, src, 4, 3, 0, done, 0), -1);
+    TEST_EQ(PIOS_DMA_Memcpy(&dst[1], src, 4, 4, 0, done, 0), -1);
+    TEST_EQ(PIOS_DMA_Memcpy(dst, &src[2], 4, 4, 0, done, 0), -1);
+    TEST_EQ(PIOS_DMA_Memcpy(&dst[1], src, 4, 2, 0, done, 0), -1);
+
+    sim_sync();
+
+    TEST_EQ(done_count, 0);
+    TEST_TRUE(guard_intact(0));
+}
+
+static uint32_t peripheral_init(DMA_Channel_TypeDef *stream, uint8_t irq_prio)
+{
+    static uint32_t word;
+    uint32_t handle;
+
+    struct pios_dma_config config = {
+        .init = {
+            .DMA_PeripheralBaseAddr = (uint32_t)&GPIOB->BSRR,
+            .DMA_MemoryBaseAddr = (uint32_t)&word,
+            .DMA_DIR = DMA_DIR_PeripheralDST,
+            .DMA_BufferSize = 1,
+            .DMA_PeripheralInc = DMA_PeripheralInc_Disable,
+            .DMA_MemoryInc = DMA_MemoryInc_Disable,
+            .DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word,
+            .DMA_MemoryDataSize = DMA_MemoryDataSize_Word,
+            .DMA_Mode = DMA_Mode_Circular,
+            .DMA_Priority = DMA_Priority_High,
+            .DMA_M2M = DMA_M2M_Disable,
+        },
+        .stream = stream,
+        .irq = {
+            .NVIC_IRQChannelPreemptionPriority = irq_prio,
+        },
+    };
+
+    TEST_EQ(PIOS_DMA_Init(&handle, &config), 0);
+
+    return handle;
+}
+
+/*
+ * Copies stay off channels a peripheral request was made on, even with
+ * that request holding its channel forever, and give up once none is left.
+ * A channel copies used gets the peripheral's irq priority once one is
+ * made on it.
+ */
+static void check_channels(void)
+{
+    /* the copies so far ran on channel 7 */
+    TEST_EQ(NVIC_GetPriority(DMA1_Channel7_IRQn), PIOS_IRQ_PRIO_LOW);
+
+    PIOS_DMA_Queue(peripheral_init(DMA1_Channel7, PIOS_IRQ_PRIO_MID), 0);
+
+    reset();
+
+    uint32_t ch6 = sim_irq_count[DMA1_Channel6_IRQn];
+    uint32_t ch7 = sim_irq_count[DMA1_Channel7_IRQn];
+
+    TEST_EQ(PIOS_DMA_Memcpy(dst, src, 100, 1, 0, done, 0), 0);
+    sim_sync();
+
+    TEST_EQ(done_count, 1);
+    TEST_EQ(memcmp(dst, src, 100), 0);
+    TEST_EQ(sim_irq_count[DMA1_Channel6_IRQn], ch6 + 1);
+    TEST_EQ(sim_irq_count[DMA1_Channel7_IRQn], ch7);
+
+    /* the peripheral's priority over the copy's, raised but never lowered by later requests */
+    TEST_EQ(NVIC_GetPriority(DMA1_Channel7_IRQn), PIOS_IRQ_PRIO_MID);
+    TEST_EQ(NVIC_GetPriority(DMA1_Channel6_IRQn), PIOS_IRQ_PRIO_LOW);
+
+    peripheral_init(DMA1_Channel7, PIOS_IRQ_PRIO_HIGH);
+    TEST_EQ(NVIC_GetPriority(DMA1_Channel7_IRQn), PIOS_IRQ_PRIO_HIGH);
+
+    peripheral_init(DMA1_Channel7, PIOS_IRQ_PRIO_LOW);
+    TEST_EQ(NVIC_GetPriority(DMA1_Channel7_IRQn), PIOS_IRQ_PRIO_HIGH);
+
+    static DMA_Channel_TypeDef *const others[] = {
+        DMA1_Channel1, DMA1_Channel2, DMA1_Channel3, DMA1_Channel4, DMA1_Channel5, DMA1_Channel6,
+    };
+
+    for (uint8_t n = 0; n < sizeof(others) / sizeof(others[0]); ++n) {
+        peripheral_init(others[n], PIOS_IRQ_PRIO_MID);
+    }
+
+    TEST_EQ(NVIC_GetPriority(DMA1_Channel6_IRQn), PIOS_IRQ_PRIO_MID);
+
+    reset();
+
+    TEST_EQ(PIOS_DMA_Memcpy(dst, src, 4, 1, 0, done, 0), -1);
+}
+
+int main(void)
+{
+    sim_init();
+    NVIC_PriorityGroupConfig(NVIC_PriorityGroup_4);
+
+    for (uint32_t i = 0; i < BYTES; ++i) {
+        src[i] = rand();
+    }
+
+    check_copy();
+    check_fill();
+    check_order();
+    check_refused();
+    check_channels();
+
+    return test_result();
+}
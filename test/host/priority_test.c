@@ -0,0 +1,308 @@
+/**
+ ******************************************************************************
+ * @file       priority_test.c
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      DMA requests sharing one channel: priorities, chains, irq mask
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "pios.h"
+#include "pios_dma.h"
+
+#include "test.h"
+
+/* TIM2 update paces channel 2 at a word per microsecond */
+#define CHANNEL     DMA1_Channel2
+#define CHANNEL_IRQ DMA1_Channel2_IRQn
+#define WORDS       64
+
+#define REQUESTS    5
+
+static struct {
+    uint32_t handle;
+    uint32_t src[WORDS];
+    uint32_t dst[WORDS];
+    uint32_t completed;
+} req[REQUESTS];
+
+static uint32_t order[16];
+static uint8_t order_count;
+
+/* channel registers the last setup found, and what was left at the last suspend */
+static uint32_t setup_cmar;
+static uint32_t setup_cpar;
+static uint16_t setup_cndtr;
+static uint16_t suspend_left;
+static uint8_t suspends;
+
+static void setup(uint32_t dma, uint32_t i)
+{
+    setup_cmar  = CHANNEL->CMAR;
+    setup_cpar  = CHANNEL->CPAR;
+    setup_cndtr = CHANNEL->CNDTR;
+
+    TIM_DMACmd(TIM2, TIM_DMA_Update, ENABLE);
+}
+
+static void suspend(uint32_t dma, uint32_t i)
+{
+    suspend_left = CHANNEL->CNDTR;
+    ++suspends;
+
+    TIM_DMACmd(TIM2, TIM_DMA_Update, DISABLE);
+}
+
+static void complete(uint32_t dma, uint32_t i)
+{
+    ++req[i].completed;
+    order[order_count++] = i;
+}
+
+static void request_init(uint8_t i, uint8_t priority, bool suspendable)
+{
+    struct pios_dma_config config = {
+        .init = {
+            .DMA_PeripheralBaseAddr = (uint32_t)req[i].src,
+            .DMA_MemoryBaseAddr = (uint32_t)req[i].dst,
+            .DMA_DIR = DMA_DIR_PeripheralSRC,
+            .DMA_BufferSize = WORDS,
+            .DMA_PeripheralInc = DMA_PeripheralInc_Enable,
+            .DMA_MemoryInc = DMA_MemoryInc_Enable,
+            .DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word,
+            .DMA_MemoryDataSize = DMA_MemoryDataSize_Word,
+            .DMA_Mode = DMA_Mode_Normal,
+            .DMA_Priority = DMA_Priority_Low,
+            .DMA_M2M = DMA_M2M_Disable,
+        },
+        .stream = CHANNEL,
+        .callbacks = {
+            .setup = setup,
+            .complete = complete,
+            .suspend = suspendable ? suspend : 0,
+        },
+        .irq = {
+            .NVIC_IRQChannelPreemptionPriority = PIOS_IRQ_PRIO_MID,
+        },
+        .priority = priority,
+        .timer = TIM2,
+        .tim_dma_source = TIM_DMA_Update,
+    };
+
+    for (uint8_t w = 0; w < WORDS; ++w) {
+        req[i].src[w] = i << 16 | w;
+    }
+
+    TEST_EQ(PIOS_DMA_Init(&req[i].handle, &config), 0);
+}
+
+static void reset(void)
+{
+    for (uint8_t i = 0; i < REQUESTS; ++i) {
+        memset(req[i].dst, 0, sizeof(req[i].dst));
+    }
+
+    order_count = 0;
+    suspends = 0;
+}
+
+static bool copied(uint8_t i)
+{
+    return !memcmp(req[i].dst, req[i].src, sizeof(req[i].src));
+}
+
+static bool channel_irq_on(void)
+{
+    return NVIC->ISER[CHANNEL_IRQ >> 5] & (1 << (CHANNEL_IRQ & 31));
+}
+
+/*
+ * Queue and Stop from code that has the channel irq off themselves must
+ * leave it off, the completion only runs once that code turns it on.
+ */
+static void check_irq_nesting(void)
+{
+    reset();
+
+    NVIC_DisableIRQ(CHANNEL_IRQ);
+
+    /* claims the idle channel */
+    PIOS_DMA_Queue(req[0].handle, 0);
+    TEST_TRUE(!channel_irq_on());
+
+    sim_run(2 * WORDS * SIM_CYCLES_PER_US);
+
+    TEST_TRUE(copied(0));
+    TEST_EQ(order_count, 0);
+
+    /* not running */
+    PIOS_DMA_Stop(req[1].handle);
+    TEST_TRUE(!channel_irq_on());
+    TEST_EQ(order_count, 0);
+
+    NVIC_EnableIRQ(CHANNEL_IRQ);
+
+    TEST_EQ(order_count, 1);
+    TEST_EQ(req[0].completed, 1);
+}
+
+/*
+ * Request 0 (priority 0, suspendable) is running and request 2 (priority
+ * 0) waits when request 1 (priority 1) is queued. Request 1 takes the
+ * channel right away, request 0 resumes from where it stopped with its
+ * addresses and count moved on, and still goes before request 2.
+ */
+static void check_preempt(void)
+{
+    reset();
+
+    PIOS_DMA_Queue(req[0].handle, 0);
+    sim_run(WORDS / 3 * SIM_CYCLES_PER_US);
+
+    PIOS_DMA_Queue(req[2].handle, 2);
+    TEST_EQ(suspends, 0);
+
+    PIOS_DMA_Queue(req[1].handle, 1);
+
+    uint16_t left = suspend_left;
+    uint16_t done = WORDS - left;
+
+    TEST_EQ(suspends, 1);
+    TEST_TRUE(left > 0 && left < WORDS);
+    TEST_EQ(PIOS_DMA_GetRemaining(req[0].handle), left);
+
+    /* request 1 from its start */
+    TEST_EQ(setup_cmar, (uint32_t)req[1].dst);
+    TEST_EQ(setup_cndtr, WORDS);
+
+    sim_run(WORDS * SIM_CYCLES_PER_US + SIM_CYCLES_PER_US);
+
+    /* request 0 again, where it left */
+    TEST_EQ(order_count, 1);
+    TEST_EQ(setup_cmar, (uint32_t)&req[0].dst[done]);
+    TEST_EQ(setup_cpar, (uint32_t)&req[0].src[done]);
+    TEST_EQ(setup_cndtr, left);
+
+    sim_run(3 * WORDS * SIM_CYCLES_PER_US);
+
+    TEST_EQ(order_count, 3);
+    TEST_EQ(order[0], 1);
+    TEST_EQ(order[1], 0);
+    TEST_EQ(order[2], 2);
+    TEST_TRUE(copied(0) && copied(1) && copied(2));
+}
+
+/*
+ * Request 2 has no suspend callback, it runs to its end. Behind it the
+ * queue goes by priority, request 1 before request 0 queued earlier, and
+ * request 3 behind both, first come first served among equals.
+ */
+static void check_order(void)
+{
+    reset();
+
+    PIOS_DMA_Queue(req[2].handle, 2);
+    sim_run(WORDS / 3 * SIM_CYCLES_PER_US);
+
+    PIOS_DMA_Queue(req[0].handle, 0);
+    PIOS_DMA_Queue(req[1].handle, 1);
+    PIOS_DMA_Queue(req[3].handle, 3);
+
+    sim_run(5 * WORDS * SIM_CYCLES_PER_US);
+
+    TEST_EQ(suspends, 0);
+    TEST_EQ(order_count, 4);
+    TEST_EQ(order[0], 2);
+    TEST_EQ(order[1], 1);
+    TEST_EQ(order[2], 0);
+    TEST_EQ(order[3], 3);
+    TEST_TRUE(copied(0) && copied(1) && copied(2) && copied(3));
+}
+
+/*
+ * Request 4 as a chain of three segments. The middle one reads its own
+ * source, the last goes back to the request's one and holds its
+ * destination word. Each segment lands where it should and complete is
+ * called once, after the last.
+ */
+static void check_chain(void)
+{
+    static uint32_t first[16];
+    static uint32_t second[8];
+    static uint32_t second_src[8];
+    static uint32_t pad[3];
+    static const struct pios_dma_segment chain[] = {
+        { .memory = first, .count = 16 },
+        { .memory = second, .peripheral = second_src, .count = 8 },
+        { .memory = &pad[1], .count = 4, .flags = PIOS_DMA_SEGMENT_HOLD_MEMORY },
+    };
+
+    reset();
+
+    for (uint8_t w = 0; w < 8; ++w) {
+        second_src[w] = 0xc0de0000 | w;
+    }
+
+    PIOS_DMA_SetChain(req[4].handle, chain, 3);
+    PIOS_DMA_Queue(req[4].handle, 4);
+
+    /* into the last segment */
+    sim_run((16 + 8 + 2) * SIM_CYCLES_PER_US);
+    TEST_EQ(req[4].completed, 0);
+
+    sim_run(WORDS * SIM_CYCLES_PER_US);
+
+    TEST_EQ(req[4].completed, 1);
+    TEST_EQ(order_count, 1);
+
+    TEST_EQ(memcmp(first, req[4].src, sizeof(first)), 0);
+    TEST_EQ(memcmp(second, second_src, sizeof(second)), 0);
+    TEST_EQ(pad[0], 0);
+    TEST_EQ(pad[1], req[4].src[3]);
+    TEST_EQ(pad[2], 0);
+
+    /* the plain request is untouched by it */
+    for (uint8_t w = 0; w < WORDS; ++w) {
+        TEST_EQ(req[4].dst[w], 0);
+    }
+
+    PIOS_DMA_SetChain(req[4].handle, 0, 0);
+}
+
+int main(void)
+{
+    sim_init();
+    NVIC_PriorityGroupConfig(NVIC_PriorityGroup_4);
+
+    request_init(0, 0, true);
+    request_init(1, 1, false);
+    request_init(2, 0, false);
+    request_init(3, 0, false);
+    request_init(4, 0, false);
+
+    TIM_SetAutoreload(TIM2, SIM_CYCLES_PER_US - 1);
+    TIM_DMACmd(TIM2, TIM_DMA_Update, ENABLE);
+    TIM_Cmd(TIM2, ENABLE);
+
+    check_irq_nesting();
+    check_preempt();
+    check_order();
+    check_chain();
+
+    return test_result();
+}
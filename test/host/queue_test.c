@@ -0,0 +1,255 @@
+/**
+ ******************************************************************************
+ * @file       queue_test.c
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      PIOS_DMA_Queue() from racing threads against the channel irq
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/* for the queue state after the run */
+#include "pios_dma.c"
+
+#include "test.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+/*
+ * Producer threads queue requests on one channel, the complete callbacks
+ * queue half of them again from the handler. The TIM2 update paces the
+ * transfers at a word per microsecond, so requests are in flight while
+ * the others push. The handler runs in whichever thread has the
+ * simulator: the irq thread that keeps the clock going, or a producer
+ * whose claim of the idle channel re-enabled the irq. Either way it runs
+ * while the other producers keep pushing, which is harsher than one core
+ * where the irq only ever cuts a producer short.
+ */
+#define PRODUCERS   3
+#define PER_THREAD  4
+#define REQUESTS    (PRODUCERS * PER_THREAD)
+#define ROUNDS      5000
+#define WORDS       8
+
+/* no transfer for this long is a lost request */
+#define STALL_SECONDS 5.0
+
+static const NVIC_InitTypeDef irq = {
+    .NVIC_IRQChannelPreemptionPriority = PIOS_IRQ_PRIO_MID,
+};
+
+static struct {
+    uint32_t handle;
+    uint32_t src[WORDS];
+    uint32_t dst[WORDS];
+
+    volatile uint32_t seq;      /* what the transfer running now copies */
+    volatile int running;       /* between setup and complete */
+    volatile int idle;          /* done, for its producer to queue again */
+
+    volatile uint32_t queued;
+    volatile uint32_t started;
+    volatile uint32_t completed;
+} req[REQUESTS];
+
+static volatile int owner = -1; /* request on the channel */
+static volatile uint32_t overlapped;
+static volatile uint32_t started_twice;
+static volatile uint32_t not_running;
+static volatile uint32_t wrong_data;
+static volatile bool stop;
+
+/* Next round of request i, its source holds the round number */
+static void queue(uint8_t i)
+{
+    uint32_t seq = req[i].queued + 1;
+
+    for (uint8_t w = 0; w < WORDS; ++w) {
+        req[i].src[w] = seq * WORDS + w;
+    }
+
+    req[i].seq = seq;
+    __atomic_store_n(&req[i].queued, seq, __ATOMIC_SEQ_CST);
+
+    PIOS_DMA_Queue(req[i].handle, i);
+}
+
+static void setup(uint32_t dma, uint32_t i)
+{
+    if (__atomic_exchange_n(&owner, (int)i, __ATOMIC_SEQ_CST) != -1) {
+        __atomic_fetch_add(&overlapped, 1, __ATOMIC_SEQ_CST);
+    }
+
+    if (__atomic_exchange_n(&req[i].running, 1, __ATOMIC_SEQ_CST)) {
+        __atomic_fetch_add(&started_twice, 1, __ATOMIC_SEQ_CST);
+    }
+
+    __atomic_fetch_add(&req[i].started, 1, __ATOMIC_SEQ_CST);
+}
+
+static void complete(uint32_t dma, uint32_t i)
+{
+    if (__atomic_exchange_n(&owner, -1, __ATOMIC_SEQ_CST) != (int)i) {
+        __atomic_fetch_add(&overlapped, 1, __ATOMIC_SEQ_CST);
+    }
+
+    if (!__atomic_exchange_n(&req[i].running, 0, __ATOMIC_SEQ_CST)) {
+        __atomic_fetch_add(&not_running, 1, __ATOMIC_SEQ_CST);
+    }
+
+    for (uint8_t w = 0; w < WORDS; ++w) {
+        if (req[i].dst[w] != req[i].seq * WORDS + w) {
+            __atomic_fetch_add(&wrong_data, 1, __ATOMIC_SEQ_CST);
+            break;
+        }
+    }
+
+    uint32_t completed = __atomic_add_fetch(&req[i].completed, 1, __ATOMIC_SEQ_CST);
+
+    /* every other round again right from the irq */
+    if (completed < ROUNDS && ((completed * 2654435761u) >> 31)) {
+        queue(i);
+    } else {
+        __atomic_store_n(&req[i].idle, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+/* Stands in for the core taking interrupts while time goes on */
+static void *irq_thread(void *arg)
+{
+    while (!stop) {
+        sim_run(SIM_CYCLES_PER_US);
+        sched_yield();
+    }
+
+    return 0;
+}
+
+static void *producer(void *arg)
+{
+    uint8_t first = (uintptr_t)arg * PER_THREAD;
+    double last = test_now();
+
+    for (uint8_t i = first; i < first + PER_THREAD; ++i) {
+        queue(i);
+    }
+
+    for (;;) {
+        bool busy = false;
+
+        for (uint8_t i = first; i < first + PER_THREAD; ++i) {
+            if (req[i].completed >= ROUNDS) {
+                continue;
+            }
+
+            busy = true;
+
+            if (__atomic_exchange_n(&req[i].idle, 0, __ATOMIC_SEQ_CST)) {
+                queue(i);
+                last = test_now();
+            }
+        }
+
+        if (!busy || test_now() - last > STALL_SECONDS) {
+            break;
+        }
+
+        sched_yield();
+    }
+
+    return 0;
+}
+
+int main(void)
+{
+    sim_init();
+    NVIC_PriorityGroupConfig(NVIC_PriorityGroup_4);
+
+    for (uint8_t i = 0; i < REQUESTS; ++i) {
+        struct pios_dma_config config = {
+            .init = {
+                .DMA_PeripheralBaseAddr = (uint32_t)req[i].src,
+                .DMA_MemoryBaseAddr = (uint32_t)req[i].dst,
+                .DMA_DIR = DMA_DIR_PeripheralSRC,
+                .DMA_BufferSize = WORDS,
+                .DMA_PeripheralInc = DMA_PeripheralInc_Enable,
+                .DMA_MemoryInc = DMA_MemoryInc_Enable,
+                .DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word,
+                .DMA_MemoryDataSize = DMA_MemoryDataSize_Word,
+                .DMA_Mode = DMA_Mode_Normal,
+                .DMA_Priority = DMA_Priority_Low,
+                .DMA_M2M = DMA_M2M_Disable,
+            },
+            .stream = DMA1_Channel2,
+            .callbacks = {
+                .setup = setup,
+                .complete = complete,
+            },
+            .irq = irq,
+            /* the channel side sorts by priority too */
+            .priority = i % 3,
+            .timer = TIM2,
+            .tim_dma_source = TIM_DMA_Update,
+        };
+
+        TEST_EQ(PIOS_DMA_Init(&req[i].handle, &config), 0);
+    }
+
+    TIM_SetAutoreload(TIM2, SIM_CYCLES_PER_US - 1);
+    TIM_DMACmd(TIM2, TIM_DMA_Update, ENABLE);
+    TIM_Cmd(TIM2, ENABLE);
+
+    pthread_t threads[PRODUCERS + 1];
+    double start = test_now();
+
+    pthread_create(&threads[PRODUCERS], 0, irq_thread, 0);
+
+    for (uintptr_t p = 0; p < PRODUCERS; ++p) {
+        pthread_create(&threads[p], 0, producer, (void *)p);
+    }
+
+    for (uint8_t p = 0; p < PRODUCERS; ++p) {
+        pthread_join(threads[p], 0);
+    }
+
+    stop = true;
+    pthread_join(threads[PRODUCERS], 0);
+
+    uint32_t transfers = 0;
+
+    for (uint8_t i = 0; i < REQUESTS; ++i) {
+        TEST_EQ(req[i].completed, ROUNDS);
+        TEST_EQ(req[i].started, req[i].queued);
+        TEST_EQ(req[i].completed, req[i].started);
+
+        transfers += req[i].completed;
+    }
+
+    TEST_EQ(overlapped, 0);
+    TEST_EQ(started_twice, 0);
+    TEST_EQ(not_running, 0);
+    TEST_EQ(wrong_data, 0);
+
+    /* channel handed back idle */
+    TEST_EQ(dma_queue[1].pending, 0);
+    TEST_TRUE(!dma_queue[1].head && !dma_queue[1].ready);
+
+    printf("%u transfers from %u threads in %.1f s\n", (unsigned)transfers, PRODUCERS + 1, test_now() - start);
+
+    return test_result();
+}
@@ -0,0 +1,420 @@
+/**
+ ******************************************************************************
+ * @file       rx_test.c
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      Oversampled and capture soft serial RX against skewed and noisy waveforms
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include "pios_soft_serial.h"
+#include "pios_usart.h"
+
+#include "test.h"
+#include "uart.h"
+
+#define BAUD    115200
+#define FRAMES  256
+
+static const struct pios_soft_serial_config config = {
+    .timer = TIM3,
+    .tim_channel = TIM_Channel_1,
+};
+
+static const struct stm32_gpio rx_pin = {
+    .gpio = GPIOA,
+    .init = {
+        .GPIO_Pin  = GPIO_Pin_3,
+        .GPIO_Mode = GPIO_Mode_IN_FLOATING,
+    },
+};
+
+/* capture RX on channel 2 takes the edges of TI1, TIM4 CH1 */
+static const struct pios_soft_serial_config capture_config = {
+    .timer = TIM4,
+    .tim_channel = TIM_Channel_2,
+};
+
+static const struct stm32_gpio capture_pin = {
+    .gpio = GPIOB,
+    .init = {
+        .GPIO_Pin  = GPIO_Pin_6,
+        .GPIO_Mode = GPIO_Mode_IN_FLOATING,
+    },
+};
+
+/* the pin the frames go to */
+static const struct stm32_gpio *line = &rx_pin;
+
+static uint8_t received[2 * FRAMES];
+static uint16_t received_count;
+
+static uint16_t rx_in(uint32_t context, uint8_t *buf, uint16_t buf_len, uint16_t *headroom, bool *task_woken)
+{
+    for (uint16_t i = 0; i < buf_len && received_count < sizeof(received); ++i) {
+        received[received_count++] = buf[i];
+    }
+
+    *headroom = sizeof(received) - received_count;
+
+    return buf_len;
+}
+
+/* nothing to send, a tx start just restarts rx with the new setup */
+static uint16_t tx_out(uint32_t context, uint8_t *buf, uint16_t buf_len, uint16_t *headroom, bool *task_woken)
+{
+    *headroom = 0;
+
+    return 0;
+}
+
+/* xorshift, the same waveforms on every run */
+static uint32_t rng_state = 2463534242u;
+
+static double rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+
+    return rng_state / 4294967296.0;
+}
+
+static void drive(bool level)
+{
+    sim_gpio_drive(line->gpio, line->init.GPIO_Pin, level ? line->init.GPIO_Pin : 0);
+}
+
+/*
+ * One frame's levels on the sender's clock, bit_cycles off from the
+ * receiver's by the skew. A glitch shorter than one sample flips the
+ * line inside a random data bit: it can hit one of the three voted
+ * samples, never two. The stop bit stays clean, a space there would be
+ * a new start bit.
+ */
+static void send_levels(const uint8_t *level, uint8_t bits, double bit_cycles, double sample_cycles, bool glitch)
+{
+    uint64_t start = sim_time;
+    uint8_t glitch_bit = 1 + rng() * (bits - 2);
+
+    for (uint8_t i = 0; i < bits; ++i) {
+        uint64_t bit_start = start + (uint64_t)(i * bit_cycles);
+
+        sim_run_until(bit_start);
+        drive(level[i]);
+
+        if (glitch && i == glitch_bit) {
+            double width = (0.3 + 0.6 * rng()) * sample_cycles;
+            double at = (bit_cycles - width) * rng();
+
+            sim_run_until(bit_start + (uint64_t)at);
+            drive(!level[i]);
+            sim_run_until(bit_start + (uint64_t)(at + width));
+            drive(level[i]);
+        }
+    }
+
+    sim_run_until(start + (uint64_t)(bits * bit_cycles));
+}
+
+static void send(const struct uart_format *f, uint16_t data, double bit_cycles, double sample_cycles, bool glitch)
+{
+    uint8_t level[UART_FRAME_MAX];
+    uint8_t bits = uart_frame(f, data, level);
+
+    send_levels(level, bits, bit_cycles, sample_cycles, glitch);
+}
+
+static void receive(uint32_t id, const struct uart_format *f, uint8_t oversample, double skew, bool noise)
+{
+    struct pios_soft_serial_rx_errors errors;
+    double bit_cycles = (double)SIM_SYSCLK / BAUD;
+    double sender_cycles = bit_cycles / (1 + skew);
+    double sample_cycles = bit_cycles / oversample;
+    enum PIOS_USART_Inverted inv = f->inverted ? PIOS_USART_Inverted_Rx : PIOS_USART_Inverted_None;
+
+    pios_soft_serial_driver.ioctl(id, PIOS_IOCTL_SOFT_SERIAL_SET_RXOVERSAMPLE, &oversample);
+    pios_soft_serial_driver.ioctl(id, PIOS_IOCTL_USART_SET_INVERTED, &inv);
+    pios_soft_serial_driver.set_config(id, f->word_len, f->parity, f->stop_bits, BAUD);
+
+    /* idle line, then the sampling starts at some phase of it */
+    drive(!f->inverted);
+    sim_run(rng() * bit_cycles * 8);
+
+    received_count = 0;
+    pios_soft_serial_driver.tx_start(id, 0);
+    pios_soft_serial_driver.ioctl(id, PIOS_IOCTL_SOFT_SERIAL_GET_RXERRORS, &errors);
+
+    /* back to back frames, or a gap of a few bits */
+    for (uint16_t i = 0; i < FRAMES; ++i) {
+        send(f, i, sender_cycles, sample_cycles, noise);
+        if (i & 1) {
+            sim_run(rng() * 3 * sender_cycles);
+        }
+    }
+
+    /* one frame with bad parity, one with its stop bit a space */
+    if (f->parity != PIOS_COM_Parity_No) {
+        struct uart_format flipped = *f;
+
+        flipped.parity = f->parity == PIOS_COM_Parity_Even ? PIOS_COM_Parity_Odd : PIOS_COM_Parity_Even;
+        send(&flipped, 0x5a, sender_cycles, sample_cycles, false);
+    }
+
+    uint8_t level[UART_FRAME_MAX];
+    uint8_t bits = uart_frame(f, 0xff, level);
+
+    level[bits - 1] = !level[bits - 1];
+    send_levels(level, bits, sender_cycles, sample_cycles, false);
+    drive(!level[bits - 1]);
+
+    /* the decoder runs per half buffer, flush it with idle samples */
+    sim_run(100 * bit_cycles);
+
+    struct pios_soft_serial_rx_errors after;
+
+    pios_soft_serial_driver.ioctl(id, PIOS_IOCTL_SOFT_SERIAL_GET_RXERRORS, &after);
+
+    uint32_t wrong = 0;
+
+    for (uint16_t i = 0; i < FRAMES && i < received_count; ++i) {
+        wrong += received[i] != (uint8_t)i;
+    }
+
+    TEST_EQ(received_count, FRAMES);
+    TEST_EQ(wrong, 0);
+    TEST_EQ(after.parity - errors.parity, f->parity != PIOS_COM_Parity_No);
+    TEST_EQ(after.framing - errors.framing, 1);
+    TEST_EQ(after.overrun - errors.overrun, 0);
+
+    printf("%ux %+.1f%%%s%s: %u/%u\n", oversample, skew * 100, noise ? " noise" : "", f->inverted ? " inverted" : "", received_count - wrong, FRAMES);
+}
+
+/*
+ * The first space sample is up to one sample after the start bit edge,
+ * so bit centers land up to 1/6 bit late at 3x, 1/4 at 4x and 1/8 at 8x
+ * (3x rounds half a sample early). By the stop bit of an 11 bit frame
+ * that leaves about 3.2%, 2.4% and 3.6% of skew. A glitch shorter than
+ * a sample is only outvoted while all three voted samples are inside
+ * the bit, at 8x that holds to 2.4% of skew.
+ */
+static const struct {
+    uint8_t oversample;
+    double skew;
+    bool noise;
+} cases[] = {
+    { 3, 0.03,  false },
+    { 4, 0.02,  false },
+    { 8, 0.03,  false },
+    { 8, 0.02,  true  },
+};
+
+/*
+ * One sample per bit, aligned by the start bit edge. Each data bit only
+ * holds its level within 1/16 bit of its center and the opposite one
+ * around it, so the frames only come through if the edge handler's
+ * counter preload puts the first data bit sample (and the ones after it)
+ * mid-bit. The simulated edge handler runs on the edge, the driver's
+ * allowance for exception entry takes its 16 cycles off the 39 here.
+ */
+static void receive_mid_bit(uint32_t id)
+{
+    static const struct uart_format f = { PIOS_COM_Word_length_8b, PIOS_COM_Parity_No, PIOS_COM_StopBits_1 };
+    struct pios_soft_serial_rx_errors errors;
+    double bit_cycles = (double)SIM_SYSCLK / BAUD;
+    uint8_t oversample = 1;
+    enum PIOS_USART_Inverted inv = PIOS_USART_Inverted_None;
+
+    /*
+     * Switched while the oversampled receiver waits, with the inverted
+     * line's last edges still pending: no tx_start, the ioctls alone
+     * must leave it waiting for a start bit in the new mode.
+     */
+    pios_soft_serial_driver.ioctl(id, PIOS_IOCTL_SOFT_SERIAL_SET_RXOVERSAMPLE, &oversample);
+    pios_soft_serial_driver.ioctl(id, PIOS_IOCTL_USART_SET_INVERTED, &inv);
+    pios_soft_serial_driver.set_config(id, f.word_len, f.parity, f.stop_bits, BAUD);
+
+    drive(true);
+    sim_run(rng() * bit_cycles * 8);
+
+    received_count = 0;
+    pios_soft_serial_driver.ioctl(id, PIOS_IOCTL_SOFT_SERIAL_GET_RXERRORS, &errors);
+
+    for (uint16_t i = 0; i < FRAMES; ++i) {
+        uint8_t level[UART_FRAME_MAX];
+        uint8_t bits  = uart_frame(&f, i, level);
+        uint64_t start = sim_time;
+
+        drive(level[0]);
+
+        for (uint8_t b = 1; b < bits - 1; ++b) {
+            uint64_t bit_start = start + (uint64_t)(b * bit_cycles);
+
+            sim_run_until(bit_start);
+            drive(!level[b]);
+            sim_run_until(bit_start + (uint64_t)(bit_cycles * 7 / 16));
+            drive(level[b]);
+            sim_run_until(bit_start + (uint64_t)(bit_cycles * 9 / 16));
+            drive(!level[b]);
+        }
+
+        sim_run_until(start + (uint64_t)((bits - 1) * bit_cycles));
+        drive(true);
+        sim_run_until(start + (uint64_t)(bits * bit_cycles));
+
+        /* some phase of the timer for the next edge */
+        sim_run(rng() * 3 * bit_cycles);
+    }
+
+    sim_run(10 * bit_cycles);
+
+    struct pios_soft_serial_rx_errors after;
+
+    pios_soft_serial_driver.ioctl(id, PIOS_IOCTL_SOFT_SERIAL_GET_RXERRORS, &after);
+
+    uint32_t wrong = 0;
+
+    for (uint16_t i = 0; i < FRAMES && i < received_count; ++i) {
+        wrong += received[i] != (uint8_t)i;
+    }
+
+    TEST_EQ(received_count, FRAMES);
+    TEST_EQ(wrong, 0);
+    TEST_EQ(after.framing - errors.framing, 0);
+    TEST_EQ(after.late - errors.late, 0);
+
+    printf("1x mid-bit: %u/%u\n", received_count - wrong, FRAMES);
+}
+
+/* mostly all space and all mark data bits, the fewest edges per frame */
+static uint8_t capture_data(uint16_t i)
+{
+    return (i % 3 == 2) ? i : ((i & 1) ? 0xff : 0x00);
+}
+
+/*
+ * Capture RX on the edge timestamps. The edges are decoded on the dma
+ * half and full transfer irqs, frames end by the next edge or by time.
+ * A burst ending on a frame without edges after its start bit (0xff)
+ * keeps that frame until PIOS_Soft_Serial_Rx_Poll(). A space pulse on
+ * the idle line shorter than half a bit is dropped.
+ */
+static void receive_capture(uint32_t id, double skew)
+{
+    static const struct uart_format f = { PIOS_COM_Word_length_8b, PIOS_COM_Parity_No, PIOS_COM_StopBits_1 };
+    struct pios_soft_serial_rx_errors errors;
+    double bit_cycles = (double)SIM_SYSCLK / BAUD;
+    double sender_cycles = bit_cycles / (1 + skew);
+
+    drive(true);
+    sim_run(rng() * bit_cycles * 8);
+
+    received_count = 0;
+    pios_soft_serial_driver.tx_start(id, 0);
+    pios_soft_serial_driver.ioctl(id, PIOS_IOCTL_SOFT_SERIAL_GET_RXERRORS, &errors);
+
+    /* TRC on channel 2, TI1F_ED filtered by IC1F (8 clocks by default) */
+    TEST_EQ(TIM4->CCMR1 & TIM_CCMR1_CC2S, TIM_CCMR1_CC2S);
+    TEST_EQ(TIM4->CCMR1 & TIM_CCMR1_IC1F, 3 << 4);
+
+    for (uint16_t i = 0; i < FRAMES; ++i) {
+        send(&f, capture_data(i), sender_cycles, 0, false);
+
+        if (i & 1) {
+            sim_run(rng() * 3 * sender_cycles);
+        }
+
+        if (i % 8 == 3) {
+            sim_run(2 * sender_cycles);
+            drive(false);
+            sim_run((0.1 + 0.3 * rng()) * bit_cycles);
+            drive(true);
+            sim_run(2 * sender_cycles);
+        }
+    }
+
+    /* mark ending, polled well within the 16 bit timer period */
+    send(&f, 0xff, sender_cycles, 0, false);
+    sim_run(20 * bit_cycles);
+
+    TEST_TRUE(received_count <= FRAMES);
+
+    PIOS_Soft_Serial_Rx_Poll(id);
+
+    struct pios_soft_serial_rx_errors after;
+
+    pios_soft_serial_driver.ioctl(id, PIOS_IOCTL_SOFT_SERIAL_GET_RXERRORS, &after);
+
+    uint32_t wrong = 0;
+
+    for (uint16_t i = 0; i < FRAMES && i < received_count; ++i) {
+        wrong += received[i] != capture_data(i);
+    }
+
+    TEST_EQ(received_count, FRAMES + 1);
+    TEST_EQ(received[FRAMES], 0xff);
+    TEST_EQ(wrong, 0);
+    TEST_EQ(after.framing - errors.framing, 0);
+    TEST_EQ(after.overrun - errors.overrun, 0);
+
+    printf("capture %+.1f%%: %u/%u\n", skew * 100, received_count - wrong, FRAMES + 1);
+}
+
+int main(void)
+{
+    struct uart_format formats[] = {
+        { PIOS_COM_Word_length_8b, PIOS_COM_Parity_No, PIOS_COM_StopBits_1 },
+        { PIOS_COM_Word_length_8b, PIOS_COM_Parity_Even, PIOS_COM_StopBits_1, true },
+    };
+    uint32_t id;
+
+    sim_init();
+    NVIC_PriorityGroupConfig(NVIC_PriorityGroup_4);
+
+    TEST_EQ(PIOS_Soft_Serial_Init(&id, &config), 0);
+    pios_soft_serial_driver.ioctl(id, PIOS_IOCTL_SOFT_SERIAL_SET_RXGPIO, (void *)&rx_pin);
+    pios_soft_serial_driver.bind_rx_cb(id, rx_in, 0);
+    pios_soft_serial_driver.bind_tx_cb(id, tx_out, 0);
+    pios_soft_serial_driver.rx_start(id, sizeof(received));
+
+    for (uint8_t n = 0; n < sizeof(formats) / sizeof(formats[0]); ++n) {
+        for (uint8_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+            for (int8_t sign = -1; sign <= 1; ++sign) {
+                receive(id, &formats[n], cases[c].oversample, sign * cases[c].skew, cases[c].noise);
+            }
+        }
+    }
+
+    receive_mid_bit(id);
+
+    bool capture = true;
+
+    TEST_EQ(PIOS_Soft_Serial_Init(&id, &capture_config), 0);
+    pios_soft_serial_driver.ioctl(id, PIOS_IOCTL_SOFT_SERIAL_SET_RXGPIO, (void *)&capture_pin);
+    pios_soft_serial_driver.ioctl(id, PIOS_IOCTL_SOFT_SERIAL_SET_RXCAPTURE, &capture);
+    pios_soft_serial_driver.bind_rx_cb(id, rx_in, 0);
+    pios_soft_serial_driver.bind_tx_cb(id, tx_out, 0);
+    pios_soft_serial_driver.set_config(id, PIOS_COM_Word_length_8b, PIOS_COM_Parity_No, PIOS_COM_StopBits_1, BAUD);
+    pios_soft_serial_driver.rx_start(id, sizeof(received));
+    line = &capture_pin;
+
+    for (int8_t sign = -1; sign <= 1; ++sign) {
+        receive_capture(id, sign * 0.03);
+    }
+
+    return test_result();
+}
@@ -0,0 +1,1634 @@
+/**
+ ******************************************************************************
+ * @file       sim.c
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      Host-side STM32F1 peripheral simulator for the driver tests
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#define _GNU_SOURCE
+
+#include "sim.h"
+
+#include <malloc.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define SIM_PERIPH_SIZE     0x24000                 /* up to the end of RCC */
+#define SIM_BB_SIZE         (SIM_PERIPH_SIZE * 32)
+#define SIM_CORE_BASE       0xe0000000              /* DWT, NVIC, SCB */
+#define SIM_CORE_SIZE       0x10000
+
+#define SIM_NEVER           UINT64_MAX
+
+#define SIM_GPIO_PORTS      5                       /* A..E on medium density parts */
+#define SIM_TIMERS          4
+#define SIM_DMA_CHANNELS    7
+#define SIM_EXTI_LINES      20
+#define SIM_NO_PIN          0xff
+
+/* what bit-band alias words hold between two looks, a byte repeated */
+#define SIM_BB_IDLE         0xa5a5a5a5
+
+/* EXTI_PR holds this next to the pending bits, any write clears it */
+#define SIM_EXTI_PR_MARK    0x80000000
+
+/* dispatches at one point in time before we call it an interrupt storm */
+#define SIM_IRQ_STORM       1000000
+
+#define DWT_CYCCNT_REG      (*(volatile uint32_t *)0xe0001004)
+
+uint64_t sim_time;
+sim_gpio_hook_t sim_gpio_hook;
+uint32_t sim_irq_count[64];
+__thread uint32_t sim_exclusive;
+
+struct sim_gpio {
+    GPIO_TypeDef *regs;
+    uint32_t crl;           /* config the pin masks are decoded from */
+    uint32_t crh;
+    uint16_t out;           /* general purpose outputs */
+    uint16_t af;            /* alternate function outputs */
+    uint16_t od;            /* outputs that are open drain */
+    uint16_t input;         /* digital inputs */
+    uint16_t pull;          /* inputs with ODR selecting up or down */
+    uint16_t odr;           /* last seen */
+    uint16_t drive;         /* pins driven from outside */
+    uint16_t drive_levels;
+    uint16_t tim_levels;    /* timer channel outputs on this port */
+    uint16_t levels;
+    uint16_t exti;          /* EXTI lines AFIO routes from this port */
+    uint16_t capture;       /* pins some timer channel captures on */
+};
+
+/* DIER request bits 8..14 */
+enum {
+    SIM_TIM_REQ_UP,
+    SIM_TIM_REQ_CC1,
+    SIM_TIM_REQ_COM = 5,
+    SIM_TIM_REQ_TRIG,
+    SIM_TIM_REQS
+};
+
+/* input capture edges */
+#define SIM_EDGE_RISING     1
+#define SIM_EDGE_FALLING    2
+
+struct sim_tim {
+    TIM_TypeDef *regs;
+    uint8_t remap_shift;
+    uint8_t remap_mask;
+    const uint8_t (*remaps)[4];
+    uint8_t dma[SIM_TIM_REQS];  /* DMA1 channel + 1 serving the request, RM0008 table 78 */
+
+    uint8_t pins[4];            /* port << 4 | pin of CH1..4 */
+    uint8_t in_pin[4];          /* what the channel captures on */
+    uint8_t in_edge[4];
+
+    bool running;
+    uint32_t div;               /* cycles per counter tick */
+    uint64_t next_tick;
+    uint64_t next_event;
+    uint16_t cnt;               /* as of the last tick */
+    uint16_t arr;               /* shadow registers in use */
+    uint16_t psc;
+    uint16_t ccr[4];
+    uint16_t sr;
+    uint16_t seen_cnt;
+    uint8_t oc;                 /* channels in output compare */
+    uint8_t ocpe;               /* with CCRx preload */
+    uint8_t follow;             /* with a forced or PWM mode */
+    uint8_t ocm[4];
+    bool ref[4];                /* OCxREF */
+    uint8_t out;                /* channel output levels */
+};
+
+struct sim_dma {
+    DMA_Channel_TypeDef *regs;
+    uint8_t shift;              /* of its ISR bits */
+    bool on;                    /* enabled with what is loaded below */
+    uint32_t cpar;              /* as loaded */
+    uint32_t cmar;
+    uint16_t reload;
+    uint16_t count;
+    uint32_t par;
+    uint32_t mar;
+    struct sim_tim *req_tim;    /* timer request waiting for the channel */
+    uint8_t req;
+};
+
+struct sim_exti {
+    uint32_t imr;
+    uint32_t emr;
+    uint32_t rtsr;
+    uint32_t ftsr;
+    uint32_t pr;
+};
+
+#define P(port, pin) (((port) - 'A') << 4 | (pin))
+
+/* CH1..4 by the timer's remap field in AFIO_MAPR */
+static const uint8_t sim_tim1_pins[4][4] = {
+    { P('A', 8), P('A', 9), P('A', 10), P('A', 11) },
+    { P('A', 8), P('A', 9), P('A', 10), P('A', 11) },
+    { P('A', 8), P('A', 9), P('A', 10), P('A', 11) },
+    { P('E', 9), P('E', 11), P('E', 13), P('E', 14) },
+};
+
+static const uint8_t sim_tim2_pins[4][4] = {
+    { P('A', 0), P('A', 1), P('A', 2), P('A', 3) },
+    { P('A', 15), P('B', 3), P('A', 2), P('A', 3) },
+    { P('A', 0), P('A', 1), P('B', 10), P('B', 11) },
+    { P('A', 15), P('B', 3), P('B', 10), P('B', 11) },
+};
+
+static const uint8_t sim_tim3_pins[4][4] = {
+    { P('A', 6), P('A', 7), P('B', 0), P('B', 1) },
+    { P('A', 6), P('A', 7), P('B', 0), P('B', 1) },
+    { P('B', 4), P('B', 5), P('B', 0), P('B', 1) },
+    { P('C', 6), P('C', 7), P('C', 8), P('C', 9) },
+};
+
+static const uint8_t sim_tim4_pins[2][4] = {
+    { P('B', 6), P('B', 7), P('B', 8), P('B', 9) },
+    { P('D', 12), P('D', 13), P('D', 14), P('D', 15) },
+};
+
+#undef P
+
+static struct sim_gpio sim_gpio[SIM_GPIO_PORTS];
+static struct sim_tim sim_tim[SIM_TIMERS];
+static struct sim_dma sim_dma[SIM_DMA_CHANNELS];
+static struct sim_exti sim_exti;
+static uint32_t sim_dma_isr;
+static uint32_t sim_mapr;
+static uint32_t sim_exticr[4];
+
+static bool sim_ready;
+static pthread_mutex_t sim_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+/* NVIC, the enable bits live in ISER where the code reads them */
+#define sim_enabled ((volatile uint32_t *)NVIC->ISER)
+static uint32_t sim_pending[2];
+static uint8_t sim_active[64];
+static uint8_t sim_depth;
+static uint32_t sim_basepri;
+static uint32_t sim_primask;
+static uint64_t sim_storm_time;
+static uint32_t sim_storm_count;
+
+#define SIM_HANDLER(name) extern void name(void) __attribute__((weak))
+
+SIM_HANDLER(EXTI0_IRQHandler);
+SIM_HANDLER(EXTI1_IRQHandler);
+SIM_HANDLER(EXTI2_IRQHandler);
+SIM_HANDLER(EXTI3_IRQHandler);
+SIM_HANDLER(EXTI4_IRQHandler);
+SIM_HANDLER(DMA1_Channel1_IRQHandler);
+SIM_HANDLER(DMA1_Channel2_IRQHandler);
+SIM_HANDLER(DMA1_Channel3_IRQHandler);
+SIM_HANDLER(DMA1_Channel4_IRQHandler);
+SIM_HANDLER(DMA1_Channel5_IRQHandler);
+SIM_HANDLER(DMA1_Channel6_IRQHandler);
+SIM_HANDLER(DMA1_Channel7_IRQHandler);
+SIM_HANDLER(EXTI9_5_IRQHandler);
+SIM_HANDLER(TIM1_BRK_IRQHandler);
+SIM_HANDLER(TIM1_UP_IRQHandler);
+SIM_HANDLER(TIM1_TRG_COM_IRQHandler);
+SIM_HANDLER(TIM1_CC_IRQHandler);
+SIM_HANDLER(TIM2_IRQHandler);
+SIM_HANDLER(TIM3_IRQHandler);
+SIM_HANDLER(TIM4_IRQHandler);
+SIM_HANDLER(EXTI15_10_IRQHandler);
+
+static void (*const sim_vectors[64])(void) = {
+    [EXTI0_IRQn] = EXTI0_IRQHandler,
+    [EXTI1_IRQn] = EXTI1_IRQHandler,
+    [EXTI2_IRQn] = EXTI2_IRQHandler,
+    [EXTI3_IRQn] = EXTI3_IRQHandler,
+    [EXTI4_IRQn] = EXTI4_IRQHandler,
+    [DMA1_Channel1_IRQn] = DMA1_Channel1_IRQHandler,
+    [DMA1_Channel2_IRQn] = DMA1_Channel2_IRQHandler,
+    [DMA1_Channel3_IRQn] = DMA1_Channel3_IRQHandler,
+    [DMA1_Channel4_IRQn] = DMA1_Channel4_IRQHandler,
+    [DMA1_Channel5_IRQn] = DMA1_Channel5_IRQHandler,
+    [DMA1_Channel6_IRQn] = DMA1_Channel6_IRQHandler,
+    [DMA1_Channel7_IRQn] = DMA1_Channel7_IRQHandler,
+    [EXTI9_5_IRQn] = EXTI9_5_IRQHandler,
+    [TIM1_BRK_IRQn] = TIM1_BRK_IRQHandler,
+    [TIM1_UP_IRQn] = TIM1_UP_IRQHandler,
+    [TIM1_TRG_COM_IRQn] = TIM1_TRG_COM_IRQHandler,
+    [TIM1_CC_IRQn] = TIM1_CC_IRQHandler,
+    [TIM2_IRQn] = TIM2_IRQHandler,
+    [TIM3_IRQn] = TIM3_IRQHandler,
+    [TIM4_IRQn] = TIM4_IRQHandler,
+    [EXTI15_10_IRQn] = EXTI15_10_IRQHandler,
+};
+
+static void sim_dma_request(struct sim_dma *ch, struct sim_tim *tim, uint8_t req);
+static void sim_tim_capture(struct sim_tim *tim, uint8_t ch);
+static void sim_gpio_update(struct sim_gpio *port);
+static void sim_take(void);
+
+static void sim_fail(const char *what)
+{
+    fprintf(stderr, "sim: %s at cycle %llu\n", what, (unsigned long long)sim_time);
+    abort();
+}
+
+void assert_failed(uint8_t *file, uint32_t line)
+{
+    fprintf(stderr, "%s:%u: assertion failed at cycle %llu\n", (const char *)file, line, (unsigned long long)sim_time);
+    abort();
+}
+
+/* Bit-band alias word of a register bit */
+static volatile uint32_t *sim_bb(volatile void *reg, uint8_t bit)
+{
+    return (volatile uint32_t *)(uintptr_t)(PERIPH_BB_BASE + ((uint32_t)(uintptr_t)reg - PERIPH_BASE) * 32 + bit * 4);
+}
+
+/*
+ * Alias words hold SIM_BB_IDLE, anything else was stored by the code. The
+ * register may have been written directly as well, the alias store is
+ * taken as the later one.
+ */
+static uint32_t sim_bb_take(volatile uint32_t *reg, uint32_t value, uint8_t bits)
+{
+    for (uint8_t bit = 0; bit < bits; ++bit) {
+        volatile uint32_t *alias = sim_bb(reg, bit);
+        uint32_t word = *alias;
+
+        if (word != SIM_BB_IDLE) {
+            value  = (value & ~(1u << bit)) | ((word & 1) << bit);
+            *alias = SIM_BB_IDLE;
+        }
+    }
+
+    return value;
+}
+
+/* EXTI */
+
+static void sim_exti_pend(uint32_t lines)
+{
+    sim_exti.pr |= lines;
+    EXTI->PR = sim_exti.pr | SIM_EXTI_PR_MARK;
+}
+
+static uint32_t sim_exti_reg(volatile uint32_t *reg, uint32_t *seen)
+{
+    uint32_t value = sim_bb_take(reg, *reg, SIM_EXTI_LINES) & ((1u << SIM_EXTI_LINES) - 1);
+
+    *reg = value;
+    *seen = value;
+
+    return value;
+}
+
+static void sim_exti_take(void)
+{
+    EXTI_TypeDef *regs = EXTI;
+
+    sim_exti_reg(&regs->IMR, &sim_exti.imr);
+    sim_exti_reg(&regs->EMR, &sim_exti.emr);
+    sim_exti_reg(&regs->RTSR, &sim_exti.rtsr);
+    sim_exti_reg(&regs->FTSR, &sim_exti.ftsr);
+
+    uint32_t pr = regs->PR;
+
+    if (pr != (sim_exti.pr | SIM_EXTI_PR_MARK)) {
+        /* write 1 to clear */
+        sim_exti.pr &= ~pr;
+    }
+
+    uint32_t swier = regs->SWIER;
+
+    if (swier) {
+        regs->SWIER = 0;
+        sim_exti.pr |= swier & sim_exti.imr;
+    }
+
+    regs->PR = sim_exti.pr | SIM_EXTI_PR_MARK;
+}
+
+/* GPIO */
+
+static void sim_gpio_config(struct sim_gpio *port)
+{
+    port->crl = port->regs->CRL;
+    port->crh = port->regs->CRH;
+    port->out = port->af = port->od = port->input = port->pull = 0;
+
+    uint64_t cr = (uint64_t)port->crh << 32 | port->crl;
+
+    for (uint8_t pin = 0; pin < 16; ++pin) {
+        uint8_t mode = (cr >> (pin * 4)) & 3;
+        uint8_t cnf = (cr >> (pin * 4 + 2)) & 3;
+        uint16_t bit = 1 << pin;
+
+        if (mode) {
+            if (cnf & 2) {
+                port->af |= bit;
+            } else {
+                port->out |= bit;
+            }
+            if (cnf & 1) {
+                port->od |= bit;
+            }
+        } else if (cnf == 1) {
+            port->input |= bit;
+        } else if (cnf == 2) {
+            port->input |= bit;
+            port->pull |= bit;
+        }
+        /* analog inputs read 0 */
+    }
+}
+
+/* Edges latch EXTI pending bits and timer captures */
+static void sim_gpio_edges(struct sim_gpio *port, uint16_t changed)
+{
+    uint8_t nr = port - sim_gpio;
+    uint32_t lines = changed & port->exti;
+
+    if (lines) {
+        uint32_t rising = lines & port->levels & sim_exti.rtsr;
+        uint32_t falling = lines & ~port->levels & sim_exti.ftsr;
+
+        if (rising | falling) {
+            sim_exti_pend(rising | falling);
+        }
+    }
+
+    if (!(changed & port->capture)) {
+        return;
+    }
+
+    for (struct sim_tim *tim = sim_tim; tim < sim_tim + SIM_TIMERS; ++tim) {
+        for (uint8_t ch = 0; ch < 4; ++ch) {
+            uint8_t pin = tim->in_pin[ch];
+
+            if (!tim->in_edge[ch] || (pin >> 4) != nr || !(changed & (1 << (pin & 15)))) {
+                continue;
+            }
+
+            bool level = (port->levels >> (pin & 15)) & 1;
+
+            if (tim->in_edge[ch] & (level ? SIM_EDGE_RISING : SIM_EDGE_FALLING)) {
+                sim_tim_capture(tim, ch);
+            }
+        }
+    }
+}
+
+static void sim_gpio_update(struct sim_gpio *port)
+{
+    uint16_t driven_high = port->drive & port->drive_levels;
+    uint16_t outputs = port->out | port->af;
+    uint16_t source = (port->odr & port->out) | (port->tim_levels & port->af);
+
+    /* a released open drain line floats high unless something outside pulls it down */
+    uint16_t levels = (source & outputs & ~port->od)
+                      | (source & port->od & (driven_high | ~port->drive))
+                      | (port->input & (driven_high | (~port->drive & port->pull & port->odr)));
+
+    uint16_t changed = levels ^ port->levels;
+
+    if (!changed) {
+        return;
+    }
+
+    port->levels = levels;
+    port->regs->IDR = levels;
+
+    if (sim_gpio_hook) {
+        sim_gpio_hook(port->regs, levels, changed);
+    }
+
+    sim_gpio_edges(port, changed);
+}
+
+static void sim_gpio_take(struct sim_gpio *port)
+{
+    GPIO_TypeDef *regs = port->regs;
+
+    if (regs->CRL != port->crl || regs->CRH != port->crh) {
+        sim_gpio_config(port);
+    }
+
+    uint32_t odr = sim_bb_take(&regs->ODR, regs->ODR, 16);
+    uint32_t bsrr = regs->BSRR;
+    uint32_t brr = regs->BRR;
+
+    if (bsrr) {
+        regs->BSRR = 0;
+        odr = (odr & ~(bsrr >> 16)) | (bsrr & 0xffff);
+    }
+    if (brr) {
+        regs->BRR = 0;
+        odr &= ~brr;
+    }
+
+    odr &= 0xffff;
+    regs->ODR = odr;
+
+    port->odr = odr;
+
+    sim_gpio_update(port);
+}
+
+/* DMA writes to BSRR/BRR, without looking for anything else the code wrote */
+static void sim_gpio_set_reset(struct sim_gpio *port)
+{
+    GPIO_TypeDef *regs = port->regs;
+    uint32_t odr = (port->odr & ~(regs->BSRR >> 16) & ~regs->BRR) | (regs->BSRR & 0xffff);
+
+    regs->BSRR = 0;
+    regs->BRR  = 0;
+    regs->ODR  = odr;
+
+    if (odr != port->odr) {
+        port->odr = odr;
+        sim_gpio_update(port);
+    }
+}
+
+static struct sim_gpio *sim_gpio_port(GPIO_TypeDef *gpio)
+{
+    uint32_t nr = ((uint32_t)(uintptr_t)gpio - GPIOA_BASE) / (GPIOB_BASE - GPIOA_BASE);
+
+    if (nr >= SIM_GPIO_PORTS) {
+        sim_fail("no such gpio port");
+    }
+
+    return &sim_gpio[nr];
+}
+
+/* TIM */
+
+/* channel modes from CCMR1/2, looked at on every event */
+static void sim_tim_modes(struct sim_tim *tim)
+{
+    uint32_t ccmr = tim->regs->CCMR2 << 16 | tim->regs->CCMR1;
+
+    tim->oc     = 0;
+    tim->ocpe   = 0;
+    tim->follow = 0;
+
+    for (uint8_t ch = 0; ch < 4; ++ch) {
+        uint8_t field = ccmr >> (ch * 8);
+
+        tim->ocm[ch] = (field >> 4) & 7;
+
+        if (!(field & TIM_CCMR1_CC1S)) {
+            tim->oc |= 1 << ch;
+        }
+        if (field & TIM_CCMR1_OC1PE) {
+            tim->ocpe |= 1 << ch;
+        }
+        if (tim->ocm[ch] >= 4) {
+            tim->follow |= 1 << ch;
+        }
+    }
+}
+
+static bool sim_tim_oc(struct sim_tim *tim, uint8_t ch)
+{
+    return (tim->oc >> ch) & 1;
+}
+
+static bool sim_tim_ocpe(struct sim_tim *tim, uint8_t ch)
+{
+    return (tim->ocpe >> ch) & 1;
+}
+
+static volatile uint16_t *sim_tim_ccr(struct sim_tim *tim, uint8_t ch)
+{
+    return &tim->regs->CCR1 + ch * 2;
+}
+
+/* cycles per tick of the timer clock, twice a divided APB clock */
+static uint32_t sim_tim_ck(struct sim_tim *tim)
+{
+    uint32_t ppre = (tim->regs == TIM1) ? (RCC->CFGR >> 11) & 7 : (RCC->CFGR >> 8) & 7;
+
+    return (ppre & 4) ? 1u << (ppre & 3) : 1;
+}
+
+static void sim_tim_flag(struct sim_tim *tim, uint16_t flag)
+{
+    tim->sr |= flag;
+    tim->regs->SR = tim->sr;
+}
+
+static void sim_tim_dma(struct sim_tim *tim, uint8_t req)
+{
+    if ((tim->regs->DIER & (TIM_DIER_UDE << req)) && tim->dma[req]) {
+        sim_dma_request(&sim_dma[tim->dma[req] - 1], tim, req);
+    }
+}
+
+/* counter to now, stopping short of an event not handled yet */
+static void sim_tim_advance(struct sim_tim *tim)
+{
+    if (!tim->running) {
+        return;
+    }
+
+    uint64_t until = (sim_time < tim->next_event) ? sim_time : tim->next_event - 1;
+
+    if (until < tim->next_tick) {
+        return;
+    }
+
+    uint64_t ticks = (until - tim->next_tick) / tim->div + 1;
+
+    tim->cnt += ticks;
+    tim->next_tick += ticks * tim->div;
+}
+
+static uint32_t sim_tim_limit(struct sim_tim *tim)
+{
+    /* a counter set past ARR runs up to the 16 bit wrap */
+    return (tim->cnt > tim->arr) ? 0xffff : tim->arr;
+}
+
+static void sim_tim_schedule(struct sim_tim *tim)
+{
+    tim->running = (tim->regs->CR1 & TIM_CR1_CEN) && tim->arr;
+
+    if (!tim->running) {
+        tim->next_event = SIM_NEVER;
+        return;
+    }
+
+    uint32_t limit = sim_tim_limit(tim);
+    uint32_t ticks = limit + 1 - tim->cnt;
+
+    for (uint8_t ch = 0; ch < 4; ++ch) {
+        uint16_t ccr = tim->ccr[ch];
+
+        if (sim_tim_oc(tim, ch) && ccr > tim->cnt && ccr <= limit && (uint32_t)(ccr - tim->cnt) < ticks) {
+            ticks = ccr - tim->cnt;
+        }
+    }
+
+    tim->next_event = tim->next_tick + (uint64_t)(ticks - 1) * tim->div;
+}
+
+static void sim_tim_outputs(struct sim_tim *tim)
+{
+    TIM_TypeDef *regs = tim->regs;
+    bool moe = (regs != TIM1) || (regs->BDTR & TIM_BDTR_MOE);
+    uint8_t out = 0;
+
+    if (!tim->out && !(regs->CCER & 0x1111)) {
+        return;
+    }
+
+    for (uint8_t ch = 0; ch < 4; ++ch) {
+        uint16_t ccer = regs->CCER >> (ch * 4);
+
+        if (moe && (ccer & TIM_CCER_CC1E) && sim_tim_oc(tim, ch)) {
+            out |= (tim->ref[ch] ^ ((ccer & TIM_CCER_CC1P) != 0)) << ch;
+        }
+    }
+
+    for (uint8_t changed = out ^ tim->out; changed; changed &= changed - 1) {
+        uint8_t ch = __builtin_ctz(changed);
+        uint8_t pin = tim->pins[ch];
+
+        if ((pin >> 4) >= SIM_GPIO_PORTS) {
+            continue;
+        }
+
+        struct sim_gpio *port = &sim_gpio[pin >> 4];
+
+        port->tim_levels ^= 1 << (pin & 15);
+        sim_gpio_update(port);
+    }
+
+    tim->out = out;
+}
+
+/* OCxREF of the modes that follow the counter, or are forced */
+static void sim_tim_refs(struct sim_tim *tim)
+{
+    if (!tim->follow) {
+        return;
+    }
+
+    for (uint8_t ch = 0; ch < 4; ++ch) {
+        switch (tim->ocm[ch]) {
+            case 4:
+                tim->ref[ch] = false;
+                break;
+            case 5:
+                tim->ref[ch] = true;
+                break;
+            case 6:
+                tim->ref[ch] = tim->cnt < tim->ccr[ch];
+                break;
+            case 7:
+                tim->ref[ch] = tim->cnt >= tim->ccr[ch];
+                break;
+        }
+    }
+}
+
+/* shadow registers from their preload */
+static void sim_tim_update(struct sim_tim *tim, bool flag)
+{
+    TIM_TypeDef *regs = tim->regs;
+
+    tim->arr = regs->ARR;
+    tim->psc = regs->PSC;
+    tim->div = (tim->psc + 1) * sim_tim_ck(tim);
+    tim->next_tick = sim_time + tim->div;
+
+    for (uint8_t preload = tim->oc & tim->ocpe; preload; preload &= preload - 1) {
+        uint8_t ch = __builtin_ctz(preload);
+
+        tim->ccr[ch] = *sim_tim_ccr(tim, ch);
+    }
+
+    if (flag) {
+        sim_tim_flag(tim, TIM_SR_UIF);
+        sim_tim_dma(tim, SIM_TIM_REQ_UP);
+    }
+}
+
+static void sim_tim_match(struct sim_tim *tim, uint8_t ch)
+{
+    switch (tim->ocm[ch]) {
+        case 1:
+            tim->ref[ch] = true;
+            break;
+        case 2:
+            tim->ref[ch] = false;
+            break;
+        case 3:
+            tim->ref[ch] = !tim->ref[ch];
+            break;
+    }
+
+    sim_tim_flag(tim, TIM_SR_CC1IF << ch);
+    sim_tim_dma(tim, SIM_TIM_REQ_CC1 + ch);
+}
+
+static void sim_tim_capture(struct sim_tim *tim, uint8_t ch)
+{
+    uint16_t flag = TIM_SR_CC1IF << ch;
+
+    sim_tim_advance(tim);
+
+    if (tim->sr & flag) {
+        sim_tim_flag(tim, TIM_SR_CC1OF << ch);
+    }
+
+    *sim_tim_ccr(tim, ch) = tim->cnt;
+    sim_tim_flag(tim, flag);
+    sim_tim_dma(tim, SIM_TIM_REQ_CC1 + ch);
+}
+
+/* what each channel in input mode captures on */
+static void sim_tim_inputs(struct sim_tim *tim)
+{
+    TIM_TypeDef *regs = tim->regs;
+
+    for (uint8_t ch = 0; ch < 4; ++ch) {
+        uint16_t ccmr = (ch < 2) ? regs->CCMR1 : regs->CCMR2;
+        uint8_t ccs = (ccmr >> ((ch & 1) * 8)) & TIM_CCMR1_CC1S;
+        uint8_t pol_ch = ch;
+        uint8_t edge = 0;
+
+        tim->in_pin[ch] = SIM_NO_PIN;
+
+        if (!ccs || !(regs->CCER & (TIM_CCER_CC1E << (ch * 4)))) {
+            tim->in_edge[ch] = 0;
+            continue;
+        }
+
+        if (ccs == 1) {
+            tim->in_pin[ch] = tim->pins[ch];
+        } else if (ccs == 2) {
+            tim->in_pin[ch] = tim->pins[ch ^ 1];
+        } else {
+            /* TRC: TI1F_ED, TI1FP1 or TI2FP2 */
+            switch ((regs->SMCR & TIM_SMCR_TS) >> 4) {
+                case 4:
+                    tim->in_pin[ch] = tim->pins[0];
+                    edge = SIM_EDGE_RISING | SIM_EDGE_FALLING;
+                    break;
+                case 5:
+                    tim->in_pin[ch] = tim->pins[0];
+                    pol_ch = 0;
+                    break;
+                case 6:
+                    tim->in_pin[ch] = tim->pins[1];
+                    pol_ch = 1;
+                    break;
+            }
+        }
+
+        if (!edge) {
+            uint16_t ccer = regs->CCER >> (pol_ch * 4);
+
+            if ((ccer & TIM_CCER_CC1P) && (ccer & TIM_CCER_CC1NP)) {
+                edge = SIM_EDGE_RISING | SIM_EDGE_FALLING;
+            } else {
+                edge = (ccer & TIM_CCER_CC1P) ? SIM_EDGE_FALLING : SIM_EDGE_RISING;
+            }
+        }
+
+        tim->in_edge[ch] = (tim->in_pin[ch] == SIM_NO_PIN) ? 0 : edge;
+    }
+
+    for (struct sim_gpio *port = sim_gpio; port < sim_gpio + SIM_GPIO_PORTS; ++port) {
+        port->capture = 0;
+    }
+
+    for (struct sim_tim *other = sim_tim; other < sim_tim + SIM_TIMERS; ++other) {
+        for (uint8_t ch = 0; ch < 4; ++ch) {
+            uint8_t pin = other->in_pin[ch];
+
+            if (other->in_edge[ch] && (pin >> 4) < SIM_GPIO_PORTS) {
+                sim_gpio[pin >> 4].capture |= 1 << (pin & 15);
+            }
+        }
+    }
+}
+
+static void sim_tim_pins(struct sim_tim *tim)
+{
+    const uint8_t *pins = tim->remaps[(sim_mapr >> tim->remap_shift) & tim->remap_mask];
+
+    for (uint8_t ch = 0; ch < 4; ++ch) {
+        if (tim->pins[ch] == pins[ch]) {
+            continue;
+        }
+
+        /* the channel output moves along */
+        if (tim->out & (1 << ch)) {
+            uint8_t old = tim->pins[ch];
+
+            sim_gpio[old >> 4].tim_levels &= ~(1 << (old & 15));
+            sim_gpio[pins[ch] >> 4].tim_levels |= 1 << (pins[ch] & 15);
+            sim_gpio_update(&sim_gpio[old >> 4]);
+        }
+
+        tim->pins[ch] = pins[ch];
+        sim_gpio_update(&sim_gpio[pins[ch] >> 4]);
+    }
+
+    sim_tim_inputs(tim);
+}
+
+static void sim_tim_take(struct sim_tim *tim)
+{
+    TIM_TypeDef *regs = tim->regs;
+
+    sim_tim_advance(tim);
+    sim_tim_modes(tim);
+
+    if (regs->CNT != tim->seen_cnt) {
+        tim->cnt = regs->CNT;
+        tim->next_tick = sim_time + tim->div;
+    }
+
+    /* SR bits are cleared by writing 0 */
+    tim->sr &= regs->SR;
+
+    if (!(regs->CR1 & TIM_CR1_ARPE)) {
+        tim->arr = regs->ARR;
+    }
+
+    for (uint8_t ch = 0; ch < 4; ++ch) {
+        if (sim_tim_oc(tim, ch) && !sim_tim_ocpe(tim, ch)) {
+            tim->ccr[ch] = *sim_tim_ccr(tim, ch);
+        }
+    }
+
+    bool was_running = tim->running;
+
+    tim->running = (regs->CR1 & TIM_CR1_CEN) && tim->arr;
+
+    if (tim->running && !was_running) {
+        tim->next_tick = sim_time + tim->div;
+    }
+
+    uint16_t egr = regs->EGR;
+
+    if (egr) {
+        regs->EGR = 0;
+
+        if (egr & TIM_EGR_UG) {
+            tim->cnt = 0;
+
+            if (regs->CR1 & TIM_CR1_UDIS) {
+                tim->next_tick = sim_time + tim->div;
+            } else {
+                sim_tim_update(tim, !(regs->CR1 & TIM_CR1_URS));
+            }
+        }
+
+        for (uint8_t ch = 0; ch < 4; ++ch) {
+            if (!(egr & (TIM_EGR_CC1G << ch))) {
+                continue;
+            }
+
+            if (sim_tim_oc(tim, ch)) {
+                sim_tim_flag(tim, TIM_SR_CC1IF << ch);
+                sim_tim_dma(tim, SIM_TIM_REQ_CC1 + ch);
+            } else {
+                sim_tim_capture(tim, ch);
+            }
+        }
+    }
+
+    /* a request nobody wants any more is gone */
+    for (struct sim_dma *ch = sim_dma; ch < sim_dma + SIM_DMA_CHANNELS; ++ch) {
+        if (ch->req_tim == tim && !(regs->DIER & (TIM_DIER_UDE << ch->req))) {
+            ch->req_tim = 0;
+        }
+    }
+
+    regs->SR = tim->sr;
+    sim_tim_refs(tim);
+    sim_tim_outputs(tim);
+    sim_tim_inputs(tim);
+    sim_tim_schedule(tim);
+
+    regs->CNT = tim->cnt;
+    tim->seen_cnt = tim->cnt;
+}
+
+static void sim_tim_event(struct sim_tim *tim)
+{
+    uint32_t limit = sim_tim_limit(tim);
+    uint32_t cnt = tim->cnt + (sim_time - tim->next_tick) / tim->div + 1;
+
+    tim->next_tick = sim_time + tim->div;
+
+    tim->cnt = (cnt > limit) ? 0 : cnt;
+    tim->regs->CNT = tim->cnt;
+    tim->seen_cnt = tim->cnt;
+
+    if (cnt > limit) {
+
+        if (!(tim->regs->CR1 & TIM_CR1_UDIS)) {
+            sim_tim_update(tim, true);
+        }
+    }
+
+    for (uint8_t ch = 0; ch < 4; ++ch) {
+        if (sim_tim_oc(tim, ch) && tim->ccr[ch] == tim->cnt) {
+            sim_tim_match(tim, ch);
+        }
+    }
+
+    sim_tim_refs(tim);
+    sim_tim_outputs(tim);
+    sim_tim_schedule(tim);
+}
+
+static struct sim_tim *sim_tim_of(uint32_t addr)
+{
+    for (struct sim_tim *tim = sim_tim; tim < sim_tim + SIM_TIMERS; ++tim) {
+        if (addr - (uint32_t)(uintptr_t)tim->regs < 0x400) {
+            return tim;
+        }
+    }
+
+    return 0;
+}
+
+/* DMA */
+
+static void sim_dma_flags(struct sim_dma *ch, uint32_t flags)
+{
+    sim_dma_isr |= (flags | DMA_ISR_GIF1) << ch->shift;
+    DMA1->ISR = sim_dma_isr;
+}
+
+static void sim_bus_written(uint32_t addr);
+
+static bool sim_bus_bb(uint32_t *addr, uint8_t *bit)
+{
+    uint32_t offset = *addr - PERIPH_BB_BASE;
+
+    if (offset >= SIM_BB_SIZE) {
+        return false;
+    }
+
+    *addr = PERIPH_BASE + ((offset >> 5) & ~3u);
+    *bit = (offset >> 2) & 31;
+
+    return true;
+}
+
+static uint32_t sim_bus_read(uint32_t addr, uint8_t size)
+{
+    uint8_t bit;
+
+    if (sim_bus_bb(&addr, &bit)) {
+        return (*(volatile uint32_t *)(uintptr_t)addr >> bit) & 1;
+    }
+
+    struct sim_tim *tim = sim_tim_of(addr);
+
+    if (tim) {
+        /* the counter is only brought up to date on demand */
+        sim_tim_advance(tim);
+        tim->regs->CNT = tim->cnt;
+        tim->seen_cnt = tim->cnt;
+    }
+
+    switch (size) {
+        case 1:
+            return *(volatile uint8_t *)(uintptr_t)addr;
+        case 2:
+            return *(volatile uint16_t *)(uintptr_t)addr;
+        default:
+            return *(volatile uint32_t *)(uintptr_t)addr;
+    }
+}
+
+static void sim_bus_write(uint32_t addr, uint32_t value, uint8_t size)
+{
+    uint8_t bit;
+
+    if (sim_bus_bb(&addr, &bit)) {
+        uint32_t word = *(volatile uint32_t *)(uintptr_t)addr;
+
+        value = (value & 1) ? word | (1u << bit) : word & ~(1u << bit);
+        size = 4;
+    }
+
+    switch (size) {
+        case 1:
+            *(volatile uint8_t *)(uintptr_t)addr = value;
+            break;
+        case 2:
+            *(volatile uint16_t *)(uintptr_t)addr = value;
+            break;
+        default:
+            *(volatile uint32_t *)(uintptr_t)addr = value;
+            break;
+    }
+
+    if (addr - PERIPH_BASE < SIM_PERIPH_SIZE) {
+        sim_bus_written(addr);
+    }
+}
+
+static void sim_dma_beat(struct sim_dma *ch)
+{
+    uint32_t ccr = ch->regs->CCR;
+    uint8_t psize = 1 << ((ccr & DMA_CCR1_PSIZE) >> 8);
+    uint8_t msize = 1 << ((ccr & DMA_CCR1_MSIZE) >> 10);
+
+    if (!ch->par || !ch->mar) {
+        /* bus error, the channel disables itself */
+        ch->regs->CCR &= ~DMA_CCR1_EN;
+        ch->on = false;
+        sim_dma_flags(ch, DMA_ISR_TEIF1);
+        return;
+    }
+
+    if (ccr & DMA_CCR1_DIR) {
+        sim_bus_write(ch->par, sim_bus_read(ch->mar, msize), psize);
+    } else {
+        sim_bus_write(ch->mar, sim_bus_read(ch->par, psize), msize);
+    }
+
+    if (ccr & DMA_CCR1_PINC) {
+        ch->par += psize;
+    }
+    if (ccr & DMA_CCR1_MINC) {
+        ch->mar += msize;
+    }
+
+    ch->regs->CNDTR = --ch->count;
+
+    uint32_t flags = 0;
+
+    if (ch->count == ch->reload / 2) {
+        flags |= DMA_ISR_HTIF1;
+    }
+
+    if (!ch->count) {
+        flags |= DMA_ISR_TCIF1;
+
+        if (ccr & DMA_CCR1_CIRC) {
+            ch->count = ch->reload;
+            ch->par = ch->cpar;
+            ch->mar = ch->cmar;
+            ch->regs->CNDTR = ch->count;
+        }
+    }
+
+    if (flags) {
+        sim_dma_flags(ch, flags);
+    }
+}
+
+static void sim_dma_request(struct sim_dma *ch, struct sim_tim *tim, uint8_t req)
+{
+    if (ch->on && ch->count && !(ch->regs->CCR & DMA_CCR1_MEM2MEM)) {
+        sim_dma_beat(ch);
+    } else {
+        /* held until the channel serves it */
+        ch->req_tim = tim;
+        ch->req = req;
+    }
+}
+
+/* (Re)start a channel the code enabled or reprogrammed */
+static void sim_dma_load(struct sim_dma *ch)
+{
+    DMA_Channel_TypeDef *regs = ch->regs;
+
+    if (!(regs->CCR & DMA_CCR1_EN)) {
+        ch->on = false;
+        return;
+    }
+
+    if (ch->on && regs->CPAR == ch->cpar && regs->CMAR == ch->cmar && regs->CNDTR == ch->count) {
+        return;
+    }
+
+    ch->on = true;
+    ch->cpar = ch->par = regs->CPAR;
+    ch->cmar = ch->mar = regs->CMAR;
+    ch->reload = ch->count = regs->CNDTR;
+
+    if (regs->CCR & DMA_CCR1_MEM2MEM) {
+        for (uint16_t n = ch->reload; n-- && ch->on;) {
+            sim_dma_beat(ch);
+        }
+    } else if (ch->req_tim) {
+        struct sim_tim *tim = ch->req_tim;
+
+        ch->req_tim = 0;
+        sim_dma_request(ch, tim, ch->req);
+    }
+}
+
+static void sim_dma_take(void)
+{
+    uint32_t ifcr = DMA1->IFCR;
+
+    if (ifcr) {
+        DMA1->IFCR = 0;
+
+        for (struct sim_dma *ch = sim_dma; ch < sim_dma + SIM_DMA_CHANNELS; ++ch) {
+            uint32_t clear = (ifcr >> ch->shift) & 0xf;
+
+            if (clear & DMA_IFCR_CGIF1) {
+                clear = 0xf;
+            }
+
+            sim_dma_isr &= ~(clear << ch->shift);
+
+            if (!(sim_dma_isr & ((DMA_ISR_TCIF1 | DMA_ISR_HTIF1 | DMA_ISR_TEIF1) << ch->shift))) {
+                sim_dma_isr &= ~(DMA_ISR_GIF1 << ch->shift);
+            }
+        }
+    }
+
+    DMA1->ISR = sim_dma_isr;
+
+    for (struct sim_dma *ch = sim_dma; ch < sim_dma + SIM_DMA_CHANNELS; ++ch) {
+        sim_dma_load(ch);
+    }
+}
+
+/* AFIO */
+
+static void sim_afio_take(void)
+{
+    if (AFIO->MAPR != sim_mapr) {
+        sim_mapr = AFIO->MAPR;
+
+        for (struct sim_tim *tim = sim_tim; tim < sim_tim + SIM_TIMERS; ++tim) {
+            sim_tim_pins(tim);
+        }
+    }
+
+    if (memcmp((const void *)AFIO->EXTICR, sim_exticr, sizeof(sim_exticr))) {
+        memcpy(sim_exticr, (const void *)AFIO->EXTICR, sizeof(sim_exticr));
+
+        for (struct sim_gpio *port = sim_gpio; port < sim_gpio + SIM_GPIO_PORTS; ++port) {
+            port->exti = 0;
+        }
+
+        for (uint8_t line = 0; line < 16; ++line) {
+            uint8_t nr = (sim_exticr[line >> 2] >> ((line & 3) * 4)) & 0xf;
+
+            if (nr < SIM_GPIO_PORTS) {
+                sim_gpio[nr].exti |= 1 << line;
+            }
+        }
+    }
+}
+
+/* Bus writes by DMA take effect right away */
+static void sim_bus_written(uint32_t addr)
+{
+    struct sim_tim *tim = sim_tim_of(addr);
+
+    if (tim) {
+        sim_tim_take(tim);
+    } else if (addr - GPIOA_BASE < SIM_GPIO_PORTS * (GPIOB_BASE - GPIOA_BASE)) {
+        struct sim_gpio *port = &sim_gpio[(addr - GPIOA_BASE) / (GPIOB_BASE - GPIOA_BASE)];
+        uint32_t offset = (addr - GPIOA_BASE) % (GPIOB_BASE - GPIOA_BASE);
+
+        if (offset == offsetof(GPIO_TypeDef, BSRR) || offset == offsetof(GPIO_TypeDef, BRR)) {
+            sim_gpio_set_reset(port);
+        } else {
+            sim_gpio_take(port);
+        }
+    } else if (addr - EXTI_BASE < sizeof(EXTI_TypeDef)) {
+        sim_exti_take();
+    } else if (addr - AFIO_BASE < sizeof(AFIO_TypeDef)) {
+        sim_afio_take();
+    }
+}
+
+/* NVIC */
+
+static uint8_t sim_group_mask(void)
+{
+    return (0xff << (((SCB->AIRCR & SCB_AIRCR_PRIGROUP_Msk) >> SCB_AIRCR_PRIGROUP_Pos) + 1)) & 0xf0;
+}
+
+/* interrupt requests of the peripherals */
+static void sim_irq_lines(uint32_t lines[2])
+{
+    lines[0] = lines[1] = 0;
+
+    for (struct sim_dma *ch = sim_dma; ch < sim_dma + SIM_DMA_CHANNELS; ++ch) {
+        /* TCIE, HTIE and TEIE line up with their flags */
+        if ((sim_dma_isr >> ch->shift) & ch->regs->CCR & (DMA_CCR1_TCIE | DMA_CCR1_HTIE | DMA_CCR1_TEIE)) {
+            lines[0] |= 1u << (DMA1_Channel1_IRQn + (ch - sim_dma));
+        }
+    }
+
+    uint16_t tim1 = sim_tim[0].sr & TIM1->DIER;
+
+    if (tim1 & TIM_SR_UIF) {
+        lines[0] |= 1u << TIM1_UP_IRQn;
+    }
+    if (tim1 & (TIM_SR_CC1IF | TIM_SR_CC2IF | TIM_SR_CC3IF | TIM_SR_CC4IF)) {
+        lines[0] |= 1u << TIM1_CC_IRQn;
+    }
+    if (tim1 & 0x60) {
+        lines[0] |= 1u << TIM1_TRG_COM_IRQn;
+    }
+    if (tim1 & 0x80) {
+        lines[0] |= 1u << TIM1_BRK_IRQn;
+    }
+
+    for (uint8_t nr = 1; nr < SIM_TIMERS; ++nr) {
+        if (sim_tim[nr].sr & sim_tim[nr].regs->DIER & 0x7f) {
+            lines[0] |= 1u << (TIM2_IRQn + nr - 1);
+        }
+    }
+
+    uint32_t exti = sim_exti.pr & sim_exti.imr;
+
+    lines[0] |= (exti & 0x1f) << EXTI0_IRQn;
+
+    if (exti & 0x3e0) {
+        lines[0] |= 1u << EXTI9_5_IRQn;
+    }
+    if (exti & 0xfc00) {
+        lines[1] |= 1u << (EXTI15_10_IRQn - 32);
+    }
+}
+
+static uint32_t sim_exec_prio(uint8_t mask)
+{
+    uint32_t prio = 0x100;
+
+    if (sim_depth) {
+        prio = NVIC->IP[sim_active[sim_depth - 1]] & mask;
+    }
+    if (sim_basepri && (sim_basepri & mask) < prio) {
+        prio = sim_basepri & mask;
+    }
+    if (sim_primask) {
+        prio = 0;
+    }
+
+    return prio;
+}
+
+static void sim_publish(void)
+{
+    for (struct sim_tim *tim = sim_tim; tim < sim_tim + SIM_TIMERS; ++tim) {
+        sim_tim_advance(tim);
+        tim->regs->CNT = tim->cnt;
+        tim->seen_cnt = tim->cnt;
+    }
+
+    DWT_CYCCNT_REG = (uint32_t)sim_time;
+}
+
+/* Run the handlers that may preempt what runs now, most urgent first */
+static void sim_dispatch(void)
+{
+    while (sim_enabled[0] | sim_enabled[1]) {
+        uint32_t lines[2];
+        uint8_t mask = sim_group_mask();
+        uint32_t prio = sim_exec_prio(mask);
+        int best = -1;
+        uint8_t best_ip = 0;
+
+        sim_irq_lines(lines);
+
+        for (uint8_t word = 0; word < 2; ++word) {
+            for (uint32_t bits = (lines[word] | sim_pending[word]) & sim_enabled[word]; bits; bits &= bits - 1) {
+                int irq = word * 32 + __builtin_ctz(bits);
+                uint8_t ip = NVIC->IP[irq] & 0xf0;
+
+                if ((ip & mask) < prio && (best < 0 || ip < best_ip)) {
+                    best = irq;
+                    best_ip = ip;
+                }
+            }
+        }
+
+        if (best < 0) {
+            return;
+        }
+
+        if (sim_storm_time != sim_time) {
+            sim_storm_time = sim_time;
+            sim_storm_count = 0;
+        }
+        if (++sim_storm_count > SIM_IRQ_STORM) {
+            fprintf(stderr, "sim: irq %d keeps firing\n", best);
+            sim_fail("interrupt storm");
+        }
+
+        if (!sim_vectors[best]) {
+            fprintf(stderr, "sim: irq %d has no handler\n", best);
+            sim_fail("unhandled interrupt");
+        }
+
+        sim_pending[best >> 5] &= ~(1u << (best & 31));
+        sim_active[sim_depth++] = best;
+        ++sim_irq_count[best];
+
+        sim_publish();
+        sim_vectors[best]();
+
+        --sim_depth;
+        sim_take();
+    }
+}
+
+/* Everything the code wrote since we last looked */
+static void sim_take(void)
+{
+    sim_afio_take();
+    sim_exti_take();
+    sim_dma_take();
+
+    for (struct sim_tim *tim = sim_tim; tim < sim_tim + SIM_TIMERS; ++tim) {
+        sim_tim_take(tim);
+    }
+
+    for (struct sim_gpio *port = sim_gpio; port < sim_gpio + SIM_GPIO_PORTS; ++port) {
+        sim_gpio_take(port);
+    }
+}
+
+static void sim_lock(void)
+{
+    pthread_mutex_lock(&sim_mutex);
+}
+
+static void sim_unlock(void)
+{
+    pthread_mutex_unlock(&sim_mutex);
+}
+
+/* A point where pending interrupts may run */
+static void sim_preempt(void)
+{
+    if (!sim_ready) {
+        return;
+    }
+
+    sim_lock();
+    sim_take();
+    sim_dispatch();
+    sim_unlock();
+}
+
+void sim_sync(void)
+{
+    sim_preempt();
+}
+
+void NVIC_EnableIRQ(IRQn_Type IRQn)
+{
+    __atomic_fetch_or(&sim_enabled[IRQn >> 5], 1u << (IRQn & 31), __ATOMIC_SEQ_CST);
+    sim_preempt();
+}
+
+void NVIC_DisableIRQ(IRQn_Type IRQn)
+{
+    __atomic_fetch_and(&sim_enabled[IRQn >> 5], ~(1u << (IRQn & 31)), __ATOMIC_SEQ_CST);
+}
+
+uint32_t NVIC_GetPendingIRQ(IRQn_Type IRQn)
+{
+    uint32_t lines[2];
+
+    sim_lock();
+    sim_take();
+    sim_irq_lines(lines);
+    sim_unlock();
+
+    return (((lines[IRQn >> 5] | sim_pending[IRQn >> 5]) >> (IRQn & 31)) & 1);
+}
+
+void NVIC_SetPendingIRQ(IRQn_Type IRQn)
+{
+    __atomic_fetch_or(&sim_pending[IRQn >> 5], 1u << (IRQn & 31), __ATOMIC_SEQ_CST);
+    sim_preempt();
+}
+
+void NVIC_ClearPendingIRQ(IRQn_Type IRQn)
+{
+    __atomic_fetch_and(&sim_pending[IRQn >> 5], ~(1u << (IRQn & 31)), __ATOMIC_SEQ_CST);
+}
+
+uint32_t NVIC_GetActive(IRQn_Type IRQn)
+{
+    for (uint8_t i = 0; i < sim_depth; ++i) {
+        if (sim_active[i] == IRQn) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+uint32_t __get_BASEPRI(void)
+{
+    return sim_basepri;
+}
+
+void __set_BASEPRI(uint32_t basePri)
+{
+    uint32_t old = sim_basepri;
+
+    sim_basepri = basePri & 0xf0;
+
+    /* only a lower ceiling lets anything new in */
+    if (!sim_basepri || (old && sim_basepri > old)) {
+        sim_preempt();
+    }
+}
+
+uint32_t __get_PRIMASK(void)
+{
+    return sim_primask;
+}
+
+void __set_PRIMASK(uint32_t priMask)
+{
+    sim_primask = priMask & 1;
+
+    if (!sim_primask) {
+        sim_preempt();
+    }
+}
+
+/* Clock */
+
+static struct sim_tim *sim_next_tim(void)
+{
+    struct sim_tim *next = 0;
+
+    for (struct sim_tim *tim = sim_tim; tim < sim_tim + SIM_TIMERS; ++tim) {
+        if (tim->running && (!next || tim->next_event < next->next_event)) {
+            next = tim;
+        }
+    }
+
+    return next;
+}
+
+void sim_run_until(uint64_t time)
+{
+    sim_lock();
+    sim_take();
+    sim_dispatch();
+
+    for (;;) {
+        struct sim_tim *tim = sim_next_tim();
+
+        if (!tim || tim->next_event > time) {
+            break;
+        }
+
+        sim_time = tim->next_event;
+        sim_tim_event(tim);
+
+        /* everything due at the same cycle happens before the handlers run */
+        tim = sim_next_tim();
+
+        if (tim && tim->next_event == sim_time) {
+            continue;
+        }
+
+        sim_dispatch();
+    }
+
+    if (time > sim_time) {
+        sim_time = time;
+    }
+
+    sim_publish();
+    sim_unlock();
+}
+
+void sim_run(uint64_t cycles)
+{
+    sim_run_until(sim_time + cycles);
+}
+
+/* Pins */
+
+void sim_gpio_drive(GPIO_TypeDef *gpio, uint16_t pins, uint16_t levels)
+{
+    struct sim_gpio *port = sim_gpio_port(gpio);
+
+    sim_lock();
+    sim_take();
+    port->drive |= pins;
+    port->drive_levels = (port->drive_levels & ~pins) | (levels & pins);
+    sim_gpio_update(port);
+    sim_dispatch();
+    sim_unlock();
+}
+
+void sim_gpio_release(GPIO_TypeDef *gpio, uint16_t pins)
+{
+    struct sim_gpio *port = sim_gpio_port(gpio);
+
+    sim_lock();
+    sim_take();
+    port->drive &= ~pins;
+    sim_gpio_update(port);
+    sim_dispatch();
+    sim_unlock();
+}
+
+uint16_t sim_gpio_levels(GPIO_TypeDef *gpio)
+{
+    struct sim_gpio *port = sim_gpio_port(gpio);
+
+    sim_sync();
+
+    return port->levels;
+}
+
+/* Setup */
+
+static void sim_map(uint32_t base, uint32_t size)
+{
+    void *addr = (void *)(uintptr_t)base;
+    void *map = mmap(addr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE | MAP_NORESERVE, -1, 0);
+
+    if (map != addr) {
+        fprintf(stderr, "sim: cannot map 0x%08x, build with -no-pie\n", base);
+        abort();
+    }
+}
+
+static const struct {
+    TIM_TypeDef *regs;
+    uint8_t remap_shift;
+    uint8_t remap_mask;
+    const uint8_t (*remaps)[4];
+    uint8_t dma[SIM_TIM_REQS];
+} sim_tim_cfg[SIM_TIMERS] = {
+    { TIM1, 6, 3, sim_tim1_pins, { 5, 2, 3, 6, 4, 4, 4 } },
+    { TIM2, 8, 3, sim_tim2_pins, { 2, 5, 7, 1, 7, 0, 0 } },
+    { TIM3, 10, 3, sim_tim3_pins, { 3, 6, 0, 2, 3, 0, 6 } },
+    { TIM4, 12, 1, sim_tim4_pins, { 7, 1, 4, 5, 0, 0, 0 } },
+};
+
+void sim_init(void)
+{
+    static bool mapped;
+
+    if (!mapped) {
+        sim_map(PERIPH_BASE, SIM_PERIPH_SIZE);
+        sim_map(PERIPH_BB_BASE, SIM_BB_SIZE);
+        sim_map(SIM_CORE_BASE, SIM_CORE_SIZE);
+        mapped = true;
+
+        void *heap = malloc(1);
+
+        if ((uintptr_t)&sim_time > UINT32_MAX || (uintptr_t)heap > UINT32_MAX) {
+            fprintf(stderr, "sim: data above 4 GB, build with -no-pie\n");
+            abort();
+        }
+        free(heap);
+
+        /* DMA addresses are 32 bits, keep the heap in the low 4 GB next to the data */
+        mallopt(M_MMAP_MAX, 0);
+    }
+
+    memset((void *)(uintptr_t)PERIPH_BASE, 0, SIM_PERIPH_SIZE);
+    memset((void *)(uintptr_t)PERIPH_BB_BASE, SIM_BB_IDLE & 0xff, SIM_BB_SIZE);
+    memset((void *)(uintptr_t)SIM_CORE_BASE, 0, SIM_CORE_SIZE);
+
+    sim_time = 0;
+    sim_gpio_hook = 0;
+    memset(sim_irq_count, 0, sizeof(sim_irq_count));
+    memset(sim_pending, 0, sizeof(sim_pending));
+    sim_depth = 0;
+    sim_basepri = 0;
+    sim_primask = 0;
+    sim_storm_time = SIM_NEVER;
+
+    /* what SystemInit() leaves for 72 MHz from the PLL */
+    RCC->CFGR = RCC_CFGR_PPRE1_DIV2;
+    SCB->AIRCR = 0xfa050000;
+
+    memset(&sim_exti, 0, sizeof(sim_exti));
+    EXTI->PR = SIM_EXTI_PR_MARK;
+    sim_dma_isr = 0;
+    sim_mapr = 0;
+    memset(sim_exticr, 0, sizeof(sim_exticr));
+
+    for (uint8_t nr = 0; nr < SIM_GPIO_PORTS; ++nr) {
+        struct sim_gpio *port = &sim_gpio[nr];
+
+        memset(port, 0, sizeof(*port));
+        port->regs = (GPIO_TypeDef *)(uintptr_t)(GPIOA_BASE + nr * (GPIOB_BASE - GPIOA_BASE));
+
+        /* floating inputs */
+        port->regs->CRL = 0x44444444;
+        port->regs->CRH = 0x44444444;
+        sim_gpio_config(port);
+    }
+
+    /* every line starts routed to port A */
+    sim_gpio[0].exti = 0xffff;
+
+    for (uint8_t nr = 0; nr < SIM_DMA_CHANNELS; ++nr) {
+        struct sim_dma *ch = &sim_dma[nr];
+
+        memset(ch, 0, sizeof(*ch));
+        ch->regs = (DMA_Channel_TypeDef *)(uintptr_t)(DMA1_Channel1_BASE + nr * (DMA1_Channel2_BASE - DMA1_Channel1_BASE));
+        ch->shift = nr * 4;
+    }
+
+    for (uint8_t nr = 0; nr < SIM_TIMERS; ++nr) {
+        struct sim_tim *tim = &sim_tim[nr];
+
+        memset(tim, 0, sizeof(*tim));
+        tim->regs = sim_tim_cfg[nr].regs;
+        tim->remap_shift = sim_tim_cfg[nr].remap_shift;
+        tim->remap_mask = sim_tim_cfg[nr].remap_mask;
+        tim->remaps = sim_tim_cfg[nr].remaps;
+        memcpy(tim->dma, sim_tim_cfg[nr].dma, sizeof(tim->dma));
+        memcpy(tim->pins, tim->remaps[0], sizeof(tim->pins));
+        tim->div = 1;
+        tim->next_event = SIM_NEVER;
+        sim_tim_inputs(tim);
+    }
+
+    sim_ready = true;
+}
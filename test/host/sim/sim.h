@@ -0,0 +1,85 @@
+/**
+ ******************************************************************************
+ * @file       sim.h
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      Host-side STM32F1 peripheral simulator for the driver tests
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef SIM_H
+#define SIM_H
+
+/*
+ * The register blocks of GPIOA..G, AFIO, EXTI, TIM1..4, DMA1, RCC, the
+ * bit-band alias, DWT and the NVIC/SCB page are mapped at their real
+ * addresses, the unmodified drivers read and write them directly. The
+ * simulator looks at what they wrote whenever it gets control back:
+ * on entry to sim_run*(), after each interrupt handler and whenever the
+ * code changes the interrupt mask or enables an interrupt.
+ *
+ * Time advances only in sim_run*(), in cycles of a 72 MHz core, event
+ * to event: timer updates and compare matches trigger DMA beats, DMA
+ * writes to BSRR/BRR/ODR change pins, pin changes latch EXTI and input
+ * captures, and interrupt flags dispatch to the DMA1_ChannelN, EXTIx
+ * and TIMx handlers by NVIC priority, preempting as the hardware would.
+ * Code between two events takes no time.
+ *
+ * Not modeled: input filters, one pulse and down/center counting, slave
+ * modes other than TRC capture, DMA channel priorities (requests are
+ * served in event order), DMA2, anything that spins on DWT_CYCCNT.
+ * Reading a bit-band alias word returns junk, writing one works.
+ * NVIC->ISER reads the enable bits, change them through NVIC_EnableIRQ()
+ * and NVIC_DisableIRQ().
+ * EXTI_PR reads with bit 31 set, the simulator's marker for W1C writes.
+ */
+
+#include "stm32f10x.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SIM_SYSCLK          72000000u
+#define SIM_CYCLES_PER_US   (SIM_SYSCLK / 1000000u)
+
+/* cycles since sim_init() */
+extern uint64_t sim_time;
+
+/* maps the registers at their addresses in reset state, first thing in main() */
+extern void sim_init(void);
+
+extern void sim_run_until(uint64_t time);
+extern void sim_run(uint64_t cycles);
+
+/* takes register writes made since the simulator last had control */
+extern void sim_sync(void);
+
+/* external drivers of input pins, output pins ignore them */
+extern void sim_gpio_drive(GPIO_TypeDef *gpio, uint16_t pins, uint16_t levels);
+extern void sim_gpio_release(GPIO_TypeDef *gpio, uint16_t pins);
+
+/* pin levels right now, what IDR reads */
+extern uint16_t sim_gpio_levels(GPIO_TypeDef *gpio);
+
+/* called on every change of pin levels, sim_time is when */
+typedef void (*sim_gpio_hook_t)(GPIO_TypeDef *gpio, uint16_t levels, uint16_t changed);
+extern sim_gpio_hook_t sim_gpio_hook;
+
+/* handler runs per irq number, for checking how often an interrupt fired */
+extern uint32_t sim_irq_count[64];
+
+#endif /* SIM_H */
@@ -0,0 +1,442 @@
+/**
+ ******************************************************************************
+ * @file       spl.c
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      StdPeriph functions the drivers use, on the simulated registers
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * Same register accesses as the StdPeriph library V3.5, so the simulator
+ * sees what the hardware would.
+ */
+
+#include "sim.h"
+
+/* misc */
+
+void NVIC_PriorityGroupConfig(uint32_t NVIC_PriorityGroup)
+{
+    SCB->AIRCR = 0x05FA0000 | NVIC_PriorityGroup;
+}
+
+void NVIC_Init(const NVIC_InitTypeDef *NVIC_InitStruct)
+{
+    IRQn_Type irq = (IRQn_Type)NVIC_InitStruct->NVIC_IRQChannel;
+
+    if (NVIC_InitStruct->NVIC_IRQChannelCmd != DISABLE) {
+        uint32_t pre = (0x700 - (SCB->AIRCR & 0x700)) >> 8;
+        uint32_t sub = 0x0F >> pre;
+        uint32_t priority = (NVIC_InitStruct->NVIC_IRQChannelPreemptionPriority << (4 - pre))
+                            | (NVIC_InitStruct->NVIC_IRQChannelSubPriority & sub);
+
+        NVIC->IP[irq] = priority << 4;
+        NVIC_EnableIRQ(irq);
+    } else {
+        NVIC_DisableIRQ(irq);
+    }
+}
+
+/* GPIO */
+
+void GPIO_Init(GPIO_TypeDef *GPIOx, const GPIO_InitTypeDef *GPIO_InitStruct)
+{
+    uint32_t mode = GPIO_InitStruct->GPIO_Mode & 0x0F;
+
+    if (GPIO_InitStruct->GPIO_Mode & 0x10) {
+        mode |= GPIO_InitStruct->GPIO_Speed;
+    }
+
+    for (uint8_t pin = 0; pin < 16; ++pin) {
+        uint16_t bit = 1 << pin;
+
+        if (!(GPIO_InitStruct->GPIO_Pin & bit)) {
+            continue;
+        }
+
+        volatile uint32_t *cr = (pin < 8) ? &GPIOx->CRL : &GPIOx->CRH;
+        uint8_t shift = (pin & 7) * 4;
+
+        *cr = (*cr & ~(0x0Fu << shift)) | (mode << shift);
+
+        if (GPIO_InitStruct->GPIO_Mode == GPIO_Mode_IPD) {
+            GPIOx->BRR = bit;
+        } else if (GPIO_InitStruct->GPIO_Mode == GPIO_Mode_IPU) {
+            GPIOx->BSRR = bit;
+        }
+    }
+}
+
+uint8_t GPIO_ReadInputDataBit(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+    return (GPIOx->IDR & GPIO_Pin) ? Bit_SET : Bit_RESET;
+}
+
+uint16_t GPIO_ReadInputData(GPIO_TypeDef *GPIOx)
+{
+    return GPIOx->IDR;
+}
+
+uint8_t GPIO_ReadOutputDataBit(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+    return (GPIOx->ODR & GPIO_Pin) ? Bit_SET : Bit_RESET;
+}
+
+void GPIO_SetBits(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+    GPIOx->BSRR = GPIO_Pin;
+}
+
+void GPIO_ResetBits(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+    GPIOx->BRR = GPIO_Pin;
+}
+
+void GPIO_WriteBit(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, BitAction BitVal)
+{
+    if (BitVal != Bit_RESET) {
+        GPIOx->BSRR = GPIO_Pin;
+    } else {
+        GPIOx->BRR = GPIO_Pin;
+    }
+}
+
+void GPIO_PinRemapConfig(uint32_t GPIO_Remap, FunctionalState NewState)
+{
+    uint32_t mask;
+
+    if (GPIO_Remap & 0x00100000) {
+        /* two bit field at the position in bits 19:16 */
+        mask = 3u << ((GPIO_Remap >> 16) & 0x0F);
+    } else {
+        mask = GPIO_Remap & 0xFFFF;
+    }
+
+    AFIO->MAPR = (AFIO->MAPR & ~mask) | ((NewState != DISABLE) ? (GPIO_Remap & 0xFFFF) : 0);
+}
+
+void GPIO_EXTILineConfig(uint8_t GPIO_PortSource, uint8_t GPIO_PinSource)
+{
+    uint32_t shift = 4 * (GPIO_PinSource & 0x03);
+
+    AFIO->EXTICR[GPIO_PinSource >> 2] &= ~(0x0Fu << shift);
+    AFIO->EXTICR[GPIO_PinSource >> 2] |= (uint32_t)GPIO_PortSource << shift;
+}
+
+/* EXTI */
+
+void EXTI_DeInit(void)
+{
+    EXTI->IMR   = 0;
+    EXTI->EMR   = 0;
+    EXTI->RTSR  = 0;
+    EXTI->FTSR  = 0;
+    EXTI->PR    = 0x000FFFFF;
+}
+
+void EXTI_Init(const EXTI_InitTypeDef *EXTI_InitStruct)
+{
+    uint32_t base = EXTI_BASE;
+    uint32_t line = EXTI_InitStruct->EXTI_Line;
+
+    if (EXTI_InitStruct->EXTI_LineCmd != DISABLE) {
+        EXTI->IMR &= ~line;
+        EXTI->EMR &= ~line;
+        *(volatile uint32_t *)(uintptr_t)(base + EXTI_InitStruct->EXTI_Mode) |= line;
+
+        EXTI->RTSR &= ~line;
+        EXTI->FTSR &= ~line;
+
+        if (EXTI_InitStruct->EXTI_Trigger == EXTI_Trigger_Rising_Falling) {
+            EXTI->RTSR |= line;
+            EXTI->FTSR |= line;
+        } else {
+            *(volatile uint32_t *)(uintptr_t)(base + EXTI_InitStruct->EXTI_Trigger) |= line;
+        }
+    } else {
+        *(volatile uint32_t *)(uintptr_t)(base + EXTI_InitStruct->EXTI_Mode) &= ~line;
+    }
+}
+
+void EXTI_GenerateSWInterrupt(uint32_t EXTI_Line)
+{
+    EXTI->SWIER |= EXTI_Line;
+}
+
+FlagStatus EXTI_GetFlagStatus(uint32_t EXTI_Line)
+{
+    return (EXTI->PR & EXTI_Line) ? SET : RESET;
+}
+
+void EXTI_ClearFlag(uint32_t EXTI_Line)
+{
+    EXTI->PR = EXTI_Line;
+}
+
+ITStatus EXTI_GetITStatus(uint32_t EXTI_Line)
+{
+    return ((EXTI->PR & EXTI_Line) && (EXTI->IMR & EXTI_Line)) ? SET : RESET;
+}
+
+void EXTI_ClearITPendingBit(uint32_t EXTI_Line)
+{
+    EXTI->PR = EXTI_Line;
+}
+
+/* DMA */
+
+void DMA_DeInit(DMA_Channel_TypeDef *DMAy_Channelx)
+{
+    uint32_t nr = ((uint32_t)(uintptr_t)DMAy_Channelx - DMA1_Channel1_BASE) / (DMA1_Channel2_BASE - DMA1_Channel1_BASE);
+
+    DMAy_Channelx->CCR  &= ~DMA_CCR1_EN;
+    DMAy_Channelx->CCR   = 0;
+    DMAy_Channelx->CNDTR = 0;
+    DMAy_Channelx->CPAR  = 0;
+    DMAy_Channelx->CMAR  = 0;
+    DMA1->IFCR |= 0x0Fu << (nr * 4);
+}
+
+void DMA_Init(DMA_Channel_TypeDef *DMAy_Channelx, const DMA_InitTypeDef *DMA_InitStruct)
+{
+    uint32_t ccr = DMAy_Channelx->CCR & 0xFFFF800F;
+
+    ccr |= DMA_InitStruct->DMA_DIR | DMA_InitStruct->DMA_Mode
+           | DMA_InitStruct->DMA_PeripheralInc | DMA_InitStruct->DMA_MemoryInc
+           | DMA_InitStruct->DMA_PeripheralDataSize | DMA_InitStruct->DMA_MemoryDataSize
+           | DMA_InitStruct->DMA_Priority | DMA_InitStruct->DMA_M2M;
+
+    DMAy_Channelx->CCR   = ccr;
+    DMAy_Channelx->CNDTR = DMA_InitStruct->DMA_BufferSize;
+    DMAy_Channelx->CPAR  = DMA_InitStruct->DMA_PeripheralBaseAddr;
+    DMAy_Channelx->CMAR  = DMA_InitStruct->DMA_MemoryBaseAddr;
+}
+
+void DMA_Cmd(DMA_Channel_TypeDef *DMAy_Channelx, FunctionalState NewState)
+{
+    if (NewState != DISABLE) {
+        DMAy_Channelx->CCR |= DMA_CCR1_EN;
+    } else {
+        DMAy_Channelx->CCR &= ~DMA_CCR1_EN;
+    }
+}
+
+void DMA_ITConfig(DMA_Channel_TypeDef *DMAy_Channelx, uint32_t DMA_IT, FunctionalState NewState)
+{
+    if (NewState != DISABLE) {
+        DMAy_Channelx->CCR |= DMA_IT;
+    } else {
+        DMAy_Channelx->CCR &= ~DMA_IT;
+    }
+}
+
+uint16_t DMA_GetCurrDataCounter(DMA_Channel_TypeDef *DMAy_Channelx)
+{
+    return DMAy_Channelx->CNDTR;
+}
+
+/* RCC */
+
+void RCC_GetClocksFreq(RCC_ClocksTypeDef *RCC_Clocks)
+{
+    uint32_t ppre1 = (RCC->CFGR >> 8) & 7;
+    uint32_t ppre2 = (RCC->CFGR >> 11) & 7;
+
+    RCC_Clocks->SYSCLK_Frequency = SIM_SYSCLK;
+    RCC_Clocks->HCLK_Frequency   = SIM_SYSCLK;
+    RCC_Clocks->PCLK1_Frequency  = (ppre1 & 4) ? SIM_SYSCLK >> ((ppre1 & 3) + 1) : SIM_SYSCLK;
+    RCC_Clocks->PCLK2_Frequency  = (ppre2 & 4) ? SIM_SYSCLK >> ((ppre2 & 3) + 1) : SIM_SYSCLK;
+    RCC_Clocks->ADCCLK_Frequency = RCC_Clocks->PCLK2_Frequency / 2;
+}
+
+void RCC_AHBPeriphClockCmd(uint32_t RCC_AHBPeriph, FunctionalState NewState)
+{
+    if (NewState != DISABLE) {
+        RCC->AHBENR |= RCC_AHBPeriph;
+    } else {
+        RCC->AHBENR &= ~RCC_AHBPeriph;
+    }
+}
+
+void RCC_APB2PeriphClockCmd(uint32_t RCC_APB2Periph, FunctionalState NewState)
+{
+    if (NewState != DISABLE) {
+        RCC->APB2ENR |= RCC_APB2Periph;
+    } else {
+        RCC->APB2ENR &= ~RCC_APB2Periph;
+    }
+}
+
+void RCC_APB1PeriphClockCmd(uint32_t RCC_APB1Periph, FunctionalState NewState)
+{
+    if (NewState != DISABLE) {
+        RCC->APB1ENR |= RCC_APB1Periph;
+    } else {
+        RCC->APB1ENR &= ~RCC_APB1Periph;
+    }
+}
+
+/* TIM */
+
+void TIM_TimeBaseInit(TIM_TypeDef *TIMx, const TIM_TimeBaseInitTypeDef *TIM_TimeBaseInitStruct)
+{
+    uint16_t cr1 = TIMx->CR1;
+
+    cr1 &= ~(TIM_CR1_DIR | TIM_CR1_CMS | TIM_CR1_CKD);
+    cr1 |= TIM_TimeBaseInitStruct->TIM_CounterMode | TIM_TimeBaseInitStruct->TIM_ClockDivision;
+
+    TIMx->CR1 = cr1;
+    TIMx->ARR = TIM_TimeBaseInitStruct->TIM_Period;
+    TIMx->PSC = TIM_TimeBaseInitStruct->TIM_Prescaler;
+
+    if (TIMx == TIM1) {
+        TIMx->RCR = TIM_TimeBaseInitStruct->TIM_RepetitionCounter;
+    }
+
+    /* loads the prescaler right away */
+    TIMx->EGR = TIM_EGR_UG;
+}
+
+/* CCMR and CCER fields of one channel, ch 0..3 */
+static void TIM_OCxInit(TIM_TypeDef *TIMx, uint8_t ch, const TIM_OCInitTypeDef *TIM_OCInitStruct)
+{
+    volatile uint16_t *ccmr = (ch < 2) ? &TIMx->CCMR1 : &TIMx->CCMR2;
+    uint8_t ccmr_shift = (ch & 1) * 8;
+    uint8_t ccer_shift = ch * 4;
+
+    TIMx->CCER &= ~(TIM_CCER_CC1E << ccer_shift);
+
+    uint16_t ccer = TIMx->CCER & ~((TIM_CCER_CC1P | TIM_CCER_CC1E) << ccer_shift);
+    uint16_t mode = *ccmr & ~((TIM_CCMR1_OC1M | TIM_CCMR1_CC1S) << ccmr_shift);
+
+    mode |= TIM_OCInitStruct->TIM_OCMode << ccmr_shift;
+    ccer |= (TIM_OCInitStruct->TIM_OCPolarity | TIM_OCInitStruct->TIM_OutputState) << ccer_shift;
+
+    if (TIMx == TIM1) {
+        ccer &= ~((TIM_CCER_CC1NP | TIM_CCER_CC1NE) << ccer_shift);
+        ccer |= (TIM_OCInitStruct->TIM_OCNPolarity | TIM_OCInitStruct->TIM_OutputNState) << ccer_shift;
+    }
+
+    *ccmr = mode;
+    *(&TIMx->CCR1 + ch * 2) = TIM_OCInitStruct->TIM_Pulse;
+    TIMx->CCER = ccer;
+}
+
+void TIM_OC1Init(TIM_TypeDef *TIMx, const TIM_OCInitTypeDef *TIM_OCInitStruct)
+{
+    TIM_OCxInit(TIMx, 0, TIM_OCInitStruct);
+}
+
+void TIM_OC2Init(TIM_TypeDef *TIMx, const TIM_OCInitTypeDef *TIM_OCInitStruct)
+{
+    TIM_OCxInit(TIMx, 1, TIM_OCInitStruct);
+}
+
+void TIM_OC3Init(TIM_TypeDef *TIMx, const TIM_OCInitTypeDef *TIM_OCInitStruct)
+{
+    TIM_OCxInit(TIMx, 2, TIM_OCInitStruct);
+}
+
+void TIM_OC4Init(TIM_TypeDef *TIMx, const TIM_OCInitTypeDef *TIM_OCInitStruct)
+{
+    TIM_OCxInit(TIMx, 3, TIM_OCInitStruct);
+}
+
+void TIM_Cmd(TIM_TypeDef *TIMx, FunctionalState NewState)
+{
+    if (NewState != DISABLE) {
+        TIMx->CR1 |= TIM_CR1_CEN;
+    } else {
+        TIMx->CR1 &= ~TIM_CR1_CEN;
+    }
+}
+
+void TIM_ITConfig(TIM_TypeDef *TIMx, uint16_t TIM_IT, FunctionalState NewState)
+{
+    if (NewState != DISABLE) {
+        TIMx->DIER |= TIM_IT;
+    } else {
+        TIMx->DIER &= ~TIM_IT;
+    }
+}
+
+void TIM_DMACmd(TIM_TypeDef *TIMx, uint16_t TIM_DMASource, FunctionalState NewState)
+{
+    if (NewState != DISABLE) {
+        TIMx->DIER |= TIM_DMASource;
+    } else {
+        TIMx->DIER &= ~TIM_DMASource;
+    }
+}
+
+void TIM_InternalClockConfig(TIM_TypeDef *TIMx)
+{
+    TIMx->SMCR &= ~TIM_SMCR_SMS;
+}
+
+void TIM_PrescalerConfig(TIM_TypeDef *TIMx, uint16_t Prescaler, uint16_t TIM_PSCReloadMode)
+{
+    TIMx->PSC = Prescaler;
+    TIMx->EGR = TIM_PSCReloadMode;
+}
+
+void TIM_ARRPreloadConfig(TIM_TypeDef *TIMx, FunctionalState NewState)
+{
+    if (NewState != DISABLE) {
+        TIMx->CR1 |= TIM_CR1_ARPE;
+    } else {
+        TIMx->CR1 &= ~TIM_CR1_ARPE;
+    }
+}
+
+void TIM_CCxCmd(TIM_TypeDef *TIMx, uint16_t TIM_Channel, uint16_t TIM_CCx)
+{
+    TIMx->CCER &= ~(TIM_CCER_CC1E << TIM_Channel);
+    TIMx->CCER |= TIM_CCx << TIM_Channel;
+}
+
+void TIM_SetCounter(TIM_TypeDef *TIMx, uint16_t Counter)
+{
+    TIMx->CNT = Counter;
+}
+
+void TIM_SetAutoreload(TIM_TypeDef *TIMx, uint16_t Autoreload)
+{
+    TIMx->ARR = Autoreload;
+}
+
+void TIM_SetCompare1(TIM_TypeDef *TIMx, uint16_t Compare1)
+{
+    TIMx->CCR1 = Compare1;
+}
+
+uint16_t TIM_GetCounter(TIM_TypeDef *TIMx)
+{
+    return TIMx->CNT;
+}
+
+ITStatus TIM_GetITStatus(TIM_TypeDef *TIMx, uint16_t TIM_IT)
+{
+    return ((TIMx->SR & TIM_IT) && (TIMx->DIER & TIM_IT)) ? SET : RESET;
+}
+
+void TIM_ClearITPendingBit(TIM_TypeDef *TIMx, uint16_t TIM_IT)
+{
+    TIMx->SR = (uint16_t)~TIM_IT;
+}
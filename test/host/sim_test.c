@@ -0,0 +1,242 @@
+/**
+ ******************************************************************************
+ * @file       sim_test.c
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      Checks the peripheral simulator on its own, and how fast it runs
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "test.h"
+
+/* 1 Mbaud: one BSRR word per bit out of a circular buffer on the TIM3 update */
+#define BAUD      1000000
+#define SECONDS   60
+
+static uint32_t bits[10];
+static uint64_t edges;
+static uint64_t last_edge;
+static uint64_t bad_edges;
+
+static void count_edges(GPIO_TypeDef *gpio, uint16_t levels, uint16_t changed)
+{
+    if (gpio != GPIOB || !(changed & GPIO_Pin_0)) {
+        return;
+    }
+
+    /* every edge on a bit boundary */
+    if ((sim_time - last_edge) % (SIM_SYSCLK / BAUD)) {
+        ++bad_edges;
+    }
+    last_edge = sim_time;
+    ++edges;
+}
+
+static void test_timer_dma_gpio(void)
+{
+    GPIO_InitTypeDef gpio = {
+        .GPIO_Pin   = GPIO_Pin_0,
+        .GPIO_Speed = GPIO_Speed_50MHz,
+        .GPIO_Mode  = GPIO_Mode_Out_PP,
+    };
+
+    GPIO_Init(GPIOB, &gpio);
+
+    /* 0x55 8N1, start bit low */
+    for (uint8_t i = 0; i < 10; ++i) {
+        bool high = (i == 0) ? false : (i == 9) ? true : (0x55 >> (i - 1)) & 1;
+
+        bits[i] = high ? GPIO_Pin_0 : GPIO_Pin_0 << 16;
+    }
+
+    DMA_InitTypeDef dma = {
+        .DMA_PeripheralBaseAddr = (uint32_t)&GPIOB->BSRR,
+        .DMA_MemoryBaseAddr     = (uint32_t)bits,
+        .DMA_DIR                = DMA_DIR_PeripheralDST,
+        .DMA_BufferSize         = 10,
+        .DMA_MemoryInc          = DMA_MemoryInc_Enable,
+        .DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word,
+        .DMA_MemoryDataSize     = DMA_MemoryDataSize_Word,
+        .DMA_Mode = DMA_Mode_Circular,
+    };
+
+    DMA_Init(DMA1_Channel3, &dma);
+    DMA_Cmd(DMA1_Channel3, ENABLE);
+
+    TIM_TimeBaseInitTypeDef base = {
+        .TIM_Period = SIM_SYSCLK / BAUD - 1,
+    };
+
+    TIM_TimeBaseInit(TIM3, &base);
+    TIM_DMACmd(TIM3, TIM_DMA_Update, ENABLE);
+    TIM_Cmd(TIM3, ENABLE);
+
+    sim_gpio_hook = count_edges;
+    last_edge     = 0;
+
+    double start = test_now();
+
+    sim_run((uint64_t)SECONDS * SIM_SYSCLK);
+
+    double wall = test_now() - start;
+
+    sim_gpio_hook = 0;
+
+    /* 0x55 toggles on every bit */
+    TEST_EQ(edges, (uint64_t)SECONDS * BAUD);
+    TEST_EQ(bad_edges, 0);
+    printf("%d s of 1 Mbaud in %.2f s\n", SECONDS, wall);
+
+    TIM_Cmd(TIM3, DISABLE);
+    DMA_Cmd(DMA1_Channel3, DISABLE);
+    DMA1->IFCR = DMA_IFCR_CGIF1 << 8;
+}
+
+static volatile uint32_t exti_hits;
+static volatile uint64_t exti_time;
+
+void EXTI0_IRQHandler(void)
+{
+    EXTI_ClearITPendingBit(EXTI_Line0);
+    exti_time = sim_time;
+    ++exti_hits;
+}
+
+static void test_exti(void)
+{
+    GPIO_InitTypeDef gpio = {
+        .GPIO_Pin  = GPIO_Pin_0,
+        .GPIO_Mode = GPIO_Mode_IPU,
+    };
+
+    GPIO_Init(GPIOA, &gpio);
+    GPIO_EXTILineConfig(GPIO_PortSourceGPIOA, GPIO_PinSource0);
+
+    EXTI_InitTypeDef exti = {
+        .EXTI_Line    = EXTI_Line0,
+        .EXTI_Mode    = EXTI_Mode_Interrupt,
+        .EXTI_Trigger = EXTI_Trigger_Falling,
+        .EXTI_LineCmd = ENABLE,
+    };
+
+    EXTI_Init(&exti);
+
+    NVIC_InitTypeDef nvic = {
+        .NVIC_IRQChannel = EXTI0_IRQn,
+        .NVIC_IRQChannelPreemptionPriority = 5,
+        .NVIC_IRQChannelCmd = ENABLE,
+    };
+
+    NVIC_Init(&nvic);
+
+    TEST_EQ(sim_gpio_levels(GPIOA) & GPIO_Pin_0, GPIO_Pin_0);
+
+    sim_run(100);
+    sim_gpio_drive(GPIOA, GPIO_Pin_0, 0);
+    TEST_EQ(exti_hits, 1);
+    TEST_EQ(exti_time, sim_time);
+
+    /* rising edges are not wanted, masked ones stay pending */
+    sim_gpio_release(GPIOA, GPIO_Pin_0);
+    TEST_EQ(exti_hits, 1);
+
+    __set_BASEPRI(5 << 4);
+    sim_gpio_drive(GPIOA, GPIO_Pin_0, 0);
+    TEST_EQ(exti_hits, 1);
+    TEST_EQ(NVIC_GetPendingIRQ(EXTI0_IRQn), 1);
+    __set_BASEPRI(0);
+    TEST_EQ(exti_hits, 2);
+    sim_gpio_release(GPIOA, GPIO_Pin_0);
+
+    NVIC_DisableIRQ(EXTI0_IRQn);
+}
+
+/* TC of a copy preempts a less urgent handler, not the other way round */
+static uint8_t src[64];
+static uint8_t dst[64];
+static volatile uint32_t order[4];
+static volatile uint8_t order_len;
+
+static void start_copy(DMA_Channel_TypeDef *ch)
+{
+    DMA_InitTypeDef dma = {
+        .DMA_PeripheralBaseAddr = (uint32_t)src,
+        .DMA_MemoryBaseAddr     = (uint32_t)dst,
+        .DMA_DIR                = DMA_DIR_PeripheralSRC,
+        .DMA_BufferSize         = sizeof(src),
+        .DMA_PeripheralInc      = DMA_PeripheralInc_Enable,
+        .DMA_MemoryInc          = DMA_MemoryInc_Enable,
+        .DMA_M2M = DMA_M2M_Enable,
+    };
+
+    DMA_Init(ch, &dma);
+    DMA_ITConfig(ch, DMA_IT_TC, ENABLE);
+    DMA_Cmd(ch, ENABLE);
+    sim_sync();
+}
+
+void DMA1_Channel1_IRQHandler(void)
+{
+    DMA1->IFCR = DMA_IFCR_CGIF1;
+    DMA_Cmd(DMA1_Channel1, DISABLE);
+    order[order_len++] = 1;
+
+    /* more urgent, runs before we return */
+    start_copy(DMA1_Channel2);
+    order[order_len++] = 11;
+}
+
+void DMA1_Channel2_IRQHandler(void)
+{
+    DMA1->IFCR = DMA_IFCR_CGIF1 << 4;
+    DMA_Cmd(DMA1_Channel2, DISABLE);
+    order[order_len++] = 2;
+}
+
+static void test_dma_preempt(void)
+{
+    for (uint8_t i = 0; i < sizeof(src); ++i) {
+        src[i] = i * 7;
+    }
+
+    NVIC_SetPriority(DMA1_Channel1_IRQn, 8);
+    NVIC_SetPriority(DMA1_Channel2_IRQn, 4);
+    NVIC_EnableIRQ(DMA1_Channel1_IRQn);
+    NVIC_EnableIRQ(DMA1_Channel2_IRQn);
+
+    start_copy(DMA1_Channel1);
+
+    TEST_EQ(memcmp(src, dst, sizeof(src)), 0);
+    TEST_EQ(order_len, 3);
+    TEST_EQ(order[0], 1);
+    TEST_EQ(order[1], 2);
+    TEST_EQ(order[2], 11);
+    TEST_EQ(DMA1->ISR, 0);
+}
+
+int main(void)
+{
+    sim_init();
+    NVIC_PriorityGroupConfig(NVIC_PriorityGroup_4);
+
+    test_timer_dma_gpio();
+    test_exti();
+    test_dma_preempt();
+
+    return test_result();
+}
@@ -0,0 +1,149 @@
+/*
+ * Host stand-in for the CMSIS Cortex-M3 core header. Register layouts are
+ * the real ones at the real addresses (the simulator maps them), NVIC and
+ * the BASEPRI/PRIMASK intrinsics go to the interrupt model in sim/sim.c.
+ */
+#ifndef CORE_CM3_H
+#define CORE_CM3_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define __I  volatile const
+#define __O  volatile
+#define __IO volatile
+
+typedef struct {
+    __IO uint32_t ISER[8];
+    uint32_t RESERVED0[24];
+    __IO uint32_t ICER[8];
+    uint32_t RSERVED1[24];
+    __IO uint32_t ISPR[8];
+    uint32_t RESERVED2[24];
+    __IO uint32_t ICPR[8];
+    uint32_t RESERVED3[24];
+    __IO uint32_t IABR[8];
+    uint32_t RESERVED4[56];
+    __IO uint8_t IP[240];
+    uint32_t RESERVED5[644];
+    __O uint32_t STIR;
+} NVIC_Type;
+
+typedef struct {
+    __I uint32_t CPUID;
+    __IO uint32_t ICSR;
+    __IO uint32_t VTOR;
+    __IO uint32_t AIRCR;
+    __IO uint32_t SCR;
+    __IO uint32_t CCR;
+    __IO uint8_t SHP[12];
+    __IO uint32_t SHCSR;
+    __IO uint32_t CFSR;
+    __IO uint32_t HFSR;
+    __IO uint32_t DFSR;
+    __IO uint32_t MMFAR;
+    __IO uint32_t BFAR;
+    __IO uint32_t AFSR;
+} SCB_Type;
+
+typedef struct {
+    __IO uint32_t DHCSR;
+    __O uint32_t DCRSR;
+    __IO uint32_t DCRDR;
+    __IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+#define SCS_BASE        (0xE000E000UL)
+#define NVIC_BASE       (SCS_BASE + 0x0100UL)
+#define SCB_BASE        (SCS_BASE + 0x0D00UL)
+#define CoreDebug_BASE  (0xE000EDF0UL)
+
+#define NVIC            ((NVIC_Type *)NVIC_BASE)
+#define SCB             ((SCB_Type *)SCB_BASE)
+#define CoreDebug       ((CoreDebug_Type *)CoreDebug_BASE)
+
+#define SCB_AIRCR_VECTKEY_Pos       16
+#define SCB_AIRCR_VECTKEY_Msk       (0xFFFFUL << SCB_AIRCR_VECTKEY_Pos)
+#define SCB_AIRCR_PRIGROUP_Pos      8
+#define SCB_AIRCR_PRIGROUP_Msk      (7UL << SCB_AIRCR_PRIGROUP_Pos)
+
+#define CoreDebug_DEMCR_TRCENA_Pos  24
+#define CoreDebug_DEMCR_TRCENA_Msk  (1UL << CoreDebug_DEMCR_TRCENA_Pos)
+
+/* sim/sim.c */
+extern void NVIC_EnableIRQ(IRQn_Type IRQn);
+extern void NVIC_DisableIRQ(IRQn_Type IRQn);
+extern uint32_t NVIC_GetPendingIRQ(IRQn_Type IRQn);
+extern void NVIC_SetPendingIRQ(IRQn_Type IRQn);
+extern void NVIC_ClearPendingIRQ(IRQn_Type IRQn);
+extern uint32_t NVIC_GetActive(IRQn_Type IRQn);
+
+static inline void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority)
+{
+    NVIC->IP[(uint32_t)IRQn] = (uint8_t)(priority << (8 - __NVIC_PRIO_BITS));
+}
+
+static inline uint32_t NVIC_GetPriority(IRQn_Type IRQn)
+{
+    return (uint32_t)NVIC->IP[(uint32_t)IRQn] >> (8 - __NVIC_PRIO_BITS);
+}
+
+extern uint32_t __get_BASEPRI(void);
+extern void __set_BASEPRI(uint32_t basePri);
+extern uint32_t __get_PRIMASK(void);
+extern void __set_PRIMASK(uint32_t priMask);
+
+static inline void __disable_irq(void)
+{
+    __set_PRIMASK(1);
+}
+
+static inline void __enable_irq(void)
+{
+    __set_PRIMASK(0);
+}
+
+/* exclusive monitor of the calling thread, the store fails if the word changed meanwhile */
+extern __thread uint32_t sim_exclusive;
+
+static inline uint32_t __LDREXW(volatile uint32_t *addr)
+{
+    return sim_exclusive = __atomic_load_n(addr, __ATOMIC_SEQ_CST);
+}
+
+static inline uint32_t __STREXW(uint32_t value, volatile uint32_t *addr)
+{
+    uint32_t expected = sim_exclusive;
+
+    return !__atomic_compare_exchange_n(addr, &expected, value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline void __CLREX(void)
+{
+}
+
+static inline void __DMB(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void __DSB(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void __ISB(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void __NOP(void)
+{
+}
+
+/* nothing happens between events unless the test runs the clock */
+static inline void __WFI(void)
+{
+}
+
+#endif /* CORE_CM3_H */
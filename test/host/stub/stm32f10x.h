@@ -0,0 +1,354 @@
+/*
+ * Host stand-in for the STM32F10x device header, medium density: register
+ * blocks with their RM0008 layout at their RM0008 addresses, so the driver
+ * sources compile unchanged and sim/sim.c maps real memory behind them.
+ * Only what the drivers and the simulator use.
+ */
+#ifndef __STM32F10x_H
+#define __STM32F10x_H
+
+#include <stdint.h>
+
+typedef enum IRQn {
+    NonMaskableInt_IRQn   = -14,
+    MemoryManagement_IRQn = -12,
+    BusFault_IRQn         = -11,
+    UsageFault_IRQn       = -10,
+    SVCall_IRQn           = -5,
+    DebugMonitor_IRQn     = -4,
+    PendSV_IRQn           = -2,
+    SysTick_IRQn          = -1,
+    WWDG_IRQn             = 0,
+    PVD_IRQn              = 1,
+    TAMPER_IRQn           = 2,
+    RTC_IRQn              = 3,
+    FLASH_IRQn            = 4,
+    RCC_IRQn              = 5,
+    EXTI0_IRQn            = 6,
+    EXTI1_IRQn            = 7,
+    EXTI2_IRQn            = 8,
+    EXTI3_IRQn            = 9,
+    EXTI4_IRQn            = 10,
+    DMA1_Channel1_IRQn    = 11,
+    DMA1_Channel2_IRQn    = 12,
+    DMA1_Channel3_IRQn    = 13,
+    DMA1_Channel4_IRQn    = 14,
+    DMA1_Channel5_IRQn    = 15,
+    DMA1_Channel6_IRQn    = 16,
+    DMA1_Channel7_IRQn    = 17,
+    ADC1_2_IRQn           = 18,
+    USB_HP_CAN1_TX_IRQn   = 19,
+    USB_LP_CAN1_RX0_IRQn  = 20,
+    CAN1_RX1_IRQn         = 21,
+    CAN1_SCE_IRQn         = 22,
+    EXTI9_5_IRQn          = 23,
+    TIM1_BRK_IRQn         = 24,
+    TIM1_UP_IRQn          = 25,
+    TIM1_TRG_COM_IRQn     = 26,
+    TIM1_CC_IRQn          = 27,
+    TIM2_IRQn             = 28,
+    TIM3_IRQn             = 29,
+    TIM4_IRQn             = 30,
+    I2C1_EV_IRQn          = 31,
+    I2C1_ER_IRQn          = 32,
+    I2C2_EV_IRQn          = 33,
+    I2C2_ER_IRQn          = 34,
+    SPI1_IRQn             = 35,
+    SPI2_IRQn             = 36,
+    USART1_IRQn           = 37,
+    USART2_IRQn           = 38,
+    USART3_IRQn           = 39,
+    EXTI15_10_IRQn        = 40,
+    RTCAlarm_IRQn         = 41,
+    USBWakeUp_IRQn        = 42,
+} IRQn_Type;
+
+#define __MPU_PRESENT           0
+#define __NVIC_PRIO_BITS        4
+#define __Vendor_SysTickConfig  0
+
+#include "core_cm3.h"
+
+typedef enum { RESET = 0, SET = !RESET } FlagStatus, ITStatus;
+typedef enum { DISABLE = 0, ENABLE = !DISABLE } FunctionalState;
+#define IS_FUNCTIONAL_STATE(STATE) (((STATE) == DISABLE) || ((STATE) == ENABLE))
+typedef enum { ERROR = 0, SUCCESS = !ERROR } ErrorStatus;
+
+typedef struct {
+    __IO uint32_t CCR;
+    __IO uint32_t CNDTR;
+    __IO uint32_t CPAR;
+    __IO uint32_t CMAR;
+} DMA_Channel_TypeDef;
+
+typedef struct {
+    __IO uint32_t ISR;
+    __IO uint32_t IFCR;
+} DMA_TypeDef;
+
+typedef struct {
+    __IO uint32_t IMR;
+    __IO uint32_t EMR;
+    __IO uint32_t RTSR;
+    __IO uint32_t FTSR;
+    __IO uint32_t SWIER;
+    __IO uint32_t PR;
+} EXTI_TypeDef;
+
+typedef struct {
+    __IO uint32_t CRL;
+    __IO uint32_t CRH;
+    __IO uint32_t IDR;
+    __IO uint32_t ODR;
+    __IO uint32_t BSRR;
+    __IO uint32_t BRR;
+    __IO uint32_t LCKR;
+} GPIO_TypeDef;
+
+typedef struct {
+    __IO uint32_t EVCR;
+    __IO uint32_t MAPR;
+    __IO uint32_t EXTICR[4];
+    uint32_t RESERVED0;
+    __IO uint32_t MAPR2;
+} AFIO_TypeDef;
+
+typedef struct {
+    __IO uint32_t CR;
+    __IO uint32_t CFGR;
+    __IO uint32_t CIR;
+    __IO uint32_t APB2RSTR;
+    __IO uint32_t APB1RSTR;
+    __IO uint32_t AHBENR;
+    __IO uint32_t APB2ENR;
+    __IO uint32_t APB1ENR;
+    __IO uint32_t BDCR;
+    __IO uint32_t CSR;
+} RCC_TypeDef;
+
+typedef struct {
+    __IO uint16_t CR1;
+    uint16_t RESERVED0;
+    __IO uint16_t CR2;
+    uint16_t RESERVED1;
+    __IO uint16_t SMCR;
+    uint16_t RESERVED2;
+    __IO uint16_t DIER;
+    uint16_t RESERVED3;
+    __IO uint16_t SR;
+    uint16_t RESERVED4;
+    __IO uint16_t EGR;
+    uint16_t RESERVED5;
+    __IO uint16_t CCMR1;
+    uint16_t RESERVED6;
+    __IO uint16_t CCMR2;
+    uint16_t RESERVED7;
+    __IO uint16_t CCER;
+    uint16_t RESERVED8;
+    __IO uint16_t CNT;
+    uint16_t RESERVED9;
+    __IO uint16_t PSC;
+    uint16_t RESERVED10;
+    __IO uint16_t ARR;
+    uint16_t RESERVED11;
+    __IO uint16_t RCR;
+    uint16_t RESERVED12;
+    __IO uint16_t CCR1;
+    uint16_t RESERVED13;
+    __IO uint16_t CCR2;
+    uint16_t RESERVED14;
+    __IO uint16_t CCR3;
+    uint16_t RESERVED15;
+    __IO uint16_t CCR4;
+    uint16_t RESERVED16;
+    __IO uint16_t BDTR;
+    uint16_t RESERVED17;
+    __IO uint16_t DCR;
+    uint16_t RESERVED18;
+    __IO uint16_t DMAR;
+    uint16_t RESERVED19;
+} TIM_TypeDef;
+
+#define FLASH_BASE          ((uint32_t)0x08000000)
+#define SRAM_BASE           ((uint32_t)0x20000000)
+#define PERIPH_BASE         ((uint32_t)0x40000000)
+#define SRAM_BB_BASE        ((uint32_t)0x22000000)
+#define PERIPH_BB_BASE      ((uint32_t)0x42000000)
+
+#define APB1PERIPH_BASE     PERIPH_BASE
+#define APB2PERIPH_BASE     (PERIPH_BASE + 0x10000)
+#define AHBPERIPH_BASE      (PERIPH_BASE + 0x20000)
+
+#define TIM2_BASE           (APB1PERIPH_BASE + 0x0000)
+#define TIM3_BASE           (APB1PERIPH_BASE + 0x0400)
+#define TIM4_BASE           (APB1PERIPH_BASE + 0x0800)
+#define AFIO_BASE           (APB2PERIPH_BASE + 0x0000)
+#define EXTI_BASE           (APB2PERIPH_BASE + 0x0400)
+#define GPIOA_BASE          (APB2PERIPH_BASE + 0x0800)
+#define GPIOB_BASE          (APB2PERIPH_BASE + 0x0C00)
+#define GPIOC_BASE          (APB2PERIPH_BASE + 0x1000)
+#define GPIOD_BASE          (APB2PERIPH_BASE + 0x1400)
+#define GPIOE_BASE          (APB2PERIPH_BASE + 0x1800)
+#define GPIOF_BASE          (APB2PERIPH_BASE + 0x1C00)
+#define GPIOG_BASE          (APB2PERIPH_BASE + 0x2000)
+#define TIM1_BASE           (APB2PERIPH_BASE + 0x2C00)
+#define DMA1_BASE           (AHBPERIPH_BASE + 0x0000)
+#define DMA1_Channel1_BASE  (AHBPERIPH_BASE + 0x0008)
+#define DMA1_Channel2_BASE  (AHBPERIPH_BASE + 0x001C)
+#define DMA1_Channel3_BASE  (AHBPERIPH_BASE + 0x0030)
+#define DMA1_Channel4_BASE  (AHBPERIPH_BASE + 0x0044)
+#define DMA1_Channel5_BASE  (AHBPERIPH_BASE + 0x0058)
+#define DMA1_Channel6_BASE  (AHBPERIPH_BASE + 0x006C)
+#define DMA1_Channel7_BASE  (AHBPERIPH_BASE + 0x0080)
+#define DMA2_BASE           (AHBPERIPH_BASE + 0x0400)
+#define DMA2_Channel1_BASE  (AHBPERIPH_BASE + 0x0408)
+#define DMA2_Channel2_BASE  (AHBPERIPH_BASE + 0x041C)
+#define DMA2_Channel3_BASE  (AHBPERIPH_BASE + 0x0430)
+#define DMA2_Channel4_BASE  (AHBPERIPH_BASE + 0x0444)
+#define DMA2_Channel5_BASE  (AHBPERIPH_BASE + 0x0458)
+#define RCC_BASE            (AHBPERIPH_BASE + 0x1000)
+
+#define TIM2                ((TIM_TypeDef *)TIM2_BASE)
+#define TIM3                ((TIM_TypeDef *)TIM3_BASE)
+#define TIM4                ((TIM_TypeDef *)TIM4_BASE)
+#define AFIO                ((AFIO_TypeDef *)AFIO_BASE)
+#define EXTI                ((EXTI_TypeDef *)EXTI_BASE)
+#define GPIOA               ((GPIO_TypeDef *)GPIOA_BASE)
+#define GPIOB               ((GPIO_TypeDef *)GPIOB_BASE)
+#define GPIOC               ((GPIO_TypeDef *)GPIOC_BASE)
+#define GPIOD               ((GPIO_TypeDef *)GPIOD_BASE)
+#define GPIOE               ((GPIO_TypeDef *)GPIOE_BASE)
+#define GPIOF               ((GPIO_TypeDef *)GPIOF_BASE)
+#define GPIOG               ((GPIO_TypeDef *)GPIOG_BASE)
+#define TIM1                ((TIM_TypeDef *)TIM1_BASE)
+#define DMA1                ((DMA_TypeDef *)DMA1_BASE)
+#define DMA1_Channel1       ((DMA_Channel_TypeDef *)DMA1_Channel1_BASE)
+#define DMA1_Channel2       ((DMA_Channel_TypeDef *)DMA1_Channel2_BASE)
+#define DMA1_Channel3       ((DMA_Channel_TypeDef *)DMA1_Channel3_BASE)
+#define DMA1_Channel4       ((DMA_Channel_TypeDef *)DMA1_Channel4_BASE)
+#define DMA1_Channel5       ((DMA_Channel_TypeDef *)DMA1_Channel5_BASE)
+#define DMA1_Channel6       ((DMA_Channel_TypeDef *)DMA1_Channel6_BASE)
+#define DMA1_Channel7       ((DMA_Channel_TypeDef *)DMA1_Channel7_BASE)
+#define DMA2                ((DMA_TypeDef *)DMA2_BASE)
+#define DMA2_Channel1       ((DMA_Channel_TypeDef *)DMA2_Channel1_BASE)
+#define DMA2_Channel2       ((DMA_Channel_TypeDef *)DMA2_Channel2_BASE)
+#define DMA2_Channel3       ((DMA_Channel_TypeDef *)DMA2_Channel3_BASE)
+#define DMA2_Channel4       ((DMA_Channel_TypeDef *)DMA2_Channel4_BASE)
+#define DMA2_Channel5       ((DMA_Channel_TypeDef *)DMA2_Channel5_BASE)
+#define RCC                 ((RCC_TypeDef *)RCC_BASE)
+
+/* DMA */
+#define DMA_ISR_GIF1        ((uint32_t)0x00000001)
+#define DMA_ISR_TCIF1       ((uint32_t)0x00000002)
+#define DMA_ISR_HTIF1       ((uint32_t)0x00000004)
+#define DMA_ISR_TEIF1       ((uint32_t)0x00000008)
+#define DMA_IFCR_CGIF1      ((uint32_t)0x00000001)
+#define DMA_IFCR_CTCIF1     ((uint32_t)0x00000002)
+#define DMA_IFCR_CHTIF1     ((uint32_t)0x00000004)
+#define DMA_IFCR_CTEIF1     ((uint32_t)0x00000008)
+
+#define DMA_CCR1_EN         ((uint16_t)0x0001)
+#define DMA_CCR1_TCIE       ((uint16_t)0x0002)
+#define DMA_CCR1_HTIE       ((uint16_t)0x0004)
+#define DMA_CCR1_TEIE       ((uint16_t)0x0008)
+#define DMA_CCR1_DIR        ((uint16_t)0x0010)
+#define DMA_CCR1_CIRC       ((uint16_t)0x0020)
+#define DMA_CCR1_PINC       ((uint16_t)0x0040)
+#define DMA_CCR1_MINC       ((uint16_t)0x0080)
+#define DMA_CCR1_PSIZE      ((uint16_t)0x0300)
+#define DMA_CCR1_PSIZE_0    ((uint16_t)0x0100)
+#define DMA_CCR1_PSIZE_1    ((uint16_t)0x0200)
+#define DMA_CCR1_MSIZE      ((uint16_t)0x0C00)
+#define DMA_CCR1_MSIZE_0    ((uint16_t)0x0400)
+#define DMA_CCR1_MSIZE_1    ((uint16_t)0x0800)
+#define DMA_CCR1_PL         ((uint16_t)0x3000)
+#define DMA_CCR1_PL_0       ((uint16_t)0x1000)
+#define DMA_CCR1_PL_1       ((uint16_t)0x2000)
+#define DMA_CCR1_MEM2MEM    ((uint16_t)0x4000)
+
+/* TIM */
+#define TIM_CR1_CEN         ((uint16_t)0x0001)
+#define TIM_CR1_UDIS        ((uint16_t)0x0002)
+#define TIM_CR1_URS         ((uint16_t)0x0004)
+#define TIM_CR1_OPM         ((uint16_t)0x0008)
+#define TIM_CR1_DIR         ((uint16_t)0x0010)
+#define TIM_CR1_CMS         ((uint16_t)0x0060)
+#define TIM_CR1_ARPE        ((uint16_t)0x0080)
+#define TIM_CR1_CKD         ((uint16_t)0x0300)
+
+#define TIM_SMCR_SMS        ((uint16_t)0x0007)
+#define TIM_SMCR_TS         ((uint16_t)0x0070)
+#define TIM_SMCR_TS_0       ((uint16_t)0x0010)
+#define TIM_SMCR_TS_1       ((uint16_t)0x0020)
+#define TIM_SMCR_TS_2       ((uint16_t)0x0040)
+
+#define TIM_DIER_UIE        ((uint16_t)0x0001)
+#define TIM_DIER_CC1IE      ((uint16_t)0x0002)
+#define TIM_DIER_CC2IE      ((uint16_t)0x0004)
+#define TIM_DIER_CC3IE      ((uint16_t)0x0008)
+#define TIM_DIER_CC4IE      ((uint16_t)0x0010)
+#define TIM_DIER_UDE        ((uint16_t)0x0100)
+#define TIM_DIER_CC1DE      ((uint16_t)0x0200)
+#define TIM_DIER_CC2DE      ((uint16_t)0x0400)
+#define TIM_DIER_CC3DE      ((uint16_t)0x0800)
+#define TIM_DIER_CC4DE      ((uint16_t)0x1000)
+#define TIM_DIER_COMDE      ((uint16_t)0x2000)
+#define TIM_DIER_TDE        ((uint16_t)0x4000)
+
+#define TIM_SR_UIF          ((uint16_t)0x0001)
+#define TIM_SR_CC1IF        ((uint16_t)0x0002)
+#define TIM_SR_CC2IF        ((uint16_t)0x0004)
+#define TIM_SR_CC3IF        ((uint16_t)0x0008)
+#define TIM_SR_CC4IF        ((uint16_t)0x0010)
+#define TIM_SR_CC1OF        ((uint16_t)0x0200)
+
+#define TIM_EGR_UG          ((uint8_t)0x01)
+#define TIM_EGR_CC1G        ((uint8_t)0x02)
+#define TIM_EGR_CC2G        ((uint8_t)0x04)
+#define TIM_EGR_CC3G        ((uint8_t)0x08)
+#define TIM_EGR_CC4G        ((uint8_t)0x10)
+
+#define TIM_CCMR1_CC1S      ((uint16_t)0x0003)
+#define TIM_CCMR1_CC1S_0    ((uint16_t)0x0001)
+#define TIM_CCMR1_CC1S_1    ((uint16_t)0x0002)
+#define TIM_CCMR1_OC1FE     ((uint16_t)0x0004)
+#define TIM_CCMR1_OC1PE     ((uint16_t)0x0008)
+#define TIM_CCMR1_OC1M      ((uint16_t)0x0070)
+#define TIM_CCMR1_OC1M_0    ((uint16_t)0x0010)
+#define TIM_CCMR1_OC1M_1    ((uint16_t)0x0020)
+#define TIM_CCMR1_OC1M_2    ((uint16_t)0x0040)
+#define TIM_CCMR1_IC1PSC    ((uint16_t)0x000C)
+#define TIM_CCMR1_IC1F      ((uint16_t)0x00F0)
+#define TIM_CCMR1_CC2S      ((uint16_t)0x0300)
+#define TIM_CCMR1_IC2F      ((uint16_t)0xF000)
+
+#define TIM_CCER_CC1E       ((uint16_t)0x0001)
+#define TIM_CCER_CC1P       ((uint16_t)0x0002)
+#define TIM_CCER_CC1NE      ((uint16_t)0x0004)
+#define TIM_CCER_CC1NP      ((uint16_t)0x0008)
+
+#define TIM_BDTR_MOE        ((uint16_t)0x8000)
+
+/* RCC */
+#define RCC_CFGR_PPRE1      ((uint32_t)0x00000700)
+#define RCC_CFGR_PPRE1_0    ((uint32_t)0x00000100)
+#define RCC_CFGR_PPRE1_1    ((uint32_t)0x00000200)
+#define RCC_CFGR_PPRE1_2    ((uint32_t)0x00000400)
+#define RCC_CFGR_PPRE1_DIV1 ((uint32_t)0x00000000)
+#define RCC_CFGR_PPRE1_DIV2 ((uint32_t)0x00000400)
+#define RCC_CFGR_PPRE1_DIV4 ((uint32_t)0x00000500)
+#define RCC_CFGR_PPRE2      ((uint32_t)0x00003800)
+#define RCC_CFGR_PPRE2_0    ((uint32_t)0x00000800)
+#define RCC_CFGR_PPRE2_1    ((uint32_t)0x00001000)
+#define RCC_CFGR_PPRE2_2    ((uint32_t)0x00002000)
+#define RCC_CFGR_PPRE2_DIV8 ((uint32_t)0x00003000)
+
+/* EXTI */
+#define EXTI_IMR_MR0        ((uint32_t)0x00000001)
+#define EXTI_PR_PR0         ((uint32_t)0x00000001)
+
+#ifdef USE_STDPERIPH_DRIVER
+#include "stm32f10x_conf.h"
+#endif
+
+#endif /* __STM32F10x_H */
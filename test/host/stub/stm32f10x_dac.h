@@ -0,0 +1,7 @@
+/* Host stand-in, nothing in here is used */
+#ifndef __STM32F10x_DAC_H
+#define __STM32F10x_DAC_H
+
+#include "stm32f10x.h"
+
+#endif /* __STM32F10x_DAC_H */
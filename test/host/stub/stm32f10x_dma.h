@@ -0,0 +1,52 @@
+/* Host stand-in for the StdPeriph DMA header, implemented in sim/spl.c */
+#ifndef __STM32F10x_DMA_H
+#define __STM32F10x_DMA_H
+
+#include "stm32f10x.h"
+
+typedef struct {
+    uint32_t DMA_PeripheralBaseAddr;
+    uint32_t DMA_MemoryBaseAddr;
+    uint32_t DMA_DIR;
+    uint32_t DMA_BufferSize;
+    uint32_t DMA_PeripheralInc;
+    uint32_t DMA_MemoryInc;
+    uint32_t DMA_PeripheralDataSize;
+    uint32_t DMA_MemoryDataSize;
+    uint32_t DMA_Mode;
+    uint32_t DMA_Priority;
+    uint32_t DMA_M2M;
+} DMA_InitTypeDef;
+
+#define DMA_DIR_PeripheralDST           ((uint32_t)0x00000010)
+#define DMA_DIR_PeripheralSRC           ((uint32_t)0x00000000)
+#define DMA_PeripheralInc_Enable        ((uint32_t)0x00000040)
+#define DMA_PeripheralInc_Disable       ((uint32_t)0x00000000)
+#define DMA_MemoryInc_Enable            ((uint32_t)0x00000080)
+#define DMA_MemoryInc_Disable           ((uint32_t)0x00000000)
+#define DMA_PeripheralDataSize_Byte     ((uint32_t)0x00000000)
+#define DMA_PeripheralDataSize_HalfWord ((uint32_t)0x00000100)
+#define DMA_PeripheralDataSize_Word     ((uint32_t)0x00000200)
+#define DMA_MemoryDataSize_Byte         ((uint32_t)0x00000000)
+#define DMA_MemoryDataSize_HalfWord     ((uint32_t)0x00000400)
+#define DMA_MemoryDataSize_Word         ((uint32_t)0x00000800)
+#define DMA_Mode_Circular               ((uint32_t)0x00000020)
+#define DMA_Mode_Normal                 ((uint32_t)0x00000000)
+#define DMA_Priority_VeryHigh           ((uint32_t)0x00003000)
+#define DMA_Priority_High               ((uint32_t)0x00002000)
+#define DMA_Priority_Medium             ((uint32_t)0x00001000)
+#define DMA_Priority_Low                ((uint32_t)0x00000000)
+#define DMA_M2M_Enable                  ((uint32_t)0x00004000)
+#define DMA_M2M_Disable                 ((uint32_t)0x00000000)
+
+#define DMA_IT_TC                       ((uint32_t)0x00000002)
+#define DMA_IT_HT                       ((uint32_t)0x00000004)
+#define DMA_IT_TE                       ((uint32_t)0x00000008)
+
+void DMA_DeInit(DMA_Channel_TypeDef *DMAy_Channelx);
+void DMA_Init(DMA_Channel_TypeDef *DMAy_Channelx, const DMA_InitTypeDef *DMA_InitStruct);
+void DMA_Cmd(DMA_Channel_TypeDef *DMAy_Channelx, FunctionalState NewState);
+void DMA_ITConfig(DMA_Channel_TypeDef *DMAy_Channelx, uint32_t DMA_IT, FunctionalState NewState);
+uint16_t DMA_GetCurrDataCounter(DMA_Channel_TypeDef *DMAy_Channelx);
+
+#endif /* __STM32F10x_DMA_H */
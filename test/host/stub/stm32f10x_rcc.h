@@ -0,0 +1,34 @@
+/* Host stand-in for the StdPeriph RCC header, implemented in sim/spl.c */
+#ifndef __STM32F10x_RCC_H
+#define __STM32F10x_RCC_H
+
+#include "stm32f10x.h"
+
+typedef struct {
+    uint32_t SYSCLK_Frequency;
+    uint32_t HCLK_Frequency;
+    uint32_t PCLK1_Frequency;
+    uint32_t PCLK2_Frequency;
+    uint32_t ADCCLK_Frequency;
+} RCC_ClocksTypeDef;
+
+#define RCC_AHBPeriph_DMA1   ((uint32_t)0x00000001)
+#define RCC_AHBPeriph_DMA2   ((uint32_t)0x00000002)
+
+#define RCC_APB2Periph_AFIO  ((uint32_t)0x00000001)
+#define RCC_APB2Periph_GPIOA ((uint32_t)0x00000004)
+#define RCC_APB2Periph_GPIOB ((uint32_t)0x00000008)
+#define RCC_APB2Periph_GPIOC ((uint32_t)0x00000010)
+#define RCC_APB2Periph_GPIOD ((uint32_t)0x00000020)
+#define RCC_APB2Periph_TIM1  ((uint32_t)0x00000800)
+
+#define RCC_APB1Periph_TIM2  ((uint32_t)0x00000001)
+#define RCC_APB1Periph_TIM3  ((uint32_t)0x00000002)
+#define RCC_APB1Periph_TIM4  ((uint32_t)0x00000004)
+
+void RCC_GetClocksFreq(RCC_ClocksTypeDef *RCC_Clocks);
+void RCC_AHBPeriphClockCmd(uint32_t RCC_AHBPeriph, FunctionalState NewState);
+void RCC_APB2PeriphClockCmd(uint32_t RCC_APB2Periph, FunctionalState NewState);
+void RCC_APB1PeriphClockCmd(uint32_t RCC_APB1Periph, FunctionalState NewState);
+
+#endif /* __STM32F10x_RCC_H */
@@ -0,0 +1,113 @@
+/* Host stand-in for the StdPeriph TIM header, implemented in sim/spl.c */
+#ifndef __STM32F10x_TIM_H
+#define __STM32F10x_TIM_H
+
+#include "stm32f10x.h"
+
+typedef struct {
+    uint16_t TIM_Prescaler;
+    uint16_t TIM_CounterMode;
+    uint16_t TIM_Period;
+    uint16_t TIM_ClockDivision;
+    uint8_t TIM_RepetitionCounter;
+} TIM_TimeBaseInitTypeDef;
+
+typedef struct {
+    uint16_t TIM_OCMode;
+    uint16_t TIM_OutputState;
+    uint16_t TIM_OutputNState;
+    uint16_t TIM_Pulse;
+    uint16_t TIM_OCPolarity;
+    uint16_t TIM_OCNPolarity;
+    uint16_t TIM_OCIdleState;
+    uint16_t TIM_OCNIdleState;
+} TIM_OCInitTypeDef;
+
+typedef struct {
+    uint16_t TIM_Channel;
+    uint16_t TIM_ICPolarity;
+    uint16_t TIM_ICSelection;
+    uint16_t TIM_ICPrescaler;
+    uint16_t TIM_ICFilter;
+} TIM_ICInitTypeDef;
+
+#define TIM_OCMode_Timing           ((uint16_t)0x0000)
+#define TIM_OCMode_Active           ((uint16_t)0x0010)
+#define TIM_OCMode_Inactive         ((uint16_t)0x0020)
+#define TIM_OCMode_Toggle           ((uint16_t)0x0030)
+#define TIM_OCMode_PWM1             ((uint16_t)0x0060)
+#define TIM_OCMode_PWM2             ((uint16_t)0x0070)
+#define TIM_ForcedAction_Active     ((uint16_t)0x0050)
+#define TIM_ForcedAction_InActive   ((uint16_t)0x0040)
+
+#define TIM_Channel_1               ((uint16_t)0x0000)
+#define TIM_Channel_2               ((uint16_t)0x0004)
+#define TIM_Channel_3               ((uint16_t)0x0008)
+#define TIM_Channel_4               ((uint16_t)0x000C)
+
+#define TIM_CKD_DIV1                ((uint16_t)0x0000)
+#define TIM_CKD_DIV2                ((uint16_t)0x0100)
+#define TIM_CKD_DIV4                ((uint16_t)0x0200)
+
+#define TIM_CounterMode_Up          ((uint16_t)0x0000)
+#define TIM_CounterMode_Down        ((uint16_t)0x0010)
+
+#define TIM_OCPolarity_High         ((uint16_t)0x0000)
+#define TIM_OCPolarity_Low          ((uint16_t)0x0002)
+#define TIM_OutputState_Disable     ((uint16_t)0x0000)
+#define TIM_OutputState_Enable      ((uint16_t)0x0001)
+#define TIM_OutputNState_Disable    ((uint16_t)0x0000)
+#define TIM_OutputNState_Enable     ((uint16_t)0x0004)
+#define TIM_CCx_Enable              ((uint16_t)0x0001)
+#define TIM_CCx_Disable             ((uint16_t)0x0000)
+#define TIM_OCPreload_Enable        ((uint16_t)0x0008)
+#define TIM_OCPreload_Disable       ((uint16_t)0x0000)
+
+#define TIM_ICPolarity_Rising       ((uint16_t)0x0000)
+#define TIM_ICPolarity_Falling      ((uint16_t)0x0002)
+#define TIM_ICPolarity_BothEdge     ((uint16_t)0x000A)
+#define TIM_ICSelection_DirectTI    ((uint16_t)0x0001)
+#define TIM_ICSelection_IndirectTI  ((uint16_t)0x0002)
+#define TIM_ICSelection_TRC         ((uint16_t)0x0003)
+#define TIM_ICPSC_DIV1              ((uint16_t)0x0000)
+
+#define TIM_IT_Update               ((uint16_t)0x0001)
+#define TIM_IT_CC1                  ((uint16_t)0x0002)
+#define TIM_IT_CC2                  ((uint16_t)0x0004)
+#define TIM_IT_CC3                  ((uint16_t)0x0008)
+#define TIM_IT_CC4                  ((uint16_t)0x0010)
+
+#define TIM_DMA_Update              ((uint16_t)0x0100)
+#define TIM_DMA_CC1                 ((uint16_t)0x0200)
+#define TIM_DMA_CC2                 ((uint16_t)0x0400)
+#define TIM_DMA_CC3                 ((uint16_t)0x0800)
+#define TIM_DMA_CC4                 ((uint16_t)0x1000)
+#define TIM_DMA_COM                 ((uint16_t)0x2000)
+#define TIM_DMA_Trigger             ((uint16_t)0x4000)
+
+#define TIM_PSCReloadMode_Update    ((uint16_t)0x0000)
+#define TIM_PSCReloadMode_Immediate ((uint16_t)0x0001)
+
+#define TIM_FLAG_Update             ((uint16_t)0x0001)
+#define TIM_FLAG_CC1                ((uint16_t)0x0002)
+
+void TIM_TimeBaseInit(TIM_TypeDef *TIMx, const TIM_TimeBaseInitTypeDef *TIM_TimeBaseInitStruct);
+void TIM_OC1Init(TIM_TypeDef *TIMx, const TIM_OCInitTypeDef *TIM_OCInitStruct);
+void TIM_OC2Init(TIM_TypeDef *TIMx, const TIM_OCInitTypeDef *TIM_OCInitStruct);
+void TIM_OC3Init(TIM_TypeDef *TIMx, const TIM_OCInitTypeDef *TIM_OCInitStruct);
+void TIM_OC4Init(TIM_TypeDef *TIMx, const TIM_OCInitTypeDef *TIM_OCInitStruct);
+void TIM_Cmd(TIM_TypeDef *TIMx, FunctionalState NewState);
+void TIM_ITConfig(TIM_TypeDef *TIMx, uint16_t TIM_IT, FunctionalState NewState);
+void TIM_DMACmd(TIM_TypeDef *TIMx, uint16_t TIM_DMASource, FunctionalState NewState);
+void TIM_InternalClockConfig(TIM_TypeDef *TIMx);
+void TIM_PrescalerConfig(TIM_TypeDef *TIMx, uint16_t Prescaler, uint16_t TIM_PSCReloadMode);
+void TIM_ARRPreloadConfig(TIM_TypeDef *TIMx, FunctionalState NewState);
+void TIM_CCxCmd(TIM_TypeDef *TIMx, uint16_t TIM_Channel, uint16_t TIM_CCx);
+void TIM_SetCounter(TIM_TypeDef *TIMx, uint16_t Counter);
+void TIM_SetAutoreload(TIM_TypeDef *TIMx, uint16_t Autoreload);
+void TIM_SetCompare1(TIM_TypeDef *TIMx, uint16_t Compare1);
+uint16_t TIM_GetCounter(TIM_TypeDef *TIMx);
+ITStatus TIM_GetITStatus(TIM_TypeDef *TIMx, uint16_t TIM_IT);
+void TIM_ClearITPendingBit(TIM_TypeDef *TIMx, uint16_t TIM_IT);
+
+#endif /* __STM32F10x_TIM_H */
@@ -0,0 +1,210 @@
+/**
+ ******************************************************************************
+ * @file       swtimer_test.c
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      Software timer accuracy with many timers pending at once
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "pios.h"
+#include "pios_swtimer.h"
+
+#include "test.h"
+
+/*
+ * A thousand timers: one-shots that start themselves again with a new
+ * delay, periodic ones, and restarts and cancels of random other timers
+ * from the callbacks. Delays spread from 1 us to 8 s, so every level of
+ * the wheel and the longest compare sleep are in use. Code takes no
+ * time in the simulator, so each callback must run in the microsecond
+ * tick of its deadline, measured on the simulator clock.
+ */
+#define TIMERS      1000
+#define SECONDS     20
+#define CYCLES_US   SIM_CYCLES_PER_US
+
+static const struct pios_swtimer_cfg swtimer_cfg = {
+    .timer = TIM4,
+    .tim_channel = TIM_Channel_1,
+    .irq = {
+        .init = {
+            .NVIC_IRQChannel = TIM4_IRQn,
+            .NVIC_IRQChannelPreemptionPriority = PIOS_IRQ_PRIO_MID,
+            .NVIC_IRQChannelSubPriority = 0,
+            .NVIC_IRQChannelCmd = ENABLE,
+        },
+    },
+};
+
+void TIM4_IRQHandler(void)
+{
+    PIOS_SWTimer_IRQ_Handler();
+}
+
+static struct pios_swtimer timers[TIMERS];
+
+static struct {
+    uint64_t due;       /* simulator cycle of the next call */
+    uint32_t period;    /* us */
+    bool armed;
+} expect[TIMERS];
+
+static uint64_t end_time;
+static uint32_t callbacks;
+static uint32_t early;
+static uint32_t late;
+static uint32_t unexpected;
+static uint32_t wrong_pending;
+
+static uint32_t rng_state = 2463534242u;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+
+    return rng_state;
+}
+
+/* about even over the powers of two from 1 us to 2^max_log2 us */
+static uint32_t random_delay(uint32_t max_log2)
+{
+    uint32_t bits = rng() % (max_log2 + 1);
+
+    return (rng() & ((1u << bits) - 1)) | (bits ? 1u << (bits - 1) : 1);
+}
+
+static void fired(struct pios_swtimer *timer, uint32_t i);
+
+static void start(uint32_t i, uint32_t delay, uint32_t period)
+{
+    PIOS_SWTimer_Start(&timers[i], delay, period, fired, i);
+
+    expect[i].due    = sim_time + (uint64_t)delay * CYCLES_US;
+    expect[i].period = period;
+    expect[i].armed  = true;
+}
+
+static void fired(struct pios_swtimer *timer, uint32_t i)
+{
+    ++callbacks;
+
+    if (!expect[i].armed) {
+        ++unexpected;
+        return;
+    }
+
+    /* the counter ticked over somewhere in the cycles before the deadline */
+    if (sim_time + CYCLES_US <= expect[i].due) {
+        ++early;
+    } else if (sim_time > expect[i].due) {
+        ++late;
+    }
+
+    if (expect[i].period) {
+        expect[i].due += (uint64_t)expect[i].period * CYCLES_US;
+    } else {
+        expect[i].armed = false;
+    }
+
+    if (PIOS_SWTimer_Pending(timer) != (expect[i].period != 0)) {
+        ++wrong_pending;
+    }
+
+    if (sim_time >= end_time) {
+        return;
+    }
+
+    uint32_t other = rng() % TIMERS;
+
+    switch (rng() % 8) {
+        case 0:
+            /* restart whatever it is doing */
+            start(other, random_delay(23), 0);
+            break;
+
+        case 1:
+            if (PIOS_SWTimer_Cancel(&timers[other]) != expect[other].armed) {
+                ++wrong_pending;
+            }
+            expect[other].armed = false;
+            break;
+    }
+
+    if (!expect[i].period && !expect[i].armed) {
+        start(i, random_delay(23), 0);
+    }
+}
+
+int main(void)
+{
+    sim_init();
+    NVIC_PriorityGroupConfig(NVIC_PriorityGroup_4);
+
+    TEST_EQ(PIOS_SWTimer_Init(&swtimer_cfg), 0);
+
+    end_time = sim_time + (uint64_t)SECONDS * SIM_SYSCLK;
+
+    for (uint32_t i = 0; i < TIMERS; ++i) {
+        /* a third periodic, 1 ms to 100 ms */
+        if (i % 3 == 0) {
+            start(i, random_delay(23), 1000 + rng() % 99000);
+        } else {
+            start(i, random_delay(23), 0);
+        }
+
+        /* not all from the same microsecond */
+        sim_run(rng() % (100 * CYCLES_US));
+    }
+
+    sim_run_until(end_time);
+
+    uint32_t pending = 0;
+    uint32_t armed = 0;
+
+    for (uint32_t i = 0; i < TIMERS; ++i) {
+        pending += PIOS_SWTimer_Pending(&timers[i]);
+        armed += expect[i].armed;
+
+        if (PIOS_SWTimer_Cancel(&timers[i]) != expect[i].armed) {
+            ++wrong_pending;
+        }
+        expect[i].armed = false;
+    }
+
+    /* nothing runs once cancelled */
+    sim_run(11 * SIM_SYSCLK);
+
+    TEST_EQ(early, 0);
+    TEST_EQ(late, 0);
+    TEST_EQ(unexpected, 0);
+    TEST_EQ(wrong_pending, 0);
+    TEST_EQ(pending, armed);
+
+    /* tickless: wakeups for calls and cascades, a 1 us tick would take 20M */
+    uint32_t irqs = sim_irq_count[TIM4_IRQn];
+
+    TEST_TRUE(irqs < SECONDS * 1000000 / 100);
+
+    printf("%u timers, %u calls within their microsecond, %u irqs in %u s\n",
+           TIMERS, (unsigned)callbacks, (unsigned)irqs, SECONDS);
+
+    return test_result();
+}
@@ -0,0 +1,68 @@
+/**
+ ******************************************************************************
+ * @file       test.h
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      Checks shared by the host driver tests
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef TEST_H
+#define TEST_H
+
+#include "sim.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static unsigned test_failures;
+
+#define TEST_EQ(a, b) \
+    do { \
+        unsigned long long test_a = (unsigned long long)(a); \
+        unsigned long long test_b = (unsigned long long)(b); \
+        if (test_a != test_b) { \
+            printf("%s:%d: %s == %s failed: %llu != %llu\n", __FILE__, __LINE__, #a, #b, test_a, test_b); \
+            ++test_failures; \
+        } \
+    } while (0)
+
+#define TEST_TRUE(x) TEST_EQ(!!(x), 1)
+
+/* wall clock seconds */
+static inline double test_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline int test_result(void)
+{
+    if (test_failures) {
+        printf("%u failed\n", test_failures);
+        return 1;
+    }
+
+    printf("ok\n");
+    return 0;
+}
+
+#endif /* TEST_H */
@@ -0,0 +1,268 @@
+/**
+ ******************************************************************************
+ * @file       tim_test.c
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      PIOS_TIM prescaler and ARR choice, the timer clock cache, SetPeriod
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/* for the clock cache */
+#include "pios_tim.c"
+
+#include "test.h"
+
+#define RATE_MIN 300
+#define RATE_MAX 4500000
+
+/* the nearest whole number of prescaled ticks, unclipped */
+static uint64_t nearest_ticks(uint32_t ck_int, uint32_t rate, uint32_t div)
+{
+    uint64_t tick_rate = (uint64_t)rate * div;
+
+    return (ck_int + tick_rate / 2) / tick_rate;
+}
+
+/* how far a period is off ck_int / rate timer clocks, times rate */
+static uint64_t period_error(uint32_t ck_int, uint32_t rate, uint64_t clocks)
+{
+    uint64_t exact = ck_int;
+    uint64_t got   = clocks * rate;
+
+    return (got > exact) ? got - exact : exact - got;
+}
+
+/* the best any prescaler with its nearest fitting ARR gets */
+static uint64_t best_error(uint32_t ck_int, uint32_t rate)
+{
+    uint64_t best = ~0ull;
+
+    for (uint32_t div = 1; div <= 0x10000 && (uint64_t)rate * div <= ck_int; ++div) {
+        uint64_t ticks = nearest_ticks(ck_int, rate, div);
+
+        if (ticks < 2 || ticks > 0x10000) {
+            continue;
+        }
+
+        uint64_t error = period_error(ck_int, rate, div * ticks);
+
+        if (error < best) {
+            best = error;
+        }
+    }
+
+    return best;
+}
+
+/*
+ * Every rate from 300 baud to 4.5 Mbaud in steps of 0.2 %. PSC is the
+ * finest the period fits ARR with, since the prescaler also sets the
+ * resolution of the faster rx samples, ARR the nearest for it without
+ * clipping. Against every other prescaler the period is the best one
+ * where no prescaler is needed and within 16 ppm of the best below that.
+ */
+static void check_period(TIM_TypeDef *timer)
+{
+    uint32_t ck_int = PIOS_TIM_Ck_Int(timer);
+    uint32_t rates = 0;
+    uint32_t prescaled = 0;
+    uint32_t not_best = 0;
+    uint32_t wrong_arr = 0;
+    uint32_t wrong_psc = 0;
+    uint32_t wrong_nearest = 0;
+    uint32_t wrong_best = 0;
+    double worst_ppm = 0;
+
+    for (double r = RATE_MIN; r < RATE_MAX * 1.002; r *= 1.002) {
+        uint32_t rate = (r < RATE_MAX) ? (uint32_t)r : RATE_MAX;
+        struct pios_tim_period period;
+
+        ++rates;
+
+        if (PIOS_TIM_Period(timer, rate, &period)) {
+            ++wrong_arr;
+            continue;
+        }
+
+        uint32_t div   = period.psc + 1;
+        uint64_t ticks = nearest_ticks(ck_int, rate, div);
+
+        /* the ARR the division asked for made it through 16 bits */
+        wrong_arr += ticks > 0x10000 || period.arr + 1 != ticks;
+
+        /* one prescaler finer would not have fit */
+        wrong_psc += div > 1 && nearest_ticks(ck_int, rate, div - 1) <= 0x10000;
+
+        uint64_t clocks = (uint64_t)div * (period.arr + 1);
+        uint64_t error  = period_error(ck_int, rate, clocks);
+
+        /* half a prescaled tick at most, and no other ARR closer */
+        wrong_nearest += 2 * error > (uint64_t)rate * div;
+        wrong_nearest += period.arr > 1 && period_error(ck_int, rate, clocks - div) < error;
+        wrong_nearest += period_error(ck_int, rate, clocks + div) < error;
+
+        uint64_t best = best_error(ck_int, rate);
+        double ppm    = (double)(error - best) / ck_int * 1e6;
+
+        prescaled  += div > 1;
+        not_best   += error > best;
+        wrong_best += error < best || (div == 1 && error > best) || ppm >= 16;
+
+        if (ppm > worst_ppm) {
+            worst_ppm = ppm;
+        }
+    }
+
+    TEST_EQ(wrong_arr, 0);
+    TEST_EQ(wrong_psc, 0);
+    TEST_EQ(wrong_nearest, 0);
+    TEST_EQ(wrong_best, 0);
+    TEST_TRUE(prescaled > 0);
+
+    /* the limits */
+    struct pios_tim_period period;
+
+    TEST_EQ(PIOS_TIM_Period(timer, 0, &period), -1);
+    TEST_EQ(PIOS_TIM_Period(timer, ck_int / 2 + 1, &period), -1);
+    TEST_EQ(PIOS_TIM_Period(timer, ck_int / 2, &period), 0);
+    TEST_EQ(period.psc, 0);
+    TEST_EQ(period.arr, 1);
+
+    printf("%u MHz: %u rates, %u prescaled, %u of them %.1f ppm off the best prescaler at most\n",
+           ck_int / 1000000, rates, prescaled, not_best, worst_ppm);
+}
+
+/*
+ * The decoded clocks stay until RCC->CFGR changes: a clock planted in
+ * the cache is used as long as CFGR is the same, and goes with any APB
+ * prescaler change. Timer clocks are twice a divided APB clock.
+ */
+static void check_clock_cache(void)
+{
+    uint32_t cfgr = RCC->CFGR;
+    struct pios_tim_period period;
+
+    TEST_EQ(PIOS_TIM_Ck_Int(TIM3), SIM_SYSCLK);
+    TEST_EQ(PIOS_TIM_Ck_Int(TIM1), SIM_SYSCLK);
+
+    /* at 65.536 MHz 1 kHz is the longest period without a prescaler */
+    tim_clock.apb1 = 0x10000 * 1000;
+    TEST_EQ(PIOS_TIM_Period(TIM3, 1000, &period), 0);
+    TEST_EQ(period.psc, 0);
+    TEST_EQ(period.arr, 0xffff);
+    TEST_EQ(PIOS_TIM_Period(TIM3, 999, &period), 0);
+    TEST_EQ(period.psc, 1);
+
+    RCC->CFGR = (cfgr & ~RCC_CFGR_PPRE1) | RCC_CFGR_PPRE1_DIV4;
+    TEST_EQ(PIOS_TIM_Ck_Int(TIM3), SIM_SYSCLK / 2);
+    TEST_EQ(PIOS_TIM_Ck_Int(TIM1), SIM_SYSCLK);
+
+    /* the period follows */
+    TEST_EQ(PIOS_TIM_Period(TIM3, 9600, &period), 0);
+    TEST_EQ(period.arr + 1, SIM_SYSCLK / 2 / 9600);
+
+    check_period(TIM3);
+
+    RCC->CFGR = (cfgr & ~RCC_CFGR_PPRE1) | RCC_CFGR_PPRE1_DIV1;
+    TEST_EQ(PIOS_TIM_Ck_Int(TIM3), SIM_SYSCLK);
+
+    RCC->CFGR = (cfgr & ~RCC_CFGR_PPRE2) | RCC_CFGR_PPRE2_DIV8;
+    TEST_EQ(PIOS_TIM_Ck_Int(TIM1), SIM_SYSCLK / 4);
+    TEST_EQ(PIOS_TIM_Ck_Int(TIM3), SIM_SYSCLK);
+
+    RCC->CFGR = cfgr;
+    TEST_EQ(PIOS_TIM_Ck_Int(TIM3), SIM_SYSCLK);
+    TEST_EQ(PIOS_TIM_Ck_Int(TIM1), SIM_SYSCLK);
+}
+
+/* cycles until the next update flag, up to limit */
+static uint32_t cycles_to_update(uint32_t limit)
+{
+    uint32_t cycles = 0;
+
+    TIM3->SR = 0;
+
+    while (!(TIM3->SR & TIM_SR_UIF) && cycles < limit) {
+        sim_run(1);
+        ++cycles;
+    }
+
+    return cycles;
+}
+
+/* the period for rate on TIM3, the simulator catching up with the writes */
+static struct pios_tim_period set_period(uint32_t rate)
+{
+    struct pios_tim_period period;
+
+    TEST_EQ(PIOS_TIM_Period(TIM3, rate, &period), 0);
+    PIOS_TIM_SetPeriod(TIM3, &period);
+    sim_sync();
+
+    return period;
+}
+
+/*
+ * On the running counter a new prescaler loads right away through an
+ * update event. With the same prescaler a counter already past the new
+ * ARR restarts, one below it runs on to the new ARR.
+ */
+static void check_set_period(void)
+{
+    TIM_Cmd(TIM3, ENABLE);
+
+    /* 300 baud needs a prescaler */
+    TEST_EQ(set_period(300).psc, 3);
+    TEST_EQ(TIM3->PSC, 3);
+    TEST_EQ(TIM3->CNT, 0);
+    TEST_EQ(cycles_to_update(SIM_SYSCLK), SIM_SYSCLK / 300);
+
+    TEST_EQ(set_period(9600).psc, 0);
+    TEST_EQ(TIM3->CNT, 0);
+    TEST_EQ(cycles_to_update(SIM_SYSCLK), SIM_SYSCLK / 9600);
+
+    /* past the shorter period */
+    sim_run(5000);
+    set_period(19200);
+
+    TEST_EQ(TIM3->CNT, 0);
+    TEST_EQ(cycles_to_update(SIM_SYSCLK), SIM_SYSCLK / 19200);
+
+    /* below the longer one */
+    sim_run(1000);
+    set_period(9600);
+
+    TEST_EQ(TIM3->CNT, 1000);
+    TEST_EQ(cycles_to_update(SIM_SYSCLK), SIM_SYSCLK / 9600 - 1000);
+
+    TIM_Cmd(TIM3, DISABLE);
+
+    printf("SetPeriod: the prescaler loads at once, a counter past ARR restarts\n");
+}
+
+int main(void)
+{
+    sim_init();
+    NVIC_PriorityGroupConfig(NVIC_PriorityGroup_4);
+
+    check_period(TIM3);
+    check_clock_cache();
+    check_set_period();
+
+    return test_result();
+}
@@ -0,0 +1,243 @@
+/**
+ ******************************************************************************
+ * @file       toggle_test.c
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      Output compare toggle TX against the BSRR encoder, bit for bit
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/* for both encoders and the batch fill */
+#include "pios_soft_serial.c"
+
+#include "test.h"
+#include "uart.h"
+
+static const struct {
+    const char *name;
+    struct uart_format format;
+} formats[] = {
+    { "8N1", { PIOS_COM_Word_length_8b, PIOS_COM_Parity_No, PIOS_COM_StopBits_1 } },
+    { "8E1", { PIOS_COM_Word_length_8b, PIOS_COM_Parity_Even, PIOS_COM_StopBits_1 } },
+    { "8O1", { PIOS_COM_Word_length_8b, PIOS_COM_Parity_Odd, PIOS_COM_StopBits_1 } },
+    { "8N2", { PIOS_COM_Word_length_8b, PIOS_COM_Parity_No, PIOS_COM_StopBits_2 } },
+    { "8E2", { PIOS_COM_Word_length_8b, PIOS_COM_Parity_Even, PIOS_COM_StopBits_2 } },
+    { "9N1", { PIOS_COM_Word_length_9b, PIOS_COM_Parity_No, PIOS_COM_StopBits_1 } },
+};
+
+static const uint32_t bauds[] = { 300, 9600, 115200, 1000000 };
+
+/* bit rate of the runs on the simulated pin */
+#define WIRE_BAUD 115200
+
+static const struct pios_soft_serial_config config = {
+    .timer = TIM3,
+    .tim_channel = TIM_Channel_1,
+};
+
+/* TIM3 CH1 without remap */
+static const struct stm32_gpio tx_pin = {
+    .gpio = GPIOA,
+    .init = {
+        .GPIO_Pin   = GPIO_Pin_6,
+        .GPIO_Speed = GPIO_Speed_50MHz,
+        .GPIO_Mode  = GPIO_Mode_Out_PP,
+    },
+};
+
+/* bytes first..last - 1, for the COM layer */
+static uint16_t tx_next;
+static uint16_t tx_last;
+
+static uint16_t tx_out(uint32_t context, uint8_t *buf, uint16_t buf_len, uint16_t *headroom, bool *task_woken)
+{
+    uint16_t count = 0;
+
+    while (count < buf_len && tx_next < tx_last) {
+        buf[count++] = tx_next++;
+    }
+
+    *headroom = tx_last - tx_next;
+
+    return count;
+}
+
+static uint32_t beats_toggle;
+static uint32_t beats_bsrr;
+
+/*
+ * Every byte in batches as the driver sends them. The compare list of a
+ * batch is played back on a line starting at mark, toggling at each
+ * compare, and sampled at the bit centers of the BSRR words for the same
+ * bytes. Toggles must sit on bit boundaries, the extra compare a whole
+ * wrap behind the last and the batch end right after the last stop bit.
+ */
+static void check_encode(struct pios_soft_serial_device *dev, bool inverted)
+{
+    uint32_t bit = dev->ts_bit;
+    uint32_t wrong = 0;
+    uint32_t off_grid = 0;
+
+    for (uint16_t first = 0; first < 256; first += PIOS_SOFT_SERIAL_TX_BATCH) {
+        pios_soft_serial_tx_word_t words[DMA_BUFFER_SIZE];
+        pios_soft_serial_tx_word_t *compare = dev->dma_buffer[0];
+        uint16_t headroom;
+        uint16_t n_words = 0;
+
+        for (uint16_t i = 0; i < PIOS_SOFT_SERIAL_TX_BATCH; ++i) {
+            n_words += PIOS_Soft_Serial_Encode(dev, first + i, &words[n_words]);
+        }
+
+        tx_next = first;
+        tx_last = first + PIOS_SOFT_SERIAL_TX_BATCH;
+        dev->tx_toggle = true;
+
+        uint16_t n_compare = PIOS_Soft_Serial_Tx_Fill(dev, compare, &headroom);
+
+        dev->tx_toggle = false;
+
+        TEST_TRUE(n_compare <= DMA_BUFFER_SIZE);
+        TEST_EQ((uint16_t)(compare[n_compare - 1] - compare[n_compare - 2]), 0xffff);
+        TEST_EQ(dev->tx_toggle_end[0], (uint16_t)(n_words * bit));
+
+        beats_toggle += n_compare - 1;
+        beats_bsrr   += n_words;
+
+        /* compares unwrapped to batch time */
+        uint32_t at[DMA_BUFFER_SIZE];
+        uint32_t t = 0;
+
+        for (uint16_t i = 0; i < n_compare - 1; ++i) {
+            t += (uint16_t)(compare[i] - (i ? compare[i - 1] : 0));
+            at[i] = t;
+            off_grid += (t % bit) != 0;
+        }
+
+        bool level = !inverted;
+        uint16_t k = 0;
+
+        for (uint16_t n = 0; n < n_words; ++n) {
+            uint32_t center = n * bit + bit / 2;
+
+            while (k < n_compare - 1 && at[k] <= center) {
+                level = !level;
+                ++k;
+            }
+
+            wrong += level != (words[n] == tx_pin.init.GPIO_Pin);
+        }
+
+        /* no toggle left after the last stop bit */
+        TEST_EQ(k, n_compare - 1);
+    }
+
+    TEST_EQ(wrong, 0);
+    TEST_EQ(off_grid, 0);
+}
+
+/* The same 256 frames on the pin, the BSRR way and toggling */
+static void send_all(uint32_t id, bool toggle, const struct uart_format *f, struct uart_wave *wave, uint8_t (*frames)[UART_FRAME_MAX])
+{
+    uint8_t level[UART_FRAME_MAX];
+    uint8_t bits = uart_frame(f, 0, level);
+    double bit_cycles = (double)SIM_SYSCLK / WIRE_BAUD;
+    uint32_t misaligned;
+
+    pios_soft_serial_driver.ioctl(id, PIOS_IOCTL_SOFT_SERIAL_SET_TXTOGGLE, &toggle);
+
+    uart_wave_reset(wave);
+    tx_next = 0;
+    tx_last = 256;
+    pios_soft_serial_driver.tx_start(id, 256);
+    sim_run(256 * (bits + 2) * bit_cycles);
+
+    TEST_EQ(uart_wave_frames(wave, f, bits, bit_cycles, frames, 0, 256, &misaligned), 256);
+    TEST_EQ(misaligned, 0);
+}
+
+static void check_wire(uint32_t id, const struct uart_format *f, struct uart_wave *wave)
+{
+    static uint8_t bsrr[256][UART_FRAME_MAX];
+    static uint8_t toggled[256][UART_FRAME_MAX];
+    uint8_t level[UART_FRAME_MAX];
+    uint8_t bits = uart_frame(f, 0, level);
+    uint32_t wrong = 0;
+
+    send_all(id, false, f, wave, bsrr);
+    send_all(id, true, f, wave, toggled);
+
+    for (uint16_t i = 0; i < 256; ++i) {
+        uart_frame(f, (f->word_len == PIOS_COM_Word_length_9b && f->parity == PIOS_COM_Parity_No) ? i | 0x100 : i, level);
+
+        wrong += memcmp(bsrr[i], level, bits) != 0;
+        wrong += memcmp(toggled[i], bsrr[i], bits) != 0;
+    }
+
+    TEST_EQ(wrong, 0);
+
+    /* back at a mark gpio output */
+    TEST_EQ(!!(sim_gpio_levels(GPIOA) & tx_pin.init.GPIO_Pin), !f->inverted);
+}
+
+int main(void)
+{
+    static struct uart_wave wave;
+    uint32_t id;
+
+    sim_init();
+    NVIC_PriorityGroupConfig(NVIC_PriorityGroup_4);
+
+    TEST_EQ(PIOS_Soft_Serial_Init(&id, &config), 0);
+    pios_soft_serial_driver.ioctl(id, PIOS_IOCTL_SOFT_SERIAL_SET_TXGPIO, (void *)&tx_pin);
+    pios_soft_serial_driver.bind_tx_cb(id, tx_out, 0);
+
+    struct pios_soft_serial_device *dev = (struct pios_soft_serial_device *)id;
+
+    for (uint8_t n = 0; n < sizeof(formats) / sizeof(formats[0]); ++n) {
+        for (uint8_t inverted = 0; inverted < 2; ++inverted) {
+            struct uart_format f = formats[n].format;
+            enum PIOS_USART_Inverted inv = inverted ? PIOS_USART_Inverted_Tx : PIOS_USART_Inverted_None;
+
+            f.inverted = inverted;
+            pios_soft_serial_driver.ioctl(id, PIOS_IOCTL_USART_SET_INVERTED, &inv);
+
+            beats_toggle = beats_bsrr = 0;
+
+            for (uint8_t b = 0; b < sizeof(bauds) / sizeof(bauds[0]); ++b) {
+                pios_soft_serial_driver.set_config(id, f.word_len, f.parity, f.stop_bits, bauds[b]);
+                check_encode(dev, inverted);
+            }
+
+            pios_soft_serial_driver.set_config(id, f.word_len, f.parity, f.stop_bits, WIRE_BAUD);
+
+            GPIO_WriteBit(GPIOA, tx_pin.init.GPIO_Pin, inverted ? Bit_RESET : Bit_SET);
+            if (!wave.gpio) {
+                uart_wave_attach(&wave, GPIOA, tx_pin.init.GPIO_Pin);
+            }
+
+            check_wire(id, &f, &wave);
+
+            printf("%s%s: %u dma beats toggling, %u as BSRR words\n", formats[n].name, inverted ? " inverted" : "",
+                   (unsigned)beats_toggle, (unsigned)beats_bsrr);
+        }
+    }
+
+    uart_wave_detach_all();
+
+    return test_result();
+}
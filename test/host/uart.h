@@ -0,0 +1,243 @@
+/**
+ ******************************************************************************
+ * @file       uart.h
+ * @author     The LibrePilot Project, http://www.librepilot.org Copyright (C) 2017.
+ * @brief      Reference UART frames and a recorder/decoder for simulated pins
+ * @see        The GNU Public License (GPL) Version 3
+ *
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef UART_H
+#define UART_H
+
+#include "sim.h"
+#include "pios_com.h"
+
+#include <stdlib.h>
+
+#define UART_FRAME_MAX 12
+
+struct uart_format {
+    enum PIOS_COM_Word_Length word_len;
+    enum PIOS_COM_Parity parity;
+    enum PIOS_COM_StopBits stop_bits;
+    bool inverted;
+};
+
+/*
+ * Wire levels of one frame, bit by bit the obvious way, start bit first.
+ * Bit 8 of data is the 9th data bit of 9 bit words without parity.
+ */
+static inline uint8_t uart_frame(const struct uart_format *f, uint16_t data, uint8_t *level)
+{
+    uint8_t n = 0;
+    uint8_t ones = 0;
+
+    level[n++] = 0;
+
+    for (uint8_t i = 0; i < 8; ++i) {
+        uint8_t bit = (data >> i) & 1;
+
+        ones += bit;
+        level[n++] = bit;
+    }
+
+    if (f->parity == PIOS_COM_Parity_Even) {
+        level[n++] = ones & 1;
+    } else if (f->parity == PIOS_COM_Parity_Odd) {
+        level[n++] = !(ones & 1);
+    } else if (f->word_len == PIOS_COM_Word_length_9b) {
+        level[n++] = (data >> 8) & 1;
+    }
+
+    level[n++] = 1;
+
+    if (f->stop_bits == PIOS_COM_StopBits_1_5 || f->stop_bits == PIOS_COM_StopBits_2) {
+        level[n++] = 1;
+    }
+
+    for (uint8_t i = 0; i < n; ++i) {
+        level[i] ^= f->inverted;
+    }
+
+    return n;
+}
+
+/* Every change of one pin, with the simulator time it happened at */
+struct uart_wave {
+    GPIO_TypeDef *gpio;
+    uint16_t pin;
+    bool initial;
+    uint32_t count;
+    uint32_t size;
+    uint64_t *time;
+    bool *level;
+};
+
+#define UART_WAVES_MAX 16
+
+static struct uart_wave *uart_waves[UART_WAVES_MAX];
+static uint8_t uart_wave_count;
+
+static void uart_wave_hook(GPIO_TypeDef *gpio, uint16_t levels, uint16_t changed)
+{
+    for (uint8_t i = 0; i < uart_wave_count; ++i) {
+        struct uart_wave *w = uart_waves[i];
+
+        if (w->gpio != gpio || !(changed & w->pin)) {
+            continue;
+        }
+
+        if (w->count == w->size) {
+            w->size  = w->size ? w->size * 2 : 1024;
+            w->time  = realloc(w->time, w->size * sizeof(*w->time));
+            w->level = realloc(w->level, w->size * sizeof(*w->level));
+        }
+
+        w->time[w->count]  = sim_time;
+        w->level[w->count] = (levels & w->pin) != 0;
+        ++w->count;
+    }
+}
+
+/* Starts recording from the level the pin has now */
+static inline void uart_wave_attach(struct uart_wave *w, GPIO_TypeDef *gpio, uint16_t pin)
+{
+    w->gpio    = gpio;
+    w->pin     = pin;
+    w->initial = (sim_gpio_levels(gpio) & pin) != 0;
+    w->count   = 0;
+
+    uart_waves[uart_wave_count++] = w;
+    sim_gpio_hook = uart_wave_hook;
+}
+
+static inline void uart_wave_reset(struct uart_wave *w)
+{
+    w->initial = (sim_gpio_levels(w->gpio) & w->pin) != 0;
+    w->count   = 0;
+}
+
+static inline void uart_wave_detach_all(void)
+{
+    for (uint8_t i = 0; i < uart_wave_count; ++i) {
+        free(uart_waves[i]->time);
+        free(uart_waves[i]->level);
+        uart_waves[i]->time  = 0;
+        uart_waves[i]->level = 0;
+        uart_waves[i]->size  = 0;
+        uart_waves[i]->count = 0;
+    }
+
+    uart_wave_count = 0;
+    sim_gpio_hook   = 0;
+}
+
+/* Level at time t, edge index of the first change after it in *next */
+static inline bool uart_wave_level(const struct uart_wave *w, uint64_t t, uint32_t *next)
+{
+    uint32_t lo = 0, hi = w->count;
+
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+
+        if (w->time[mid] <= t) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (next) {
+        *next = lo;
+    }
+
+    return lo ? w->level[lo - 1] : w->initial;
+}
+
+/*
+ * Frames as a receiver sampling at bit centers sees them: from each edge
+ * leaving idle, bits wire levels at (i + 1/2) bit times. Edges inside a
+ * frame off the bit grid by more than one cycle count in *misaligned.
+ * Returns the frames found, at most max.
+ */
+static inline uint32_t uart_wave_frames(const struct uart_wave *w, const struct uart_format *f, uint8_t bits, double bit_cycles,
+                                        uint8_t (*frames)[UART_FRAME_MAX], uint64_t *starts, uint32_t max, uint32_t *misaligned)
+{
+    uint32_t found = 0;
+    uint32_t e = 0;
+    bool idle = !f->inverted;
+
+    if (misaligned) {
+        *misaligned = 0;
+    }
+
+    while (found < max) {
+        /* next edge into the start bit */
+        while (e < w->count && w->level[e] == idle) {
+            ++e;
+        }
+        if (e == w->count) {
+            break;
+        }
+
+        uint64_t start = w->time[e];
+        uint64_t end   = start + (uint64_t)(bits * bit_cycles + 0.5);
+
+        for (uint8_t i = 0; i < bits; ++i) {
+            frames[found][i] = uart_wave_level(w, start + (uint64_t)((i + 0.5) * bit_cycles), 0);
+        }
+
+        if (starts) {
+            starts[found] = start;
+        }
+        ++found;
+
+        /* the stop bit is idle, its end may be the next start edge */
+        for (++e; e < w->count && w->time[e] < end; ++e) {
+            double phase = (w->time[e] - start) / bit_cycles;
+            double off   = (phase - (uint64_t)(phase + 0.5)) * bit_cycles;
+
+            if (misaligned && (off > 1.0 || off < -1.0)) {
+                ++*misaligned;
+            }
+        }
+    }
+
+    return found;
+}
+
+/* Data of a frame from uart_wave_frames, -1 on framing or parity error */
+static inline int32_t uart_decode(const struct uart_format *f, const uint8_t *frame)
+{
+    uint8_t expect[UART_FRAME_MAX];
+    uint16_t data = 0;
+
+    for (uint8_t i = 0; i < 8; ++i) {
+        data |= (frame[1 + i] ^ f->inverted) << i;
+    }
+
+    if (f->parity == PIOS_COM_Parity_No && f->word_len == PIOS_COM_Word_length_9b) {
+        data |= (frame[9] ^ f->inverted) << 8;
+    }
+
+    uint8_t bits = uart_frame(f, data, expect);
+
+    return memcmp(frame, expect, bits) ? -1 : data;
+}
+
+#endif /* UART_H */
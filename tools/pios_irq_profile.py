@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+#
+# Report the interrupt masking profile (PIOS_INCLUDE_IRQ_PROFILE,
+# src/pios_irq.h) from a raw RAM dump.
+#
+#   arm-none-eabi-gdb: dump binary memory ram.bin 0x20000000 0x20005000
+#   tools/pios_irq_profile.py ram.bin --elf build/firmware.elf
+#
+# With --limit-cycles or --limit-us it exits non-zero when the longest
+# section exceeds the limit, for use as a regression check after a bench
+# run under load.
+
+import argparse
+import shutil
+import struct
+import subprocess
+import sys
+
+MAGIC = 0x51524950
+HEADER = struct.Struct('<IIII')
+SECTIONS = struct.Struct('<III')
+
+KINDS = [
+    ('disabled', 'PIOS_IRQ_Disable'),
+    ('masked', 'PIOS_IRQ_Mask'),
+]
+
+
+def find_profiles(data):
+    for offset in range(0, len(data) - HEADER.size + 1, 4):
+        magic, clock, buckets, shift = HEADER.unpack_from(data, offset)
+
+        if magic != MAGIC or not 0 < buckets <= 32 or shift >= 32:
+            continue
+        if offset + HEADER.size + len(KINDS) * (SECTIONS.size + buckets * 4) > len(data):
+            continue
+
+        yield offset, clock, buckets, shift
+
+
+def parse(data, offset, buckets):
+    pos = offset + HEADER.size
+    histogram = struct.Struct('<%dI' % buckets)
+    kinds = []
+
+    for name, function in KINDS:
+        count, cycles, caller = SECTIONS.unpack_from(data, pos)
+        pos += SECTIONS.size
+        kinds.append((name, function, count, cycles, caller, histogram.unpack_from(data, pos)))
+        pos += histogram.size
+
+    return kinds
+
+
+def symbolize(elf, address):
+    # a thumb return address, the call is the instruction before it
+    address = (address & ~1) - 1
+    tool = shutil.which('arm-none-eabi-addr2line') or shutil.which('addr2line')
+
+    if not elf or not tool or address < 0:
+        return ''
+
+    result = subprocess.run([tool, '-f', '-C', '-s', '-e', elf, '%#x' % address],
+                            capture_output=True, text=True)
+    lines = result.stdout.split()
+
+    return ' (%s %s)' % (lines[0], lines[1]) if len(lines) >= 2 else ''
+
+
+def duration(cycles, clock):
+    return '%.3f us' % (cycles * 1e6 / clock) if clock else '%d cy' % cycles
+
+
+def report(offset, clock, buckets, shift, kinds, elf, out):
+    out.write('profile at dump offset %#x, %s\n' %
+              (offset, '%d Hz' % clock if clock else 'clock unknown, times in cycles'))
+
+    for name, function, count, cycles, caller, histogram in kinds:
+        out.write('%s: %d sections (%s), longest %s begun at %#010x%s\n' %
+                  (name, count, function, duration(cycles, clock), caller, symbolize(elf, caller)))
+
+        for bucket, hits in enumerate(histogram):
+            if bucket == buckets - 1:
+                label = '>= %s' % duration(1 << (shift + bucket - 1), clock) if bucket else 'all'
+            else:
+                label = '<  %s' % duration(1 << (shift + bucket), clock)
+            out.write('  %-16s %d\n' % (label, hits))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Report the interrupt masking profile from a RAM dump')
+    parser.add_argument('dump', help='raw RAM dump containing pios_irq_profile')
+    parser.add_argument('--elf', help='firmware image, to name the callers of the longest sections')
+    limit = parser.add_mutually_exclusive_group()
+    limit.add_argument('--limit-cycles', type=int, help='fail if any section took longer')
+    limit.add_argument('--limit-us', type=float, help='fail if any section took longer')
+    args = parser.parse_args()
+
+    with open(args.dump, 'rb') as f:
+        data = f.read()
+
+    profiles = list(find_profiles(data))
+
+    if not profiles:
+        sys.exit('no irq profile in %s' % args.dump)
+
+    failed = False
+
+    for offset, clock, buckets, shift in profiles:
+        kinds = parse(data, offset, buckets)
+        report(offset, clock, buckets, shift, kinds, args.elf, sys.stdout)
+
+        if args.limit_cycles is not None:
+            limit = args.limit_cycles
+        elif args.limit_us is not None:
+            if not clock:
+                sys.exit('--limit-us needs the clock, call PIOS_IRQ_Profile_Init()')
+            limit = args.limit_us * clock / 1e6
+        else:
+            continue
+
+        for name, function, count, cycles, caller, histogram in kinds:
+            if cycles > limit:
+                sys.stdout.write('FAIL: longest %s section %s exceeds the limit of %s\n' %
+                                 (name, duration(cycles, clock), duration(limit, clock)))
+                failed = True
+
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+#
+# Decode a PIOS_TRACE ring (src/pios_trace.h) from a raw RAM dump into a
+# timeline, oldest event first.
+#
+#   arm-none-eabi-gdb: dump binary memory ram.bin 0x20000000 0x20005000
+#   tools/pios_trace_decode.py ram.bin
+#
+# The ring is found by its magic, the dump only has to contain it.
+
+import argparse
+import struct
+import sys
+
+MAGIC = 0x43525450
+HEADER = struct.Struct('<IIII')
+EVENT = struct.Struct('<IHH')
+
+# enum pios_trace_event_id
+EVENTS = [
+    'DMA_QUEUE',
+    'DMA_BEGIN',
+    'DMA_COMPLETE',
+    'DMA_HALFTRANSFER',
+    'DMA_ERROR',
+    'EXTI',
+    'SS_IDLE',
+    'SS_RX_WAIT',
+    'SS_RX_DATA',
+    'SS_TX_DATA',
+    'COM_RX',
+    'COM_TX',
+]
+
+
+def describe(event, arg):
+    name = EVENTS[event] if event < len(EVENTS) else 'EVENT_%d' % event
+
+    if name.startswith('DMA_'):
+        return '%-16s DMA1 ch%d' % (name, arg + 1) if arg < 7 else '%-16s DMA2 ch%d' % (name, arg - 6)
+    if name == 'EXTI':
+        return '%-16s line %d' % (name, arg)
+    if name.startswith('SS_'):
+        return '%-16s dev ..%04x' % (name, arg)
+    if name.startswith('COM_'):
+        return '%-16s %d bytes' % (name, arg)
+
+    return '%-16s %#06x' % (name, arg)
+
+
+def find_rings(data):
+    for offset in range(0, len(data) - HEADER.size + 1, 4):
+        magic, clock, size, head = HEADER.unpack_from(data, offset)
+
+        if magic != MAGIC or not size or size & (size - 1):
+            continue
+        if offset + HEADER.size + size * EVENT.size > len(data):
+            continue
+
+        yield offset, clock, size, head
+
+
+def decode(data, offset, clock, size, head, out):
+    base = offset + HEADER.size
+    count = min(head, size)
+    first = head - count
+
+    out.write('ring at dump offset %#x: %d events recorded, %d kept, %s\n' %
+              (offset, head, count, '%d Hz' % clock if clock else 'clock unknown, times in cycles'))
+
+    start = None
+    last = None
+    elapsed = 0
+
+    for n in range(first, head):
+        time, event, arg = EVENT.unpack_from(data, base + (n % size) * EVENT.size)
+
+        if start is None:
+            start = last = time
+
+        # 32 bit cycle counter, events are never a whole wrap apart
+        delta = (time - last) & 0xffffffff
+        elapsed += delta
+        last = time
+
+        if clock:
+            out.write('%14.3f us %+10.3f  %s\n' % (elapsed * 1e6 / clock, delta * 1e6 / clock, describe(event, arg)))
+        else:
+            out.write('%14d cy %+10d  %s\n' % (elapsed, delta, describe(event, arg)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode a PIOS_TRACE ring from a RAM dump')
+    parser.add_argument('dump', help='raw RAM dump containing pios_trace_ring')
+    args = parser.parse_args()
+
+    with open(args.dump, 'rb') as f:
+        data = f.read()
+
+    rings = list(find_rings(data))
+
+    if not rings:
+        sys.exit('no trace ring in %s' % args.dump)
+
+    for ring in rings:
+        decode(data, *ring, out=sys.stdout)
+
+
+if __name__ == '__main__':
+    main()